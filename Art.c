@@ -0,0 +1,542 @@
+/*
+ * @Author: WangZhe
+ * @Date: 2026-10-21 09:40:17
+ * @LastEditors: WangZhe
+ * @LastEditTime: 2026-10-21 14:02:36
+ * @FilePath: /Sqlite/Art.c
+ * @Description: 主表主键上的自适应基数树前端索引
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include"Sqlite.h"
+
+
+/**
+ * @description: 叶子指针的最低位是1，内部节点和叶子都按至少2字节对齐
+ */
+bool art_is_leaf(void *child)
+{
+    return ((uintptr_t)child & 1) != 0;
+}
+
+ArtLeaf *art_leaf(void *child)
+{
+    return (ArtLeaf *)((uintptr_t)child & ~(uintptr_t)1);
+}
+
+void *art_leaf_create(ArtTree *art, const void *key, uint32_t page_num, uint32_t cell_num)
+{
+    ArtLeaf *leaf = malloc(sizeof(ArtLeaf) + art->key_size);
+    leaf->page_num = page_num;
+    leaf->cell_num = cell_num;
+    memcpy(leaf->key, key, art->key_size);
+    return (void *)((uintptr_t)leaf | 1);
+}
+
+
+ArtNode *art_node_create(ArtNodeType type)
+{
+    ArtNode *node;
+    switch (type)
+    {
+    case (ART_NODE4):
+        node = calloc(1, sizeof(ArtNode4));
+        break;
+    case (ART_NODE16):
+        node = calloc(1, sizeof(ArtNode16));
+        break;
+    case (ART_NODE48):
+        node = calloc(1, sizeof(ArtNode48));
+        break;
+    default:
+        node = calloc(1, sizeof(ArtNode256));
+        break;
+    }
+    node->type = type;
+    return node;
+}
+
+/**
+ * @description: 释放一棵子树
+ */
+void art_node_free(void *node)
+{
+    if (node == NULL)
+    {
+        return;
+    }
+    if (art_is_leaf(node))
+    {
+        free(art_leaf(node));
+        return;
+    }
+    ArtNode *inner = node;
+    switch (inner->type)
+    {
+    case (ART_NODE4):
+        for (uint32_t i = 0; i < inner->num_children; i++)
+        {
+            art_node_free(((ArtNode4 *)inner)->children[i]);
+        }
+        break;
+    case (ART_NODE16):
+        for (uint32_t i = 0; i < inner->num_children; i++)
+        {
+            art_node_free(((ArtNode16 *)inner)->children[i]);
+        }
+        break;
+    case (ART_NODE48):
+        for (uint32_t i = 0; i < inner->num_children; i++)
+        {
+            art_node_free(((ArtNode48 *)inner)->children[i]);
+        }
+        break;
+    case (ART_NODE256):
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            art_node_free(((ArtNode256 *)inner)->children[i]);
+        }
+        break;
+    }
+    free(inner);
+}
+
+
+/**
+ * @description: 找到字节byte对应的孩子
+ * @param {ArtNode} *node
+ * @param {uint8_t} byte
+ * @return {*} 指向孩子槽位的指针，没有时返回NULL
+ * @note: 4和16个孩子的节点按插入顺序存放，只做精确查找，不需要有序
+ */
+void **art_find_child(ArtNode *node, uint8_t byte)
+{
+    switch (node->type)
+    {
+    case (ART_NODE4):
+    {
+        ArtNode4 *node4 = (ArtNode4 *)node;
+        for (uint32_t i = 0; i < node->num_children; i++)
+        {
+            if (node4->keys[i] == byte)
+            {
+                return &(node4->children[i]);
+            }
+        }
+        return NULL;
+    }
+    case (ART_NODE16):
+    {
+        ArtNode16 *node16 = (ArtNode16 *)node;
+        for (uint32_t i = 0; i < node->num_children; i++)
+        {
+            if (node16->keys[i] == byte)
+            {
+                return &(node16->children[i]);
+            }
+        }
+        return NULL;
+    }
+    case (ART_NODE48):
+    {
+        ArtNode48 *node48 = (ArtNode48 *)node;
+        uint8_t index = node48->child_index[byte];
+        return index == 0 ? NULL : &(node48->children[index - 1]);
+    }
+    default:
+    {
+        ArtNode256 *node256 = (ArtNode256 *)node;
+        return node256->children[byte] == NULL ? NULL : &(node256->children[byte]);
+    }
+    }
+}
+
+/**
+ * @description: 给节点加一个孩子，节点满了先换成更大的一种
+ * @param {void} **ref 指向节点的槽位，换节点时改写它
+ * @param {uint8_t} byte 节点中还没有这个字节
+ * @param {void} *child
+ * @return {*}
+ */
+void art_add_child(void **ref, uint8_t byte, void *child)
+{
+    ArtNode *node = *ref;
+    switch (node->type)
+    {
+    case (ART_NODE4):
+    {
+        ArtNode4 *node4 = (ArtNode4 *)node;
+        if (node->num_children < 4)
+        {
+            node4->keys[node->num_children] = byte;
+            node4->children[node->num_children] = child;
+            node->num_children++;
+            return;
+        }
+        ArtNode16 *node16 = (ArtNode16 *)art_node_create(ART_NODE16);
+        memcpy(&(node16->header), node, sizeof(ArtNode));
+        node16->header.type = ART_NODE16;
+        memcpy(node16->keys, node4->keys, sizeof(node4->keys));
+        memcpy(node16->children, node4->children, sizeof(node4->children));
+        free(node);
+        *ref = node16;
+        break;
+    }
+    case (ART_NODE16):
+    {
+        ArtNode16 *node16 = (ArtNode16 *)node;
+        if (node->num_children < 16)
+        {
+            node16->keys[node->num_children] = byte;
+            node16->children[node->num_children] = child;
+            node->num_children++;
+            return;
+        }
+        ArtNode48 *node48 = (ArtNode48 *)art_node_create(ART_NODE48);
+        memcpy(&(node48->header), node, sizeof(ArtNode));
+        node48->header.type = ART_NODE48;
+        for (uint32_t i = 0; i < 16; i++)
+        {
+            node48->child_index[node16->keys[i]] = i + 1;
+            node48->children[i] = node16->children[i];
+        }
+        free(node);
+        *ref = node48;
+        break;
+    }
+    case (ART_NODE48):
+    {
+        ArtNode48 *node48 = (ArtNode48 *)node;
+        if (node->num_children < 48)
+        {
+            node48->children[node->num_children] = child;
+            node48->child_index[byte] = node->num_children + 1;
+            node->num_children++;
+            return;
+        }
+        ArtNode256 *node256 = (ArtNode256 *)art_node_create(ART_NODE256);
+        memcpy(&(node256->header), node, sizeof(ArtNode));
+        node256->header.type = ART_NODE256;
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            if (node48->child_index[i] != 0)
+            {
+                node256->children[i] = node48->children[node48->child_index[i] - 1];
+            }
+        }
+        free(node);
+        *ref = node256;
+        break;
+    }
+    case (ART_NODE256):
+    {
+        ArtNode256 *node256 = (ArtNode256 *)node;
+        node256->children[byte] = child;
+        node->num_children++;
+        return;
+    }
+    }
+    art_add_child(ref, byte, child);
+}
+
+
+/**
+ * @description: 查找主键
+ * @param {ArtTree} *art 调用者至少共享地持有art->lock
+ * @param {void} *key
+ * @param {uint32_t} *page_num 输出
+ * @param {uint32_t} *cell_num 输出
+ * @return {*}
+ * @note: 每层比较压缩的前缀，再按下一个字节选孩子，叶子上核对完整的主键
+ */
+bool art_get(ArtTree *art, const void *key, uint32_t *page_num, uint32_t *cell_num)
+{
+    const uint8_t *bytes = key;
+    void *node = art->root;
+    uint32_t depth = 0;
+    while (node != NULL)
+    {
+        if (art_is_leaf(node))
+        {
+            ArtLeaf *leaf = art_leaf(node);
+            if (memcmp(leaf->key, key, art->key_size) != 0)
+            {
+                return false;
+            }
+            *page_num = leaf->page_num;
+            *cell_num = leaf->cell_num;
+            return true;
+        }
+        ArtNode *inner = node;
+        if (memcmp(inner->prefix, bytes + depth, inner->prefix_len) != 0)
+        {
+            return false;
+        }
+        depth += inner->prefix_len;
+        void **child = art_find_child(inner, bytes[depth]);
+        if (child == NULL)
+        {
+            return false;
+        }
+        node = *child;
+        depth++;
+    }
+    return false;
+}
+
+/**
+ * @description: 插入主键或者改写它的位置
+ * @param {ArtTree} *art 调用者独占地持有art->lock
+ * @param {void} *key
+ * @param {uint32_t} page_num
+ * @param {uint32_t} cell_num
+ * @return {*}
+ * @note: 遇到叶子时用两个主键的公共部分作为前缀建一个4孩子节点；
+ *        前缀只有一部分相同时在不同的位置拆开前缀
+ */
+void art_put(ArtTree *art, const void *key, uint32_t page_num, uint32_t cell_num)
+{
+    const uint8_t *bytes = key;
+    void **ref = &(art->root);
+    uint32_t depth = 0;
+    while (true)
+    {
+        void *node = *ref;
+        if (node == NULL)
+        {
+            *ref = art_leaf_create(art, key, page_num, cell_num);
+            art->num_keys++;
+            return;
+        }
+        if (art_is_leaf(node))
+        {
+            ArtLeaf *leaf = art_leaf(node);
+            if (memcmp(leaf->key, key, art->key_size) == 0)
+            {
+                leaf->page_num = page_num;
+                leaf->cell_num = cell_num;
+                return;
+            }
+            // 主键定长且不同，公共部分之后一定还有一个不同的字节
+            void *inner = art_node_create(ART_NODE4);
+            uint32_t common = 0;
+            while (leaf->key[depth + common] == bytes[depth + common])
+            {
+                common++;
+            }
+            ((ArtNode *)inner)->prefix_len = common;
+            memcpy(((ArtNode *)inner)->prefix, bytes + depth, common);
+            art_add_child(&inner, leaf->key[depth + common], node);
+            art_add_child(&inner, bytes[depth + common], art_leaf_create(art, key, page_num, cell_num));
+            *ref = inner;
+            art->num_keys++;
+            return;
+        }
+
+        ArtNode *inner = node;
+        uint32_t mismatch = 0;
+        while (mismatch < inner->prefix_len && inner->prefix[mismatch] == bytes[depth + mismatch])
+        {
+            mismatch++;
+        }
+        if (mismatch < inner->prefix_len)
+        {
+            // 新节点接管前缀中相同的部分，原节点保留不同字节之后的部分
+            void *parent = art_node_create(ART_NODE4);
+            ((ArtNode *)parent)->prefix_len = mismatch;
+            memcpy(((ArtNode *)parent)->prefix, inner->prefix, mismatch);
+            uint8_t inner_byte = inner->prefix[mismatch];
+            inner->prefix_len -= mismatch + 1;
+            memmove(inner->prefix, inner->prefix + mismatch + 1, inner->prefix_len);
+            art_add_child(&parent, inner_byte, inner);
+            art_add_child(&parent, bytes[depth + mismatch], art_leaf_create(art, key, page_num, cell_num));
+            *ref = parent;
+            art->num_keys++;
+            return;
+        }
+        depth += inner->prefix_len;
+        void **child = art_find_child(inner, bytes[depth]);
+        if (child == NULL)
+        {
+            art_add_child(ref, bytes[depth], art_leaf_create(art, key, page_num, cell_num));
+            art->num_keys++;
+            return;
+        }
+        ref = child;
+        depth++;
+    }
+}
+
+
+/**
+ * @description: 打开主表的ART前端索引
+ * @param {Table} *table
+ * @return {*}
+ * @note: 只用于不是写时复制模式的B树主表：写时复制模式的读者在快照上下降，叶子会被复制到别的页；
+ *        其他存取方式的叶子不是主键的最终位置。打开时不扫描，第一次查找时才建立
+ */
+void table_art_open(Table *table)
+{
+    if (table->access_method != ACCESS_BTREE || table->pager->copy_on_write)
+    {
+        return;
+    }
+    ArtTree *art = malloc(sizeof(ArtTree));
+    art->root = NULL;
+    art->key_size = table->key_size;
+    art->num_keys = 0;
+    art->built = false;
+    pthread_rwlock_init(&(art->lock), NULL);
+    pthread_mutex_init(&(art->build_mutex), NULL);
+    table->front_index = art;
+}
+
+void table_art_close(Table *table)
+{
+    ArtTree *art = table->front_index;
+    art_node_free(art->root);
+    pthread_rwlock_destroy(&(art->lock));
+    pthread_mutex_destroy(&(art->build_mutex));
+    free(art);
+    table->front_index = NULL;
+}
+
+/**
+ * @description: 丢弃所有的项，下次查找时重新建立
+ * @note: .vacuum重写了所有叶子并截断文件之后调用
+ */
+void table_art_reset(Table *table)
+{
+    ArtTree *art = table->front_index;
+    pthread_rwlock_wrlock(&(art->lock));
+    art_node_free(art->root);
+    art->root = NULL;
+    art->num_keys = 0;
+    __atomic_store_n(&(art->built), false, __ATOMIC_RELEASE);
+    pthread_rwlock_unlock(&(art->lock));
+}
+
+/**
+ * @description: 扫描所有叶子建立ART
+ * @param {Table} *table
+ * @return {*}
+ * @note: 调用者持有build_mutex。扫描时不持有art->lock，建好之后再换上；
+ *        扫描期间的插入没有记录下来，查找时对不上会回到下降并补上。
+ *        扫描用的table_start也会经过table_find，build_mutex已被占用，它直接下降
+ */
+void table_art_build(Table *table)
+{
+    ArtTree *art = table->front_index;
+    ArtTree scratch;
+    scratch.root = NULL;
+    scratch.key_size = art->key_size;
+    scratch.num_keys = 0;
+    Cursor *cursor = table_start(table);
+    while (!(cursor->end_of_table))
+    {
+        art_put(&scratch, cursor_key(cursor), cursor->page_num, cursor->cell_num);
+        cursor_advance(cursor);
+    }
+    cursor_close(cursor);
+
+    pthread_rwlock_wrlock(&(art->lock));
+    art_node_free(art->root);
+    art->root = scratch.root;
+    art->num_keys = scratch.num_keys;
+    __atomic_store_n(&(art->built), true, __ATOMIC_RELEASE);
+    pthread_rwlock_unlock(&(art->lock));
+}
+
+/**
+ * @description: 记录叶子中[first_cell, last_cell)这些单元格的新位置
+ * @param {Table} *table
+ * @param {uint32_t} page_num
+ * @param {void} *node 调用者独占地闩住的叶子，或者刚分裂出来、还只有当前线程能修改的新叶子
+ * @param {uint32_t} first_cell
+ * @param {uint32_t} last_cell
+ * @return {*}
+ * @note: 叶子插入时插入点之后的单元格右移一格，分裂时一部分单元格移到新叶子，都要重新记录。
+ *        还没有建立时什么也不做
+ */
+void table_art_update(Table *table, uint32_t page_num, void *node, uint32_t first_cell, uint32_t last_cell)
+{
+    ArtTree *art = table->front_index;
+    if (art == NULL || !__atomic_load_n(&(art->built), __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+    pthread_rwlock_wrlock(&(art->lock));
+    for (uint32_t i = first_cell; i < last_cell; i++)
+    {
+        art_put(art, leaf_node_key(node, i), page_num, i);
+    }
+    pthread_rwlock_unlock(&(art->lock));
+}
+
+/**
+ * @description: 用ART定位主键
+ * @param {Table} *table
+ * @param {void} *key
+ * @return {*} 命中时返回共享地闩住叶子、停在这个主键上的游标(没有路径，持有整理锁)；否则返回NULL，由调用者下降
+ * @note: ART中的位置可能已经过时(单元格移动过，页面被.vacuum重写)，闩住叶子后核对它仍是主表格式的叶子、
+ *        单元格号在范围内并且主键相同。还没有建立时先建立，别的线程正在建立时直接返回NULL
+ */
+Cursor *table_art_find(Table *table, const void *key)
+{
+    ArtTree *art = table->front_index;
+    Pager *pager = table->pager;
+    vacuum_read_lock(pager);
+    if (!__atomic_load_n(&(art->built), __ATOMIC_ACQUIRE))
+    {
+        if (pthread_mutex_trylock(&(art->build_mutex)) != 0)
+        {
+            vacuum_read_unlock(pager);
+            return NULL;
+        }
+        if (!__atomic_load_n(&(art->built), __ATOMIC_ACQUIRE))
+        {
+            table_art_build(table);
+        }
+        pthread_mutex_unlock(&(art->build_mutex));
+    }
+
+    uint32_t page_num;
+    uint32_t cell_num;
+    pthread_rwlock_rdlock(&(art->lock));
+    bool found = art_get(art, key, &page_num, &cell_num);
+    pthread_rwlock_unlock(&(art->lock));
+    if (!found)
+    {
+        vacuum_read_unlock(pager);
+        return NULL;
+    }
+
+    page_latch(pager, page_num, LATCH_SHARED);
+    void *node = get_page(pager, page_num);
+    if (get_node_type(node) != NODE_LEAF || get_node_key_type(node) != table->key_type ||
+        get_node_value_size(node) != table->value_size || cell_num >= *leaf_node_num_cells(node) ||
+        memcmp(leaf_node_key(node, cell_num), key, table->key_size) != 0)
+    {
+        page_unlatch(pager, page_num);
+        vacuum_read_unlock(pager);
+        return NULL;
+    }
+    Cursor *cursor = malloc(sizeof(Cursor));
+    cursor->table = table;
+    cursor->page_num = page_num;
+    cursor->cell_num = cell_num;
+    cursor->end_of_table = false;
+    cursor->depth = 0;
+    cursor->latch_mode = LATCH_SHARED;
+    cursor->snapshot_slot = -1;
+    return cursor;
+}
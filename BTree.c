@@ -14,6 +14,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include"Sqlite.h"
 
@@ -36,6 +37,7 @@ void print_tree(Pager *pager, uint32_t page_num, uint32_t indentation_level)
 {
     void *node = get_page(pager, page_num);
     uint32_t num_keys, child;
+    Key key;
 
     switch (get_node_type(node))
     {
@@ -46,7 +48,10 @@ void print_tree(Pager *pager, uint32_t page_num, uint32_t indentation_level)
         for (uint32_t i = 0; i < num_keys; i++)
         {
             indent(indentation_level + 1);
-            printf("- %d\n", *leaf_node_key(node, i));
+            decode_key(get_node_key_type(node), leaf_node_key(node, i), &key);
+            printf("- ");
+            print_key(get_node_key_type(node), &key);
+            printf("\n");
         }
         break;
     case (NODE_INTERNAL):
@@ -61,7 +66,10 @@ void print_tree(Pager *pager, uint32_t page_num, uint32_t indentation_level)
                 print_tree(pager, child, indentation_level + 1);
 
                 indent(indentation_level + 1);
-                printf("- key %d\n", *internal_node_key(node, i));
+                decode_key(get_node_key_type(node), internal_node_key(node, i), &key);
+                printf("- key ");
+                print_key(get_node_key_type(node), &key);
+                printf("\n");
             }
             child = *internal_node_right_child(node);
             print_tree(pager, child, indentation_level + 1);
@@ -70,22 +78,116 @@ void print_tree(Pager *pager, uint32_t page_num, uint32_t indentation_level)
     }
 }
 
+/**
+ * @description: 检查内部节点中行数字段的对齐，不对齐时退出
+ * @return {*}
+ * @note: 行数用原子操作增加，跨缓存行的原子操作会锁总线(split lock)，一次插入慢上百倍，
+ *        在要求对齐的平台上还会直接出错。头部和每种主键的单元格大小都必须是4的倍数
+ */
+void check_node_layout(void)
+{
+    bool aligned = INTERNAL_NODE_HEADER_SIZE % sizeof(uint32_t) == 0 &&
+                   INTERNAL_NODE_RIGHT_COUNT_OFFSET % sizeof(uint32_t) == 0 &&
+                   (INTERNAL_NODE_CHILD_SIZE % sizeof(uint32_t)) == 0;
+    KeyType key_types[] = {KEY_U32, KEY_U64, KEY_COMPOSITE, KEY_INDEX};
+    for (uint32_t i = 0; i < sizeof(key_types) / sizeof(key_types[0]); i++)
+    {
+        uint32_t cell_size = INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_COUNT_SIZE + key_type_size(key_types[i]);
+        aligned = aligned && cell_size % sizeof(uint32_t) == 0;
+    }
+    if (!aligned)
+    {
+        printf("Internal node row counts are not 4-byte aligned.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
 /**
  * @description: 输出部分常量
  */
-void print_constants()
+void print_constants(Table *table)
 {
     printf("ROW_SIZE: %d\n", ROW_SIZE);
+    if (table->access_method == ACCESS_HASH)
+    {
+        printf("HASH_BUCKET_HEADER_SIZE: %d\n", HASH_BUCKET_HEADER_SIZE);
+        printf("KEY_SIZE: %d\n", table->key_size);
+        printf("HASH_BUCKET_MAX_CELLS: %d\n", hash_bucket_max_cells(table));
+        return;
+    }
+    if (table->access_method == ACCESS_LSM)
+    {
+        printf("LSM_RUN_HEADER_SIZE: %d\n", LSM_RUN_HEADER_SIZE);
+        printf("KEY_SIZE: %d\n", table->key_size);
+        printf("LSM_RUN_MAX_CELLS: %d\n", lsm_run_max_cells(table));
+        printf("LSM_MEMTABLE_MAX_ROWS: %d\n", LSM_MEMTABLE_MAX_ROWS);
+        return;
+    }
+    void *root = get_page(table->pager, table->root_page_num);
     printf("COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
     printf("LEAF_NODE_HEADER_SIZE: %d\n", LEAF_NODE_HEADER_SIZE);
-    printf("LEAF_NODE_CELL_SIZE: %d\n", LEAF_NODE_CELL_SIZE);
+    printf("KEY_SIZE: %d\n", table->key_size);
+    printf("LEAF_NODE_CELL_SIZE: %d\n", leaf_node_cell_size(root));
     printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n", LEAF_NODE_SPACE_FOR_CELLS);
-    printf("LEAF_NODE_MAX_CELLS: %d\n", LEAF_NODE_MAX_CELLS);
+    printf("LEAF_NODE_MAX_CELLS: %d\n", leaf_node_max_cells(root));
+    if (table->access_method == ACCESS_BETREE)
+    {
+        printf("INTERNAL_NODE_MAX_MESSAGES: %d\n", internal_node_max_messages(root));
+    }
 }
 
 
 
 
+/**
+ * @description: 节点头部记录的主键格式，单元格的大小由它决定
+ */
+KeyType get_node_key_type(void *node)
+{
+    uint8_t value = *((uint8_t *)(node + NODE_KEY_TYPE_OFFSET));
+    return (KeyType)value;
+}
+
+uint32_t get_node_key_size(void *node)
+{
+    return *((uint8_t *)(node + NODE_KEY_SIZE_OFFSET));
+}
+
+void set_node_key_format(void *node, KeyType key_type, uint32_t key_size)
+{
+    *((uint8_t *)(node + NODE_KEY_TYPE_OFFSET)) = key_type;
+    *((uint8_t *)(node + NODE_KEY_SIZE_OFFSET)) = key_size;
+}
+
+/**
+ * @description: 叶子单元格中值的字节数，主表和索引不同，记录在节点头部
+ */
+uint32_t get_node_value_size(void *node)
+{
+    return *((uint16_t *)(node + NODE_VALUE_SIZE_OFFSET));
+}
+
+void set_node_value_size(void *node, uint32_t value_size)
+{
+    *((uint16_t *)(node + NODE_VALUE_SIZE_OFFSET)) = value_size;
+}
+
+uint32_t leaf_node_cell_size(void *node)
+{
+    return get_node_key_size(node) + get_node_value_size(node);
+}
+
+uint32_t leaf_node_max_cells(void *node)
+{
+    return LEAF_NODE_SPACE_FOR_CELLS / leaf_node_cell_size(node);
+}
+
+uint32_t internal_node_cell_size(void *node)
+{
+    return INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_COUNT_SIZE + get_node_key_size(node);
+}
+
+
 /**
  * @description: 访问叶节点字段,这些方法返回指向所讨论的值的指针，因此它们既可以用作getter也可以用作setter。
  */
@@ -96,17 +198,17 @@ uint32_t *leaf_node_num_cells(void *node)
 
 void *leaf_node_cell(void *node, uint32_t cell_num)
 {
-    return node + LEAF_NODE_HEADER_SIZE + cell_num * LEAF_NODE_CELL_SIZE;
+    return node + LEAF_NODE_HEADER_SIZE + cell_num * leaf_node_cell_size(node);
 }
 
-uint32_t *leaf_node_key(void *node, uint32_t cell_num)
+void *leaf_node_key(void *node, uint32_t cell_num)
 {
-    return leaf_node_cell(node, cell_num);
+    return leaf_node_cell(node, cell_num) + LEAF_NODE_KEY_OFFSET;
 }
 
 void *leaf_node_value(void *node, uint32_t cell_num)
 {
-    return leaf_node_cell(node, cell_num) + LEAF_NODE_KEY_SIZE;
+    return leaf_node_cell(node, cell_num) + get_node_key_size(node);
 }
 
 uint32_t *leaf_node_next_leaf(void *node)
@@ -114,6 +216,11 @@ uint32_t *leaf_node_next_leaf(void *node)
     return node + LEAF_NODE_NEXT_LEAF_OFFSET;
 }
 
+uint32_t *leaf_node_prev_leaf(void *node)
+{
+    return node + LEAF_NODE_PREV_LEAF_OFFSET;
+}
+
 
 /**
  * @description: 获取和设置节点的类型
@@ -146,15 +253,58 @@ void initialize_leaf_node(void* node) {
 	set_node_root(node, false);
 	*leaf_node_num_cells(node) = 0;
 	*leaf_node_next_leaf(node) = 0;
+	*leaf_node_prev_leaf(node) = 0;
 }
 uint32_t* internal_node_right_child(void* node) {
   return node + INTERNAL_NODE_RIGHT_CHILD_OFFSET;
 }
 
+uint32_t *internal_node_right_sibling(void *node)
+{
+    return node + INTERNAL_NODE_RIGHT_SIBLING_OFFSET;
+}
+
+
+/**
+ * @description: B-link树的高键和右链接
+ * @note: 叶子的右链接复用next_leaf。没有右兄弟的节点高键为正无穷，高键字段不使用
+ */
+void *node_high_key(void *node)
+{
+    return node + NODE_HIGH_KEY_OFFSET;
+}
+
+uint32_t node_right_sibling(void *node)
+{
+    if (get_node_type(node) == NODE_LEAF)
+    {
+        return *leaf_node_next_leaf(node);
+    }
+    return *internal_node_right_sibling(node);
+}
+
+
+/**
+ * @description: 主键是否落在节点的范围内(不超过高键)
+ * @param {void} *node
+ * @param {void} *key
+ * @return {*}
+ * @note: 返回false说明节点在读取父节点之后分裂了，主键已经移到右兄弟中
+ */
+bool node_covers_key(void *node, const void *key)
+{
+    return node_right_sibling(node) == 0 ||
+           compare_keys(get_node_key_type(node), get_node_key_size(node), key,
+                        node_high_key(node)) <= 0;
+}
+
 void initialize_internal_node(void* node) {
   set_node_type(node, NODE_INTERNAL);
   set_node_root(node, false);
   *internal_node_num_keys(node) = 0;
+  *internal_node_right_sibling(node) = 0;
+  *(uint32_t *)(node + INTERNAL_NODE_RIGHT_COUNT_OFFSET) = 0;
+  *internal_node_num_messages(node) = 0;
   /*
   Necessary because the root page number is 0; by not initializing an internal 
   node's right child to an invalid page number when initializing the node, we may
@@ -175,7 +325,7 @@ uint32_t *internal_node_num_keys(void *node)
 
 uint32_t *internal_node_cell(void *node, uint32_t cell_num)
 {
-    return node + INTERNAL_NODE_HEADER_SIZE + cell_num * INTERNAL_NODE_CELL_SIZE;
+    return node + INTERNAL_NODE_HEADER_SIZE + cell_num * internal_node_cell_size(node);
 }
 
 uint32_t *internal_node_child(void *node, uint32_t child_num)
@@ -208,28 +358,125 @@ uint32_t *internal_node_child(void *node, uint32_t child_num)
     }
 }
 
-uint32_t *internal_node_key(void *node, uint32_t key_num)
+void *internal_node_key(void *node, uint32_t key_num)
 {
-    return (void *)internal_node_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE;
+    return (void *)internal_node_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_COUNT_SIZE;
 }
 
-uint32_t get_node_max_key(Pager *pager, void *node)
+/**
+ * @description: 第child_num个孩子子树中的行数，child_num == num_keys时是右孩子
+ * @note: 不检查孩子是否有效，分裂时搬动孩子之前也可以读写
+ */
+uint32_t *internal_node_child_count(void *node, uint32_t child_num)
 {
-    switch (get_node_type(node))
+    if (child_num == *internal_node_num_keys(node))
     {
-    case NODE_INTERNAL:
-        return *internal_node_key(node, *internal_node_num_keys(node) - 1);
-    case NODE_LEAF:
-        return *leaf_node_key(node, *leaf_node_num_cells(node) - 1);
+        return node + INTERNAL_NODE_RIGHT_COUNT_OFFSET;
     }
+    return (void *)internal_node_cell(node, child_num) + INTERNAL_NODE_CHILD_SIZE;
 }
 
-uint32_t *node_parent(void *node)
+/**
+ * @description: 节点子树中的行数
+ * @param {Pager} *pager
+ * @param {uint32_t} page_num
+ * @return {*}
+ * @note: 叶子是单元格数，内部节点是所有孩子的行数之和，不需要继续向下读。
+ *        读者持有节点的共享闩锁，和不加闩锁地增加行数的写者之间用原子操作
+ */
+uint32_t node_row_count(Pager *pager, uint32_t page_num)
 {
-    return node + PARENT_POINTER_OFFSET;
+    void *node = get_page(pager, page_num);
+    if (get_node_type(node) == NODE_LEAF)
+    {
+        return *leaf_node_num_cells(node);
+    }
+    if (*internal_node_right_child(node) == INVALID_PAGE_NUM)
+    {
+        return 0;
+    }
+    uint32_t count = 0;
+    uint32_t num_keys = *internal_node_num_keys(node);
+    for (uint32_t i = 0; i <= num_keys; i++)
+    {
+        count += __atomic_load_n(internal_node_child_count(node, i), __ATOMIC_RELAXED);
+    }
+    return count;
 }
 
+/**
+ * @description: 按孩子现在的内容重新计算它在父节点中的行数
+ * @param {Pager} *pager
+ * @param {void} *parent
+ * @param {uint32_t} child_page_num 必须是parent的孩子
+ * @return {*}
+ * @note: 分裂改变了孩子的内容之后调用，孩子按页码查找
+ */
+void internal_node_update_child_count(Pager *pager, void *parent, uint32_t child_page_num)
+{
+    uint32_t num_keys = *internal_node_num_keys(parent);
+    for (uint32_t i = 0; i <= num_keys; i++)
+    {
+        if (*internal_node_child(parent, i) == child_page_num)
+        {
+            *internal_node_child_count(parent, i) = node_row_count(pager, child_page_num);
+            return;
+        }
+    }
+}
 
+/**
+ * @description: 插入一行之前，把游标路径上每个祖先中通向叶子的孩子的行数加一
+ * @param {Cursor} *cursor table_find得到的写游标
+ * @return {*}
+ * @note: 调用者持有count_lock，路径在这期间不会被分裂改变。共享地持有count_lock的写者
+ *        可能同时增加同一个计数，所以用原子操作；之后的分裂按孩子的实际内容重新计算受影响的计数
+ */
+void cursor_count_insert(Cursor *cursor)
+{
+    Pager *pager = cursor->table->pager;
+    for (uint32_t level = 0; level < cursor->depth; level++)
+    {
+        void *node = get_page(pager, cursor->path_pages[level]);
+        __atomic_fetch_add(internal_node_child_count(node, cursor->path_cells[level]), 1, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @description: 把子树中最大的主键复制到destination
+ * @note: 内部节点最大的主键在最右子树中，而不是它的最后一个键
+ */
+void get_node_max_key(Pager *pager, uint32_t page_num, void *destination)
+{
+    void *node = get_page(pager, page_num);
+    while (get_node_type(node) == NODE_INTERNAL)
+    {
+        page_num = *internal_node_right_child(node);
+        node = get_page(pager, page_num);
+    }
+
+    /*
+    只有分裂时会走到这里，内部节点由smo_mutex保护，但叶子可能正在被其他线程插入。
+    有右兄弟的叶子，最大键就是分裂时设置的高键，不需要加锁(给左边的叶子加锁会和向右移动的写者死锁)；
+    最右边的叶子没有高键，只能加锁读取
+    */
+    if (page_latched_exclusive(pager, page_num))
+    {
+        memcpy(destination, leaf_node_key(node, *leaf_node_num_cells(node) - 1),
+               get_node_key_size(node));
+    }
+    else if (*leaf_node_next_leaf(node) != 0)
+    {
+        memcpy(destination, node_high_key(node), get_node_key_size(node));
+    }
+    else
+    {
+        page_latch(pager, page_num, LATCH_SHARED);
+        memcpy(destination, leaf_node_key(node, *leaf_node_num_cells(node) - 1),
+               get_node_key_size(node));
+        page_unlatch(pager, page_num);
+    }
+}
 
 /**
  * @description: 创建一个新的root节点
@@ -241,39 +488,69 @@ void create_new_root(Table *table, uint32_t right_child_page_num)
     uint32_t left_child_page_num = get_unused_page_num(table->pager);
     void *left_child = get_page(table->pager, left_child_page_num);
 
+    if (get_node_type(root) == NODE_INTERNAL)
+    {
+        initialize_internal_node(right_child);
+        set_node_key_format(right_child, get_node_key_type(root), get_node_key_size(root));
+        set_node_value_size(right_child, get_node_value_size(root));
+    }
+
     memcpy(left_child, root, PAGE_SIZE);
     set_node_root(left_child, false);
+    if (get_node_type(root) == NODE_LEAF)
+    {
+        // 右叶子的左兄弟原来是根节点，根的内容已经搬到了左孩子
+        *leaf_node_prev_leaf(right_child) = left_child_page_num;
+    }
 
     initialize_internal_node(root);
     set_node_root(root, true);
     *internal_node_num_keys(root) = 1;
     *internal_node_child(root, 0) = left_child_page_num;
-    uint32_t left_child_max_key = get_node_max_key(table->pager, left_child);
-    *internal_node_key(root, 0) = left_child_max_key;
+    get_node_max_key(table->pager, left_child_page_num, internal_node_key(root, 0));
     *internal_node_right_child(root) = right_child_page_num;
-    *node_parent(left_child) = table->root_page_num;
-    *node_parent(right_child) = table->root_page_num;
+    *internal_node_child_count(root, 0) = node_row_count(table->pager, left_child_page_num);
+    *internal_node_child_count(root, 1) = node_row_count(table->pager, right_child_page_num);
 }
 
 
 
-void update_internal_node_key(void *node, uint32_t old_key, uint32_t new_key)
+void update_internal_node_key(void *node, const void *old_key, const void *new_key)
 {
     uint32_t old_child_index = internal_node_find_child(node, old_key);
-    *internal_node_key(node, old_child_index) = new_key;
+    if (old_child_index < *internal_node_num_keys(node))
+    {
+        memcpy(internal_node_key(node, old_child_index), new_key, get_node_key_size(node));
+    }
 }
 
 
 
-void internal_node_split_and_insert(Table *table, uint32_t parent_page_num,
-                                    uint32_t child_page_num)
+/**
+ * @description: 分裂游标路径上第level层的内部节点，并插入child
+ * @param {Cursor} *cursor table_find得到的游标，路径记录了所有祖先
+ * @param {uint32_t} level 被分裂的节点在路径中的层数，0是根节点
+ * @param {uint32_t} child_page_num
+ * @return {*}
+ * @note: 节点中不保存父指针，向上插入新节点时沿着游标中的路径回溯。
+ *        调用者持有第level层节点的独占闩锁，父节点在本节点分裂完成、右链接建立后才加锁
+ */
+void internal_node_split_and_insert(Cursor *cursor, uint32_t level, uint32_t child_page_num)
 {
-    uint32_t old_page_num = parent_page_num;
-    void *old_node = get_page(table->pager, parent_page_num);
-    uint32_t old_max = get_node_max_key(table->pager, old_node);
-
-    void *child = get_page(table->pager, child_page_num);
-    uint32_t child_max = get_node_max_key(table->pager, child);
+    Table *table = cursor->table;
+    uint32_t old_page_num = cursor->path_pages[level];
+    void *old_node = get_page(table->pager, old_page_num);
+    KeyType key_type = get_node_key_type(old_node);
+    uint32_t key_size = get_node_key_size(old_node);
+    uint8_t old_max[KEY_MAX_SIZE];
+    get_node_max_key(table->pager, old_page_num, old_max);
+    // 新节点接在原节点和它的右兄弟之间，继承原来的高键
+    uint8_t old_high_key[KEY_MAX_SIZE];
+    memcpy(old_high_key, node_high_key(old_node), key_size);
+    uint32_t old_right_sibling = *internal_node_right_sibling(old_node);
+
+    uint8_t child_max[KEY_MAX_SIZE];
+    get_node_max_key(table->pager, child_page_num, child_max);
 
     uint32_t new_page_num = get_unused_page_num(table->pager);
 
@@ -290,10 +567,10 @@ void internal_node_split_and_insert(Table *table, uint32_t parent_page_num,
     need to find a place for our newly created node in its parent, and we
     cannot insert it at the correct index if it does not yet have any keys
    */
-    uint32_t splitting_root = is_node_root(old_node);
+    uint32_t splitting_root = (level == 0);
 
     void *parent;
-    void *new_node;
+    void *new_node = get_page(table->pager, new_page_num);
     if (splitting_root)
     {
         create_new_root(table, new_page_num);
@@ -308,21 +585,20 @@ void internal_node_split_and_insert(Table *table, uint32_t parent_page_num,
     }
     else
     {
-        parent = get_page(table->pager, *node_parent(old_node));
-        new_node = get_page(table->pager, new_page_num);
+        parent = get_page(table->pager, cursor->path_pages[level - 1]);
         initialize_internal_node(new_node);
+        set_node_key_format(new_node, key_type, key_size);
+        set_node_value_size(new_node, get_node_value_size(old_node));
     }
 
     uint32_t *old_num_keys = internal_node_num_keys(old_node);
 
     uint32_t cur_page_num = *internal_node_right_child(old_node);
-    void *cur = get_page(table->pager, cur_page_num);
 
     /*
     First put right child into new node and set right child of old node to invalid page number
     */
-    internal_node_insert(table, new_page_num, cur_page_num);
-    *node_parent(cur) = new_page_num;
+    internal_node_add_child(table, new_page_num, cur_page_num);
     *internal_node_right_child(old_node) = INVALID_PAGE_NUM;
     /*
     For each key until you get to the middle key, move the key and the child to the new node
@@ -330,10 +606,8 @@ void internal_node_split_and_insert(Table *table, uint32_t parent_page_num,
     for (int i = INTERNAL_NODE_MAX_CELLS - 1; i > INTERNAL_NODE_MAX_CELLS / 2; i--)
     {
         cur_page_num = *internal_node_child(old_node, i);
-        cur = get_page(table->pager, cur_page_num);
 
-        internal_node_insert(table, new_page_num, cur_page_num);
-        *node_parent(cur) = new_page_num;
+        internal_node_add_child(table, new_page_num, cur_page_num);
 
         (*old_num_keys)--;
     }
@@ -343,46 +617,103 @@ void internal_node_split_and_insert(Table *table, uint32_t parent_page_num,
     and decrement number of keys
     */
     *internal_node_right_child(old_node) = *internal_node_child(old_node, *old_num_keys - 1);
+    *(uint32_t *)(old_node + INTERNAL_NODE_RIGHT_COUNT_OFFSET) =
+        *internal_node_child_count(old_node, *old_num_keys - 1);
     (*old_num_keys)--;
 
     /*
     Determine which of the two nodes after the split should contain the child to be inserted,
     and insert the child
     */
-    uint32_t max_after_split = get_node_max_key(table->pager, old_node);
+    uint8_t max_after_split[KEY_MAX_SIZE];
+    get_node_max_key(table->pager, old_page_num, max_after_split);
 
-    uint32_t destination_page_num = child_max < max_after_split ? old_page_num : new_page_num;
+    uint32_t destination_page_num =
+        compare_keys(key_type, key_size, child_max, max_after_split) < 0 ? old_page_num : new_page_num;
 
-    internal_node_insert(table, destination_page_num, child_page_num);
-    *node_parent(child) = destination_page_num;
+    internal_node_add_child(table, destination_page_num, child_page_num);
 
-    update_internal_node_key(parent, old_max, get_node_max_key(table->pager, old_node));
+    uint8_t new_max[KEY_MAX_SIZE];
+    get_node_max_key(table->pager, old_page_num, new_max);
 
-    if (!splitting_root)
+    // 写优化模式下超出左节点范围的消息跟着孩子移到新节点
+    if (table->access_method == ACCESS_BETREE)
+    {
+        buffer_split(old_node, new_node, new_max);
+    }
+
+    // 写时复制模式下旧版本的兄弟不会随副本更新，不建立右链接
+    if (!table->pager->copy_on_write)
+    {
+        *internal_node_right_sibling(new_node) = old_right_sibling;
+        memcpy(node_high_key(new_node), old_high_key, key_size);
+        *internal_node_right_sibling(old_node) = new_page_num;
+        memcpy(node_high_key(old_node), new_max, key_size);
+    }
+
+    if (splitting_root)
     {
-        internal_node_insert(table, *node_parent(old_node), new_page_num);
-        *node_parent(new_node) = *node_parent(old_node);
+        // 根节点就是调用者锁住的节点，它的两个孩子是在搬动之前建立的，重新计算行数
+        update_internal_node_key(parent, old_max, new_max);
+        internal_node_update_child_count(table->pager, parent, old_page_num);
+        internal_node_update_child_count(table->pager, parent, new_page_num);
+    }
+    else
+    {
+        uint32_t parent_page_num = cursor->path_pages[level - 1];
+        page_latch(table->pager, parent_page_num, LATCH_EXCLUSIVE);
+        update_internal_node_key(parent, old_max, new_max);
+        internal_node_update_child_count(table->pager, parent, old_page_num);
+        internal_node_insert(cursor, level - 1, new_page_num);
+        page_unlatch(table->pager, parent_page_num);
     }
 }
 
 
-void internal_node_insert(Table *table, uint32_t parent_page_num, uint32_t child_page_num)
+/**
+ * @description: 向游标路径上第level层的内部节点插入child，节点已满时先分裂
+ * @param {Cursor} *cursor
+ * @param {uint32_t} level
+ * @param {uint32_t} child_page_num
+ * @return {*}
+ * @note: 调用者持有该节点的独占闩锁
+ */
+void internal_node_insert(Cursor *cursor, uint32_t level, uint32_t child_page_num)
+{
+    uint32_t parent_page_num = cursor->path_pages[level];
+    void *parent = get_page(cursor->table->pager, parent_page_num);
+
+    if (*internal_node_num_keys(parent) >= INTERNAL_NODE_MAX_CELLS)
+    {
+        internal_node_split_and_insert(cursor, level, child_page_num);
+        return;
+    }
+    internal_node_add_child(cursor->table, parent_page_num, child_page_num);
+}
+
+
+/**
+ * @description: 向一个还有空间的内部节点添加child
+ * @param {Table} *table
+ * @param {uint32_t} parent_page_num
+ * @param {uint32_t} child_page_num
+ * @return {*}
+ * @note: 分裂时搬动孩子也使用它，这时目标节点一定不会满
+ */
+void internal_node_add_child(Table *table, uint32_t parent_page_num, uint32_t child_page_num)
 {
     /*
     Add a new child/key pair to parent that corresponds to child
     */
     void *parent = get_page(table->pager, parent_page_num);
-    void *child = get_page(table->pager, child_page_num);
-    uint32_t child_max_key = get_node_max_key(table->pager, child);
+    KeyType key_type = get_node_key_type(parent);
+    uint32_t key_size = get_node_key_size(parent);
+    uint8_t child_max_key[KEY_MAX_SIZE];
+    get_node_max_key(table->pager, child_page_num, child_max_key);
     uint32_t index = internal_node_find_child(parent, child_max_key);
 
     uint32_t original_num_keys = *internal_node_num_keys(parent);
 
-    if (original_num_keys >= INTERNAL_NODE_MAX_CELLS)
-    {
-        internal_node_split_and_insert(table, parent_page_num, child_page_num);
-        return;
-    }
     uint32_t right_child_page_num = *internal_node_right_child(parent);
     /*
     An internal node with a right child of INVALID_PAGE_NUM is empty
@@ -390,9 +721,9 @@ void internal_node_insert(Table *table, uint32_t parent_page_num, uint32_t child
     if (right_child_page_num == INVALID_PAGE_NUM)
     {
         *internal_node_right_child(parent) = child_page_num;
+        *internal_node_child_count(parent, original_num_keys) = node_row_count(table->pager, child_page_num);
         return;
     }
-    void *right_child = get_page(table->pager, right_child_page_num);
     /*
     If we are already at the max number of cells for a node, we cannot increment
     before splitting. Incrementing without inserting a new key/child pair
@@ -402,15 +733,19 @@ void internal_node_insert(Table *table, uint32_t parent_page_num, uint32_t child
     递增而不插入新的键/子对，并立即调用internal_node_split_and_insert，
     其效果是在(max_cells + 1)处创建一个具有未初始化值的新键
     */
+    uint32_t right_child_count = *internal_node_child_count(parent, original_num_keys);
     *internal_node_num_keys(parent) = original_num_keys + 1;
 
-    if (child_max_key > get_node_max_key(table->pager, right_child))
+    uint8_t right_child_max_key[KEY_MAX_SIZE];
+    get_node_max_key(table->pager, right_child_page_num, right_child_max_key);
+    if (compare_keys(key_type, key_size, child_max_key, right_child_max_key) > 0)
     {
         /* Replace right child */
         *internal_node_child(parent, original_num_keys) = right_child_page_num;
-        *internal_node_key(parent, original_num_keys) =
-            get_node_max_key(table->pager, right_child);
+        *internal_node_child_count(parent, original_num_keys) = right_child_count;
+        memcpy(internal_node_key(parent, original_num_keys), right_child_max_key, key_size);
         *internal_node_right_child(parent) = child_page_num;
+        *internal_node_child_count(parent, original_num_keys + 1) = node_row_count(table->pager, child_page_num);
     }
     else
     {
@@ -419,44 +754,98 @@ void internal_node_insert(Table *table, uint32_t parent_page_num, uint32_t child
         {
             void *destination = internal_node_cell(parent, i);
             void *source = internal_node_cell(parent, i - 1);
-            memcpy(destination, source, INTERNAL_NODE_CELL_SIZE);
+            memcpy(destination, source, internal_node_cell_size(parent));
         }
         *internal_node_child(parent, index) = child_page_num;
-        *internal_node_key(parent, index) = child_max_key;
+        *internal_node_child_count(parent, index) = node_row_count(table->pager, child_page_num);
+        memcpy(internal_node_key(parent, index), child_max_key, key_size);
     }
 }
 
 
+/**
+ * @description: 追加到叶子末尾引起分裂时左边的叶子保留的单元格数
+ * @param {Table} *table 主表或索引，填充因子在它们共用的文件头中
+ * @param {uint32_t} max_cells
+ * @return {*} 至少为1
+ * @note: 没有设置填充因子时保留满的叶子，按顺序写入的叶子不留空间
+ */
+uint32_t leaf_node_append_split_count(Table *table, uint32_t max_cells)
+{
+    uint32_t fill_factor = __atomic_load_n(db_header_fill_factor(get_page(table->pager, DB_HEADER_PAGE_NUM)),
+                                           __ATOMIC_RELAXED);
+    if (fill_factor == 0)
+    {
+        return max_cells;
+    }
+    uint32_t count = max_cells * fill_factor / 100;
+    return count > 0 ? count : 1;
+}
+
 /**
  * @description: 拆分节点
- *
+ * @note: 追加到最右叶子末尾时(按主键递增插入)左边按填充因子保留，否则对半分
  */
-void leaf_node_split_and_insert(Cursor *cursor, uint32_t key, Row *value)
+void leaf_node_split_and_insert(Cursor *cursor, const void *key, const void *value)
+{
+    void *old_node = get_page(cursor->table->pager, cursor->page_num);
+    uint32_t max_cells = leaf_node_max_cells(old_node);
+    if (!cursor->table->pager->copy_on_write && *leaf_node_next_leaf(old_node) == 0 &&
+        cursor->cell_num == *leaf_node_num_cells(old_node))
+    {
+        leaf_node_split_at(cursor, key, value, leaf_node_append_split_count(cursor->table, max_cells));
+        return;
+    }
+    leaf_node_split_at(cursor, key, value, (max_cells + 1) - (max_cells + 1) / 2);
+}
+
+/**
+ * @description: 拆分叶子并插入，分裂后左边的叶子保留left_split_count个单元格
+ * @param {Cursor} *cursor
+ * @param {void} *key
+ * @param {void} *value
+ * @param {uint32_t} left_split_count 1到max_cells，其余的(连同新单元格)移到新的右叶子
+ * @return {*}
+ * @note: 随机插入对半分；按主键顺序追加时左边按填充因子保留(没有设置时保留满的叶子)，
+ *        其余的和新单元格放在右边，后续的行接着填充右边
+ */
+void leaf_node_split_at(Cursor *cursor, const void *key, const void *value, uint32_t left_split_count)
 {
     /*
-    Create a new node and move half the cells over.
+    Create a new node and move the cells after the split point over.
     Insert the new value in one of the two nodes.
     Update parent or create a new parent.
     */
 
     void *old_node = get_page(cursor->table->pager, cursor->page_num);
-    uint32_t old_max = get_node_max_key(cursor->table->pager, old_node);
+    uint32_t key_size = get_node_key_size(old_node);
+    uint32_t cell_size = leaf_node_cell_size(old_node);
+    uint32_t max_cells = leaf_node_max_cells(old_node);
+    uint32_t right_split_count = (max_cells + 1) - left_split_count;
+    uint8_t old_max[KEY_MAX_SIZE];
+    get_node_max_key(cursor->table->pager, cursor->page_num, old_max);
     uint32_t new_page_num = get_unused_page_num(cursor->table->pager);
     void *new_node = get_page(cursor->table->pager, new_page_num);
     initialize_leaf_node(new_node);
-    *node_parent(new_node) = *node_parent(old_node);
-    *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
-    *leaf_node_next_leaf(old_node) = new_page_num;
+    set_node_key_format(new_node, get_node_key_type(old_node), key_size);
+    set_node_value_size(new_node, get_node_value_size(old_node));
+    bool linked = !cursor->table->pager->copy_on_write;
+    bool rightmost = *leaf_node_next_leaf(old_node) == 0;
+    if (linked)
+    {
+        *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
+        *leaf_node_prev_leaf(new_node) = cursor->page_num;
+    }
 
     /*
     All existing keys plus new key should should be divided
     evenly between old (left) and new (right) nodes.
     Starting from the right, move each key to correct position.
     */
-    for (int32_t i = LEAF_NODE_MAX_CELLS; i >= 0; i--)
+    for (uint32_t i = max_cells + 1; i-- > 0;)
     {
         void *destination_node;
-        if (i >= LEAF_NODE_LEFT_SPLIT_COUNT)
+        if (i >= left_split_count)
         {
             destination_node = new_node;
         }
@@ -464,39 +853,82 @@ void leaf_node_split_and_insert(Cursor *cursor, uint32_t key, Row *value)
         {
             destination_node = old_node;
         }
-        uint32_t index_within_node = i % LEAF_NODE_LEFT_SPLIT_COUNT;
+        uint32_t index_within_node = i >= left_split_count ? i - left_split_count : i;
         void *destination = leaf_node_cell(destination_node, index_within_node);
 
         if (i == cursor->cell_num)
         {
-            serialize_row(value,
-                          leaf_node_value(destination_node, index_within_node));
-            *leaf_node_key(destination_node, index_within_node) = key;
+            memcpy(leaf_node_value(destination_node, index_within_node), value,
+                   get_node_value_size(old_node));
+            memcpy(leaf_node_key(destination_node, index_within_node), key, key_size);
         }
         else if (i > cursor->cell_num)
         {
-            memcpy(destination, leaf_node_cell(old_node, i - 1), LEAF_NODE_CELL_SIZE);
+            memcpy(destination, leaf_node_cell(old_node, i - 1), cell_size);
         }
         else
         {
-            memcpy(destination, leaf_node_cell(old_node, i), LEAF_NODE_CELL_SIZE);
+            memcpy(destination, leaf_node_cell(old_node, i), cell_size);
         }
     }
     /* Update cell count on both leaf nodes */
-    *(leaf_node_num_cells(old_node)) = LEAF_NODE_LEFT_SPLIT_COUNT;
-    *(leaf_node_num_cells(new_node)) = LEAF_NODE_RIGHT_SPLIT_COUNT;
+    *(leaf_node_num_cells(old_node)) = left_split_count;
+    *(leaf_node_num_cells(new_node)) = right_split_count;
+    // 移到新叶子的单元格，以及原叶子中插入点之后右移的单元格。新叶子还没有链接，别的写者改不到它
+    if (cursor->cell_num < left_split_count)
+    {
+        table_art_update(cursor->table, cursor->page_num, old_node, cursor->cell_num, left_split_count);
+    }
+    table_art_update(cursor->table, new_page_num, new_node, 0, right_split_count);
+
+    // 新叶子继承原来的高键，原叶子的高键降为分裂后自己的最大键
+    uint8_t new_max[KEY_MAX_SIZE];
+    get_node_max_key(cursor->table->pager, cursor->page_num, new_max);
+    memcpy(node_high_key(new_node), node_high_key(old_node), NODE_HIGH_KEY_SIZE);
+    memcpy(node_high_key(old_node), new_max, key_size);
+
+    /*
+    新叶子填好之后才链接到兄弟叶子上。old_node由当前线程独占，从左边扫描过来的读者
+    看不到新叶子；右兄弟的prev_leaf改写后，反向扫描的读者才能走到新叶子。
+    写时复制模式下游标沿路径移动，叶子之间没有链接
+    */
+    if (linked && *leaf_node_next_leaf(old_node) != 0)
+    {
+        // 叶子之间按从左到右的顺序加锁
+        uint32_t next_page_num = *leaf_node_next_leaf(old_node);
+        page_latch(cursor->table->pager, next_page_num, LATCH_EXCLUSIVE);
+        void *next_node = get_page(cursor->table->pager, next_page_num);
+        *leaf_node_prev_leaf(next_node) = new_page_num;
+        page_unlatch(cursor->table->pager, next_page_num);
+    }
+    if (linked)
+    {
+        *leaf_node_next_leaf(old_node) = new_page_num;
+    }
+    // 最右边的叶子分裂后，新的右叶子接替它
+    if (linked && rightmost)
+    {
+        __atomic_store_n(&(cursor->table->rightmost_leaf_page_num), new_page_num, __ATOMIC_RELEASE);
+    }
 
-    if (is_node_root(old_node))
+    if (cursor->depth == 0)
     {
         return create_new_root(cursor->table, new_page_num);
     }
     else
     {
-        uint32_t parent_page_num = *node_parent(old_node);
-        uint32_t new_max = get_node_max_key(cursor->table->pager, old_node);
+        /*
+        叶子已经通过右链接完整地连到了新叶子上，此时到达原叶子的读者会向右移动，
+        所以父节点可以在之后单独加锁更新。分裂由smo_mutex串行化，路径中的父节点不会变
+        */
+        uint32_t parent_level = cursor->depth - 1;
+        uint32_t parent_page_num = cursor->path_pages[parent_level];
+        page_latch(cursor->table->pager, parent_page_num, LATCH_EXCLUSIVE);
         void *parent = get_page(cursor->table->pager, parent_page_num);
         update_internal_node_key(parent, old_max, new_max);
-        internal_node_insert(cursor->table, parent_page_num, new_page_num);
+        internal_node_update_child_count(cursor->table->pager, parent, cursor->page_num);
+        internal_node_insert(cursor, parent_level, new_page_num);
+        page_unlatch(cursor->table->pager, parent_page_num);
         return;
     }
 }
@@ -504,12 +936,12 @@ void leaf_node_split_and_insert(Cursor *cursor, uint32_t key, Row *value)
 /**
  * @ description: 插入叶节点key/value
  */
-void leaf_node_insert(Cursor *cursor, uint32_t key, Row *value)
+void leaf_node_insert(Cursor *cursor, const void *key, const void *value)
 {
     void *node = get_page(cursor->table->pager, cursor->page_num);
 
     uint32_t num_cells = *leaf_node_num_cells(node);
-    if (num_cells >= LEAF_NODE_MAX_CELLS)
+    if (num_cells >= leaf_node_max_cells(node))
     {
         // Node full
         leaf_node_split_and_insert(cursor, key, value);
@@ -522,35 +954,34 @@ void leaf_node_insert(Cursor *cursor, uint32_t key, Row *value)
         for (uint32_t i = num_cells; i > cursor->cell_num; i--)
         {
             memcpy(leaf_node_cell(node, i), leaf_node_cell(node, i - 1),
-                   LEAF_NODE_CELL_SIZE);
+                   leaf_node_cell_size(node));
         }
     }
     *(leaf_node_num_cells(node)) += 1;
-    *(leaf_node_key(node, cursor->cell_num)) = key;
-    serialize_row(value, leaf_node_value(node, cursor->cell_num));
+    memcpy(leaf_node_key(node, cursor->cell_num), key, get_node_key_size(node));
+    memcpy(leaf_node_value(node, cursor->cell_num), value, get_node_value_size(node));
+    // 新单元格和右移的单元格
+    table_art_update(cursor->table, cursor->page_num, node, cursor->cell_num, num_cells + 1);
 }
 
 
 
 /**
- * @ description: 更新叶节点key/value
+ * @ description: 更新叶节点的value，主键不变
+ * @ note: 值是已经序列化好的字节，旧值引用的溢出页由调用者处理
  */
-void leaf_node_update(Cursor *cursor, uint32_t key, Row *value)
+void leaf_node_update(Cursor *cursor, const void *value)
 {
     void *node = get_page(cursor->table->pager, cursor->page_num);
-
-    uint32_t num_cells = *leaf_node_num_cells(node);
-    
-    *(leaf_node_key(node, cursor->cell_num)) = key;
-    serialize_row(value, leaf_node_value(node, cursor->cell_num));
+    memcpy(leaf_node_value(node, cursor->cell_num), value, get_node_value_size(node));
 }
 
 
 
 /**
- * @description: 二分搜索叶子节点
+ * @description: 在叶子节点中查找第一个>=key的单元格
  */
-Cursor *leaf_node_find(Table *table, uint32_t page_num, uint32_t key)
+Cursor *leaf_node_find(Table *table, uint32_t page_num, const void *key)
 {
     void *node = get_page(table->pager, page_num);
     uint32_t num_cells = *leaf_node_num_cells(node);
@@ -558,30 +989,14 @@ Cursor *leaf_node_find(Table *table, uint32_t page_num, uint32_t key)
     Cursor *cursor = malloc(sizeof(Cursor));
     cursor->table = table;
     cursor->page_num = page_num;
-
-    // Binary search
-    uint32_t min_index = 0;
-    uint32_t one_past_max_index = num_cells;
-    while (one_past_max_index != min_index)
-    {
-        uint32_t index = (min_index + one_past_max_index) / 2;
-        uint32_t key_at_index = *leaf_node_key(node, index);
-        if (key == key_at_index)
-        {
-            cursor->cell_num = index;
-            return cursor;
-        }
-        if (key < key_at_index)
-        {
-            one_past_max_index = index;
-        }
-        else
-        {
-            min_index = index + 1;
-        }
-    }
-
-    cursor->cell_num = min_index;
+    cursor->end_of_table = false;
+    cursor->depth = 0;
+    cursor->snapshot_slot = -1;
+
+    // 插值或二分查找，见key_lower_bound
+    cursor->cell_num = key_lower_bound(get_node_key_type(node), get_node_key_size(node),
+                                       leaf_node_key(node, 0), leaf_node_cell_size(node),
+                                       num_cells, key);
     return cursor;
 }
 
@@ -590,7 +1005,7 @@ Cursor *leaf_node_find(Table *table, uint32_t page_num, uint32_t key)
  * @description: 二分查找关键字
  */
 
-uint32_t internal_node_find_child(void *node, uint32_t key)
+uint32_t internal_node_find_child(void *node, const void *key)
 {
     /*
       Return the index of the child which should contain
@@ -598,40 +1013,104 @@ uint32_t internal_node_find_child(void *node, uint32_t key)
       */
     uint32_t num_keys = *internal_node_num_keys(node);
     /**Binary Search*/
-    uint32_t min_index = 0;
-    uint32_t max_index = num_keys;
-    while (min_index != max_index)
+    return key_lower_bound(get_node_key_type(node), get_node_key_size(node),
+                           internal_node_key(node, 0), internal_node_cell_size(node),
+                           num_keys, key);
+}
+
+/**
+ * @description: 节点是否安全，即再插入一个单元格也不会分裂
+ * @param {void} *node
+ * @return {*}
+ * @note:
+ */
+bool node_is_safe(void *node)
+{
+    if (get_node_type(node) == NODE_LEAF)
     {
-        uint32_t index = (min_index + max_index) / 2;
-        uint32_t key_to_right = *internal_node_key(node, index);
-        if (key_to_right >= key)
-        {
-            max_index = index;
-        }
-        else
-        {
-            min_index = index + 1;
-        }
+        return *leaf_node_num_cells(node) < leaf_node_max_cells(node);
     }
-    return min_index;
+    return *internal_node_num_keys(node) < INTERNAL_NODE_MAX_CELLS;
 }
 
-Cursor *internal_node_find(Table *table, uint32_t page_num, uint32_t key)
-{
-    void *node = get_page(table->pager, page_num);
 
-    uint32_t child_index = internal_node_find_child(node, key);
-    uint32_t child_num = *internal_node_child(node, child_index);
-    void *child = get_page(table->pager, child_num);
-    switch (get_node_type(child))
+/**
+ * @description: 从page_num向下查找主键所在的叶子节点，并在游标中记录经过的路径
+ * @param {Table} *table
+ * @param {uint32_t} page_num
+ * @param {void} *key
+ * @param {FindMode} mode 叶子上的加锁方式，见FindMode
+ * @return {*}
+ * @note: 路径供分裂时向上回溯使用，取代了节点中的父指针。
+ *        按B-link树的方式下降：任何时刻只持有一个闩锁，先释放父节点再锁孩子。
+ *        孩子在这期间分裂的话，主键会超过它的高键，沿右链接向右移动即可。
+ *        孩子的页面用父节点帧中换好的指针取得(get_child_page)，整棵树都在缓存中时不再经过pager
+ */
+Cursor *internal_node_find(Table *table, uint32_t page_num, const void *key, FindMode mode)
+{
+    Pager *pager = table->pager;
+    uint32_t path_pages[BTREE_MAX_DEPTH];
+    uint32_t path_cells[BTREE_MAX_DEPTH];
+    uint32_t depth = 0;
+    LatchMode leaf_mode = mode == FIND_READ ? LATCH_SHARED : LATCH_EXCLUSIVE;
+    LatchMode held_mode = LATCH_SHARED;
+
+    page_latch(pager, page_num, LATCH_SHARED);
+    void *node = get_page(pager, page_num);
+    while (true)
     {
-    case NODE_LEAF:
-        return leaf_node_find(table, child_num, key);
-        break;
-    case NODE_INTERNAL:
-        return internal_node_find(table, child_num, key);
-        break;
-    default:
-        break;
+        if (get_node_type(node) == NODE_LEAF && held_mode != leaf_mode)
+        {
+            // 换成独占闩锁，期间叶子可能分裂，根叶子甚至可能变成内部节点，重新检查
+            page_unlatch(pager, page_num);
+            page_latch(pager, page_num, leaf_mode);
+            held_mode = leaf_mode;
+            if (get_node_type(node) != NODE_LEAF)
+            {
+                page_unlatch(pager, page_num);
+                page_latch(pager, page_num, LATCH_SHARED);
+                held_mode = LATCH_SHARED;
+            }
+            continue;
+        }
+
+        while (!node_covers_key(node, key))
+        {
+            // 先锁右兄弟再释放当前节点，同一层从左到右加锁不会死锁
+            uint32_t sibling_page_num = node_right_sibling(node);
+            page_latch(pager, sibling_page_num, held_mode);
+            page_unlatch(pager, page_num);
+            page_num = sibling_page_num;
+            node = get_page(pager, page_num);
+        }
+
+        if (get_node_type(node) == NODE_LEAF)
+        {
+            break;
+        }
+        if (depth >= BTREE_MAX_DEPTH)
+        {
+            printf("Tree is deeper than %d levels. Corrupt file.\n", BTREE_MAX_DEPTH);
+            exit(EXIT_FAILURE);
+        }
+        uint32_t child_index = internal_node_find_child(node, key);
+        path_pages[depth] = page_num;
+        path_cells[depth] = child_index;
+        depth++;
+
+        uint32_t child_page_num = *internal_node_child(node, child_index);
+        void *child = get_child_page(pager, node, child_index, child_page_num);
+        page_unlatch(pager, page_num);
+        page_num = child_page_num;
+        page_latch(pager, page_num, LATCH_SHARED);
+        held_mode = LATCH_SHARED;
+        node = child;
     }
-}
\ No newline at end of file
+
+    Cursor *cursor = leaf_node_find(table, page_num, key);
+    memcpy(cursor->path_pages, path_pages, depth * sizeof(uint32_t));
+    memcpy(cursor->path_cells, path_cells, depth * sizeof(uint32_t));
+    cursor->depth = depth;
+    cursor->latch_mode = leaf_mode;
+    return cursor;
+}
@@ -0,0 +1,535 @@
+/*
+ * @Author: WangZhe
+ * @Date: 2026-10-19 22:40:03
+ * @LastEditors: WangZhe
+ * @LastEditTime: 2026-10-19 23:31:17
+ * @FilePath: /Sqlite/Benchmark.c
+ * @Description: 基准测试：B树和可扩展哈希上的点查询(均匀分布、zipf分布和不存在的主键)，按排名定位，以及批量插入
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <math.h>
+
+#include"Sqlite.h"
+
+
+#define BENCH_ZIPF_THETA 0.99
+#define BENCH_MULTI_GET_BATCH 256
+
+/**
+ * 查找的主键分布：均匀、zipf，以及全部是表中不存在的主键
+*/
+typedef enum
+{
+    BENCH_UNIFORM,
+    BENCH_ZIPFIAN,
+    BENCH_MISSING
+} BenchDistribution;
+
+/**
+ * 节点内主键的分布：连续整数、稀疏随机、成簇(每簇连续几个主键，簇之间间隔很大)
+*/
+typedef enum
+{
+    BENCH_DENSE,
+    BENCH_SPARSE,
+    BENCH_CLUSTERED
+} BenchLayout;
+
+
+/**
+ * @description: 单调时钟，单位纳秒
+ */
+double bench_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+/**
+ * @description: [0, 1)上的均匀随机数
+ */
+double bench_random()
+{
+    return rand() / (RAND_MAX + 1.0);
+}
+
+/**
+ * @description: 原地打乱数组
+ */
+void bench_shuffle(uint32_t *values, uint32_t count)
+{
+    for (uint32_t i = count - 1; i > 0; i--)
+    {
+        uint32_t j = rand() % (i + 1);
+        uint32_t temp = values[i];
+        values[i] = values[j];
+        values[j] = temp;
+    }
+}
+
+/**
+ * @description: 输出中存取方式的名字
+ */
+const char *bench_access_name(AccessMethod access_method)
+{
+    switch (access_method)
+    {
+    case (ACCESS_HASH):
+        return "hash";
+    case (ACCESS_BETREE):
+        return "betree";
+    case (ACCESS_LSM):
+        return "lsm";
+    default:
+        return "btree";
+    }
+}
+
+/**
+ * @description: 一次点查询要读的页数：B树是从根到叶子的层数(写优化模式在缓冲中命中时更少)，哈希表是目录页加一个桶页，
+ *               日志结构合并树最多每个有序段一页(过滤器排除的段不读)，ART前端索引命中时只读叶子
+ * @param {Table} *table
+ * @return {*}
+ * @note:
+ */
+uint32_t bench_pages_per_lookup(Table *table)
+{
+    if (table->access_method == ACCESS_HASH)
+    {
+        return 2;
+    }
+    if (table->access_method == ACCESS_LSM)
+    {
+        return table->lsm->num_runs;
+    }
+    if (table->front_index != NULL)
+    {
+        return 1;
+    }
+    uint32_t depth = 1;
+    void *node = get_page(table->pager, table->root_page_num);
+    while (get_node_type(node) == NODE_INTERNAL)
+    {
+        node = get_page(table->pager, *internal_node_child(node, 0));
+        depth++;
+    }
+    return depth;
+}
+
+/**
+ * @description: 生成要查找的主键序列
+ * @param {uint32_t} *ids 表中所有的主键(1到num_rows)，zipf分布下按这个(随机)顺序排名
+ * @param {uint32_t} num_rows
+ * @param {BenchDistribution} distribution
+ * @param {uint32_t} *lookups 输出
+ * @param {uint32_t} num_lookups
+ * @return {*}
+ * @note: zipf分布：排名为r的主键被选中的概率正比于1/r^θ，按累积分布二分查找取样
+ */
+void bench_generate(uint32_t *ids, uint32_t num_rows, BenchDistribution distribution,
+                    uint32_t *lookups, uint32_t num_lookups)
+{
+    double *cdf = malloc(num_rows * sizeof(double));
+    double total = 0;
+    for (uint32_t r = 0; r < num_rows; r++)
+    {
+        total += 1.0 / pow(r + 1, BENCH_ZIPF_THETA);
+        cdf[r] = total;
+    }
+    for (uint32_t i = 0; i < num_lookups; i++)
+    {
+        if (distribution == BENCH_UNIFORM)
+        {
+            lookups[i] = ids[rand() % num_rows];
+            continue;
+        }
+        if (distribution == BENCH_MISSING)
+        {
+            lookups[i] = num_rows + 1 + rand() % num_rows;
+            continue;
+        }
+        double target = bench_random() * total;
+        uint32_t low = 0;
+        uint32_t high = num_rows - 1;
+        while (low < high)
+        {
+            uint32_t mid = (low + high) / 2;
+            if (cdf[mid] < target)
+            {
+                low = mid + 1;
+            }
+            else
+            {
+                high = mid;
+            }
+        }
+        lookups[i] = ids[low];
+    }
+    free(cdf);
+}
+
+/**
+ * @description: 依次查找lookups中的主键并输出平均耗时
+ * @param {Table} *table
+ * @param {char} *label
+ * @param {uint32_t} *lookups
+ * @param {uint32_t} num_lookups
+ * @param {uint32_t} expected_found 应该找到的次数，不符时退出
+ * @return {*}
+ * @note:
+ */
+void bench_lookups(Table *table, const char *label, uint32_t *lookups, uint32_t num_lookups,
+                   uint32_t expected_found)
+{
+    uint8_t key[KEY_MAX_SIZE];
+    uint8_t value[ROW_SIZE];
+    uint32_t found = 0;
+    double start = bench_now();
+    for (uint32_t i = 0; i < num_lookups; i++)
+    {
+        Key lookup_key = {0, lookups[i]};
+        encode_key(KEY_U32, &lookup_key, key);
+        found += table_get(table, key, value);
+    }
+    double elapsed = bench_now() - start;
+    if (found != expected_found)
+    {
+        printf("Found %d keys, expected %d.\n", found, expected_found);
+        exit(EXIT_FAILURE);
+    }
+    printf("%-6s %-20s %10.1f ns/lookup  %d pages/lookup\n",
+           bench_access_name(table->access_method), label,
+           elapsed / num_lookups, bench_pages_per_lookup(table));
+}
+
+/**
+ * @description: 把lookups按batch_size个一批交给table_multi_get并输出平均耗时
+ * @param {Table} *table
+ * @param {char} *label
+ * @param {uint32_t} *lookups
+ * @param {uint32_t} num_lookups
+ * @param {uint32_t} batch_size
+ * @param {uint32_t} expected_found 应该找到的次数，不符时退出
+ * @return {*}
+ * @note: 主键的编码计入耗时，和bench_lookups逐个查找的口径相同
+ */
+void bench_multi_get(Table *table, const char *label, uint32_t *lookups, uint32_t num_lookups,
+                     uint32_t batch_size, uint32_t expected_found)
+{
+    uint8_t *keys = malloc(batch_size * table->key_size);
+    uint8_t *values = malloc(batch_size * table->value_size);
+    bool *found = malloc(batch_size * sizeof(bool));
+    uint32_t num_found = 0;
+    double start = bench_now();
+    for (uint32_t i = 0; i < num_lookups; i += batch_size)
+    {
+        uint32_t num_keys = num_lookups - i < batch_size ? num_lookups - i : batch_size;
+        for (uint32_t j = 0; j < num_keys; j++)
+        {
+            Key lookup_key = {0, lookups[i + j]};
+            encode_key(KEY_U32, &lookup_key, keys + j * table->key_size);
+        }
+        table_multi_get(table, keys, num_keys, values, found);
+        for (uint32_t j = 0; j < num_keys; j++)
+        {
+            num_found += found[j];
+        }
+    }
+    double elapsed = bench_now() - start;
+    free(keys);
+    free(values);
+    free(found);
+    if (num_found != expected_found)
+    {
+        printf("Found %d keys, expected %d.\n", num_found, expected_found);
+        exit(EXIT_FAILURE);
+    }
+    printf("%-6s %-20s %10.1f ns/lookup\n", bench_access_name(table->access_method), label,
+           elapsed / num_lookups);
+}
+
+/**
+ * @description: 按排名定位(OFFSET)：子树行数下降对比从第一行逐行前进
+ * @param {Table} *table B树
+ * @param {uint32_t} num_rows
+ * @param {uint32_t} num_seeks
+ * @return {*}
+ * @note: 逐行前进的代价是O(n)，只跑1/100的次数
+ */
+void bench_rank(Table *table, uint32_t num_rows, uint32_t num_seeks)
+{
+    srand(6);
+    double start = bench_now();
+    for (uint32_t i = 0; i < num_seeks; i++)
+    {
+        uint32_t rank = rand() % num_rows;
+        Cursor *cursor = table_seek_rank(table, rank);
+        if (cursor->end_of_table)
+        {
+            printf("Rank %d not found.\n", rank);
+            exit(EXIT_FAILURE);
+        }
+        cursor_close(cursor);
+    }
+    double elapsed = bench_now() - start;
+    printf("%-6s %-20s %10.1f ns/seek\n", "btree", "offset (counts)", elapsed / num_seeks);
+
+    uint32_t num_scans = num_seeks / 100 > 0 ? num_seeks / 100 : 1;
+    start = bench_now();
+    for (uint32_t i = 0; i < num_scans; i++)
+    {
+        uint32_t rank = rand() % num_rows;
+        Cursor *cursor = table_start(table);
+        for (uint32_t j = 0; j < rank; j++)
+        {
+            cursor_advance(cursor);
+        }
+        cursor_close(cursor);
+    }
+    elapsed = bench_now() - start;
+    printf("%-6s %-20s %10.1f ns/seek\n", "btree", "offset (scan)", elapsed / num_scans);
+}
+
+/**
+ * @description: 在一个按叶子单元格排列的u32主键数组上对比key_lower_bound和二分查找的耗时
+ * @param {char} *label
+ * @param {BenchLayout} layout
+ * @param {uint32_t} num_searches
+ * @return {*}
+ * @note: 单元格数和u32主键的叶子相同，一半查找命中已有的主键，一半落在主键之间；两种查找的结果不同时退出
+ */
+void bench_search(const char *label, BenchLayout layout, uint32_t num_searches)
+{
+    uint32_t stride = sizeof(uint32_t) + ROW_SIZE;
+    uint32_t count = LEAF_NODE_SPACE_FOR_CELLS / stride;
+    uint8_t *cells = calloc(count, stride);
+    uint32_t key = 1000;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        switch (layout)
+        {
+        case BENCH_DENSE:
+            key += 1;
+            break;
+        case BENCH_SPARSE:
+            key += 1 + rand() % 100000;
+            break;
+        case BENCH_CLUSTERED:
+            key += i % 8 == 0 ? 1 + rand() % 1000000 : 1;
+            break;
+        }
+        memcpy(cells + i * stride, &key, sizeof(key));
+    }
+
+    uint32_t *targets = malloc(num_searches * sizeof(uint32_t));
+    for (uint32_t i = 0; i < num_searches; i++)
+    {
+        uint32_t cell_key;
+        memcpy(&cell_key, cells + (rand() % count) * stride, sizeof(cell_key));
+        targets[i] = i % 2 == 0 ? cell_key : cell_key - rand() % 3;
+    }
+
+    uint64_t checksum[2] = {0, 0};
+    double elapsed[2];
+    for (uint32_t method = 0; method < 2; method++)
+    {
+        double start = bench_now();
+        for (uint32_t i = 0; i < num_searches; i++)
+        {
+            if (method == 0)
+            {
+                checksum[method] += key_bisect(KEY_U32, sizeof(uint32_t), cells, stride, 0, count, targets + i);
+            }
+            else
+            {
+                checksum[method] += key_lower_bound(KEY_U32, sizeof(uint32_t), cells, stride, count, targets + i);
+            }
+        }
+        elapsed[method] = bench_now() - start;
+    }
+    if (checksum[0] != checksum[1])
+    {
+        printf("Search results differ on %s keys.\n", label);
+        exit(EXIT_FAILURE);
+    }
+    printf("%-6s search %-13s %10.1f ns/search (bisect)  %6.1f ns/search (adaptive)\n", "node", label,
+           elapsed[0] / num_searches, elapsed[1] / num_searches);
+
+    free(cells);
+    free(targets);
+}
+
+/**
+ * @description: 在一种存取方式上建表并跑各种分布的点查询
+ * @param {AccessMethod} access_method
+ * @param {char} *filename 基准测试前后都会删除
+ * @param {uint32_t} num_rows
+ * @param {uint32_t} num_lookups
+ * @return {*}
+ * @note: 主键按随机顺序插入；每种分布使用相同的随机种子，两种存取方式查找的主键序列完全相同
+ */
+void bench_run(AccessMethod access_method, const char *filename, uint32_t num_rows, uint32_t num_lookups)
+{
+    unlink(filename);
+    Table *table = db_open(filename, KEY_U32, false, access_method);
+
+    uint32_t *ids = malloc(num_rows * sizeof(uint32_t));
+    for (uint32_t i = 0; i < num_rows; i++)
+    {
+        ids[i] = i + 1;
+    }
+    srand(1);
+    bench_shuffle(ids, num_rows);
+
+    Row row;
+    memset(&row, 0, sizeof(row));
+    uint8_t key[KEY_MAX_SIZE];
+    uint8_t value[ROW_SIZE];
+    for (uint32_t i = 0; i < num_rows; i++)
+    {
+        Key row_key = {0, ids[i]};
+        row.id = ids[i];
+        snprintf(row.username, sizeof(row.username), "user%d", ids[i]);
+        snprintf(row.email, sizeof(row.email), "person%d@example.com", ids[i]);
+        encode_key(KEY_U32, &row_key, key);
+        serialize_row(table->pager, &row, value);
+        if (table_put(table, key, value, PUT_INSERT, NULL) != EXECUTE_SUCCESS)
+        {
+            printf("Insert of %d failed.\n", ids[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    uint32_t *lookups = malloc(num_lookups * sizeof(uint32_t));
+    srand(2);
+    bench_generate(ids, num_rows, BENCH_UNIFORM, lookups, num_lookups);
+    bench_lookups(table, "uniform", lookups, num_lookups, num_lookups);
+    srand(3);
+    bench_generate(ids, num_rows, BENCH_ZIPFIAN, lookups, num_lookups);
+    bench_lookups(table, "zipfian", lookups, num_lookups, num_lookups);
+
+    // 不存在的主键，先走过滤器，再关掉过滤器对比下降到叶子(桶)的代价
+    srand(4);
+    bench_generate(ids, num_rows, BENCH_MISSING, lookups, num_lookups);
+    bench_lookups(table, "missing", lookups, num_lookups, 0);
+    KeyFilter *filter = table->key_filter;
+    table->key_filter = NULL;
+    bench_lookups(table, "missing (no filter)", lookups, num_lookups, 0);
+    table->key_filter = filter;
+    if (access_method == ACCESS_BTREE)
+    {
+        bench_rank(table, num_rows, num_lookups);
+        // 同样的uniform序列每BENCH_MULTI_GET_BATCH个一批一起下降
+        srand(2);
+        bench_generate(ids, num_rows, BENCH_UNIFORM, lookups, num_lookups);
+        bench_multi_get(table, "uniform (multi_get)", lookups, num_lookups, BENCH_MULTI_GET_BATCH, num_lookups);
+        // 同样的uniform序列改查ART前端索引，建立的时间不计入
+        table_art_open(table);
+        table_art_build(table);
+        srand(2);
+        bench_generate(ids, num_rows, BENCH_UNIFORM, lookups, num_lookups);
+        bench_lookups(table, "uniform (art)", lookups, num_lookups, num_lookups);
+        table_art_close(table);
+    }
+
+    free(ids);
+    free(lookups);
+    db_close(table);
+    unlink(filename);
+}
+
+/**
+ * @description: 用insert_rows按批插入主键并输出平均耗时
+ * @param {char} *filename 基准测试前后都会删除
+ * @param {uint32_t} num_rows
+ * @param {uint32_t} batch_size 1时相当于逐行插入
+ * @param {bool} sequential 主键按递增顺序插入，否则随机顺序
+ * @param {AccessMethod} access_method B树或写优化的B树
+ * @return {*}
+ * @note: 一批中的行排序后落在同一个叶子里的只下降一次；逐行递增插入走最右叶子的快速路径。
+ *        写优化模式不走批量插入，逐行放进根的缓冲
+ */
+void bench_insert(const char *filename, uint32_t num_rows, uint32_t batch_size, bool sequential,
+                  AccessMethod access_method)
+{
+    unlink(filename);
+    Table *table = db_open(filename, KEY_U32, false, access_method);
+    uint32_t *ids = malloc(num_rows * sizeof(uint32_t));
+    for (uint32_t i = 0; i < num_rows; i++)
+    {
+        ids[i] = i + 1;
+    }
+    if (!sequential)
+    {
+        srand(5);
+        bench_shuffle(ids, num_rows);
+    }
+    Row *rows = calloc(num_rows, sizeof(Row));
+    for (uint32_t i = 0; i < num_rows; i++)
+    {
+        rows[i].id = ids[i];
+        snprintf(rows[i].username, sizeof(rows[i].username), "user%d", ids[i]);
+        snprintf(rows[i].email, sizeof(rows[i].email), "person%d@example.com", ids[i]);
+    }
+
+    double start = bench_now();
+    for (uint32_t i = 0; i < num_rows; i += batch_size)
+    {
+        uint32_t count = num_rows - i < batch_size ? num_rows - i : batch_size;
+        if (insert_rows(table, rows + i, count) != EXECUTE_SUCCESS)
+        {
+            printf("Batch insert failed.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    double elapsed = bench_now() - start;
+    printf("%-6s insert %-10s batch %-7d %10.1f ns/row\n", bench_access_name(access_method),
+           sequential ? "sequential" : "random", batch_size, elapsed / num_rows);
+
+    free(ids);
+    free(rows);
+    db_close(table);
+    unlink(filename);
+}
+
+
+int main(int argc, char *argv[])
+{
+    // db_bench [行数] [查找次数]，所有页面都要放进缓存，行数受TABLE_MAX_PAGES限制
+    uint32_t num_rows = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000;
+    uint32_t num_lookups = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000;
+    if (num_rows == 0 || num_lookups == 0)
+    {
+        printf("Usage: %s [rows] [lookups]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    printf("%d rows, %d lookups, zipf theta %.2f\n", num_rows, num_lookups, BENCH_ZIPF_THETA);
+    bench_run(ACCESS_BTREE, "bench_btree.db", num_rows, num_lookups);
+    bench_run(ACCESS_HASH, "bench_hash.db", num_rows, num_lookups);
+    bench_run(ACCESS_BETREE, "bench_betree.db", num_rows, num_lookups);
+    bench_run(ACCESS_LSM, "bench_lsm.db", num_rows, num_lookups);
+    srand(7);
+    bench_search("dense", BENCH_DENSE, num_lookups);
+    bench_search("sparse", BENCH_SPARSE, num_lookups);
+    bench_search("clustered", BENCH_CLUSTERED, num_lookups);
+    bench_insert("bench_insert.db", num_rows, 1, false, ACCESS_BTREE);
+    bench_insert("bench_insert.db", num_rows, 100, false, ACCESS_BTREE);
+    bench_insert("bench_insert.db", num_rows, num_rows, false, ACCESS_BTREE);
+    bench_insert("bench_insert.db", num_rows, 1, true, ACCESS_BTREE);
+    bench_insert("bench_insert.db", num_rows, 1, false, ACCESS_BETREE);
+    bench_insert("bench_insert.db", num_rows, 1, true, ACCESS_BETREE);
+    bench_insert("bench_insert.db", num_rows, 1, false, ACCESS_LSM);
+    bench_insert("bench_insert.db", num_rows, 1, true, ACCESS_LSM);
+    return 0;
+}
@@ -0,0 +1,628 @@
+/*
+ * @Author: WangZhe
+ * @Date: 2026-10-20 14:06:31
+ * @LastEditors: WangZhe
+ * @LastEditTime: 2026-10-20 17:42:15
+ * @FilePath: /Sqlite/Buffer.c
+ * @Description: 写优化模式：内部节点中的消息缓冲和成批下推
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include"Sqlite.h"
+
+
+/**
+ * @description: 读写内部节点的消息缓冲
+ * @note: 消息的大小和叶子单元格相同，由节点头部记录的主键和值的宽度决定
+ */
+uint32_t *internal_node_num_messages(void *node)
+{
+    return node + INTERNAL_NODE_NUM_MESSAGES_OFFSET;
+}
+
+void *internal_node_message(void *node, uint32_t message_num)
+{
+    return node + INTERNAL_NODE_MESSAGES_OFFSET + message_num * leaf_node_cell_size(node);
+}
+
+uint32_t internal_node_max_messages(void *node)
+{
+    return (PAGE_SIZE - INTERNAL_NODE_MESSAGES_OFFSET) / leaf_node_cell_size(node);
+}
+
+
+/**
+ * @description: 二分查找缓冲中的主键
+ * @param {void} *node 内部节点
+ * @param {void} *key
+ * @param {bool} *found 输出是否正好找到key
+ * @return {*} 第一条主键>=key的消息的下标
+ * @note:
+ */
+uint32_t buffer_find(void *node, const void *key, bool *found)
+{
+    uint32_t num_messages = *internal_node_num_messages(node);
+    uint32_t index = key_lower_bound(get_node_key_type(node), get_node_key_size(node),
+                                     internal_node_message(node, 0), leaf_node_cell_size(node),
+                                     num_messages, key);
+    *found = index < num_messages &&
+             compare_keys(get_node_key_type(node), get_node_key_size(node),
+                          internal_node_message(node, index), key) == 0;
+    return index;
+}
+
+
+/**
+ * @description: 把一条消息放进节点的缓冲
+ * @param {void} *node
+ * @param {void} *key
+ * @param {void} *value
+ * @return {*}
+ * @note: 已有同一主键的消息时直接覆盖(新消息总是比缓冲中的旧)，否则按主键顺序插入。
+ *        调用者持有节点的独占闩锁，并保证缓冲还有空间
+ */
+void buffer_put(void *node, const void *key, const void *value)
+{
+    bool found;
+    uint32_t index = buffer_find(node, key, &found);
+    uint32_t message_size = leaf_node_cell_size(node);
+    uint32_t key_size = get_node_key_size(node);
+    uint32_t *num_messages = internal_node_num_messages(node);
+    if (!found)
+    {
+        memmove(internal_node_message(node, index + 1), internal_node_message(node, index),
+                (*num_messages - index) * message_size);
+        *num_messages += 1;
+        memcpy(internal_node_message(node, index), key, key_size);
+    }
+    memcpy(internal_node_message(node, index) + key_size, value, get_node_value_size(node));
+}
+
+/**
+ * @description: 把一批有序的消息合并进节点的缓冲
+ * @param {void} *node
+ * @param {uint8_t} *messages count条按主键升序排列的消息
+ * @param {uint32_t} count
+ * @return {*}
+ * @note: 和缓冲中的消息一遍归并，主键相同时保留新的消息。调用者持有节点的独占闩锁，并保证缓冲放得下
+ */
+void buffer_merge(void *node, const uint8_t *messages, uint32_t count)
+{
+    KeyType key_type = get_node_key_type(node);
+    uint32_t key_size = get_node_key_size(node);
+    uint32_t message_size = leaf_node_cell_size(node);
+    uint32_t *num_messages = internal_node_num_messages(node);
+    uint8_t *old_messages = malloc(*num_messages * message_size);
+    memcpy(old_messages, internal_node_message(node, 0), *num_messages * message_size);
+
+    uint32_t i = 0;
+    uint32_t j = 0;
+    uint32_t k = 0;
+    while (i < *num_messages || j < count)
+    {
+        int cmp;
+        if (i == *num_messages)
+        {
+            cmp = 1;
+        }
+        else if (j == count)
+        {
+            cmp = -1;
+        }
+        else
+        {
+            cmp = compare_keys(key_type, key_size, old_messages + i * message_size, messages + j * message_size);
+        }
+        if (cmp < 0)
+        {
+            memcpy(internal_node_message(node, k), old_messages + i * message_size, message_size);
+            i++;
+        }
+        else
+        {
+            memcpy(internal_node_message(node, k), messages + j * message_size, message_size);
+            j++;
+            if (cmp == 0)
+            {
+                i++;
+            }
+        }
+        k++;
+    }
+    *num_messages = k;
+    free(old_messages);
+}
+
+/**
+ * @description: 删除缓冲中从message_num开始的count条消息
+ */
+void buffer_remove(void *node, uint32_t message_num, uint32_t count)
+{
+    uint32_t *num_messages = internal_node_num_messages(node);
+    memmove(internal_node_message(node, message_num), internal_node_message(node, message_num + count),
+            (*num_messages - message_num - count) * leaf_node_cell_size(node));
+    *num_messages -= count;
+}
+
+
+/**
+ * @description: 内部节点分裂后，把主键超过左节点范围的消息移到新的右节点
+ * @param {void} *old_node 分裂后的左节点
+ * @param {void} *new_node 分裂出的右节点，缓冲为空
+ * @param {void} *old_max 左节点分裂后的最大主键
+ * @return {*}
+ * @note: 消息有序，移走的是一段后缀。在建立右链接之前调用
+ */
+void buffer_split(void *old_node, void *new_node, const void *old_max)
+{
+    bool found;
+    uint32_t index = buffer_find(old_node, old_max, &found);
+    if (found)
+    {
+        index++;
+    }
+    uint32_t count = *internal_node_num_messages(old_node) - index;
+    memcpy(internal_node_message(new_node, 0), internal_node_message(old_node, index),
+           count * leaf_node_cell_size(old_node));
+    *internal_node_num_messages(new_node) = count;
+    *internal_node_num_messages(old_node) = index;
+}
+
+
+/**
+ * @description: 按主键读取一行，沿途合并缓冲中的消息
+ * @param {Table} *table
+ * @param {void} *key
+ * @param {void} *value 输出table->value_size个字节，可以为NULL
+ * @return {*} 主键是否存在
+ * @note: 和internal_node_find一样一次只闩住一个节点，遇到的第一条消息就是最新值，不必再向下。
+ *        下推时先写入孩子再从父节点删除，所以读者在两层之间不会错过正在下推的消息
+ */
+bool betree_get(Table *table, const void *key, void *value)
+{
+    Pager *pager = table->pager;
+    vacuum_read_lock(pager);
+    uint32_t page_num = table->root_page_num;
+    page_latch(pager, page_num, LATCH_SHARED);
+    void *node = get_page(pager, page_num);
+    bool found;
+    uint32_t index;
+    while (true)
+    {
+        while (!node_covers_key(node, key))
+        {
+            uint32_t sibling_page_num = node_right_sibling(node);
+            page_latch(pager, sibling_page_num, LATCH_SHARED);
+            page_unlatch(pager, page_num);
+            page_num = sibling_page_num;
+            node = get_page(pager, page_num);
+        }
+
+        if (get_node_type(node) == NODE_LEAF)
+        {
+            uint32_t num_cells = *leaf_node_num_cells(node);
+            index = key_lower_bound(table->key_type, table->key_size, leaf_node_key(node, 0),
+                                    leaf_node_cell_size(node), num_cells, key);
+            found = index < num_cells &&
+                    compare_keys(table->key_type, table->key_size, leaf_node_key(node, index), key) == 0;
+            if (found && value != NULL)
+            {
+                memcpy(value, leaf_node_value(node, index), table->value_size);
+            }
+            break;
+        }
+        index = buffer_find(node, key, &found);
+        if (found)
+        {
+            if (value != NULL)
+            {
+                memcpy(value, internal_node_message(node, index) + table->key_size, table->value_size);
+            }
+            break;
+        }
+
+        uint32_t child_index = internal_node_find_child(node, key);
+        uint32_t child_page_num = *internal_node_child(node, child_index);
+        void *child = get_child_page(pager, node, child_index, child_page_num);
+        page_unlatch(pager, page_num);
+        page_num = child_page_num;
+        page_latch(pager, page_num, LATCH_SHARED);
+        node = child;
+    }
+    page_unlatch(pager, page_num);
+    vacuum_read_unlock(pager);
+    return found;
+}
+
+
+/**
+ * @description: 把一条消息写入叶子
+ * @param {Table} *table
+ * @param {void} *key
+ * @param {void} *value
+ * @return {*}
+ * @note: 主键已在叶子中时覆盖，否则插入并增加路径上的子树行数，需要时照常分裂。
+ *        被覆盖的旧值的溢出页在写入消息时已经由调用者归还
+ */
+void betree_apply(Table *table, const void *key, const void *value)
+{
+    Cursor *cursor = table_find(table, key, FIND_WRITE);
+    if (cursor_key_equals(cursor, key))
+    {
+        leaf_node_update(cursor, value);
+    }
+    else
+    {
+        cursor_count_insert(cursor);
+        leaf_node_insert(cursor, key, value);
+    }
+    cursor_close(cursor);
+}
+
+/**
+ * @description: 按主键顺序把一批消息写入叶子
+ * @param {Table} *table
+ * @param {uint8_t} *messages count条按主键升序排列的消息
+ * @param {uint32_t} count
+ * @return {*}
+ * @note: 和table_insert_batch一样，落在同一个叶子里的消息只下降一次，超出当前叶子的高键或叶子分裂之后再从根下降；
+ *        追加在叶子末尾引起的分裂也按填充因子保留左边。
+ *        调用者持有smo_mutex并独占地持有count_lock
+ */
+void betree_apply_batch(Table *table, const uint8_t *messages, uint32_t count)
+{
+    Pager *pager = table->pager;
+    uint32_t message_size = table->key_size + table->value_size;
+    Cursor *cursor = NULL;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const uint8_t *key = messages + i * message_size;
+        const uint8_t *value = key + table->key_size;
+        if (cursor != NULL && !node_covers_key(get_page(pager, cursor->page_num), key))
+        {
+            cursor_close(cursor);
+            cursor = NULL;
+        }
+        if (cursor == NULL)
+        {
+            cursor = table_find(table, key, FIND_WRITE);
+        }
+        void *node = get_page(pager, cursor->page_num);
+        cursor->cell_num = key_lower_bound(table->key_type, table->key_size, leaf_node_key(node, 0),
+                                           message_size, *leaf_node_num_cells(node), key);
+        if (cursor_key_equals(cursor, key))
+        {
+            leaf_node_update(cursor, value);
+            continue;
+        }
+        bool splitting = !node_is_safe(node);
+        cursor_count_insert(cursor);
+        // 追加到叶子末尾、并且下一条消息也落在这个叶子里时，左边按填充因子保留
+        if (splitting && cursor->cell_num == *leaf_node_num_cells(node) && i + 1 < count &&
+            node_covers_key(node, key + message_size))
+        {
+            leaf_node_split_at(cursor, key, value,
+                               leaf_node_append_split_count(table, *leaf_node_num_cells(node)));
+        }
+        else
+        {
+            leaf_node_insert(cursor, key, value);
+        }
+        if (splitting)
+        {
+            cursor_close(cursor);
+            cursor = NULL;
+        }
+    }
+    if (cursor != NULL)
+    {
+        cursor_close(cursor);
+    }
+}
+
+/**
+ * @description: 一批消息写入叶子之后，从叶子的父节点的缓冲中删除它们
+ * @param {Table} *table
+ * @param {uint8_t} *messages count条按主键升序排列的消息
+ * @param {uint32_t} count
+ * @return {*}
+ * @note: 写入叶子可能连带分裂父节点甚至根，消息会随之移到别的节点，所以从根重新查找；
+ *        之后的消息仍在这个节点的范围内时不再下降。
+ *        调用者持有smo_mutex，结构不会变化，内部节点不加闩锁也可以读取
+ */
+void betree_remove_applied(Table *table, const uint8_t *messages, uint32_t count)
+{
+    Pager *pager = table->pager;
+    uint32_t message_size = table->key_size + table->value_size;
+    uint32_t i = 0;
+    while (i < count)
+    {
+        const uint8_t *key = messages + i * message_size;
+        uint32_t page_num = table->root_page_num;
+        void *node = get_page(pager, page_num);
+        while (true)
+        {
+            uint32_t child_page_num = *internal_node_child(node, internal_node_find_child(node, key));
+            if (get_node_type(get_page(pager, child_page_num)) == NODE_LEAF)
+            {
+                break;
+            }
+            page_num = child_page_num;
+            node = get_page(pager, page_num);
+        }
+        page_latch(pager, page_num, LATCH_EXCLUSIVE);
+        do
+        {
+            bool found;
+            uint32_t index = buffer_find(node, messages + i * message_size, &found);
+            if (found)
+            {
+                buffer_remove(node, index, 1);
+            }
+            i++;
+        } while (i < count && node_covers_key(node, messages + i * message_size));
+        page_unlatch(pager, page_num);
+    }
+}
+
+
+/**
+ * @description: 把一个内部节点缓冲中的一批消息下推到孩子
+ * @param {Table} *table
+ * @param {uint32_t} page_num 内部节点
+ * @return {*}
+ * @note: 选择消息最多的孩子(消息有序，同一个孩子的消息是连续的一段)。孩子是内部节点时整批放进它的缓冲，
+ *        孩子的缓冲放不下就先下推孩子，由调用者重新选择；孩子是叶子时整批写入叶子，再从缓冲中删除。
+ *        每次调用至少把一条消息向下移动一层。调用者持有smo_mutex并独占地持有count_lock
+ */
+void betree_flush(Table *table, uint32_t page_num)
+{
+    Pager *pager = table->pager;
+    void *node = get_page(pager, page_num);
+    uint32_t num_messages = *internal_node_num_messages(node);
+    if (num_messages == 0)
+    {
+        return;
+    }
+    // 第i个孩子的消息是主键不超过第i个分隔键的一段，每个孩子二分查找一次边界
+    uint32_t num_keys = *internal_node_num_keys(node);
+    uint32_t first = 0;
+    uint32_t count = 0;
+    uint32_t child_index = 0;
+    uint32_t start = 0;
+    for (uint32_t i = 0; i <= num_keys && start < num_messages; i++)
+    {
+        uint32_t end = num_messages;
+        if (i < num_keys)
+        {
+            bool found;
+            end = buffer_find(node, internal_node_key(node, i), &found);
+            if (found)
+            {
+                end++;
+            }
+        }
+        if (end - start > count)
+        {
+            first = start;
+            count = end - start;
+            child_index = i;
+        }
+        start = end;
+    }
+
+    uint32_t message_size = leaf_node_cell_size(node);
+    uint32_t child_page_num = *internal_node_child(node, child_index);
+    void *child = get_page(pager, child_page_num);
+    if (get_node_type(child) == NODE_INTERNAL)
+    {
+        if (internal_node_max_messages(child) - *internal_node_num_messages(child) < count)
+        {
+            betree_flush(table, child_page_num);
+            return;
+        }
+        // 先写入孩子再从父节点删除，两个闩锁从上到下获得
+        page_latch(pager, page_num, LATCH_EXCLUSIVE);
+        page_latch(pager, child_page_num, LATCH_EXCLUSIVE);
+        buffer_merge(child, internal_node_message(node, first), count);
+        page_unlatch(pager, child_page_num);
+        buffer_remove(node, first, count);
+        page_unlatch(pager, page_num);
+        return;
+    }
+
+    uint8_t *batch = malloc(count * message_size);
+    memcpy(batch, internal_node_message(node, first), count * message_size);
+    betree_apply_batch(table, batch, count);
+    betree_remove_applied(table, batch, count);
+    free(batch);
+}
+
+
+/**
+ * @description: 把所有缓冲中的消息都下推到叶子
+ * @param {Table} *table
+ * @return {*}
+ * @note: 范围查询、count(*)、offset以及打开时建立过滤器都直接读叶子和子树行数，先调用它。
+ *        从根开始逐层向下，同一层沿右兄弟遍历；下推会分裂节点，重复直到一遍下来没有任何消息
+ */
+void betree_flush_all(Table *table)
+{
+    Pager *pager = table->pager;
+    vacuum_read_lock(pager);
+    pthread_mutex_lock(&(table->smo_mutex));
+    pthread_rwlock_wrlock(&(table->count_lock));
+    bool pending = true;
+    while (pending)
+    {
+        pending = false;
+        uint32_t leftmost_page_num = table->root_page_num;
+        while (get_node_type(get_page(pager, leftmost_page_num)) == NODE_INTERNAL)
+        {
+            uint32_t page_num = leftmost_page_num;
+            while (page_num != 0)
+            {
+                while (*internal_node_num_messages(get_page(pager, page_num)) > 0)
+                {
+                    betree_flush(table, page_num);
+                    pending = true;
+                }
+                page_num = *internal_node_right_sibling(get_page(pager, page_num));
+            }
+            leftmost_page_num = *internal_node_child(get_page(pager, leftmost_page_num), 0);
+        }
+    }
+    pthread_rwlock_unlock(&(table->count_lock));
+    pthread_mutex_unlock(&(table->smo_mutex));
+    vacuum_read_unlock(pager);
+}
+
+
+/**
+ * @description: 主键是否比最右叶子中所有主键都大
+ * @param {Table} *table
+ * @param {void} *key
+ * @return {*} 最右叶子的页码还没有缓存(根还是叶子，或者还没有分裂过)时返回false
+ * @note: 调用者持有smo_mutex，缓存的页码不会在检查期间变化
+ */
+bool betree_after_rightmost(Table *table, const void *key)
+{
+    Pager *pager = table->pager;
+    uint32_t page_num = __atomic_load_n(&(table->rightmost_leaf_page_num), __ATOMIC_ACQUIRE);
+    if (page_num == INVALID_PAGE_NUM)
+    {
+        return false;
+    }
+    page_latch(pager, page_num, LATCH_SHARED);
+    void *node = get_page(pager, page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    bool after = num_cells == 0 ||
+                 compare_keys(table->key_type, table->key_size, key, leaf_node_key(node, num_cells - 1)) > 0;
+    page_unlatch(pager, page_num);
+    return after;
+}
+
+
+/**
+ * @description: 写优化模式下的table_put
+ * @param {Table} *table
+ * @param {void} *key
+ * @param {void} *value
+ * @param {PutMode} mode
+ * @param {void} *old_value 非NULL且主键已存在时，输出被覆盖的旧值(可能来自缓冲)
+ * @return {*}
+ * @note: 不要旧值的upsert是盲写，直接把消息放进根的缓冲；其余的先合并缓冲判断主键是否存在，
+ *        过滤器判定不存在时不读页面(随机插入绝大多数都是这样)。
+ *        确定不存在、并且比最右叶子中所有主键都大的新行不进缓冲，和table_put一样追加到最右叶子，
+ *        叶子满时下降并按填充因子分裂：缓冲中不会有它的消息，以后下推的更小的主键照常插到它前面。
+ *        根的缓冲满时先下推，根还是叶子时没有缓冲，直接写入叶子。
+ *        过滤器的检查和加入都在smo_mutex之内，同一主键的两个插入不会都判定为不存在。
+ *        下推时会打开游标，所以和table_put一样先共享地持有整理锁再取smo_mutex。
+ *        db_bench(1000行，逐行插入，6次的范围)：随机插入约1.0-1.5us/行，B树约1.1-1.5us/行；
+ *        递增插入约0.5-1.1us/行，仍比B树(约0.4-0.7us/行)慢。页面都在内存中，缓冲省下的只是下降，
+ *        每行都要多付smo_mutex和过滤器的开销
+ */
+ExecuteResult betree_put(Table *table, const void *key, const void *value, PutMode mode, void *old_value)
+{
+    Pager *pager = table->pager;
+    vacuum_read_lock(pager);
+    pthread_mutex_lock(&(table->smo_mutex));
+    pthread_rwlock_wrlock(&(table->count_lock));
+    bool blind = mode == PUT_UPSERT && old_value == NULL;
+    bool exists = false;
+    if (!blind && (table->key_filter == NULL || key_filter_may_contain(table->key_filter, key, table->key_size)))
+    {
+        exists = betree_get(table, key, mode == PUT_INSERT ? NULL : old_value);
+    }
+
+    ExecuteResult result = EXECUTE_SUCCESS;
+    if (exists && mode == PUT_INSERT)
+    {
+        result = EXECUTE_DUPLICATE_KEY;
+    }
+    else if (!exists && mode == PUT_UPDATE)
+    {
+        result = EXECUTE_KEY_NONE;
+    }
+    else
+    {
+        if (!exists && table->key_filter != NULL)
+        {
+            key_filter_add(table->key_filter, key, table->key_size);
+        }
+        void *root = get_page(pager, table->root_page_num);
+        if (!blind && !exists && betree_after_rightmost(table, key))
+        {
+            // 按主键递增写入时缓冲只会堆在最右的路径上，不如和B树一样直接追加，最右叶子满时下降并分裂
+            if (!table_append_rightmost(table, key, value))
+            {
+                betree_apply(table, key, value);
+            }
+        }
+        else if (get_node_type(root) == NODE_LEAF)
+        {
+            betree_apply(table, key, value);
+        }
+        else
+        {
+            while (*internal_node_num_messages(root) >= internal_node_max_messages(root))
+            {
+                betree_flush(table, table->root_page_num);
+            }
+            page_latch(pager, table->root_page_num, LATCH_EXCLUSIVE);
+            buffer_put(root, key, value);
+            page_unlatch(pager, table->root_page_num);
+        }
+    }
+    pthread_rwlock_unlock(&(table->count_lock));
+    pthread_mutex_unlock(&(table->smo_mutex));
+    vacuum_read_unlock(pager);
+    return result;
+}
+
+
+/**
+ * @description: .btree在写优化模式下输出每个内部节点缓冲中的主键
+ * @param {Table} *table
+ * @param {uint32_t} page_num
+ * @param {uint32_t} indentation_level
+ * @return {*}
+ * @note: 按先序遍历，只输出缓冲非空的节点
+ */
+void print_buffers(Table *table, uint32_t page_num, uint32_t indentation_level)
+{
+    void *node = get_page(table->pager, page_num);
+    if (get_node_type(node) == NODE_LEAF)
+    {
+        return;
+    }
+    uint32_t num_messages = *internal_node_num_messages(node);
+    if (num_messages > 0)
+    {
+        indent(indentation_level);
+        printf("- buffer of page %d (size %d)\n", page_num, num_messages);
+        for (uint32_t i = 0; i < num_messages; i++)
+        {
+            Key key;
+            decode_key(table->key_type, internal_node_message(node, i), &key);
+            indent(indentation_level + 1);
+            printf("- ");
+            print_key(table->key_type, &key);
+            printf("\n");
+        }
+    }
+    uint32_t num_keys = *internal_node_num_keys(node);
+    for (uint32_t i = 0; i <= num_keys; i++)
+    {
+        print_buffers(table, *internal_node_child(node, i), indentation_level + 1);
+    }
+}
@@ -15,6 +15,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include"Sqlite.h"
 
@@ -25,70 +26,252 @@
 #define TABLE_MAX_PAGES 100
 
 #define COLUMN_USERNAME_SIZE 32
-#define COLUMN_EMAIL_SIZE 255
+#define COLUMN_EMAIL_SIZE 8192
+
+#define U8T sizeof(uint8_t)
+#define U32T sizeof(uint32_t)
 
 #define size_of_attribute(Struct, Attribute) sizeof(((Struct *)0)->Attribute)
 const uint32_t PAGE_SIZE = 4096;
 const uint32_t ID_SIZE = size_of_attribute(Row, id);
+const uint32_t TENANT_ID_SIZE = size_of_attribute(Row, tenant_id);
 const uint32_t USERNAME_SIZE = size_of_attribute(Row, username);
-const uint32_t EMAIL_SIZE = size_of_attribute(Row, email);
+/*
+email在单元格中只保存长度和前EMAIL_INLINE_SIZE个字节，其余部分写入溢出页链表，
+这样短行在叶子节点中依然紧凑，长值只在被投影时才读取溢出页
+*/
+const uint32_t EMAIL_LENGTH_SIZE = U32T;
+const uint32_t EMAIL_INLINE_SIZE = 64;
+const uint32_t EMAIL_OVERFLOW_SIZE = U32T;
 const uint32_t ID_OFFSET = 0;
-const uint32_t USERNAME_OFFSET = ID_OFFSET + ID_SIZE;
-const uint32_t EMAIL_OFFSET = USERNAME_OFFSET + USERNAME_SIZE;
-const uint32_t ROW_SIZE = ID_SIZE + USERNAME_SIZE + EMAIL_SIZE;
+const uint32_t TENANT_ID_OFFSET = ID_OFFSET + ID_SIZE;
+const uint32_t USERNAME_OFFSET = TENANT_ID_OFFSET + TENANT_ID_SIZE;
+const uint32_t EMAIL_LENGTH_OFFSET = USERNAME_OFFSET + USERNAME_SIZE;
+const uint32_t EMAIL_OFFSET = EMAIL_LENGTH_OFFSET + EMAIL_LENGTH_SIZE;
+const uint32_t EMAIL_OVERFLOW_OFFSET = EMAIL_OFFSET + EMAIL_INLINE_SIZE;
+const uint32_t ROW_SIZE = EMAIL_OVERFLOW_OFFSET + EMAIL_OVERFLOW_SIZE;
 
 
+const uint32_t DB_HEADER_MAGIC_SIZE = 8;
+const uint32_t DB_HEADER_MAGIC_OFFSET = 0;
+const uint32_t DB_HEADER_ROOT_PAGE_SIZE = U32T;
+const uint32_t DB_HEADER_ROOT_PAGE_OFFSET = DB_HEADER_MAGIC_OFFSET + DB_HEADER_MAGIC_SIZE;
+const uint32_t DB_HEADER_FREE_HEAD_SIZE = U32T;
+const uint32_t DB_HEADER_FREE_HEAD_OFFSET = DB_HEADER_ROOT_PAGE_OFFSET + DB_HEADER_ROOT_PAGE_SIZE;
+const uint32_t DB_HEADER_KEY_TYPE_SIZE = U32T;
+const uint32_t DB_HEADER_KEY_TYPE_OFFSET = DB_HEADER_FREE_HEAD_OFFSET + DB_HEADER_FREE_HEAD_SIZE;
+/* 非0表示写时复制模式 */
+const uint32_t DB_HEADER_COPY_ON_WRITE_SIZE = U32T;
+const uint32_t DB_HEADER_COPY_ON_WRITE_OFFSET = DB_HEADER_KEY_TYPE_OFFSET + DB_HEADER_KEY_TYPE_SIZE;
+/* 每个二级索引的根页码，下标见index_slot，0表示没有建立 */
+const uint32_t DB_HEADER_INDEX_ROOT_SIZE = U32T;
+const uint32_t DB_HEADER_INDEX_ROOT_OFFSET = DB_HEADER_COPY_ON_WRITE_OFFSET + DB_HEADER_COPY_ON_WRITE_SIZE;
+/* 每个二级索引的INCLUDE列(ColumnMask)，决定索引项的布局 */
+const uint32_t DB_HEADER_INDEX_INCLUDE_SIZE = U32T;
+const uint32_t DB_HEADER_INDEX_INCLUDE_OFFSET =
+    DB_HEADER_INDEX_ROOT_OFFSET + DB_HEADER_INDEX_ROOT_SIZE * TABLE_MAX_INDEXES;
+/* 主表的存取方式(AccessMethod)，建表时确定 */
+const uint32_t DB_HEADER_ACCESS_METHOD_SIZE = U32T;
+const uint32_t DB_HEADER_ACCESS_METHOD_OFFSET =
+    DB_HEADER_INDEX_INCLUDE_OFFSET + DB_HEADER_INDEX_INCLUDE_SIZE * TABLE_MAX_INDEXES;
+/* 主表和索引共用的填充因子(百分比)，0表示没有设置 */
+const uint32_t DB_HEADER_FILL_FACTOR_SIZE = U32T;
+const uint32_t DB_HEADER_FILL_FACTOR_OFFSET = DB_HEADER_ACCESS_METHOD_OFFSET + DB_HEADER_ACCESS_METHOD_SIZE;
+const uint32_t FREE_PAGE_NEXT_OFFSET = 0;
+
+
+const uint32_t OVERFLOW_NEXT_PAGE_SIZE = U32T;
+const uint32_t OVERFLOW_NEXT_PAGE_OFFSET = 0;
+const uint32_t OVERFLOW_PAGE_HEADER_SIZE = OVERFLOW_NEXT_PAGE_SIZE;
+const uint32_t OVERFLOW_PAGE_SPACE = PAGE_SIZE - OVERFLOW_PAGE_HEADER_SIZE;
 
-#define U8T sizeof(uint8_t)
-#define U32T sizeof(uint32_t)
 
 
 const uint32_t NODE_TYPE_SIZE = U8T;
 const uint32_t NODE_TYPE_OFFSET = 0;
 const uint32_t IS_ROOT_SIZE = U8T;
 const uint32_t IS_ROOT_OFFSET = NODE_TYPE_SIZE;
-const uint32_t PARENT_POINTER_SIZE = U32T;
-const uint32_t PARENT_POINTER_OFFSET = IS_ROOT_OFFSET + IS_ROOT_SIZE;
-const uint8_t COMMON_NODE_HEADER_SIZE = NODE_TYPE_SIZE + IS_ROOT_SIZE + PARENT_POINTER_SIZE;
+/* 主键的类型和宽度，节点据此计算单元格的布局 */
+const uint32_t NODE_KEY_TYPE_SIZE = U8T;
+const uint32_t NODE_KEY_TYPE_OFFSET = IS_ROOT_OFFSET + IS_ROOT_SIZE;
+const uint32_t NODE_KEY_SIZE_SIZE = U8T;
+const uint32_t NODE_KEY_SIZE_OFFSET = NODE_KEY_TYPE_OFFSET + NODE_KEY_TYPE_SIZE;
+/* 叶子单元格中值的宽度：主表是ROW_SIZE，索引是INDEX_ENTRY_SIZE */
+const uint32_t NODE_VALUE_SIZE_SIZE = sizeof(uint16_t);
+const uint32_t NODE_VALUE_SIZE_OFFSET = NODE_KEY_SIZE_OFFSET + NODE_KEY_SIZE_SIZE;
+/* 填充到8字节，高键从8开始，之后的头部字段和内部节点的单元格(都是4的倍数)按4字节对齐 */
+const uint32_t NODE_PADDING_SIZE = sizeof(uint16_t);
+const uint32_t NODE_PADDING_OFFSET = NODE_VALUE_SIZE_OFFSET + NODE_VALUE_SIZE_SIZE;
+/* B-link树的高键：节点(及其子树)中主键的上界，同一层最右边的节点没有高键 */
+const uint32_t NODE_HIGH_KEY_SIZE = KEY_MAX_SIZE;
+const uint32_t NODE_HIGH_KEY_OFFSET = NODE_PADDING_OFFSET + NODE_PADDING_SIZE;
+const uint8_t COMMON_NODE_HEADER_SIZE = NODE_TYPE_SIZE + IS_ROOT_SIZE +
+                                        NODE_KEY_TYPE_SIZE + NODE_KEY_SIZE_SIZE +
+                                        NODE_VALUE_SIZE_SIZE + NODE_PADDING_SIZE + NODE_HIGH_KEY_SIZE;
 
 
 const uint32_t LEAF_NODE_NUM_CELLS_SIZE = U32T;
 const uint32_t LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
 const uint32_t LEAF_NODE_NEXT_LEAF_SIZE = U32T;
 const uint32_t LEAF_NODE_NEXT_LEAF_OFFSET = LEAF_NODE_NUM_CELLS_OFFSET + LEAF_NODE_NUM_CELLS_SIZE;
+/* 左兄弟叶子的页码，0表示最左边的叶子，用于反向扫描 */
+const uint32_t LEAF_NODE_PREV_LEAF_SIZE = U32T;
+const uint32_t LEAF_NODE_PREV_LEAF_OFFSET = LEAF_NODE_NEXT_LEAF_OFFSET + LEAF_NODE_NEXT_LEAF_SIZE;
 const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE +
                                       LEAF_NODE_NUM_CELLS_SIZE +
-                                       LEAF_NODE_NEXT_LEAF_SIZE;
+                                       LEAF_NODE_NEXT_LEAF_SIZE +
+                                       LEAF_NODE_PREV_LEAF_SIZE;
 
 
-const uint32_t LEAF_NODE_KEY_SIZE = U32T;
+/* 叶子单元格 = 主键(宽度见节点头部) + 行，单元格大小和容量由leaf_node_cell_size/leaf_node_max_cells计算 */
 const uint32_t LEAF_NODE_KEY_OFFSET = 0;
 const uint32_t LEAF_NODE_VALUE_SIZE = ROW_SIZE;
-const uint32_t LEAF_NODE_VALUE_OFFSET = LEAF_NODE_KEY_OFFSET + LEAF_NODE_KEY_SIZE;
-const uint32_t LEAF_NODE_CELL_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_VALUE_SIZE;
 const uint32_t LEAF_NODE_SPACE_FOR_CELLS = PAGE_SIZE - LEAF_NODE_HEADER_SIZE;
-const uint32_t LEAF_NODE_MAX_CELLS = LEAF_NODE_SPACE_FOR_CELLS / LEAF_NODE_CELL_SIZE;
-
-
-const uint32_t LEAF_NODE_RIGHT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS + 1) / 2;
-const uint32_t LEAF_NODE_LEFT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS + 1) - LEAF_NODE_RIGHT_SPLIT_COUNT;
 
 const uint32_t INTERNAL_NODE_NUM_KEYS_SIZE = U32T;
 const uint32_t INTERNAL_NODE_NUM_KEYS_OFFSET = COMMON_NODE_HEADER_SIZE;
 const uint32_t INTERNAL_NODE_RIGHT_CHILD_SIZE = U32T;
 const uint32_t INTERNAL_NODE_RIGHT_CHILD_OFFSET =
     INTERNAL_NODE_NUM_KEYS_OFFSET + INTERNAL_NODE_NUM_KEYS_SIZE;
+/* 同一层右兄弟的页码，0表示最右边的节点；叶子的右兄弟就是next_leaf */
+const uint32_t INTERNAL_NODE_RIGHT_SIBLING_SIZE = U32T;
+const uint32_t INTERNAL_NODE_RIGHT_SIBLING_OFFSET =
+    INTERNAL_NODE_RIGHT_CHILD_OFFSET + INTERNAL_NODE_RIGHT_CHILD_SIZE;
+/* 右孩子子树中的行数，其余孩子的行数在各自的单元格中 */
+const uint32_t INTERNAL_NODE_RIGHT_COUNT_SIZE = U32T;
+const uint32_t INTERNAL_NODE_RIGHT_COUNT_OFFSET =
+    INTERNAL_NODE_RIGHT_SIBLING_OFFSET + INTERNAL_NODE_RIGHT_SIBLING_SIZE;
 const uint32_t INTERNAL_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE +
                                            INTERNAL_NODE_NUM_KEYS_SIZE +
-                                           INTERNAL_NODE_RIGHT_CHILD_SIZE;
+                                           INTERNAL_NODE_RIGHT_CHILD_SIZE +
+                                           INTERNAL_NODE_RIGHT_SIBLING_SIZE +
+                                           INTERNAL_NODE_RIGHT_COUNT_SIZE;
 
 
 
-const uint32_t INTERNAL_NODE_KEY_SIZE = U32T;
+/* 内部节点单元格 = 孩子页码 + 孩子子树中的行数 + 分隔键 */
 const uint32_t INTERNAL_NODE_CHILD_SIZE = U32T;
-const uint32_t INTERNAL_NODE_CELL_SIZE =
-    INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE;
-
+const uint32_t INTERNAL_NODE_COUNT_SIZE = U32T;
 
+/*
+ * 内部节点的单元格数固定为INTERNAL_NODE_MAX_CELLS，按最长的主键预留空间，扇出和主键长度无关。
+ * 所以分隔键保存左孩子完整的最大主键：截断或前缀压缩分隔键不会增加扇出，反而让update_internal_node_key、
+ * 高键和.btree的输出都要处理不完整的主键
+ */
 const uint32_t INTERNAL_NODE_MAX_CELLS = 3;
 
+
+/**
+ * KEY
+ * 整数主键至少有8个时先插值再查找，猜的位置两边最多逐个比较4步，之后改用二分
+*/
+const uint32_t KEY_INTERPOLATION_MIN_KEYS = 8;
+const uint32_t KEY_INTERPOLATION_WINDOW = 4;
+
+
+/**
+ * FRAME
+ * 缓存中的一页 = PAGE_SIZE字节的页面 + 只在内存中的尾部，尾部不写入文件：
+ * 页面自己的页码，以及内部节点每个孩子(最后一个是右孩子)换成的帧指针(swizzle)，NULL表示还没有换
+*/
+const uint32_t FRAME_PAGE_NUM_OFFSET = PAGE_SIZE;
+const uint32_t FRAME_CHILDREN_OFFSET = PAGE_SIZE + sizeof(void *);
+const uint32_t FRAME_SIZE = PAGE_SIZE + sizeof(void *) + (INTERNAL_NODE_MAX_CELLS + 1) * sizeof(void *);
+
+
+/**
+ * BUFFER
+ * 写优化模式下内部节点的消息缓冲 = 消息数 + 按主键排序的消息，放在按最长主键预留的INTERNAL_NODE_MAX_CELLS个单元格之后，
+ * 一条消息和叶子单元格一样是主键 + 值，容量由internal_node_max_messages计算
+*/
+const uint32_t INTERNAL_NODE_NUM_MESSAGES_SIZE = U32T;
+const uint32_t INTERNAL_NODE_NUM_MESSAGES_OFFSET =
+    INTERNAL_NODE_HEADER_SIZE +
+    INTERNAL_NODE_MAX_CELLS * (INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_COUNT_SIZE + KEY_MAX_SIZE);
+const uint32_t INTERNAL_NODE_MESSAGES_OFFSET = INTERNAL_NODE_NUM_MESSAGES_OFFSET + INTERNAL_NODE_NUM_MESSAGES_SIZE;
+
+
+/**
+ * LSM
+ * 目录页 = 有序段数 + 每个有序段4个字段；有序段的页 = 单元格数 + 下一页的页码 + 单元格。
+ * 内存表写满LSM_MEMTABLE_MAX_ROWS行后写成第0层的有序段，第0层有LSM_L0_COMPACTION_TRIGGER个段时合并进第1层，
+ * 第i层(i>=1)超过LSM_LEVEL_BASE_ROWS * LSM_LEVEL_SIZE_RATIO^(i-1)行时合并进第i+1层
+*/
+const uint32_t LSM_DIRECTORY_NUM_RUNS_SIZE = U32T;
+const uint32_t LSM_DIRECTORY_NUM_RUNS_OFFSET = 0;
+const uint32_t LSM_DIRECTORY_RUN_LEVEL_OFFSET = 0;
+const uint32_t LSM_DIRECTORY_RUN_FIRST_PAGE_OFFSET = LSM_DIRECTORY_RUN_LEVEL_OFFSET + U32T;
+const uint32_t LSM_DIRECTORY_RUN_NUM_PAGES_OFFSET = LSM_DIRECTORY_RUN_FIRST_PAGE_OFFSET + U32T;
+const uint32_t LSM_DIRECTORY_RUN_NUM_CELLS_OFFSET = LSM_DIRECTORY_RUN_NUM_PAGES_OFFSET + U32T;
+const uint32_t LSM_DIRECTORY_RUN_SIZE = LSM_DIRECTORY_RUN_NUM_CELLS_OFFSET + U32T;
+const uint32_t LSM_DIRECTORY_RUNS_OFFSET = LSM_DIRECTORY_NUM_RUNS_OFFSET + LSM_DIRECTORY_NUM_RUNS_SIZE;
+const uint32_t LSM_RUN_NUM_CELLS_SIZE = U32T;
+const uint32_t LSM_RUN_NUM_CELLS_OFFSET = 0;
+const uint32_t LSM_RUN_NEXT_PAGE_SIZE = U32T;
+const uint32_t LSM_RUN_NEXT_PAGE_OFFSET = LSM_RUN_NUM_CELLS_OFFSET + LSM_RUN_NUM_CELLS_SIZE;
+const uint32_t LSM_RUN_HEADER_SIZE = LSM_RUN_NEXT_PAGE_OFFSET + LSM_RUN_NEXT_PAGE_SIZE;
+const uint32_t LSM_RUN_SPACE_FOR_CELLS = PAGE_SIZE - LSM_RUN_HEADER_SIZE;
+const uint32_t LSM_MEMTABLE_MAX_ROWS = 128;
+const uint32_t LSM_L0_COMPACTION_TRIGGER = 4;
+const uint32_t LSM_LEVEL_BASE_ROWS = 1024;
+const uint32_t LSM_LEVEL_SIZE_RATIO = 4;
+
+
+
+/**
+ * VACUUM
+ * 没有设置填充因子时.vacuum和建立索引的目标填充百分比，留出一些空间让之后的插入不立即分裂。
+ * 填充因子可以设置的范围是[FILL_FACTOR_MIN, 100]
+*/
+const uint32_t VACUUM_DEFAULT_FILL_FACTOR = 90;
+const uint32_t FILL_FACTOR_MIN = 10;
+
+
+/**
+ * INDEX
+ * 索引项 = 标志字节 + INCLUDE列(按username、email的顺序，和行中的布局相同，email只有行内的部分)。
+ * 被删除的索引项留在树中直到.vacuum
+*/
+const uint32_t INDEX_ENTRY_FLAGS_SIZE = U8T;
+const uint32_t INDEX_ENTRY_FLAGS_OFFSET = 0;
+const uint32_t INDEX_ENTRY_HEADER_SIZE = INDEX_ENTRY_FLAGS_OFFSET + INDEX_ENTRY_FLAGS_SIZE;
+const uint32_t INDEX_ENTRY_MAX_SIZE = INDEX_ENTRY_HEADER_SIZE + USERNAME_SIZE + EMAIL_LENGTH_SIZE + EMAIL_INLINE_SIZE;
+const uint8_t INDEX_ENTRY_DELETED = 1;
+/* 被索引的列或INCLUDE的email超出了索引项能保存的长度，只能回表读取 */
+const uint8_t INDEX_ENTRY_PARTIAL = 2;
+/* 可以建立索引的列，下标就是文件头中索引根页码的槽位 */
+const uint32_t INDEX_COLUMNS[TABLE_MAX_INDEXES] = {COLUMN_USERNAME, COLUMN_EMAIL};
+
+
+/**
+ * FILTER
+ * 每个主键10位、7个哈希函数，假阳性率约1%
+*/
+const uint32_t KEY_FILTER_BITS_PER_KEY = 10;
+const uint32_t KEY_FILTER_NUM_HASHES = 7;
+
+
+/**
+ * MULTIGET
+ * 成批查找时每个下一层的节点预取4个缓存行，覆盖内部节点的头部和所有单元格
+*/
+const uint32_t MULTI_GET_PREFETCH_LINES = 4;
+
+
+/**
+ * HASH
+ * 目录页 = 全局深度 + 2^全局深度个桶页码(按哈希值的低位取下标)；
+ * 桶页 = 局部深度 + 单元格数 + 无序存放的单元格(主键 + 行)
+*/
+const uint32_t HASH_DIRECTORY_DEPTH_SIZE = U32T;
+const uint32_t HASH_DIRECTORY_DEPTH_OFFSET = 0;
+const uint32_t HASH_DIRECTORY_BUCKET_SIZE = U32T;
+const uint32_t HASH_DIRECTORY_BUCKETS_OFFSET = HASH_DIRECTORY_DEPTH_OFFSET + HASH_DIRECTORY_DEPTH_SIZE;
+/* 目录只占一页，2^9个桶页码已经超过TABLE_MAX_PAGES */
+const uint32_t HASH_DIRECTORY_MAX_DEPTH = 9;
+const uint32_t HASH_BUCKET_LOCAL_DEPTH_SIZE = U32T;
+const uint32_t HASH_BUCKET_LOCAL_DEPTH_OFFSET = 0;
+const uint32_t HASH_BUCKET_NUM_CELLS_SIZE = U32T;
+const uint32_t HASH_BUCKET_NUM_CELLS_OFFSET = HASH_BUCKET_LOCAL_DEPTH_OFFSET + HASH_BUCKET_LOCAL_DEPTH_SIZE;
+const uint32_t HASH_BUCKET_HEADER_SIZE = HASH_BUCKET_NUM_CELLS_OFFSET + HASH_BUCKET_NUM_CELLS_SIZE;
+const uint32_t HASH_BUCKET_SPACE_FOR_CELLS = PAGE_SIZE - HASH_BUCKET_HEADER_SIZE;
@@ -15,6 +15,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include"Sqlite.h"
 
@@ -22,22 +23,67 @@
 /**
  * @description: 返回给定关键字的位置，如果关键字不存在，则返回应该插入的位置
  * @param {Table} *table
- * @param {uint32_t} key
+ * @param {void} *key 编码后的主键
+ * @param {FindMode} mode 加锁方式，游标用完后由cursor_close释放闩锁
  * @return {*}
- * @note: 
+ * @note: 写时复制模式下读者从最后一次提交的根下降，游标占用一个快照槽位直到cursor_close。
+ *        有ART前端索引时读者先查它，命中就不下降；下降找到的主键补记到ART中。游标持有整理锁直到cursor_close
  */
-Cursor *table_find(Table *table, uint32_t key)
+Cursor *table_find(Table *table, const void *key, FindMode mode)
 {
-    uint32_t root_page_num = table->root_page_num;
-    void *root_node = get_page(table->pager, root_page_num);
-    if (get_node_type(root_node) == NODE_LEAF)
+    if (table->front_index != NULL && mode == FIND_READ)
     {
-        return leaf_node_find(table, root_page_num, key);
+        Cursor *cursor = table_art_find(table, key);
+        if (cursor == NULL)
+        {
+            vacuum_read_lock(table->pager);
+            cursor = internal_node_find(table, table->root_page_num, key, mode);
+            if (cursor_key_equals(cursor, key))
+            {
+                table_art_update(table, cursor->page_num, get_page(table->pager, cursor->page_num),
+                                 cursor->cell_num, cursor->cell_num + 1);
+            }
+        }
+        return cursor;
     }
-    else
+    vacuum_read_lock(table->pager);
+    if (table->pager->copy_on_write && mode == FIND_READ)
     {
-        return internal_node_find(table, root_page_num, key);
+        uint32_t root_page_num;
+        int32_t slot = snapshot_acquire(table, &root_page_num);
+        Cursor *cursor = internal_node_find(table, root_page_num, key, mode);
+        cursor->snapshot_slot = slot;
+        return cursor;
     }
+    return internal_node_find(table, table->root_page_num, key, mode);
+}
+
+
+/**
+ * @description: 把游标移到下一个叶子的第一行
+ * @param {Cursor} *cursor
+ * @param {void} *node 游标当前所在的叶子
+ * @return {*}
+ * @note: 先锁住下一个叶子再释放当前叶子(从左到右耦合)，扫描过程中不会错过正在分裂的叶子
+ */
+void cursor_next_leaf(Cursor *cursor, void *node)
+{
+    Pager *pager = cursor->table->pager;
+    if (pager->copy_on_write)
+    {
+        cursor->end_of_table = !cursor_step_leaf(cursor, true);
+        return;
+    }
+    uint32_t next_page_num = *leaf_node_next_leaf(node);
+    if (next_page_num == 0)
+    {
+        cursor->end_of_table = true;
+        return;
+    }
+    page_latch(pager, next_page_num, cursor->latch_mode);
+    page_unlatch(pager, cursor->page_num);
+    cursor->page_num = next_page_num;
+    cursor->cell_num = 0;
 }
 
 
@@ -49,16 +95,283 @@ Cursor *table_find(Table *table, uint32_t key)
  */
 Cursor *table_start(Table *table)
 {
-    Cursor *cursor = table_find(table, 0);
+    // 全0字节是任何主键类型的最小值
+    uint8_t min_key[KEY_MAX_SIZE] = {0};
+    return table_seek(table, min_key);
+}
+
+
+/**
+ * @description: 定位到第一个>=key的行，作为范围扫描的起点
+ * @param {Table} *table
+ * @param {void} *key 编码后的主键
+ * @return {*}
+ * @note: table_find在key大于叶子中所有键时停在叶子末尾，这里再移到下一个叶子。
+ *        游标持有当前叶子的共享闩锁
+ */
+Cursor *table_seek(Table *table, const void *key)
+{
+    Cursor *cursor = table_find(table, key, FIND_READ);
+
+    void *node = get_page(table->pager, cursor->page_num);
+    if (cursor->cell_num >= *leaf_node_num_cells(node))
+    {
+        cursor_next_leaf(cursor, node);
+    }
+    return cursor;
+}
+
+
+
+/**
+ * @description: 定位到表中的最后一行，作为反向扫描的起点
+ * @param {Table} *table
+ * @return {*}
+ * @note: 沿着每层的右孩子下降到最右边的叶子，表为空时end_of_table为true
+ */
+Cursor *table_end(Table *table)
+{
+    vacuum_read_lock(table->pager);
+    Cursor *cursor = malloc(sizeof(Cursor));
+    cursor->table = table;
+    cursor->depth = 0;
+    cursor->latch_mode = LATCH_SHARED;
+    cursor->snapshot_slot = -1;
+    if (table->pager->copy_on_write)
+    {
+        cursor->snapshot_slot = snapshot_acquire(table, &(cursor->page_num));
+    }
+    else
+    {
+        cursor->page_num = table->root_page_num;
+    }
 
+    page_latch(table->pager, cursor->page_num, LATCH_SHARED);
     void *node = get_page(table->pager, cursor->page_num);
+    while (true)
+    {
+        // 读取父节点之后该节点可能分裂过，最右边的节点是沿右链接走到头的那个
+        while (node_right_sibling(node) != 0)
+        {
+            uint32_t sibling_page_num = node_right_sibling(node);
+            page_latch(table->pager, sibling_page_num, LATCH_SHARED);
+            page_unlatch(table->pager, cursor->page_num);
+            cursor->page_num = sibling_page_num;
+            node = get_page(table->pager, cursor->page_num);
+        }
+        if (get_node_type(node) == NODE_LEAF)
+        {
+            break;
+        }
+        cursor->path_pages[cursor->depth] = cursor->page_num;
+        cursor->path_cells[cursor->depth] = *internal_node_num_keys(node);
+        cursor->depth++;
+        uint32_t child_page_num = *internal_node_right_child(node);
+        void *child = get_child_page(table->pager, node, *internal_node_num_keys(node), child_page_num);
+        page_unlatch(table->pager, cursor->page_num);
+        cursor->page_num = child_page_num;
+        page_latch(table->pager, cursor->page_num, LATCH_SHARED);
+        node = child;
+    }
+
     uint32_t num_cells = *leaf_node_num_cells(node);
     cursor->end_of_table = (num_cells == 0);
-
+    cursor->cell_num = num_cells == 0 ? 0 : num_cells - 1;
     return cursor;
 }
 
 
+/**
+ * @description: 表中的行数
+ * @param {Table} *table B树的主表或索引
+ * @return {*}
+ * @note: 只读根节点中各孩子的子树行数，O(1)个页面。写时复制模式下是最后一次提交的版本
+ */
+uint32_t table_count(Table *table)
+{
+    Pager *pager = table->pager;
+    uint32_t page_num;
+    int32_t slot = -1;
+    vacuum_read_lock(pager);
+    if (pager->copy_on_write)
+    {
+        slot = snapshot_acquire(table, &page_num);
+    }
+    else
+    {
+        page_num = table->root_page_num;
+    }
+    page_latch(pager, page_num, LATCH_SHARED);
+    uint32_t count = node_row_count(pager, page_num);
+    page_unlatch(pager, page_num);
+    if (slot >= 0)
+    {
+        snapshot_release(table, slot);
+    }
+    vacuum_read_unlock(pager);
+    return count;
+}
+
+
+/**
+ * @description: 主键小于key(inclusive时小于等于)的行数
+ * @param {Table} *table
+ * @param {void} *key 编码后的主键
+ * @param {bool} inclusive
+ * @return {*}
+ * @note: 和table_find一样下降，累加经过的每个内部节点中目标孩子左边的子树行数，
+ *        最后加上叶子中的位置，代价是O(log n)。读取父节点之后孩子分裂过的话，
+ *        沿右链接越过的节点整个都在key的左边。并发插入期间结果是近似的
+ */
+uint32_t table_rank(Table *table, const void *key, bool inclusive)
+{
+    Pager *pager = table->pager;
+    uint32_t page_num;
+    int32_t slot = -1;
+    vacuum_read_lock(pager);
+    if (pager->copy_on_write)
+    {
+        slot = snapshot_acquire(table, &page_num);
+    }
+    else
+    {
+        page_num = table->root_page_num;
+    }
+    uint32_t rank = 0;
+    page_latch(pager, page_num, LATCH_SHARED);
+    void *node = get_page(pager, page_num);
+    while (true)
+    {
+        while (!node_covers_key(node, key))
+        {
+            rank += node_row_count(pager, page_num);
+            uint32_t sibling_page_num = node_right_sibling(node);
+            page_latch(pager, sibling_page_num, LATCH_SHARED);
+            page_unlatch(pager, page_num);
+            page_num = sibling_page_num;
+            node = get_page(pager, page_num);
+        }
+        if (get_node_type(node) == NODE_LEAF)
+        {
+            break;
+        }
+        uint32_t child_index = internal_node_find_child(node, key);
+        for (uint32_t i = 0; i < child_index; i++)
+        {
+            rank += __atomic_load_n(internal_node_child_count(node, i), __ATOMIC_RELAXED);
+        }
+        uint32_t child_page_num = *internal_node_child(node, child_index);
+        void *child = get_child_page(pager, node, child_index, child_page_num);
+        page_unlatch(pager, page_num);
+        page_num = child_page_num;
+        page_latch(pager, page_num, LATCH_SHARED);
+        node = child;
+    }
+
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    uint32_t cell_num = key_lower_bound(table->key_type, table->key_size, leaf_node_key(node, 0),
+                                        leaf_node_cell_size(node), num_cells, key);
+    if (inclusive && cell_num < num_cells &&
+        compare_keys(table->key_type, table->key_size, leaf_node_key(node, cell_num), key) == 0)
+    {
+        cell_num++;
+    }
+    page_unlatch(pager, page_num);
+    if (slot >= 0)
+    {
+        snapshot_release(table, slot);
+    }
+    vacuum_read_unlock(pager);
+    return rank + cell_num;
+}
+
+
+/**
+ * @description: 定位到按主键顺序的第rank行(从0开始)，用于OFFSET
+ * @param {Table} *table
+ * @param {uint32_t} rank
+ * @return {*} rank不小于行数时end_of_table为true
+ * @note: 每层按孩子的子树行数选择孩子，不读取其余的子树，代价是O(log n)。
+ *        超出当前节点行数的部分在分裂出去的右兄弟中，沿右链接继续。游标持有叶子的共享闩锁
+ */
+Cursor *table_seek_rank(Table *table, uint32_t rank)
+{
+    Pager *pager = table->pager;
+    vacuum_read_lock(pager);
+    Cursor *cursor = malloc(sizeof(Cursor));
+    cursor->table = table;
+    cursor->depth = 0;
+    cursor->latch_mode = LATCH_SHARED;
+    cursor->snapshot_slot = -1;
+    cursor->end_of_table = false;
+    if (pager->copy_on_write)
+    {
+        cursor->snapshot_slot = snapshot_acquire(table, &(cursor->page_num));
+    }
+    else
+    {
+        cursor->page_num = table->root_page_num;
+    }
+
+    page_latch(pager, cursor->page_num, LATCH_SHARED);
+    void *node = get_page(pager, cursor->page_num);
+    while (get_node_type(node) == NODE_INTERNAL)
+    {
+        uint32_t num_keys = *internal_node_num_keys(node);
+        uint32_t child_index = 0;
+        while (child_index < num_keys)
+        {
+            uint32_t count = __atomic_load_n(internal_node_child_count(node, child_index), __ATOMIC_RELAXED);
+            if (rank < count)
+            {
+                break;
+            }
+            rank -= count;
+            child_index++;
+        }
+        uint32_t right_count = __atomic_load_n(internal_node_child_count(node, num_keys), __ATOMIC_RELAXED);
+        if (child_index == num_keys && rank >= right_count && node_right_sibling(node) != 0)
+        {
+            rank -= right_count;
+            uint32_t sibling_page_num = node_right_sibling(node);
+            page_latch(pager, sibling_page_num, LATCH_SHARED);
+            page_unlatch(pager, cursor->page_num);
+            cursor->page_num = sibling_page_num;
+            node = get_page(pager, cursor->page_num);
+            continue;
+        }
+        if (cursor->depth >= BTREE_MAX_DEPTH)
+        {
+            printf("Tree is deeper than %d levels. Corrupt file.\n", BTREE_MAX_DEPTH);
+            exit(EXIT_FAILURE);
+        }
+        cursor->path_pages[cursor->depth] = cursor->page_num;
+        cursor->path_cells[cursor->depth] = child_index;
+        cursor->depth++;
+        uint32_t child_page_num = *internal_node_child(node, child_index);
+        void *child = get_child_page(pager, node, child_index, child_page_num);
+        page_unlatch(pager, cursor->page_num);
+        cursor->page_num = child_page_num;
+        page_latch(pager, cursor->page_num, LATCH_SHARED);
+        node = child;
+    }
+
+    // 写时复制模式下叶子之间没有链接，但快照中的行数是准确的，不会走到叶子之外
+    while (rank >= *leaf_node_num_cells(node) && !pager->copy_on_write && *leaf_node_next_leaf(node) != 0)
+    {
+        rank -= *leaf_node_num_cells(node);
+        cursor_next_leaf(cursor, node);
+        node = get_page(pager, cursor->page_num);
+    }
+    cursor->cell_num = rank;
+    if (rank >= *leaf_node_num_cells(node))
+    {
+        cursor->cell_num = *leaf_node_num_cells(node);
+        cursor->end_of_table = true;
+    }
+    return cursor;
+}
+
 
 /**
  * @description: 移动游标
@@ -74,17 +387,72 @@ void cursor_advance(Cursor *cursor)
     cursor->cell_num += 1;
     if (cursor->cell_num >= (*leaf_node_num_cells(node)))
     {
-        uint32_t next_page_num = *leaf_node_next_leaf(node);
-        if (next_page_num == 0)
-        {
-            cursor->end_of_table = true;
-        }
-        else
-        {
-            cursor->page_num = next_page_num;
-            cursor->cell_num = 0;
-        }
+        cursor_next_leaf(cursor, node);
+    }
+}
+
+
+/**
+ * @description: 反向移动游标，cursor_advance的逆操作
+ * @param {Cursor} *cursor
+ * @return {*}
+ * @note: 越过第一行后end_of_table为true
+ */
+void cursor_retreat(Cursor *cursor)
+{
+    if (cursor->cell_num > 0)
+    {
+        cursor->cell_num -= 1;
+        return;
     }
+
+    Pager *pager = cursor->table->pager;
+    if (pager->copy_on_write)
+    {
+        cursor->end_of_table = !cursor_step_leaf(cursor, false);
+        return;
+    }
+    void *node = get_page(pager, cursor->page_num);
+    uint32_t page_num = cursor->page_num;
+    uint32_t prev_page_num = *leaf_node_prev_leaf(node);
+    if (prev_page_num == 0)
+    {
+        cursor->end_of_table = true;
+        return;
+    }
+
+    /*
+    从右向左加锁会和从左向右的扫描、分裂死锁，所以先释放当前叶子再锁左兄弟。
+    这期间左兄弟可能分裂过，分裂只会把单元格移到右边的新叶子，
+    所以沿next_leaf向右走，直到next_leaf指向原来的叶子
+    */
+    page_unlatch(pager, page_num);
+    page_latch(pager, prev_page_num, cursor->latch_mode);
+    void *prev_node = get_page(pager, prev_page_num);
+    while (*leaf_node_next_leaf(prev_node) != page_num)
+    {
+        uint32_t next_page_num = *leaf_node_next_leaf(prev_node);
+        page_latch(pager, next_page_num, cursor->latch_mode);
+        page_unlatch(pager, prev_page_num);
+        prev_page_num = next_page_num;
+        prev_node = get_page(pager, prev_page_num);
+    }
+    cursor->page_num = prev_page_num;
+    cursor->cell_num = *leaf_node_num_cells(prev_node) - 1;
+}
+
+
+/**
+ * @description: 游标当前行的主键(编码后的字节)
+ * @param {Cursor} *cursor
+ * @return {*}
+ * @note: 
+ */
+void *cursor_key(Cursor *cursor)
+{
+    void *page = get_page(cursor->table->pager, cursor->page_num);
+
+    return leaf_node_key(page, cursor->cell_num);
 }
 
 
@@ -100,4 +468,26 @@ void *cursor_value(Cursor *cursor)
     void *page = get_page(cursor->table->pager, page_num);
 
     return leaf_node_value(page, cursor->cell_num);
-}
\ No newline at end of file
+}
+
+
+/**
+ * @description: 释放游标持有的闩锁并释放游标
+ * @param {Cursor} *cursor
+ * @return {*}
+ * @note: 最后放开整理锁，之后.vacuum可能重写游标读过的页面
+ */
+void cursor_close(Cursor *cursor)
+{
+    Pager *pager = cursor->table->pager;
+    if (cursor->latch_mode != LATCH_NONE)
+    {
+        page_unlatch(pager, cursor->page_num);
+    }
+    if (cursor->snapshot_slot >= 0)
+    {
+        snapshot_release(cursor->table, cursor->snapshot_slot);
+    }
+    vacuum_read_unlock(pager);
+    free(cursor);
+}
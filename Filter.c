@@ -0,0 +1,149 @@
+/*
+ * @Author: WangZhe
+ * @Date: 2026-10-20 09:12:44
+ * @LastEditors: WangZhe
+ * @LastEditTime: 2026-10-20 10:37:05
+ * @FilePath: /Sqlite/Filter.c
+ * @Description: 主表主键上的内存Bloom过滤器
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include"Sqlite.h"
+
+
+/**
+ * @description: 创建能容纳num_keys个主键的空过滤器
+ * @param {uint32_t} num_keys
+ * @return {*}
+ * @note: 按每个主键KEY_FILTER_BITS_PER_KEY位分配，向上取整到64位的字
+ */
+KeyFilter *key_filter_create(uint32_t num_keys)
+{
+    KeyFilter *filter = malloc(sizeof(KeyFilter));
+    filter->num_words = (num_keys * KEY_FILTER_BITS_PER_KEY + 63) / 64;
+    if (filter->num_words == 0)
+    {
+        filter->num_words = 1;
+    }
+    filter->words = calloc(filter->num_words, sizeof(uint64_t));
+    return filter;
+}
+
+void key_filter_free(KeyFilter *filter)
+{
+    free(filter->words);
+    free(filter);
+}
+
+
+/**
+ * @description: 第i个哈希函数选中的位
+ * @param {KeyFilter} *filter
+ * @param {uint64_t} hash 主键的hash_key
+ * @param {uint32_t} i
+ * @return {*}
+ * @note: 双重哈希 h1 + i*h2，h2取奇数保证不退化
+ */
+uint64_t key_filter_bit(KeyFilter *filter, uint64_t hash, uint32_t i)
+{
+    uint64_t h1 = hash & UINT32_MAX;
+    uint64_t h2 = (hash >> 32) | 1;
+    return (h1 + i * h2) % (filter->num_words * 64);
+}
+
+
+/**
+ * @description: 把主键加入过滤器
+ * @param {KeyFilter} *filter
+ * @param {void} *key 编码后的主键
+ * @param {uint32_t} key_size
+ * @return {*}
+ * @note: 写者在主键对读者可见之前调用；按位原子地置1，多个写者可以同时加入
+ */
+void key_filter_add(KeyFilter *filter, const void *key, uint32_t key_size)
+{
+    uint64_t hash = hash_key(key, key_size);
+    for (uint32_t i = 0; i < KEY_FILTER_NUM_HASHES; i++)
+    {
+        uint64_t bit = key_filter_bit(filter, hash, i);
+        __atomic_fetch_or(&(filter->words[bit / 64]), 1ULL << (bit % 64), __ATOMIC_RELEASE);
+    }
+}
+
+
+/**
+ * @description: 主键是否可能存在
+ * @param {KeyFilter} *filter
+ * @param {void} *key 编码后的主键
+ * @param {uint32_t} key_size
+ * @return {*} false表示一定不存在
+ * @note:
+ */
+bool key_filter_may_contain(KeyFilter *filter, const void *key, uint32_t key_size)
+{
+    uint64_t hash = hash_key(key, key_size);
+    for (uint32_t i = 0; i < KEY_FILTER_NUM_HASHES; i++)
+    {
+        uint64_t bit = key_filter_bit(filter, hash, i);
+        if (!(__atomic_load_n(&(filter->words[bit / 64]), __ATOMIC_ACQUIRE) & (1ULL << (bit % 64))))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * @description: 打开主表时建立过滤器，扫描一遍现有的主键
+ * @param {Table} *table
+ * @return {*}
+ * @note: 文件最多TABLE_MAX_PAGES页，按所有页面都装满单元格估计容量，之后的插入不需要扩容。
+ *        过滤器不支持删除，主键只会增加，所以不会出现假阴性
+ */
+void table_filter_open(Table *table)
+{
+    Pager *pager = table->pager;
+    uint32_t cell_size = table->key_size + table->value_size;
+    KeyFilter *filter = key_filter_create(TABLE_MAX_PAGES * (PAGE_SIZE / cell_size));
+
+    if (table->access_method == ACCESS_HASH)
+    {
+        void *directory = get_page(pager, table->root_page_num);
+        uint32_t num_buckets = 1u << *hash_directory_depth(directory);
+        for (uint32_t i = 0; i < num_buckets; i++)
+        {
+            void *bucket = get_page(pager, *hash_directory_bucket(directory, i));
+            // 被多个下标共享的桶只读一次
+            if (i >= (1u << *hash_bucket_local_depth(bucket)))
+            {
+                continue;
+            }
+            uint32_t num_cells = *hash_bucket_num_cells(bucket);
+            for (uint32_t j = 0; j < num_cells; j++)
+            {
+                key_filter_add(filter, hash_bucket_cell(table, bucket, j), table->key_size);
+            }
+        }
+    }
+    else
+    {
+        Cursor *cursor = table_start(table);
+        while (!(cursor->end_of_table))
+        {
+            key_filter_add(filter, cursor_key(cursor), table->key_size);
+            cursor_advance(cursor);
+        }
+        cursor_close(cursor);
+    }
+    table->key_filter = filter;
+}
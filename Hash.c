@@ -0,0 +1,440 @@
+/*
+ * @Author: WangZhe
+ * @Date: 2026-10-19 21:05:12
+ * @LastEditors: WangZhe
+ * @LastEditTime: 2026-10-19 23:18:40
+ * @FilePath: /Sqlite/Hash.c
+ * @Description: 可扩展哈希表，只做点查询的主表可以用它代替B树
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include"Sqlite.h"
+
+
+/**
+ * @description: 编码后主键的哈希值
+ * @param {void} *key
+ * @param {uint32_t} key_size
+ * @return {*}
+ * @note: FNV-1a之后再混合一次，目录按低位取下标，低位必须足够均匀
+ */
+uint64_t hash_key(const void *key, uint32_t key_size)
+{
+    const uint8_t *bytes = key;
+    uint64_t hash = 14695981039346656037ULL;
+    for (uint32_t i = 0; i < key_size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+
+/**
+ * @description: 目录页和桶页的字段
+ */
+uint32_t *hash_directory_depth(void *directory)
+{
+    return directory + HASH_DIRECTORY_DEPTH_OFFSET;
+}
+
+uint32_t *hash_directory_bucket(void *directory, uint32_t index)
+{
+    return directory + HASH_DIRECTORY_BUCKETS_OFFSET + index * HASH_DIRECTORY_BUCKET_SIZE;
+}
+
+uint32_t *hash_bucket_local_depth(void *bucket)
+{
+    return bucket + HASH_BUCKET_LOCAL_DEPTH_OFFSET;
+}
+
+uint32_t *hash_bucket_num_cells(void *bucket)
+{
+    return bucket + HASH_BUCKET_NUM_CELLS_OFFSET;
+}
+
+void *hash_bucket_cell(Table *table, void *bucket, uint32_t cell_num)
+{
+    return bucket + HASH_BUCKET_HEADER_SIZE + cell_num * (table->key_size + table->value_size);
+}
+
+uint32_t hash_bucket_max_cells(Table *table)
+{
+    return HASH_BUCKET_SPACE_FOR_CELLS / (table->key_size + table->value_size);
+}
+
+
+/**
+ * @description: 新建哈希表：全局深度为0的目录，唯一的下标指向一个空桶
+ * @param {Pager} *pager
+ * @param {uint32_t} directory_page_num
+ * @param {uint32_t} bucket_page_num
+ * @return {*}
+ * @note:
+ */
+void hash_initialize(Pager *pager, uint32_t directory_page_num, uint32_t bucket_page_num)
+{
+    void *directory = get_page(pager, directory_page_num);
+    memset(directory, 0, PAGE_SIZE);
+    *hash_directory_depth(directory) = 0;
+    *hash_directory_bucket(directory, 0) = bucket_page_num;
+
+    void *bucket = get_page(pager, bucket_page_num);
+    memset(bucket, 0, PAGE_SIZE);
+    *hash_bucket_local_depth(bucket) = 0;
+    *hash_bucket_num_cells(bucket) = 0;
+}
+
+
+/**
+ * @description: 在桶中查找主键
+ * @param {Table} *table
+ * @param {void} *bucket 调用者已经闩住
+ * @param {void} *key 编码后的主键
+ * @return {*} 单元格号，不存在时返回-1
+ * @note: 桶内无序，顺序比较；桶只有一页，代价和B树叶子上的二分查找相当
+ */
+int32_t hash_bucket_find(Table *table, void *bucket, const void *key)
+{
+    uint32_t num_cells = *hash_bucket_num_cells(bucket);
+    for (uint32_t i = 0; i < num_cells; i++)
+    {
+        if (memcmp(hash_bucket_cell(table, bucket, i), key, table->key_size) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+/**
+ * @description: 找到主键所在的桶并闩住它
+ * @param {Table} *table
+ * @param {uint64_t} hash 主键的哈希值
+ * @param {LatchMode} mode 桶上的闩锁
+ * @return {*} 桶页码
+ * @note: 先共享地闩住目录，闩住桶之后才放开目录，这期间目录不会加倍，桶也不会被分裂
+ */
+uint32_t hash_latch_bucket(Table *table, uint64_t hash, LatchMode mode)
+{
+    Pager *pager = table->pager;
+    page_latch(pager, table->root_page_num, LATCH_SHARED);
+    void *directory = get_page(pager, table->root_page_num);
+    uint32_t mask = (1u << *hash_directory_depth(directory)) - 1;
+    uint32_t bucket_page_num = *hash_directory_bucket(directory, hash & mask);
+    page_latch(pager, bucket_page_num, mode);
+    page_unlatch(pager, table->root_page_num);
+    return bucket_page_num;
+}
+
+
+/**
+ * @description: 按主键读取一行
+ * @param {Table} *table
+ * @param {void} *key 编码后的主键
+ * @param {void} *value 输出table->value_size个字节，可以为NULL
+ * @return {*} 主键是否存在
+ * @note: 只读目录页和一个桶页，和树的高度无关
+ */
+bool hash_get(Table *table, const void *key, void *value)
+{
+    uint32_t bucket_page_num = hash_latch_bucket(table, hash_key(key, table->key_size), LATCH_SHARED);
+    void *bucket = get_page(table->pager, bucket_page_num);
+    int32_t cell_num = hash_bucket_find(table, bucket, key);
+    if (cell_num >= 0 && value != NULL)
+    {
+        memcpy(value, hash_bucket_cell(table, bucket, cell_num) + table->key_size, table->value_size);
+    }
+    page_unlatch(table->pager, bucket_page_num);
+    return cell_num >= 0;
+}
+
+
+/**
+ * @description: 把一个满的桶分成两个
+ * @param {Table} *table
+ * @param {uint32_t} bucket_page_num
+ * @return {*} 目录已经不能再加倍时返回EXECUTE_TABLE_FULL
+ * @note: 调用者持有smo_mutex且没有持有任何闩锁。局部深度为d的桶按哈希值的第d位分开，
+ *        局部深度等于全局深度时先把目录加倍(后一半是前一半的拷贝)，再把第d位为1的下标指向新桶
+ */
+ExecuteResult hash_split_bucket(Table *table, uint32_t bucket_page_num)
+{
+    Pager *pager = table->pager;
+    page_latch(pager, table->root_page_num, LATCH_EXCLUSIVE);
+    page_latch(pager, bucket_page_num, LATCH_EXCLUSIVE);
+    void *directory = get_page(pager, table->root_page_num);
+    void *bucket = get_page(pager, bucket_page_num);
+    uint32_t global_depth = *hash_directory_depth(directory);
+    uint32_t local_depth = *hash_bucket_local_depth(bucket);
+
+    if (local_depth == global_depth)
+    {
+        if (global_depth == HASH_DIRECTORY_MAX_DEPTH)
+        {
+            page_unlatch(pager, bucket_page_num);
+            page_unlatch(pager, table->root_page_num);
+            return EXECUTE_TABLE_FULL;
+        }
+        uint32_t num_entries = 1u << global_depth;
+        for (uint32_t i = 0; i < num_entries; i++)
+        {
+            *hash_directory_bucket(directory, num_entries + i) = *hash_directory_bucket(directory, i);
+        }
+        global_depth += 1;
+        *hash_directory_depth(directory) = global_depth;
+    }
+
+    uint32_t new_page_num = get_unused_page_num(pager);
+    void *new_bucket = get_page(pager, new_page_num);
+    memset(new_bucket, 0, PAGE_SIZE);
+    *hash_bucket_local_depth(new_bucket) = local_depth + 1;
+    *hash_bucket_local_depth(bucket) = local_depth + 1;
+
+    uint32_t cell_size = table->key_size + table->value_size;
+    uint32_t num_cells = *hash_bucket_num_cells(bucket);
+    uint32_t num_kept = 0;
+    for (uint32_t i = 0; i < num_cells; i++)
+    {
+        void *cell = hash_bucket_cell(table, bucket, i);
+        if ((hash_key(cell, table->key_size) >> local_depth) & 1)
+        {
+            uint32_t *num_moved = hash_bucket_num_cells(new_bucket);
+            memcpy(hash_bucket_cell(table, new_bucket, *num_moved), cell, cell_size);
+            *num_moved += 1;
+        }
+        else
+        {
+            if (num_kept != i)
+            {
+                memcpy(hash_bucket_cell(table, bucket, num_kept), cell, cell_size);
+            }
+            num_kept++;
+        }
+    }
+    *hash_bucket_num_cells(bucket) = num_kept;
+
+    uint32_t num_entries = 1u << global_depth;
+    for (uint32_t i = 0; i < num_entries; i++)
+    {
+        if (*hash_directory_bucket(directory, i) == bucket_page_num && ((i >> local_depth) & 1))
+        {
+            *hash_directory_bucket(directory, i) = new_page_num;
+        }
+    }
+
+    page_unlatch(pager, bucket_page_num);
+    page_unlatch(pager, table->root_page_num);
+    return EXECUTE_SUCCESS;
+}
+
+
+/**
+ * @description: 哈希表上的table_put
+ * @param {Table} *table
+ * @param {void} *key 编码后的主键
+ * @param {void} *value table->value_size个字节
+ * @param {PutMode} mode 主键已存在或不存在时的行为
+ * @param {void} *old_value 非NULL且主键已存在时，输出被覆盖的旧值
+ * @return {*}
+ * @note: 写者持有smo_mutex，所以放开桶去分裂之后桶的内容不会被别的写者改变；分裂后重新定位，
+ *        所有主键的哈希值在同一位上都相同时可能要连续分裂几次
+ */
+ExecuteResult hash_put(Table *table, const void *key, const void *value, PutMode mode, void *old_value)
+{
+    Pager *pager = table->pager;
+    uint64_t hash = hash_key(key, table->key_size);
+    ExecuteResult result = EXECUTE_SUCCESS;
+    pthread_mutex_lock(&(table->smo_mutex));
+    while (result == EXECUTE_SUCCESS)
+    {
+        uint32_t bucket_page_num = hash_latch_bucket(table, hash, LATCH_EXCLUSIVE);
+        void *bucket = get_page(pager, bucket_page_num);
+        int32_t cell_num = hash_bucket_find(table, bucket, key);
+        uint32_t *num_cells = hash_bucket_num_cells(bucket);
+
+        if (cell_num < 0 && mode != PUT_UPDATE && *num_cells >= hash_bucket_max_cells(table))
+        {
+            page_unlatch(pager, bucket_page_num);
+            result = hash_split_bucket(table, bucket_page_num);
+            continue;
+        }
+
+        if (cell_num >= 0 && mode == PUT_INSERT)
+        {
+            result = EXECUTE_DUPLICATE_KEY;
+        }
+        else if (cell_num < 0 && mode == PUT_UPDATE)
+        {
+            result = EXECUTE_KEY_NONE;
+        }
+        else if (cell_num >= 0)
+        {
+            void *cell_value = hash_bucket_cell(table, bucket, cell_num) + table->key_size;
+            if (old_value != NULL)
+            {
+                memcpy(old_value, cell_value, table->value_size);
+            }
+            memcpy(cell_value, value, table->value_size);
+        }
+        else
+        {
+            void *cell = hash_bucket_cell(table, bucket, *num_cells);
+            memcpy(cell, key, table->key_size);
+            memcpy(cell + table->key_size, value, table->value_size);
+            *num_cells += 1;
+        }
+        page_unlatch(pager, bucket_page_num);
+        break;
+    }
+    pthread_mutex_unlock(&(table->smo_mutex));
+    return result;
+}
+
+
+/**
+ * @description: 哈希表上的select
+ * @param {Statement} *statement
+ * @param {Table} *table
+ * @return {*}
+ * @note: 主键等值条件只查一个桶；其余情况扫描所有的桶，收集范围内的行按主键排序后输出，
+ *        所以结果的顺序、desc、limit和offset和B树一致，但代价是O(n log n)。
+ *        扫描期间共享地闩住目录，不会有桶被分裂
+ */
+ExecuteResult hash_select(Statement *statement, Table *table)
+{
+    KeyRange *range = &(statement->select_range);
+    uint32_t columns = statement->select_columns | statement->select_filter_column;
+    uint8_t key[KEY_MAX_SIZE];
+    uint8_t value[ROW_SIZE];
+    Row row;
+    memset(&row, 0, sizeof(row));
+
+    if (range->has_lower && !key_fits(table->key_type, &(range->lower)))
+    {
+        return EXECUTE_SUCCESS;
+    }
+    if (key_range_is_point(range))
+    {
+        encode_key(table->key_type, &(range->lower), key);
+        if (statement->select_limit > 0 && table_get(table, key, value))
+        {
+            deserialize_row(table->pager, value, &row, columns);
+            if (row_matches_filter(statement, &row))
+            {
+                select_output_row(statement, &row, table->key_type);
+            }
+        }
+        return EXECUTE_SUCCESS;
+    }
+
+    Pager *pager = table->pager;
+    uint32_t cell_size = table->key_size + table->value_size;
+    uint32_t capacity = 64;
+    uint32_t num_entries = 0;
+    uint8_t *cells = malloc(capacity * cell_size);
+    KeyEntry *entries = malloc(capacity * sizeof(KeyEntry));
+
+    page_latch(pager, table->root_page_num, LATCH_SHARED);
+    void *directory = get_page(pager, table->root_page_num);
+    uint32_t num_buckets = 1u << *hash_directory_depth(directory);
+    for (uint32_t i = 0; i < num_buckets; i++)
+    {
+        uint32_t bucket_page_num = *hash_directory_bucket(directory, i);
+        void *bucket = get_page(pager, bucket_page_num);
+        // 局部深度为d的桶被低d位相同的2^(全局深度-d)个下标共享，只在最小的那个下标处读取
+        if (i >= (1u << *hash_bucket_local_depth(bucket)))
+        {
+            continue;
+        }
+        page_latch(pager, bucket_page_num, LATCH_SHARED);
+        uint32_t num_cells = *hash_bucket_num_cells(bucket);
+        for (uint32_t j = 0; j < num_cells; j++)
+        {
+            void *cell = hash_bucket_cell(table, bucket, j);
+            Key cell_key;
+            decode_key(table->key_type, cell, &cell_key);
+            if (!key_range_contains(range, &cell_key))
+            {
+                continue;
+            }
+            if (num_entries == capacity)
+            {
+                capacity *= 2;
+                cells = realloc(cells, capacity * cell_size);
+                entries = realloc(entries, capacity * sizeof(KeyEntry));
+            }
+            memcpy(cells + num_entries * cell_size, cell, cell_size);
+            entries[num_entries].key = cell_key;
+            entries[num_entries].position = num_entries;
+            num_entries++;
+        }
+        page_unlatch(pager, bucket_page_num);
+    }
+    page_unlatch(pager, table->root_page_num);
+
+    qsort(entries, num_entries, sizeof(KeyEntry), compare_key_entries);
+    for (uint32_t i = 0; i < num_entries && statement->select_num_rows < statement->select_limit; i++)
+    {
+        KeyEntry *entry = &(entries[statement->select_descending ? num_entries - 1 - i : i]);
+        deserialize_row(pager, cells + entry->position * cell_size + table->key_size, &row, columns);
+        if (row_matches_filter(statement, &row))
+        {
+            select_output_row(statement, &row, table->key_type);
+        }
+    }
+    free(cells);
+    free(entries);
+    return EXECUTE_SUCCESS;
+}
+
+
+/**
+ * @description: .btree在哈希表上输出目录和每个桶中的主键
+ * @param {Table} *table
+ * @return {*}
+ * @note: 被多个下标共享的桶只输出一次，桶内的主键按插入顺序输出
+ */
+void print_hash(Table *table)
+{
+    void *directory = get_page(table->pager, table->root_page_num);
+    uint32_t global_depth = *hash_directory_depth(directory);
+    printf("- directory (depth %d)\n", global_depth);
+    for (uint32_t i = 0; i < (1u << global_depth); i++)
+    {
+        void *bucket = get_page(table->pager, *hash_directory_bucket(directory, i));
+        uint32_t local_depth = *hash_bucket_local_depth(bucket);
+        if (i >= (1u << local_depth))
+        {
+            continue;
+        }
+        uint32_t num_cells = *hash_bucket_num_cells(bucket);
+        indent(1);
+        printf("- bucket %d (depth %d, size %d)\n", i, local_depth, num_cells);
+        for (uint32_t j = 0; j < num_cells; j++)
+        {
+            Key key;
+            decode_key(table->key_type, hash_bucket_cell(table, bucket, j), &key);
+            indent(2);
+            printf("- ");
+            print_key(table->key_type, &key);
+            printf("\n");
+        }
+    }
+}
@@ -0,0 +1,422 @@
+/*
+ * @Author: WangZhe
+ * @Date: 2026-10-19 19:10:27
+ * @LastEditors: WangZhe
+ * @LastEditTime: 2026-10-19 21:02:51
+ * @FilePath: /Sqlite/Index.c
+ * @Description: username和email上的二级索引
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include"Sqlite.h"
+
+
+/**
+ * @description: 列在文件头和table->indexes中的槽位
+ * @param {uint32_t} column ColumnMask中的一列
+ * @return {*} 不能建立索引的列返回-1
+ * @note:
+ */
+int32_t index_slot(uint32_t column)
+{
+    for (int32_t slot = 0; slot < TABLE_MAX_INDEXES; slot++)
+    {
+        if (INDEX_COLUMNS[slot] == column)
+        {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+
+/**
+ * @description: 打开一个已经在文件头中登记了根页码和INCLUDE列的索引
+ * @param {Table} *table 主表
+ * @param {uint32_t} column
+ * @return {*}
+ * @note: 只打开索引树，由调用者决定何时放进table->indexes
+ */
+Table *index_open(Table *table, uint32_t column)
+{
+    int32_t slot = index_slot(column);
+    uint32_t include = *db_header_index_include(get_page(table->pager, DB_HEADER_PAGE_NUM), slot);
+    uint32_t root_offset = DB_HEADER_INDEX_ROOT_OFFSET + slot * DB_HEADER_INDEX_ROOT_SIZE;
+    Table *index = table_open(table->pager, root_offset, KEY_INDEX, index_entry_size(include));
+    index->index_column = column;
+    index->index_include = include;
+    return index;
+}
+
+
+/**
+ * @description: 带有这些INCLUDE列的索引项的字节数
+ * @param {uint32_t} include ColumnMask
+ * @return {*}
+ * @note:
+ */
+uint32_t index_entry_size(uint32_t include)
+{
+    uint32_t size = INDEX_ENTRY_HEADER_SIZE;
+    if (include & COLUMN_USERNAME)
+    {
+        size += USERNAME_SIZE;
+    }
+    if (include & COLUMN_EMAIL)
+    {
+        size += EMAIL_LENGTH_SIZE + EMAIL_INLINE_SIZE;
+    }
+    return size;
+}
+
+
+/**
+ * @description: 由主表的一行构造索引项
+ * @param {Table} *index
+ * @param {void} *value 序列化后的行
+ * @param {void} *destination index->value_size个字节
+ * @return {*}
+ * @note: 被索引的列比INDEX_VALUE_SIZE长，或者INCLUDE的email有溢出部分时，
+ *        索引项不完整，标记INDEX_ENTRY_PARTIAL，查询这一行时仍然回表
+ */
+void index_entry(Table *index, const void *value, void *destination)
+{
+    uint8_t flags = 0;
+    uint32_t email_length;
+    memcpy(&email_length, value + EMAIL_LENGTH_OFFSET, EMAIL_LENGTH_SIZE);
+    if (index->index_column == COLUMN_EMAIL && email_length > INDEX_VALUE_SIZE)
+    {
+        flags |= INDEX_ENTRY_PARTIAL;
+    }
+
+    memset(destination, 0, index->value_size);
+    uint32_t offset = INDEX_ENTRY_HEADER_SIZE;
+    if (index->index_include & COLUMN_USERNAME)
+    {
+        memcpy(destination + offset, value + USERNAME_OFFSET, USERNAME_SIZE);
+        offset += USERNAME_SIZE;
+    }
+    if (index->index_include & COLUMN_EMAIL)
+    {
+        // 行中email长度和行内部分是相邻的
+        memcpy(destination + offset, value + EMAIL_LENGTH_OFFSET, EMAIL_LENGTH_SIZE + EMAIL_INLINE_SIZE);
+        if (email_length > EMAIL_INLINE_SIZE)
+        {
+            flags |= INDEX_ENTRY_PARTIAL;
+        }
+    }
+    *(uint8_t *)(destination + INDEX_ENTRY_FLAGS_OFFSET) = flags;
+}
+
+
+/**
+ * @description: 从没有INDEX_ENTRY_PARTIAL标记的索引项还原一行
+ * @param {Table} *index
+ * @param {void} *key KEY_INDEX格式的主键
+ * @param {void} *entry
+ * @param {Row} *row 输出主键、被索引的列和INCLUDE的列
+ * @return {*}
+ * @note: 列值中没有'\0'，主键中的前缀补0的部分就是字符串的结尾
+ */
+void index_entry_row(Table *index, const void *key, const void *entry, Row *row)
+{
+    Key row_key;
+    decode_key(KEY_INDEX, key, &row_key);
+    row->id = row_key.id;
+    row->tenant_id = row_key.tenant_id;
+
+    char *column_value = index->index_column == COLUMN_USERNAME ? row->username : row->email;
+    memcpy(column_value, key, INDEX_VALUE_SIZE);
+    column_value[INDEX_VALUE_SIZE] = '\0';
+
+    uint32_t offset = INDEX_ENTRY_HEADER_SIZE;
+    if (index->index_include & COLUMN_USERNAME)
+    {
+        // 行中的username连同结尾的'\0'一起保存
+        memcpy(row->username, entry + offset, USERNAME_SIZE);
+        offset += USERNAME_SIZE;
+    }
+    if (index->index_include & COLUMN_EMAIL)
+    {
+        uint32_t email_length;
+        memcpy(&email_length, entry + offset, EMAIL_LENGTH_SIZE);
+        memcpy(row->email, entry + offset + EMAIL_LENGTH_SIZE, email_length);
+        row->email[email_length] = '\0';
+    }
+}
+
+
+/**
+ * @description: 由主表的一行构造索引的主键
+ * @param {Table} *table 主表
+ * @param {uint32_t} column 被索引的列
+ * @param {void} *key 主表中编码后的主键
+ * @param {void} *value 序列化后的行
+ * @param {void} *destination KEY_INDEX格式的主键
+ * @return {*}
+ * @note: 只取列值的前INDEX_VALUE_SIZE个字节，email的这部分总在行内，不需要读溢出页。
+ *        前缀相同的不同值落在同一段索引项中，查询时需要回表复查
+ */
+void index_key(Table *table, uint32_t column, const void *key, const void *value, void *destination)
+{
+    uint32_t length = 0;
+    const void *source = NULL;
+    switch (column)
+    {
+    case COLUMN_USERNAME:
+        source = value + USERNAME_OFFSET;
+        length = strnlen(source, USERNAME_SIZE);
+        break;
+    case COLUMN_EMAIL:
+        source = value + EMAIL_OFFSET;
+        memcpy(&length, value + EMAIL_LENGTH_OFFSET, EMAIL_LENGTH_SIZE);
+        length = length < EMAIL_INLINE_SIZE ? length : EMAIL_INLINE_SIZE;
+        break;
+    }
+    length = length < INDEX_VALUE_SIZE ? length : INDEX_VALUE_SIZE;
+    memset(destination, 0, INDEX_VALUE_SIZE);
+    memcpy(destination, source, length);
+
+    Key row_key;
+    decode_key(table->key_type, key, &row_key);
+    encode_key(KEY_INDEX, &row_key, destination);
+}
+
+
+/**
+ * @description: 把新插入的行加入所有索引
+ * @param {Table} *table 主表
+ * @param {void} *key
+ * @param {void} *value
+ * @return {*}
+ * @note: 同一个索引主键可能还留着被删除的索引项，直接覆盖
+ */
+void index_insert_row(Table *table, const void *key, const void *value)
+{
+    uint8_t entry[INDEX_ENTRY_MAX_SIZE];
+    for (uint32_t slot = 0; slot < TABLE_MAX_INDEXES; slot++)
+    {
+        Table *index = table->indexes[slot];
+        if (index == NULL)
+        {
+            continue;
+        }
+        uint8_t index_key_bytes[KEY_MAX_SIZE];
+        index_key(table, index->index_column, key, value, index_key_bytes);
+        index_entry(index, value, entry);
+        table_put(index, index_key_bytes, entry, PUT_UPSERT, NULL);
+    }
+}
+
+
+/**
+ * @description: 行被更新后维护索引
+ * @param {Table} *table 主表
+ * @param {void} *key
+ * @param {void} *old_value 更新前的行
+ * @param {void} *new_value 更新后的行
+ * @return {*}
+ * @note: 被索引的列和INCLUDE的列都没有变化时不改动索引；被索引的列变化时旧的索引项标记为删除，
+ *        再加入新的索引项；只有INCLUDE的列变化时原地覆盖索引项
+ */
+void index_update_row(Table *table, const void *key, const void *old_value, const void *new_value)
+{
+    uint8_t old_entry[INDEX_ENTRY_MAX_SIZE];
+    uint8_t new_entry[INDEX_ENTRY_MAX_SIZE];
+
+    for (uint32_t slot = 0; slot < TABLE_MAX_INDEXES; slot++)
+    {
+        Table *index = table->indexes[slot];
+        if (index == NULL)
+        {
+            continue;
+        }
+        uint8_t old_key[KEY_MAX_SIZE];
+        uint8_t new_key[KEY_MAX_SIZE];
+        index_key(table, index->index_column, key, old_value, old_key);
+        index_key(table, index->index_column, key, new_value, new_key);
+        index_entry(index, old_value, old_entry);
+        index_entry(index, new_value, new_entry);
+        bool same_key = memcmp(old_key, new_key, index->key_size) == 0;
+        if (same_key && memcmp(old_entry, new_entry, index->value_size) == 0)
+        {
+            continue;
+        }
+        if (!same_key)
+        {
+            old_entry[INDEX_ENTRY_FLAGS_OFFSET] |= INDEX_ENTRY_DELETED;
+            table_put(index, old_key, old_entry, PUT_UPDATE, NULL);
+        }
+        table_put(index, new_key, new_entry, PUT_UPSERT, NULL);
+    }
+}
+
+
+/**
+ * @description: 写操作开始前加锁
+ * @param {Table} *table 主表
+ * @return {*}
+ * @note: 没有索引时共享地持有index_lock，写者之间照常并发，只挡住create index；
+ *        有索引时独占地持有，主表和各个索引的修改对其他写者是一个整体。
+ *        num_indexes只在独占index_lock时增加，持有共享锁时读到的值不会变
+ */
+void index_write_lock(Table *table)
+{
+    pthread_rwlock_rdlock(&(table->index_lock));
+    if (table->num_indexes > 0)
+    {
+        pthread_rwlock_unlock(&(table->index_lock));
+        pthread_rwlock_wrlock(&(table->index_lock));
+    }
+}
+
+void index_write_unlock(Table *table)
+{
+    pthread_rwlock_unlock(&(table->index_lock));
+}
+
+
+/**
+ * @description: qsort比较两个索引单元格的主键
+ */
+int index_compare_cells(const void *a, const void *b)
+{
+    return memcmp(a, b, key_type_size(KEY_INDEX));
+}
+
+
+/**
+ * @description: 执行create index on <列>
+ * @param {Statement} *statement
+ * @param {Table} *table
+ * @return {*} 索引已经存在时返回EXECUTE_INDEX_EXISTS
+ * @note: 扫描主表建成索引树并登记到文件头，之后才对查询可见。
+ *        批量建树而不是逐行插入：写时复制模式下扫描期间持有快照，逐行提交替换下来的页面在扫描结束前都不能回收
+ */
+ExecuteResult execute_create_index(Statement *statement, Table *table)
+{
+    // 索引靠扫描主表建立，目前只支持B树主表
+    if (table->access_method != ACCESS_BTREE)
+    {
+        return EXECUTE_UNSUPPORTED;
+    }
+    int32_t slot = index_slot(statement->index_column);
+    pthread_rwlock_wrlock(&(table->index_lock));
+    if (table->indexes[slot] != NULL)
+    {
+        pthread_rwlock_unlock(&(table->index_lock));
+        return EXECUTE_INDEX_EXISTS;
+    }
+
+    // 先登记一个占位的根页码，index_open据此确定根在文件头中的位置，vacuum_rebuild会写入真正的根
+    void *header = get_page(table->pager, DB_HEADER_PAGE_NUM);
+    *db_header_index_root(header, slot) = INVALID_PAGE_NUM;
+    *db_header_index_include(header, slot) = statement->index_include;
+    Table *index = index_open(table, statement->index_column);
+
+    // 主表的行按索引主键排序后一次性建成索引树，不逐行插入
+    uint32_t num_rows;
+    uint8_t *rows = vacuum_collect(table, &num_rows);
+    uint32_t row_size = table->key_size + table->value_size;
+    uint32_t cell_size = index->key_size + index->value_size;
+    uint8_t *cells = malloc(num_rows * cell_size + 1);
+    for (uint32_t i = 0; i < num_rows; i++)
+    {
+        uint8_t *row = rows + i * row_size;
+        index_key(table, index->index_column, row, row + table->key_size, cells + i * cell_size);
+        index_entry(index, row + table->key_size, cells + i * cell_size + index->key_size);
+    }
+    qsort(cells, num_rows, cell_size, index_compare_cells);
+
+    uint32_t num_leaves;
+    uint32_t fill_factor = vacuum_fill_factor(table);
+    vacuum_tree_pages(index, num_rows, fill_factor, &num_leaves);
+    vacuum_rebuild(index, cells, num_rows, num_leaves, vacuum_per_node(fill_factor));
+    free(rows);
+    free(cells);
+
+    __atomic_store_n(&(table->indexes[slot]), index, __ATOMIC_RELEASE);
+    table->num_indexes += 1;
+    pthread_rwlock_unlock(&(table->index_lock));
+    return EXECUTE_SUCCESS;
+}
+
+
+/**
+ * @description: 通过索引执行带username/email条件的select
+ * @param {Statement} *statement
+ * @param {Table} *table 主表
+ * @param {Table} *index 被过滤的列上的索引
+ * @return {*}
+ * @note: 定位到条件值(或前缀)在索引中的起点，按索引顺序逐项读取，越过前缀的范围或达到limit后停止。
+ *        投影的列都被索引覆盖(主键、被索引的列和INCLUDE的列)时直接从索引项还原行，不回表；
+ *        否则或者索引项不完整时按主键回表读取。索引只保存列值的前缀，每一行都要复查条件；
+ *        主键范围的条件在读取行之前检查
+ */
+ExecuteResult index_select(Statement *statement, Table *table, Table *index)
+{
+    uint32_t value_length = strlen(statement->select_filter_value);
+    value_length = value_length < INDEX_VALUE_SIZE ? value_length : INDEX_VALUE_SIZE;
+    uint32_t match_length = statement->select_filter_prefix ? value_length : INDEX_VALUE_SIZE;
+    uint8_t lower[KEY_MAX_SIZE];
+    memset(lower, 0, KEY_MAX_SIZE);
+    memcpy(lower, statement->select_filter_value, value_length);
+
+    Row row;
+    memset(&row, 0, sizeof(row));
+    uint32_t columns = statement->select_columns | statement->select_filter_column;
+    bool index_only = (columns & ~(COLUMN_ID | index->index_column | index->index_include)) == 0;
+    Cursor *cursor = table_seek(index, lower);
+    while (!(cursor->end_of_table) && statement->select_num_rows < statement->select_limit)
+    {
+        uint8_t *entry_key = cursor_key(cursor);
+        if (memcmp(entry_key, lower, match_length) != 0)
+        {
+            break;
+        }
+        uint8_t flags = *(uint8_t *)(cursor_value(cursor) + INDEX_ENTRY_FLAGS_OFFSET);
+        Key row_key;
+        decode_key(KEY_INDEX, entry_key, &row_key);
+        if ((flags & INDEX_ENTRY_DELETED) || !key_range_contains(&(statement->select_range), &row_key) ||
+            !key_fits(table->key_type, &row_key))
+        {
+            cursor_advance(cursor);
+            continue;
+        }
+        if (index_only && !(flags & INDEX_ENTRY_PARTIAL))
+        {
+            index_entry_row(index, entry_key, cursor_value(cursor), &row);
+            if (row_matches_filter(statement, &row))
+            {
+                select_output_row(statement, &row, table->key_type);
+            }
+            cursor_advance(cursor);
+            continue;
+        }
+
+        uint8_t key[KEY_MAX_SIZE];
+        encode_key(table->key_type, &row_key, key);
+        Cursor *row_cursor = table_find(table, key, FIND_READ);
+        if (cursor_key_equals(row_cursor, key))
+        {
+            deserialize_row(table->pager, cursor_value(row_cursor), &row, columns);
+            if (row_matches_filter(statement, &row))
+            {
+                select_output_row(statement, &row, table->key_type);
+            }
+        }
+        cursor_close(row_cursor);
+        cursor_advance(cursor);
+    }
+    cursor_close(cursor);
+    return EXECUTE_SUCCESS;
+}
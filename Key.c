@@ -0,0 +1,411 @@
+/*
+ * @Author: WangZhe
+ * @Date: 2026-10-19 09:12:47
+ * @LastEditors: WangZhe
+ * @LastEditTime: 2026-10-19 11:40:05
+ * @FilePath: /Sqlite/Key.c
+ * @Description: 主键的编码、比较与查找
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <endian.h>
+
+#include"Sqlite.h"
+
+
+/**
+ * @description: 每种主键类型在节点中占用的字节数
+ * @param {KeyType} key_type
+ * @return {*}
+ * @note:
+ */
+uint32_t key_type_size(KeyType key_type)
+{
+    switch (key_type)
+    {
+    case KEY_U32:
+        return sizeof(uint32_t);
+    case KEY_U64:
+        return sizeof(uint64_t);
+    case KEY_COMPOSITE:
+        return sizeof(uint32_t) + sizeof(uint64_t);
+    case KEY_INDEX:
+        return INDEX_VALUE_SIZE + sizeof(uint32_t) + sizeof(uint64_t);
+    }
+    return 0;
+}
+
+
+/**
+ * @description: 判断主键的取值是否能用该类型表示
+ * @param {KeyType} key_type
+ * @param {Key} *key
+ * @return {*}
+ * @note: 只有复合主键允许tenant_id不为0
+ */
+bool key_fits(KeyType key_type, Key *key)
+{
+    switch (key_type)
+    {
+    case KEY_U32:
+        return key->tenant_id == 0 && key->id <= UINT32_MAX;
+    case KEY_U64:
+        return key->tenant_id == 0;
+    case KEY_COMPOSITE:
+    case KEY_INDEX:
+        return true;
+    }
+    return false;
+}
+
+
+/**
+ * @description: 把主键编码为节点中保存的字节
+ * @param {KeyType} key_type
+ * @param {Key} *key
+ * @param {void} *destination
+ * @return {*}
+ * @note: 整数主键按本机字节序保存；复合主键按大端序保存，可以直接用memcmp比较。
+ *        索引的主键由index_key构造，这里只写入其中主表主键的部分
+ */
+void encode_key(KeyType key_type, Key *key, void *destination)
+{
+    switch (key_type)
+    {
+    case KEY_U32:
+    {
+        uint32_t id = key->id;
+        memcpy(destination, &id, sizeof(id));
+        break;
+    }
+    case KEY_U64:
+        memcpy(destination, &(key->id), sizeof(key->id));
+        break;
+    case KEY_COMPOSITE:
+    {
+        uint32_t tenant_id = htobe32(key->tenant_id);
+        uint64_t id = htobe64(key->id);
+        memcpy(destination, &tenant_id, sizeof(tenant_id));
+        memcpy(destination + sizeof(tenant_id), &id, sizeof(id));
+        break;
+    }
+    case KEY_INDEX:
+        encode_key(KEY_COMPOSITE, key, destination + INDEX_VALUE_SIZE);
+        break;
+    }
+}
+
+
+/**
+ * @description: encode_key的逆过程
+ * @param {KeyType} key_type
+ * @param {void} *source
+ * @param {Key} *key
+ * @return {*}
+ * @note: 索引的主键解码为它引用的主表主键
+ */
+void decode_key(KeyType key_type, const void *source, Key *key)
+{
+    key->tenant_id = 0;
+    switch (key_type)
+    {
+    case KEY_U32:
+    {
+        uint32_t id;
+        memcpy(&id, source, sizeof(id));
+        key->id = id;
+        break;
+    }
+    case KEY_U64:
+        memcpy(&(key->id), source, sizeof(key->id));
+        break;
+    case KEY_COMPOSITE:
+    {
+        uint32_t tenant_id;
+        uint64_t id;
+        memcpy(&tenant_id, source, sizeof(tenant_id));
+        memcpy(&id, source + sizeof(tenant_id), sizeof(id));
+        key->tenant_id = be32toh(tenant_id);
+        key->id = be64toh(id);
+        break;
+    }
+    case KEY_INDEX:
+        decode_key(KEY_COMPOSITE, source + INDEX_VALUE_SIZE, key);
+        break;
+    }
+}
+
+
+/**
+ * @description: 比较两个已编码的主键
+ * @param {KeyType} key_type
+ * @param {uint32_t} key_size
+ * @param {void} *a
+ * @param {void} *b
+ * @return {*} 小于0表示a<b，0表示相等，大于0表示a>b
+ * @note:
+ */
+int compare_keys(KeyType key_type, uint32_t key_size, const void *a, const void *b)
+{
+    switch (key_type)
+    {
+    case KEY_U32:
+    {
+        uint32_t x = *(uint32_t *)a;
+        uint32_t y = *(uint32_t *)b;
+        return (x > y) - (x < y);
+    }
+    case KEY_U64:
+    {
+        uint64_t x = *(uint64_t *)a;
+        uint64_t y = *(uint64_t *)b;
+        return (x > y) - (x < y);
+    }
+    default:
+        return memcmp(a, b, key_size);
+    }
+}
+
+
+/**
+ * @description: 比较两个未编码的主键，按(tenant_id, id)的字典序
+ * @param {Key} *a
+ * @param {Key} *b
+ * @return {*}
+ * @note: 用于合并select中的多个范围条件，与主键类型无关
+ */
+int compare_key_values(Key *a, Key *b)
+{
+    if (a->tenant_id != b->tenant_id)
+    {
+        return a->tenant_id < b->tenant_id ? -1 : 1;
+    }
+    return (a->id > b->id) - (a->id < b->id);
+}
+
+
+/**
+ * @description: qsort的比较函数，按主键排序KeyEntry，主键相同时按原来的位置
+ */
+int compare_key_entries(const void *a, const void *b)
+{
+    const KeyEntry *x = a;
+    const KeyEntry *y = b;
+    int cmp = compare_key_values((Key *)&(x->key), (Key *)&(y->key));
+    if (cmp != 0)
+    {
+        return cmp;
+    }
+    return (x->position > y->position) - (x->position < y->position);
+}
+
+
+/**
+ * @description: 在按stride排列的有序主键数组的[min_index, max_index)中二分查找第一个>=key的位置
+ * @param {KeyType} key_type
+ * @param {uint32_t} key_size
+ * @param {void} *base 第0个主键的地址
+ * @param {uint32_t} stride 相邻主键之间的字节数(单元格大小)
+ * @param {uint32_t} min_index
+ * @param {uint32_t} max_index
+ * @param {void} *key
+ * @return {*} 都小于key时返回max_index
+ * @note: 定长整数主键各有一个专门的循环，避免在循环内部对主键类型做分支
+ */
+uint32_t key_bisect(KeyType key_type, uint32_t key_size, const void *base, uint32_t stride,
+                    uint32_t min_index, uint32_t max_index, const void *key)
+{
+    switch (key_type)
+    {
+    case KEY_U32:
+    {
+        uint32_t target = *(uint32_t *)key;
+        while (min_index != max_index)
+        {
+            uint32_t index = (min_index + max_index) / 2;
+            if (*(uint32_t *)(base + index * stride) >= target)
+            {
+                max_index = index;
+            }
+            else
+            {
+                min_index = index + 1;
+            }
+        }
+        break;
+    }
+    case KEY_U64:
+    {
+        uint64_t target = *(uint64_t *)key;
+        while (min_index != max_index)
+        {
+            uint32_t index = (min_index + max_index) / 2;
+            if (*(uint64_t *)(base + index * stride) >= target)
+            {
+                max_index = index;
+            }
+            else
+            {
+                min_index = index + 1;
+            }
+        }
+        break;
+    }
+    default:
+        while (min_index != max_index)
+        {
+            uint32_t index = (min_index + max_index) / 2;
+            if (memcmp(base + index * stride, key, key_size) >= 0)
+            {
+                max_index = index;
+            }
+            else
+            {
+                min_index = index + 1;
+            }
+        }
+        break;
+    }
+    return min_index;
+}
+
+
+
+/**
+ * @description: 读出整数主键数组中第index个主键的值
+ */
+uint64_t key_integer_at(KeyType key_type, const void *base, uint32_t stride, uint32_t index)
+{
+    if (key_type == KEY_U32)
+    {
+        return *(uint32_t *)(base + index * stride);
+    }
+    return *(uint64_t *)(base + index * stride);
+}
+
+
+/**
+ * @description: 在按stride排列的有序主键数组中查找第一个>=key的位置
+ * @param {KeyType} key_type
+ * @param {uint32_t} key_size
+ * @param {void} *base 第0个主键的地址
+ * @param {uint32_t} stride 相邻主键之间的字节数(单元格大小)
+ * @param {uint32_t} count 主键个数
+ * @param {void} *key
+ * @return {*}
+ * @note: 叶子节点和内部节点的查找都使用它。整数主键至少有KEY_INTERPOLATION_MIN_KEYS个时，
+ *        先按首尾主键插值猜一个位置，再向左或向右逐个比较最多KEY_INTERPOLATION_WINDOW步：
+ *        主键接近连续整数时几次比较就能找到；窗口走完还没找到说明分布不均匀，剩下的范围改用二分。
+ *        其他主键类型和较小的节点直接二分
+ */
+uint32_t key_lower_bound(KeyType key_type, uint32_t key_size, const void *base,
+                         uint32_t stride, uint32_t count, const void *key)
+{
+    if ((key_type != KEY_U32 && key_type != KEY_U64) || count < KEY_INTERPOLATION_MIN_KEYS)
+    {
+        return key_bisect(key_type, key_size, base, stride, 0, count, key);
+    }
+
+    uint64_t target = key_type == KEY_U32 ? *(uint32_t *)key : *(uint64_t *)key;
+    uint64_t first = key_integer_at(key_type, base, stride, 0);
+    uint64_t last = key_integer_at(key_type, base, stride, count - 1);
+    if (target <= first)
+    {
+        return 0;
+    }
+    if (target > last)
+    {
+        return count;
+    }
+
+    // 到这里first < target <= last，结果在[1, count - 1]中
+    uint32_t index = 1 + (uint32_t)((double)(target - first - 1) / (double)(last - first) * (count - 1));
+    if (index > count - 1)
+    {
+        index = count - 1;
+    }
+    uint32_t steps = 0;
+    if (key_integer_at(key_type, base, stride, index) >= target)
+    {
+        while (index > 1 && key_integer_at(key_type, base, stride, index - 1) >= target)
+        {
+            if (++steps > KEY_INTERPOLATION_WINDOW)
+            {
+                return key_bisect(key_type, key_size, base, stride, 1, index, key);
+            }
+            index--;
+        }
+        return index;
+    }
+    index++;
+    while (key_integer_at(key_type, base, stride, index) < target)
+    {
+        if (++steps > KEY_INTERPOLATION_WINDOW)
+        {
+            return key_bisect(key_type, key_size, base, stride, index + 1, count - 1, key);
+        }
+        index++;
+    }
+    return index;
+}
+
+
+/**
+ * @description: 解析主键字面量: <id> 或 <tenant_id>:<id>
+ * @param {char} *string
+ * @param {Key} *key
+ * @return {*} 格式错误时返回false
+ * @note: 负数由调用者单独检查
+ */
+bool parse_key(const char *string, Key *key)
+{
+    char *end;
+    key->tenant_id = 0;
+
+    if (string == NULL || *string < '0' || *string > '9')
+    {
+        return false;
+    }
+    errno = 0;
+    unsigned long long value = strtoull(string, &end, 10);
+    if (*end == ':')
+    {
+        if (value > UINT32_MAX || end[1] < '0' || end[1] > '9')
+        {
+            return false;
+        }
+        key->tenant_id = value;
+        value = strtoull(end + 1, &end, 10);
+    }
+    if (*end != '\0' || errno == ERANGE)
+    {
+        return false;
+    }
+    key->id = value;
+    return true;
+}
+
+
+/**
+ * @description: 输出主键，复合主键输出为 tenant_id:id
+ * @param {KeyType} key_type
+ * @param {Key} *key
+ * @return {*}
+ * @note:
+ */
+void print_key(KeyType key_type, Key *key)
+{
+    if (key_type == KEY_COMPOSITE)
+    {
+        printf("%u:", key->tenant_id);
+    }
+    printf("%llu", (unsigned long long)key->id);
+}
@@ -0,0 +1,909 @@
+/*
+ * @Author: WangZhe
+ * @Date: 2026-10-20 19:31:08
+ * @LastEditors: WangZhe
+ * @LastEditTime: 2026-10-21 00:12:54
+ * @FilePath: /Sqlite/Lsm.c
+ * @Description: 日志结构合并树：内存跳表 + 顺序写出的有序段 + 后台分层合并
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include"Sqlite.h"
+
+
+/**
+ * @description: 创建空的内存表，头节点不带单元格
+ */
+LsmMemtable *lsm_memtable_create()
+{
+    LsmMemtable *memtable = malloc(sizeof(LsmMemtable));
+    memtable->head = calloc(1, sizeof(LsmNode));
+    memtable->height = 1;
+    memtable->num_rows = 0;
+    return memtable;
+}
+
+void lsm_memtable_free(LsmMemtable *memtable)
+{
+    LsmNode *node = memtable->head;
+    while (node != NULL)
+    {
+        LsmNode *next = node->next[0];
+        free(node);
+        node = next;
+    }
+    free(memtable);
+}
+
+
+/**
+ * @description: 在跳表中查找第一个主键>=key的节点
+ * @param {Table} *table
+ * @param {LsmMemtable} *memtable
+ * @param {void} *key
+ * @param {LsmNode} **update 非NULL时输出每一层最后一个主键<key的节点，插入时使用
+ * @return {*} 没有时返回NULL
+ * @note:
+ */
+LsmNode *lsm_memtable_seek(Table *table, LsmMemtable *memtable, const void *key, LsmNode **update)
+{
+    LsmNode *node = memtable->head;
+    for (int32_t level = memtable->height - 1; level >= 0; level--)
+    {
+        while (node->next[level] != NULL &&
+               compare_keys(table->key_type, table->key_size, node->next[level]->cell, key) < 0)
+        {
+            node = node->next[level];
+        }
+        if (update != NULL)
+        {
+            update[level] = node;
+        }
+    }
+    return node->next[0];
+}
+
+/**
+ * @description: 把一行写入内存表，主键已存在时覆盖
+ * @param {Table} *table
+ * @param {void} *key
+ * @param {void} *value
+ * @return {*}
+ * @note: 调用者独占地持有lsm->lock。新节点的层数按1/4的概率逐层增加
+ */
+void lsm_memtable_put(Table *table, const void *key, const void *value)
+{
+    LsmTree *lsm = table->lsm;
+    LsmMemtable *memtable = lsm->memtable;
+    LsmNode *update[LSM_MAX_HEIGHT];
+    LsmNode *node = lsm_memtable_seek(table, memtable, key, update);
+    if (node != NULL && compare_keys(table->key_type, table->key_size, node->cell, key) == 0)
+    {
+        memcpy(node->cell + table->key_size, value, table->value_size);
+        return;
+    }
+
+    uint32_t height = 1;
+    while (height < LSM_MAX_HEIGHT)
+    {
+        // xorshift64
+        lsm->random ^= lsm->random << 13;
+        lsm->random ^= lsm->random >> 7;
+        lsm->random ^= lsm->random << 17;
+        if ((lsm->random & 3) != 0)
+        {
+            break;
+        }
+        height++;
+    }
+    for (uint32_t level = memtable->height; level < height; level++)
+    {
+        update[level] = memtable->head;
+    }
+    if (height > memtable->height)
+    {
+        memtable->height = height;
+    }
+
+    node = calloc(1, sizeof(LsmNode) + table->key_size + table->value_size);
+    memcpy(node->cell, key, table->key_size);
+    memcpy(node->cell + table->key_size, value, table->value_size);
+    for (uint32_t level = 0; level < height; level++)
+    {
+        node->next[level] = update[level]->next[level];
+        update[level]->next[level] = node;
+    }
+    memtable->num_rows += 1;
+}
+
+
+/**
+ * @description: 有序段页面的字段
+ */
+uint32_t *lsm_run_num_cells(void *page)
+{
+    return page + LSM_RUN_NUM_CELLS_OFFSET;
+}
+
+uint32_t *lsm_run_next_page(void *page)
+{
+    return page + LSM_RUN_NEXT_PAGE_OFFSET;
+}
+
+void *lsm_run_cell(Table *table, void *page, uint32_t cell_num)
+{
+    return page + LSM_RUN_HEADER_SIZE + cell_num * (table->key_size + table->value_size);
+}
+
+uint32_t lsm_run_max_cells(Table *table)
+{
+    return LSM_RUN_SPACE_FOR_CELLS / (table->key_size + table->value_size);
+}
+
+
+/**
+ * @description: 把排好序的单元格顺序写成一个新的有序段
+ * @param {Table} *table
+ * @param {uint8_t} *cells 按主键排序、主键不重复
+ * @param {uint32_t} num_cells 大于0
+ * @param {uint32_t} level
+ * @param {LsmRun} *run 输出
+ * @return {*}
+ * @note: 先一次分配所有页面，文件末尾分配时页码是连续的，写出就是顺序写。
+ *        新页面在安装到目录之前别人看不到，不需要加锁
+ */
+void lsm_run_build(Table *table, uint8_t *cells, uint32_t num_cells, uint32_t level, LsmRun *run)
+{
+    uint32_t cell_size = table->key_size + table->value_size;
+    uint32_t max_cells = lsm_run_max_cells(table);
+    run->level = level;
+    run->num_cells = num_cells;
+    run->num_pages = (num_cells + max_cells - 1) / max_cells;
+    run->pages = malloc(run->num_pages * sizeof(uint32_t));
+    run->first_keys = malloc(run->num_pages * table->key_size);
+    run->filter = key_filter_create(num_cells);
+    for (uint32_t i = 0; i < run->num_pages; i++)
+    {
+        run->pages[i] = get_unused_page_num(table->pager);
+    }
+    for (uint32_t i = 0; i < run->num_pages; i++)
+    {
+        void *page = get_page(table->pager, run->pages[i]);
+        uint32_t first = i * max_cells;
+        uint32_t count = num_cells - first < max_cells ? num_cells - first : max_cells;
+        *lsm_run_num_cells(page) = count;
+        *lsm_run_next_page(page) = i + 1 < run->num_pages ? run->pages[i + 1] : 0;
+        memcpy(lsm_run_cell(table, page, 0), cells + first * cell_size, count * cell_size);
+        memcpy(run->first_keys + i * table->key_size, cells + first * cell_size, table->key_size);
+        for (uint32_t j = 0; j < count; j++)
+        {
+            key_filter_add(run->filter, cells + (first + j) * cell_size, table->key_size);
+        }
+    }
+}
+
+/**
+ * @description: 打开数据库时按目录中的记录读取一个有序段，重建稀疏索引和过滤器
+ */
+void lsm_run_load(Table *table, uint32_t level, uint32_t first_page_num, uint32_t num_pages,
+                  uint32_t num_cells, LsmRun *run)
+{
+    run->level = level;
+    run->num_cells = num_cells;
+    run->num_pages = num_pages;
+    run->pages = malloc(num_pages * sizeof(uint32_t));
+    run->first_keys = malloc(num_pages * table->key_size);
+    run->filter = key_filter_create(num_cells);
+    uint32_t page_num = first_page_num;
+    for (uint32_t i = 0; i < num_pages; i++)
+    {
+        void *page = get_page(table->pager, page_num);
+        run->pages[i] = page_num;
+        memcpy(run->first_keys + i * table->key_size, lsm_run_cell(table, page, 0), table->key_size);
+        for (uint32_t j = 0; j < *lsm_run_num_cells(page); j++)
+        {
+            key_filter_add(run->filter, lsm_run_cell(table, page, j), table->key_size);
+        }
+        page_num = *lsm_run_next_page(page);
+    }
+}
+
+/**
+ * @description: 释放有序段的内存结构
+ * @param {bool} free_pages 是否同时把页面放回空闲链表(合并之后丢弃输入段时)
+ */
+void lsm_run_free(Table *table, LsmRun *run, bool free_pages)
+{
+    if (free_pages)
+    {
+        for (uint32_t i = 0; i < run->num_pages; i++)
+        {
+            pager_free_page(table->pager, run->pages[i]);
+        }
+    }
+    free(run->pages);
+    free(run->first_keys);
+    key_filter_free(run->filter);
+}
+
+
+/**
+ * @description: 在一个有序段中查找主键
+ * @param {Table} *table
+ * @param {LsmRun} *run
+ * @param {void} *key
+ * @param {void} *value 可以为NULL
+ * @return {*}
+ * @note: 过滤器判定不存在时不读页面；否则在稀疏索引中二分找到唯一可能的页，只读这一页
+ */
+bool lsm_run_get(Table *table, LsmRun *run, const void *key, void *value)
+{
+    if (!key_filter_may_contain(run->filter, key, table->key_size))
+    {
+        return false;
+    }
+    // 最后一个第一个主键<=key的页
+    uint32_t page_index = key_lower_bound(table->key_type, table->key_size, run->first_keys,
+                                          table->key_size, run->num_pages, key);
+    if (page_index == run->num_pages ||
+        compare_keys(table->key_type, table->key_size, run->first_keys + page_index * table->key_size,
+                     key) != 0)
+    {
+        if (page_index == 0)
+        {
+            return false;
+        }
+        page_index--;
+    }
+    void *page = get_page(table->pager, run->pages[page_index]);
+    uint32_t num_cells = *lsm_run_num_cells(page);
+    uint32_t cell_num = key_lower_bound(table->key_type, table->key_size, lsm_run_cell(table, page, 0),
+                                        table->key_size + table->value_size, num_cells, key);
+    if (cell_num == num_cells ||
+        compare_keys(table->key_type, table->key_size, lsm_run_cell(table, page, cell_num), key) != 0)
+    {
+        return false;
+    }
+    if (value != NULL)
+    {
+        memcpy(value, lsm_run_cell(table, page, cell_num) + table->key_size, table->value_size);
+    }
+    return true;
+}
+
+
+/**
+ * @description: 归并来源当前的单元格，结束时返回NULL
+ */
+void *lsm_iterator_cell(LsmIterator *iterator)
+{
+    if (iterator->run == NULL)
+    {
+        return iterator->node == NULL ? NULL : iterator->node->cell;
+    }
+    if (iterator->page_index == iterator->run->num_pages)
+    {
+        return NULL;
+    }
+    void *page = get_page(iterator->table->pager, iterator->run->pages[iterator->page_index]);
+    return lsm_run_cell(iterator->table, page, iterator->cell_num);
+}
+
+void lsm_iterator_advance(LsmIterator *iterator)
+{
+    if (iterator->run == NULL)
+    {
+        iterator->node = iterator->node->next[0];
+        return;
+    }
+    void *page = get_page(iterator->table->pager, iterator->run->pages[iterator->page_index]);
+    iterator->cell_num++;
+    if (iterator->cell_num == *lsm_run_num_cells(page))
+    {
+        iterator->page_index++;
+        iterator->cell_num = 0;
+    }
+}
+
+
+/**
+ * @description: 归并内存表和若干有序段
+ * @param {Table} *table
+ * @param {LsmMemtable} *memtable 可以为NULL
+ * @param {LsmRun} *runs 从新到旧
+ * @param {uint32_t} num_runs
+ * @param {uint32_t} *num_cells 输出单元格数
+ * @return {*} 按主键排序的单元格，调用者释放
+ * @note: 内存表最新。同一主键出现在多个来源中时取最新的来源，其余的跳过
+ */
+uint8_t *lsm_merge(Table *table, LsmMemtable *memtable, LsmRun *runs, uint32_t num_runs, uint32_t *num_cells)
+{
+    uint32_t cell_size = table->key_size + table->value_size;
+    LsmIterator iterators[LSM_MAX_RUNS + 1];
+    uint32_t num_iterators = 0;
+    uint32_t capacity = memtable != NULL ? memtable->num_rows : 0;
+    if (memtable != NULL)
+    {
+        iterators[num_iterators].table = table;
+        iterators[num_iterators].node = memtable->head->next[0];
+        iterators[num_iterators].run = NULL;
+        num_iterators++;
+    }
+    for (uint32_t i = 0; i < num_runs; i++)
+    {
+        iterators[num_iterators].table = table;
+        iterators[num_iterators].node = NULL;
+        iterators[num_iterators].run = &(runs[i]);
+        iterators[num_iterators].page_index = 0;
+        iterators[num_iterators].cell_num = 0;
+        num_iterators++;
+        capacity += runs[i].num_cells;
+    }
+
+    uint8_t *cells = malloc(capacity > 0 ? capacity * cell_size : 1);
+    uint32_t count = 0;
+    while (true)
+    {
+        int32_t newest = -1;
+        void *smallest = NULL;
+        for (uint32_t i = 0; i < num_iterators; i++)
+        {
+            void *cell = lsm_iterator_cell(&(iterators[i]));
+            // 主键相同时保留下标小(更新)的来源
+            if (cell != NULL &&
+                (smallest == NULL || compare_keys(table->key_type, table->key_size, cell, smallest) < 0))
+            {
+                newest = i;
+                smallest = cell;
+            }
+        }
+        if (newest < 0)
+        {
+            break;
+        }
+        memcpy(cells + count * cell_size, smallest, cell_size);
+        for (uint32_t i = 0; i < num_iterators; i++)
+        {
+            void *cell = lsm_iterator_cell(&(iterators[i]));
+            if (cell != NULL &&
+                compare_keys(table->key_type, table->key_size, cell, cells + count * cell_size) == 0)
+            {
+                lsm_iterator_advance(&(iterators[i]));
+            }
+        }
+        count++;
+    }
+    *num_cells = count;
+    return cells;
+}
+
+
+/**
+ * @description: 把有序段的列表写入目录页
+ * @note: 调用者独占地持有lsm->lock
+ */
+void lsm_save_directory(Table *table)
+{
+    LsmTree *lsm = table->lsm;
+    void *directory = get_page(table->pager, table->root_page_num);
+    *(uint32_t *)(directory + LSM_DIRECTORY_NUM_RUNS_OFFSET) = lsm->num_runs;
+    for (uint32_t i = 0; i < lsm->num_runs; i++)
+    {
+        void *entry = directory + LSM_DIRECTORY_RUNS_OFFSET + i * LSM_DIRECTORY_RUN_SIZE;
+        *(uint32_t *)(entry + LSM_DIRECTORY_RUN_LEVEL_OFFSET) = lsm->runs[i].level;
+        *(uint32_t *)(entry + LSM_DIRECTORY_RUN_FIRST_PAGE_OFFSET) = lsm->runs[i].pages[0];
+        *(uint32_t *)(entry + LSM_DIRECTORY_RUN_NUM_PAGES_OFFSET) = lsm->runs[i].num_pages;
+        *(uint32_t *)(entry + LSM_DIRECTORY_RUN_NUM_CELLS_OFFSET) = lsm->runs[i].num_cells;
+    }
+}
+
+/**
+ * @description: 把新的有序段放到列表中它的位置
+ * @note: 第0层的段放在最前面(最新)，其余的段放在所有层号不大于它的段之后。调用者独占地持有lsm->lock
+ */
+void lsm_install_run(LsmTree *lsm, LsmRun *run)
+{
+    uint32_t position = 0;
+    if (run->level > 0)
+    {
+        while (position < lsm->num_runs && lsm->runs[position].level <= run->level)
+        {
+            position++;
+        }
+    }
+    memmove(&(lsm->runs[position + 1]), &(lsm->runs[position]), (lsm->num_runs - position) * sizeof(LsmRun));
+    lsm->runs[position] = *run;
+    lsm->num_runs += 1;
+}
+
+
+/**
+ * @description: 把内存表写成第0层的有序段，换上新的空内存表
+ * @param {Table} *table
+ * @return {*}
+ * @note: 调用者独占地持有lsm->lock，并保证列表还有空位。内存表为空时什么也不做
+ */
+void lsm_flush_memtable(Table *table)
+{
+    LsmTree *lsm = table->lsm;
+    if (lsm->memtable->num_rows == 0)
+    {
+        return;
+    }
+    uint32_t num_cells;
+    uint8_t *cells = lsm_merge(table, lsm->memtable, NULL, 0, &num_cells);
+    LsmRun run;
+    lsm_run_build(table, cells, num_cells, 0, &run);
+    free(cells);
+    lsm_install_run(lsm, &run);
+    lsm_save_directory(table);
+    lsm_memtable_free(lsm->memtable);
+    lsm->memtable = lsm_memtable_create();
+}
+
+
+/**
+ * @description: 第level层(>=1)的容量，单位是行
+ */
+uint32_t lsm_level_max_rows(uint32_t level)
+{
+    uint32_t max_rows = LSM_LEVEL_BASE_ROWS;
+    for (uint32_t i = 1; i < level; i++)
+    {
+        max_rows *= LSM_LEVEL_SIZE_RATIO;
+    }
+    return max_rows;
+}
+
+/**
+ * @description: 做一次合并
+ * @param {Table} *table
+ * @return {*} 是否有需要合并的段
+ * @note: 第0层的段数达到阈值时把它们连同第1层合并成新的第1层；否则找第一个超过容量的层，和下一层合并。
+ *        选定输入后释放lsm->lock再归并和写出，写者可以继续写内存表、增加第0层的段；
+ *        输入段不会被别人修改或释放，最后独占地替换输入段并释放它们的页面
+ */
+bool lsm_compact(Table *table)
+{
+    LsmTree *lsm = table->lsm;
+    LsmRun inputs[LSM_MAX_RUNS];
+    uint32_t num_inputs = 0;
+    uint32_t output_level = 0;
+
+    pthread_mutex_lock(&(lsm->compact_mutex));
+    pthread_rwlock_rdlock(&(lsm->lock));
+    uint32_t num_level0 = 0;
+    while (num_level0 < lsm->num_runs && lsm->runs[num_level0].level == 0)
+    {
+        num_level0++;
+    }
+    if (num_level0 >= LSM_L0_COMPACTION_TRIGGER)
+    {
+        num_inputs = num_level0;
+        if (num_level0 < lsm->num_runs && lsm->runs[num_level0].level == 1)
+        {
+            num_inputs++;
+        }
+        memcpy(inputs, lsm->runs, num_inputs * sizeof(LsmRun));
+        output_level = 1;
+    }
+    else
+    {
+        for (uint32_t i = num_level0; i < lsm->num_runs; i++)
+        {
+            if (lsm->runs[i].num_cells > lsm_level_max_rows(lsm->runs[i].level))
+            {
+                inputs[num_inputs++] = lsm->runs[i];
+                if (i + 1 < lsm->num_runs && lsm->runs[i + 1].level == lsm->runs[i].level + 1)
+                {
+                    inputs[num_inputs++] = lsm->runs[i + 1];
+                }
+                output_level = lsm->runs[i].level + 1;
+                break;
+            }
+        }
+    }
+    pthread_rwlock_unlock(&(lsm->lock));
+    if (num_inputs == 0)
+    {
+        pthread_mutex_unlock(&(lsm->compact_mutex));
+        return false;
+    }
+
+    uint32_t num_cells;
+    uint8_t *cells = lsm_merge(table, NULL, inputs, num_inputs, &num_cells);
+    LsmRun output;
+    lsm_run_build(table, cells, num_cells, output_level, &output);
+    free(cells);
+
+    pthread_rwlock_wrlock(&(lsm->lock));
+    for (uint32_t i = 0; i < num_inputs; i++)
+    {
+        for (uint32_t j = 0; j < lsm->num_runs; j++)
+        {
+            if (lsm->runs[j].pages[0] == inputs[i].pages[0])
+            {
+                memmove(&(lsm->runs[j]), &(lsm->runs[j + 1]), (lsm->num_runs - j - 1) * sizeof(LsmRun));
+                lsm->num_runs -= 1;
+                break;
+            }
+        }
+    }
+    lsm_install_run(lsm, &output);
+    lsm_save_directory(table);
+    // 读者都持有lsm->lock，独占之后没有读者还在读输入段
+    for (uint32_t i = 0; i < num_inputs; i++)
+    {
+        lsm_run_free(table, &(inputs[i]), true);
+    }
+    pthread_rwlock_unlock(&(lsm->lock));
+    pthread_mutex_unlock(&(lsm->compact_mutex));
+    return true;
+}
+
+/**
+ * @description: .vacuum：把内存表和所有有序段合并成一个
+ * @param {Table} *table
+ * @return {*}
+ * @note: 结果放在现有最深的一层(至少第1层)。整个过程独占lsm->lock
+ */
+void lsm_compact_all(Table *table)
+{
+    LsmTree *lsm = table->lsm;
+    pthread_mutex_lock(&(lsm->compact_mutex));
+    pthread_rwlock_wrlock(&(lsm->lock));
+    uint32_t num_cells;
+    uint8_t *cells = lsm_merge(table, lsm->memtable, lsm->runs, lsm->num_runs, &num_cells);
+    uint32_t level = 1;
+    for (uint32_t i = 0; i < lsm->num_runs; i++)
+    {
+        if (lsm->runs[i].level > level)
+        {
+            level = lsm->runs[i].level;
+        }
+    }
+    for (uint32_t i = 0; i < lsm->num_runs; i++)
+    {
+        lsm_run_free(table, &(lsm->runs[i]), true);
+    }
+    lsm->num_runs = 0;
+    if (num_cells > 0)
+    {
+        LsmRun run;
+        lsm_run_build(table, cells, num_cells, level, &run);
+        lsm_install_run(lsm, &run);
+    }
+    free(cells);
+    lsm_save_directory(table);
+    lsm_memtable_free(lsm->memtable);
+    lsm->memtable = lsm_memtable_create();
+    pthread_rwlock_unlock(&(lsm->lock));
+    pthread_mutex_unlock(&(lsm->compact_mutex));
+}
+
+
+/**
+ * @description: 后台合并线程
+ * @param {void} *arg Table
+ * @return {*}
+ * @note: 被唤醒后一直合并到没有需要合并的段，然后通知等待的写者
+ */
+void *lsm_compaction_thread(void *arg)
+{
+    Table *table = arg;
+    LsmTree *lsm = table->lsm;
+    pthread_mutex_lock(&(lsm->work_mutex));
+    while (!lsm->stopping)
+    {
+        if (!lsm->work_pending)
+        {
+            pthread_cond_wait(&(lsm->work_cond), &(lsm->work_mutex));
+            continue;
+        }
+        lsm->work_pending = false;
+        pthread_mutex_unlock(&(lsm->work_mutex));
+        while (lsm_compact(table))
+        {
+        }
+        pthread_mutex_lock(&(lsm->work_mutex));
+        pthread_cond_broadcast(&(lsm->done_cond));
+    }
+    pthread_mutex_unlock(&(lsm->work_mutex));
+    return NULL;
+}
+
+/**
+ * @description: 唤醒后台线程
+ * @param {LsmTree} *lsm
+ * @param {bool} wait 是否等到这一轮合并完成
+ * @return {*}
+ * @note: 调用者不能持有lsm->lock
+ */
+void lsm_notify(LsmTree *lsm, bool wait)
+{
+    pthread_mutex_lock(&(lsm->work_mutex));
+    lsm->work_pending = true;
+    pthread_cond_signal(&(lsm->work_cond));
+    if (wait)
+    {
+        pthread_cond_wait(&(lsm->done_cond), &(lsm->work_mutex));
+    }
+    pthread_mutex_unlock(&(lsm->work_mutex));
+}
+
+
+/**
+ * @description: 打开日志结构合并树：读取目录中的有序段，启动后台线程
+ * @param {Table} *table root_page_num是目录页
+ * @return {*}
+ * @note: 上次关闭时内存表已经写出，打开时内存表为空
+ */
+void lsm_open(Table *table)
+{
+    LsmTree *lsm = malloc(sizeof(LsmTree));
+    table->lsm = lsm;
+    lsm->memtable = lsm_memtable_create();
+    lsm->random = 88172645463325252ULL;
+    void *directory = get_page(table->pager, table->root_page_num);
+    lsm->num_runs = *(uint32_t *)(directory + LSM_DIRECTORY_NUM_RUNS_OFFSET);
+    for (uint32_t i = 0; i < lsm->num_runs; i++)
+    {
+        void *entry = directory + LSM_DIRECTORY_RUNS_OFFSET + i * LSM_DIRECTORY_RUN_SIZE;
+        lsm_run_load(table, *(uint32_t *)(entry + LSM_DIRECTORY_RUN_LEVEL_OFFSET),
+                     *(uint32_t *)(entry + LSM_DIRECTORY_RUN_FIRST_PAGE_OFFSET),
+                     *(uint32_t *)(entry + LSM_DIRECTORY_RUN_NUM_PAGES_OFFSET),
+                     *(uint32_t *)(entry + LSM_DIRECTORY_RUN_NUM_CELLS_OFFSET), &(lsm->runs[i]));
+    }
+    pthread_rwlock_init(&(lsm->lock), NULL);
+    pthread_mutex_init(&(lsm->compact_mutex), NULL);
+    pthread_mutex_init(&(lsm->work_mutex), NULL);
+    pthread_cond_init(&(lsm->work_cond), NULL);
+    pthread_cond_init(&(lsm->done_cond), NULL);
+    lsm->work_pending = false;
+    lsm->stopping = false;
+    pthread_create(&(lsm->thread), NULL, lsm_compaction_thread, table);
+}
+
+/**
+ * @description: 停止后台线程，把内存表写成有序段，释放内存结构
+ * @param {Table} *table
+ * @return {*}
+ * @note: 在db_close写回页面之前调用。列表已满时先在当前线程合并腾出空位
+ */
+void lsm_close(Table *table)
+{
+    LsmTree *lsm = table->lsm;
+    pthread_mutex_lock(&(lsm->work_mutex));
+    lsm->stopping = true;
+    pthread_cond_signal(&(lsm->work_cond));
+    pthread_mutex_unlock(&(lsm->work_mutex));
+    pthread_join(lsm->thread, NULL);
+
+    while (lsm->num_runs >= LSM_MAX_RUNS && lsm_compact(table))
+    {
+    }
+    pthread_rwlock_wrlock(&(lsm->lock));
+    lsm_flush_memtable(table);
+    pthread_rwlock_unlock(&(lsm->lock));
+
+    for (uint32_t i = 0; i < lsm->num_runs; i++)
+    {
+        lsm_run_free(table, &(lsm->runs[i]), false);
+    }
+    lsm_memtable_free(lsm->memtable);
+    pthread_rwlock_destroy(&(lsm->lock));
+    pthread_mutex_destroy(&(lsm->compact_mutex));
+    pthread_mutex_destroy(&(lsm->work_mutex));
+    pthread_cond_destroy(&(lsm->work_cond));
+    pthread_cond_destroy(&(lsm->done_cond));
+    free(lsm);
+    table->lsm = NULL;
+}
+
+
+/**
+ * @description: 按主键读取一行
+ * @param {Table} *table
+ * @param {void} *key
+ * @param {void} *value 可以为NULL
+ * @return {*}
+ * @note: 依次查内存表和从新到旧的有序段，第一个找到的就是最新值。调用者持有lsm->lock
+ */
+bool lsm_lookup(Table *table, const void *key, void *value)
+{
+    LsmTree *lsm = table->lsm;
+    LsmNode *node = lsm_memtable_seek(table, lsm->memtable, key, NULL);
+    if (node != NULL && compare_keys(table->key_type, table->key_size, node->cell, key) == 0)
+    {
+        if (value != NULL)
+        {
+            memcpy(value, node->cell + table->key_size, table->value_size);
+        }
+        return true;
+    }
+    for (uint32_t i = 0; i < lsm->num_runs; i++)
+    {
+        if (lsm_run_get(table, &(lsm->runs[i]), key, value))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool lsm_get(Table *table, const void *key, void *value)
+{
+    pthread_rwlock_rdlock(&(table->lsm->lock));
+    bool found = lsm_lookup(table, key, value);
+    pthread_rwlock_unlock(&(table->lsm->lock));
+    return found;
+}
+
+
+/**
+ * @description: 日志结构合并树上的table_put
+ * @param {Table} *table
+ * @param {void} *key
+ * @param {void} *value
+ * @param {PutMode} mode
+ * @param {void} *old_value 非NULL且主键已存在时，输出被覆盖的旧值
+ * @return {*}
+ * @note: 独占lsm->lock，查找主键判断是否存在后写入内存表。内存表已满时先把它写成第0层的有序段，
+ *        第0层的段数达到阈值时唤醒后台线程；列表没有空位时等后台线程合并完再写
+ */
+ExecuteResult lsm_put(Table *table, const void *key, const void *value, PutMode mode, void *old_value)
+{
+    LsmTree *lsm = table->lsm;
+    pthread_rwlock_wrlock(&(lsm->lock));
+    while (lsm->memtable->num_rows >= LSM_MEMTABLE_MAX_ROWS && lsm->num_runs >= LSM_MAX_RUNS)
+    {
+        pthread_rwlock_unlock(&(lsm->lock));
+        lsm_notify(lsm, true);
+        pthread_rwlock_wrlock(&(lsm->lock));
+    }
+
+    ExecuteResult result = EXECUTE_SUCCESS;
+    bool exists = lsm_lookup(table, key, mode == PUT_INSERT ? NULL : old_value);
+    if (exists && mode == PUT_INSERT)
+    {
+        result = EXECUTE_DUPLICATE_KEY;
+    }
+    else if (!exists && mode == PUT_UPDATE)
+    {
+        result = EXECUTE_KEY_NONE;
+    }
+    else
+    {
+        if (lsm->memtable->num_rows >= LSM_MEMTABLE_MAX_ROWS)
+        {
+            lsm_flush_memtable(table);
+        }
+        lsm_memtable_put(table, key, value);
+    }
+    bool compact = lsm->num_runs > 0 && lsm->runs[0].level == 0 &&
+                   (lsm->num_runs >= LSM_L0_COMPACTION_TRIGGER &&
+                    lsm->runs[LSM_L0_COMPACTION_TRIGGER - 1].level == 0);
+    pthread_rwlock_unlock(&(lsm->lock));
+    if (compact)
+    {
+        lsm_notify(lsm, false);
+    }
+    return result;
+}
+
+
+/**
+ * @description: 日志结构合并树上的select
+ * @param {Statement} *statement
+ * @param {Table} *table
+ * @return {*}
+ * @note: 主键等值条件只做一次查找；其余情况共享地持有lsm->lock归并内存表和所有有序段，
+ *        得到的行已经按主键排序，desc、limit和offset和B树一致，代价是O(n)
+ */
+ExecuteResult lsm_select(Statement *statement, Table *table)
+{
+    KeyRange *range = &(statement->select_range);
+    uint32_t columns = statement->select_columns | statement->select_filter_column;
+    uint8_t key[KEY_MAX_SIZE];
+    uint8_t value[ROW_SIZE];
+    Row row;
+    memset(&row, 0, sizeof(row));
+
+    if (range->has_lower && !key_fits(table->key_type, &(range->lower)))
+    {
+        return EXECUTE_SUCCESS;
+    }
+    if (key_range_is_point(range))
+    {
+        encode_key(table->key_type, &(range->lower), key);
+        if (statement->select_limit > 0 && table_get(table, key, value))
+        {
+            deserialize_row(table->pager, value, &row, columns);
+            if (row_matches_filter(statement, &row))
+            {
+                select_output_row(statement, &row, table->key_type);
+            }
+        }
+        return EXECUTE_SUCCESS;
+    }
+
+    LsmTree *lsm = table->lsm;
+    uint32_t cell_size = table->key_size + table->value_size;
+    uint32_t num_cells;
+    pthread_rwlock_rdlock(&(lsm->lock));
+    uint8_t *cells = lsm_merge(table, lsm->memtable, lsm->runs, lsm->num_runs, &num_cells);
+    pthread_rwlock_unlock(&(lsm->lock));
+
+    uint32_t num_matches = 0;
+    for (uint32_t i = 0; i < num_cells; i++)
+    {
+        Key cell_key;
+        decode_key(table->key_type, cells + i * cell_size, &cell_key);
+        if (key_range_contains(range, &cell_key))
+        {
+            memmove(cells + num_matches * cell_size, cells + i * cell_size, cell_size);
+            num_matches++;
+        }
+    }
+    for (uint32_t i = 0; i < num_matches && statement->select_num_rows < statement->select_limit; i++)
+    {
+        uint32_t position = statement->select_descending ? num_matches - 1 - i : i;
+        deserialize_row(table->pager, cells + position * cell_size + table->key_size, &row, columns);
+        if (row_matches_filter(statement, &row))
+        {
+            select_output_row(statement, &row, table->key_type);
+        }
+    }
+    free(cells);
+    return EXECUTE_SUCCESS;
+}
+
+
+/**
+ * @description: .btree在日志结构合并树上输出内存表和每个有序段中的主键
+ * @param {Table} *table
+ * @return {*}
+ * @note: 有序段按查找的顺序(从新到旧)输出
+ */
+void print_lsm(Table *table)
+{
+    LsmTree *lsm = table->lsm;
+    Key key;
+    pthread_rwlock_rdlock(&(lsm->lock));
+    printf("- memtable (size %d)\n", lsm->memtable->num_rows);
+    for (LsmNode *node = lsm->memtable->head->next[0]; node != NULL; node = node->next[0])
+    {
+        decode_key(table->key_type, node->cell, &key);
+        indent(1);
+        printf("- ");
+        print_key(table->key_type, &key);
+        printf("\n");
+    }
+    for (uint32_t i = 0; i < lsm->num_runs; i++)
+    {
+        LsmRun *run = &(lsm->runs[i]);
+        printf("- run (level %d, pages %d, size %d)\n", run->level, run->num_pages, run->num_cells);
+        for (uint32_t j = 0; j < run->num_pages; j++)
+        {
+            void *page = get_page(table->pager, run->pages[j]);
+            for (uint32_t k = 0; k < *lsm_run_num_cells(page); k++)
+            {
+                decode_key(table->key_type, lsm_run_cell(table, page, k), &key);
+                indent(1);
+                printf("- ");
+                print_key(table->key_type, &key);
+                printf("\n");
+            }
+        }
+    }
+    pthread_rwlock_unlock(&(lsm->lock));
+}
@@ -0,0 +1,141 @@
+/*
+ * @Author: WangZhe
+ * @Date: 2026-10-21 16:25:41
+ * @LastEditors: WangZhe
+ * @LastEditTime: 2026-10-21 19:48:03
+ * @FilePath: /Sqlite/MultiGet.c
+ * @Description: 成批按主键查找：排序后逐层一起下降，共享的节点只访问一次，下一层的页面提前预取
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include"Sqlite.h"
+
+
+/**
+ * @description: 预取节点开头的MULTI_GET_PREFETCH_LINES个缓存行(头部和前面的单元格)
+ */
+void page_prefetch(void *page)
+{
+    for (uint32_t i = 0; i < MULTI_GET_PREFETCH_LINES; i++)
+    {
+        __builtin_prefetch((uint8_t *)page + i * 64, 0, 3);
+    }
+}
+
+/**
+ * @description: 一次查找多个主键
+ * @param {Table} *table
+ * @param {uint8_t} *keys num_keys个编码后的主键，顺序任意，可以重复
+ * @param {uint32_t} num_keys
+ * @param {uint8_t} *values 输出，第i个主键的值写在values + i * table->value_size
+ * @param {bool} *found 输出，第i个主键是否存在
+ * @return {*}
+ * @note: B树(非写时复制)上按主键排序后逐层一起下降：同一层落在同一个节点上的主键是连续的一段，
+ *        这个节点只闩住一次，依次为每个主键选孩子；所有孩子的页面在访问下一层之前一起预取，
+ *        各个主键的缓存缺失互相重叠，而不是一次下降等一次。主键越过节点的高键时和internal_node_find一样向右移动。
+ *        过滤器判定不存在的主键不参与下降。其他存取方式和写时复制模式逐个交给table_get
+ */
+void table_multi_get(Table *table, const uint8_t *keys, uint32_t num_keys, uint8_t *values, bool *found)
+{
+    if (table->access_method != ACCESS_BTREE || table->pager->copy_on_write)
+    {
+        for (uint32_t i = 0; i < num_keys; i++)
+        {
+            found[i] = table_get(table, keys + i * table->key_size, values + i * table->value_size);
+        }
+        return;
+    }
+
+    Pager *pager = table->pager;
+    vacuum_read_lock(pager);
+    KeyEntry *entries = malloc(num_keys * sizeof(KeyEntry) + 1);
+    for (uint32_t i = 0; i < num_keys; i++)
+    {
+        decode_key(table->key_type, keys + i * table->key_size, &(entries[i].key));
+        entries[i].position = i;
+    }
+    qsort(entries, num_keys, sizeof(KeyEntry), compare_key_entries);
+
+    // active是还在下降的主键(按主键顺序)，pages是它们当前所在的页
+    uint32_t *active = malloc(num_keys * sizeof(uint32_t) + 1);
+    uint32_t *pages = malloc(num_keys * sizeof(uint32_t) + 1);
+    uint32_t num_active = 0;
+    uint32_t root_page_num = table->root_page_num;
+    for (uint32_t i = 0; i < num_keys; i++)
+    {
+        uint32_t position = entries[i].position;
+        found[position] = false;
+        if (table->key_filter != NULL &&
+            !key_filter_may_contain(table->key_filter, keys + position * table->key_size, table->key_size))
+        {
+            continue;
+        }
+        active[num_active++] = position;
+        pages[position] = root_page_num;
+    }
+
+    while (num_active > 0)
+    {
+        uint32_t num_next = 0;
+        uint32_t i = 0;
+        while (i < num_active)
+        {
+            uint32_t group_page_num = pages[active[i]];
+            uint32_t page_num = group_page_num;
+            page_latch(pager, page_num, LATCH_SHARED);
+            void *node = get_page(pager, page_num);
+            uint32_t j = i;
+            for (; j < num_active && pages[active[j]] == group_page_num; j++)
+            {
+                uint32_t position = active[j];
+                const uint8_t *key = keys + position * table->key_size;
+                while (!node_covers_key(node, key))
+                {
+                    uint32_t sibling_page_num = node_right_sibling(node);
+                    page_latch(pager, sibling_page_num, LATCH_SHARED);
+                    page_unlatch(pager, page_num);
+                    page_num = sibling_page_num;
+                    node = get_page(pager, page_num);
+                }
+
+                if (get_node_type(node) == NODE_LEAF)
+                {
+                    uint32_t num_cells = *leaf_node_num_cells(node);
+                    uint32_t cell_num = key_lower_bound(table->key_type, table->key_size, leaf_node_key(node, 0),
+                                                        leaf_node_cell_size(node), num_cells, key);
+                    if (cell_num < num_cells &&
+                        compare_keys(table->key_type, table->key_size, leaf_node_key(node, cell_num), key) == 0)
+                    {
+                        found[position] = true;
+                        memcpy(values + position * table->value_size, leaf_node_value(node, cell_num),
+                               table->value_size);
+                    }
+                    continue;
+                }
+                uint32_t child_index = internal_node_find_child(node, key);
+                uint32_t child_page_num = *internal_node_child(node, child_index);
+                page_prefetch(get_child_page(pager, node, child_index, child_page_num));
+                pages[position] = child_page_num;
+                // num_next <= j，覆盖的都是已经处理过的位置
+                active[num_next++] = position;
+            }
+            page_unlatch(pager, page_num);
+            i = j;
+        }
+        num_active = num_next;
+    }
+
+    free(entries);
+    free(active);
+    free(pages);
+    vacuum_read_unlock(pager);
+}
@@ -0,0 +1,115 @@
+/*
+ * @Author: WangZhe
+ * @Date: 2026-10-18 22:10:31
+ * @LastEditors: WangZhe
+ * @LastEditTime: 2026-10-18 22:58:12
+ * @FilePath: /Sqlite/Overflow.c
+ * @Description: 溢出页链表，存放单元格中放不下的大字段
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include"Sqlite.h"
+
+
+/**
+ * @description: 溢出页开头保存链表中下一页的页码，0表示链表结束
+ */
+uint32_t *overflow_page_next(void *page)
+{
+    return page + OVERFLOW_NEXT_PAGE_OFFSET;
+}
+
+
+/**
+ * @description: 把数据写入新分配的溢出页链表
+ * @param {Pager} *pager
+ * @param {char} *source
+ * @param {uint32_t} length
+ * @return {*} 链表第一页的页码，length为0时返回0
+ * @note: 页面从空闲链表或文件末尾分配
+ */
+uint32_t overflow_write(Pager *pager, const char *source, uint32_t length)
+{
+    uint32_t first_page_num = 0;
+    void *previous = NULL;
+
+    while (length > 0)
+    {
+        uint32_t page_num = get_unused_page_num(pager);
+        void *page = get_page(pager, page_num);
+        uint32_t chunk = length < OVERFLOW_PAGE_SPACE ? length : OVERFLOW_PAGE_SPACE;
+
+        *overflow_page_next(page) = 0;
+        memcpy(page + OVERFLOW_PAGE_HEADER_SIZE, source, chunk);
+
+        if (previous == NULL)
+        {
+            first_page_num = page_num;
+        }
+        else
+        {
+            *overflow_page_next(previous) = page_num;
+        }
+        previous = page;
+        source += chunk;
+        length -= chunk;
+    }
+    return first_page_num;
+}
+
+
+/**
+ * @description: 沿着溢出页链表读取length个字节
+ * @param {Pager} *pager
+ * @param {uint32_t} page_num 链表第一页
+ * @param {char} *destination
+ * @param {uint32_t} length
+ * @return {*}
+ * @note:
+ */
+void overflow_read(Pager *pager, uint32_t page_num, char *destination, uint32_t length)
+{
+    while (length > 0)
+    {
+        if (page_num == 0)
+        {
+            printf("Overflow chain ended early. Corrupt file.\n");
+            exit(EXIT_FAILURE);
+        }
+        void *page = get_page(pager, page_num);
+        uint32_t chunk = length < OVERFLOW_PAGE_SPACE ? length : OVERFLOW_PAGE_SPACE;
+
+        memcpy(destination, page + OVERFLOW_PAGE_HEADER_SIZE, chunk);
+        destination += chunk;
+        length -= chunk;
+        page_num = *overflow_page_next(page);
+    }
+}
+
+
+/**
+ * @description: 把整条溢出页链表归还到空闲链表
+ * @param {Pager} *pager
+ * @param {uint32_t} page_num 链表第一页，0表示没有溢出页
+ * @return {*}
+ * @note:
+ */
+void overflow_free(Pager *pager, uint32_t page_num)
+{
+    while (page_num != 0)
+    {
+        void *page = get_page(pager, page_num);
+        uint32_t next_page_num = *overflow_page_next(page);
+        pager_free_page(pager, page_num);
+        page_num = next_page_num;
+    }
+}
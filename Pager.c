@@ -7,6 +7,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include"Sqlite.h"
 
@@ -20,19 +21,28 @@
  * @param {Pager} *pager
  * @param {uint32_t} page_num
  * @return {*}
- * @note: 
+ * @note: 命中缓存时不加锁；缺失时在pager->mutex下再检查一次，避免两个线程重复加载同一页
  */
 void *get_page(Pager *pager, uint32_t page_num)
 {
-    if (page_num > TABLE_MAX_PAGES)
+    if (page_num >= TABLE_MAX_PAGES)
     {
         printf("Tried to fetch page number out of bounds. %d > %d\n", page_num, TABLE_MAX_PAGES);
         exit(EXIT_FAILURE);
     }
+    void *cached = __atomic_load_n(&(pager->pages[page_num]), __ATOMIC_ACQUIRE);
+    if (cached != NULL)
+    {
+        return cached;
+    }
+
+    pthread_mutex_lock(&(pager->mutex));
     if (pager->pages[page_num] == NULL)
     {
-        // 缓存缺失，分配内存并加载文件
-        void *page = malloc(PAGE_SIZE);
+        // 缓存缺失，分配内存并加载文件，帧的尾部记下页码，还没有换成帧指针的孩子
+        void *page = malloc(FRAME_SIZE);
+        memset(page + PAGE_SIZE, 0, FRAME_SIZE - PAGE_SIZE);
+        *frame_page_num(page) = page_num;
         uint32_t num_pages = pager->file_length / PAGE_SIZE;
 
         // 可以在文件末尾保存部分页面
@@ -53,15 +63,70 @@ void *get_page(Pager *pager, uint32_t page_num)
                 exit(EXIT_FAILURE);
             }
         }
-        pager->pages[page_num] = page;
         if (page_num >= pager->num_pages)
         {
             pager->num_pages = page_num + 1;
         }
+        __atomic_store_n(&(pager->pages[page_num]), page, __ATOMIC_RELEASE);
     }
+    pthread_mutex_unlock(&(pager->mutex));
     return pager->pages[page_num];
 }
 
+/**
+ * @description: 帧尾部的字段，见FRAME_PAGE_NUM_OFFSET
+ */
+uint32_t *frame_page_num(void *frame)
+{
+    return frame + FRAME_PAGE_NUM_OFFSET;
+}
+
+void **frame_child(void *frame, uint32_t child_num)
+{
+    return frame + FRAME_CHILDREN_OFFSET + child_num * sizeof(void *);
+}
+
+/**
+ * @description: 下降时取得内部节点第child_num个孩子的页面
+ * @param {Pager} *pager
+ * @param {void} *node 调用者持有它的闩锁
+ * @param {uint32_t} child_num
+ * @param {uint32_t} child_page_num 单元格中的孩子页码
+ * @return {*}
+ * @note: 帧尾部换好的指针指向的帧页码和单元格一致时直接使用，不经过pager；否则(还没换，或者节点的单元格移动过)
+ *        走get_page再换上。帧在缓存中的地址不会变化，只有pager_truncate释放帧，它先调用frame_unswizzle_all。
+ *        同一个节点的读者可能同时换同一个孩子，写入的是同一个指针，用原子操作即可
+ */
+void *get_child_page(Pager *pager, void *node, uint32_t child_num, uint32_t child_page_num)
+{
+    void **slot = frame_child(node, child_num);
+    void *child = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (child != NULL && *frame_page_num(child) == child_page_num)
+    {
+        return child;
+    }
+    child = get_page(pager, child_page_num);
+    __atomic_store_n(slot, child, __ATOMIC_RELEASE);
+    return child;
+}
+
+/**
+ * @description: 把所有缓存的帧中换好的指针恢复成只用单元格中的页码
+ * @param {Pager} *pager
+ * @return {*}
+ * @note: 释放帧之前调用，调用者持有pager->mutex并保证没有别的线程在下降
+ */
+void frame_unswizzle_all(Pager *pager)
+{
+    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++)
+    {
+        if (pager->pages[i] != NULL)
+        {
+            memset(frame_child(pager->pages[i], 0), 0, (INTERNAL_NODE_MAX_CELLS + 1) * sizeof(void *));
+        }
+    }
+}
+
 /**
  * @description: 根据指定文件名打开文件，并初始化
  * @param {char} *filename
@@ -95,7 +160,29 @@ Pager *pager_open(const char *filename)
     for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++)
     {
         pager->pages[i] = NULL;
+        pthread_rwlock_init(&(pager->latches[i]), NULL);
+        pager->latch_exclusive[i] = false;
     }
+
+    // get_unused_page_num在持有锁时还会调用get_page，所以使用可重入锁
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&(pager->mutex), &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    // glibc的读写锁默认偏向读者：已经有读者时再加读锁不会排在等待的.vacuum之后，
+    // 持有游标的线程可以再打开游标
+    pthread_rwlock_init(&(pager->vacuum_lock), NULL);
+    pager->vacuuming = false;
+
+    pager->copy_on_write = false;
+    pager->txn_id = 0;
+    memset(pager->readers, 0, sizeof(pager->readers));
+    pager->retired_pages = NULL;
+    pager->retired_txns = NULL;
+    pager->num_retired = 0;
+    pager->retired_capacity = 0;
     return pager;
 }
 
@@ -134,24 +221,142 @@ void pager_flush(Pager *pager, uint32_t page_num)
 /**
  * @description: 打开数据库
  * @param {char} *filename
+ * @param {KeyType} key_type 新建数据库时使用的主键类型，打开已有文件时以文件头为准
+ * @param {bool} copy_on_write 新建数据库时是否使用写时复制模式，同样以文件头为准
+ * @param {AccessMethod} access_method 新建数据库时主表的存取方式，同样以文件头为准
  * @return {*}
  * @note: 
  */
-Table *db_open(const char *filename)
+Table *db_open(const char *filename, KeyType key_type, bool copy_on_write, AccessMethod access_method)
 {
+    check_node_layout();
     Pager *pager = pager_open(filename);
 
+    bool new_file = (pager->num_pages == 0);
+    void *header = get_page(pager, DB_HEADER_PAGE_NUM);
+    // 第一次打开：第0页写入文件头，第1页作为根节点(哈希表和日志结构合并树的目录页，哈希表的第2页是第一个桶)
+    if (new_file)
+    {
+        memset(header, 0, PAGE_SIZE);
+        memcpy(header + DB_HEADER_MAGIC_OFFSET, DB_HEADER_MAGIC, DB_HEADER_MAGIC_SIZE);
+        *db_header_root_page(header) = 1;
+        *db_header_free_head(header) = 0;
+        *db_header_key_type(header) = key_type;
+        *db_header_copy_on_write(header) = copy_on_write;
+        *db_header_access_method(header) = access_method;
+
+        void *root_node;
+        switch (access_method)
+        {
+        case (ACCESS_BTREE):
+        case (ACCESS_BETREE):
+            root_node = get_page(pager, 1);
+            initialize_leaf_node(root_node);
+            set_node_root(root_node, true);
+            set_node_key_format(root_node, key_type, key_type_size(key_type));
+            set_node_value_size(root_node, LEAF_NODE_VALUE_SIZE);
+            break;
+        case (ACCESS_HASH):
+            hash_initialize(pager, 1, 2);
+            break;
+        case (ACCESS_LSM):
+            // 空的目录页，还没有有序段
+            root_node = get_page(pager, 1);
+            memset(root_node, 0, PAGE_SIZE);
+            break;
+        }
+    }
+    else if (memcmp(header + DB_HEADER_MAGIC_OFFSET, DB_HEADER_MAGIC, DB_HEADER_MAGIC_SIZE) != 0)
+    {
+        printf("Db file has an unrecognized header.\n");
+        exit(EXIT_FAILURE);
+    }
+    pager->copy_on_write = *db_header_copy_on_write(header) != 0;
+    Table *table = table_open(pager, DB_HEADER_ROOT_PAGE_OFFSET, *db_header_key_type(header),
+                              LEAF_NODE_VALUE_SIZE);
+    table->access_method = *db_header_access_method(header);
+    for (uint32_t slot = 0; slot < TABLE_MAX_INDEXES; slot++)
+    {
+        if (*db_header_index_root(header, slot) != 0)
+        {
+            table->indexes[slot] = index_open(table, INDEX_COLUMNS[slot]);
+            table->num_indexes += 1;
+        }
+    }
+    // 日志结构合并树的每个有序段有自己的过滤器，不建立整张表的过滤器
+    if (table->access_method == ACCESS_LSM)
+    {
+        lsm_open(table);
+        return table;
+    }
+    // 过滤器扫描叶子建立，写优化模式下先把上次留在缓冲中的消息写入叶子
+    if (table->access_method == ACCESS_BETREE)
+    {
+        betree_flush_all(table);
+    }
+    table_filter_open(table);
+    return table;
+}
+
+
+
+/**
+ * @description: 打开pager中的一棵B树
+ * @param {Pager} *pager
+ * @param {uint32_t} root_offset 文件头中保存根页码的位置
+ * @param {KeyType} key_type
+ * @param {uint32_t} value_size 叶子单元格中值的字节数
+ * @return {*}
+ * @note: 主表和二级索引都通过它打开，根页码必须已经写入文件头
+ */
+Table *table_open(Pager *pager, uint32_t root_offset, KeyType key_type, uint32_t value_size)
+{
+    void *header = get_page(pager, DB_HEADER_PAGE_NUM);
     Table *table = malloc(sizeof(Table));
     table->pager = pager;
-    table->root_page_num = 0;
-    // 第一次打开
-    if (pager->num_pages == 0)
+    table->root_offset = root_offset;
+    table->root_page_num = *(uint32_t *)(header + root_offset);
+    table->key_type = key_type;
+    table->key_size = key_type_size(key_type);
+    table->value_size = value_size;
+    table->snapshot_root_page_num = table->root_page_num;
+    memset(table->indexes, 0, sizeof(table->indexes));
+    table->num_indexes = 0;
+    table->index_column = 0;
+    table->index_include = 0;
+    table->access_method = ACCESS_BTREE;
+    table->key_filter = NULL;
+    table->rightmost_leaf_page_num = INVALID_PAGE_NUM;
+    table->lsm = NULL;
+    table->front_index = NULL;
+    pthread_mutex_init(&(table->smo_mutex), NULL);
+    pthread_rwlock_init(&(table->count_lock), NULL);
+    pthread_rwlock_init(&(table->index_lock), NULL);
+    return table;
+}
+
+
+
+/**
+ * @description: 释放table_open分配的资源，不涉及页面
+ * @param {Table} *table
+ * @return {*}
+ * @note:
+ */
+void table_close(Table *table)
+{
+    pthread_mutex_destroy(&(table->smo_mutex));
+    pthread_rwlock_destroy(&(table->count_lock));
+    pthread_rwlock_destroy(&(table->index_lock));
+    if (table->key_filter != NULL)
     {
-        void *root_node = get_page(pager, 0);
-        initialize_leaf_node(root_node);
-        set_node_root(root_node, true);
+        key_filter_free(table->key_filter);
     }
-    return table;
+    if (table->front_index != NULL)
+    {
+        table_art_close(table);
+    }
+    free(table);
 }
 
 
@@ -165,6 +370,13 @@ Table *db_open(const char *filename)
 void db_close(Table *table)
 {
     Pager *pager = table->pager;
+    // 日志结构合并树先停止后台线程，把内存表写成有序段
+    if (table->lsm != NULL)
+    {
+        lsm_close(table);
+    }
+    // 关闭时已经没有读者，所有被替换下来的页面都可以放回空闲链表
+    snapshot_reclaim(pager);
     for (uint32_t i = 0; i < pager->num_pages; i++)
     {
         if (pager->pages[i] == NULL)
@@ -190,18 +402,218 @@ void db_close(Table *table)
             free(page);
             pager->pages[i] = NULL;
         }
+        pthread_rwlock_destroy(&(pager->latches[i]));
     }
+    pthread_mutex_destroy(&(pager->mutex));
+    pthread_rwlock_destroy(&(pager->vacuum_lock));
+    free(pager->retired_pages);
+    free(pager->retired_txns);
     free(pager);
-    free(table);
+    for (uint32_t slot = 0; slot < TABLE_MAX_INDEXES; slot++)
+    {
+        if (table->indexes[slot] != NULL)
+        {
+            table_close(table->indexes[slot]);
+        }
+    }
+    table_close(table);
 }
 
 /**
- * @description: 除非我们开始回收空闲页面，否则总会有新的页面转到数据库文件的末尾?
+ * @description: 优先复用空闲链表中的页面，否则新的页面转到数据库文件的末尾
  * @param {Pager} *Pager
  * @return {*}
- * @note: 
+ * @note: 在pager->mutex下分配，文件末尾的新页面立即计入num_pages，两个线程不会拿到同一页
  */
 uint32_t get_unused_page_num(Pager *Pager)
 {
-    return Pager->num_pages;
+    pthread_mutex_lock(&(Pager->mutex));
+    void *header = get_page(Pager, DB_HEADER_PAGE_NUM);
+    uint32_t free_head = *db_header_free_head(header);
+    uint32_t page_num;
+    if (free_head != 0)
+    {
+        void *page = get_page(Pager, free_head);
+        *db_header_free_head(header) = *(uint32_t *)(page + FREE_PAGE_NEXT_OFFSET);
+        page_num = free_head;
+    }
+    else
+    {
+        page_num = Pager->num_pages;
+        Pager->num_pages += 1;
+    }
+    pthread_mutex_unlock(&(Pager->mutex));
+    return page_num;
+}
+
+
+/**
+ * @description: 释放不再使用的页面
+ * @param {Pager} *pager
+ * @param {uint32_t} page_num
+ * @return {*}
+ * @note: 写时复制模式下旧版本的读者可能还在读这个页面，推迟到没有快照引用它时再放回空闲链表
+ */
+void pager_free_page(Pager *pager, uint32_t page_num)
+{
+    if (pager->copy_on_write)
+    {
+        snapshot_retire_page(pager, page_num);
+        return;
+    }
+    pager_free_list_push(pager, page_num);
+}
+
+
+/**
+ * @description: 把页面放入空闲链表头部
+ * @param {Pager} *pager
+ * @param {uint32_t} page_num
+ * @return {*}
+ * @note: 
+ */
+void pager_free_list_push(Pager *pager, uint32_t page_num)
+{
+    pthread_mutex_lock(&(pager->mutex));
+    void *header = get_page(pager, DB_HEADER_PAGE_NUM);
+    void *page = get_page(pager, page_num);
+    memset(page, 0, PAGE_SIZE);
+    *(uint32_t *)(page + FREE_PAGE_NEXT_OFFSET) = *db_header_free_head(header);
+    *db_header_free_head(header) = page_num;
+    pthread_mutex_unlock(&(pager->mutex));
+}
+
+
+/**
+ * @description: 丢弃num_pages及之后的页面，并截断文件
+ * @param {Pager} *pager
+ * @param {uint32_t} num_pages 保留的页数
+ * @return {*}
+ * @note: 调用者保证这些页面已经不被引用
+ */
+void pager_truncate(Pager *pager, uint32_t num_pages)
+{
+    pthread_mutex_lock(&(pager->mutex));
+    frame_unswizzle_all(pager);
+    for (uint32_t i = num_pages; i < TABLE_MAX_PAGES; i++)
+    {
+        free(pager->pages[i]);
+        pager->pages[i] = NULL;
+    }
+    pager->num_pages = num_pages;
+    if (pager->file_length > num_pages * PAGE_SIZE)
+    {
+        if (ftruncate(pager->file_descriptor, num_pages * PAGE_SIZE) == -1)
+        {
+            printf("Error truncating db file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        pager->file_length = num_pages * PAGE_SIZE;
+    }
+    pthread_mutex_unlock(&(pager->mutex));
+}
+
+
+/**
+ * @description: 给页面加闩锁
+ * @param {Pager} *pager
+ * @param {uint32_t} page_num
+ * @param {LatchMode} mode
+ * @return {*}
+ * @note: 闩锁只保护页面内容在读写过程中的一致性，加锁顺序由调用者保证:
+ *        从根到叶子、叶子之间从左到右
+ */
+void page_latch(Pager *pager, uint32_t page_num, LatchMode mode)
+{
+    // 写时复制模式下已发布的页面不会被修改，写者之间由smo_mutex串行化
+    if (pager->copy_on_write)
+    {
+        return;
+    }
+    switch (mode)
+    {
+    case LATCH_SHARED:
+        pthread_rwlock_rdlock(&(pager->latches[page_num]));
+        break;
+    case LATCH_EXCLUSIVE:
+        pthread_rwlock_wrlock(&(pager->latches[page_num]));
+        __atomic_store_n(&(pager->latch_owners[page_num]), pthread_self(), __ATOMIC_RELAXED);
+        __atomic_store_n(&(pager->latch_exclusive[page_num]), true, __ATOMIC_RELAXED);
+        break;
+    case LATCH_NONE:
+        break;
+    }
+}
+
+void page_unlatch(Pager *pager, uint32_t page_num)
+{
+    if (pager->copy_on_write)
+    {
+        return;
+    }
+    if (page_latched_exclusive(pager, page_num))
+    {
+        __atomic_store_n(&(pager->latch_exclusive[page_num]), false, __ATOMIC_RELAXED);
+    }
+    pthread_rwlock_unlock(&(pager->latches[page_num]));
+}
+
+
+/**
+ * @description: 当前线程是否持有该页面的独占闩锁
+ * @param {Pager} *pager
+ * @param {uint32_t} page_num
+ * @return {*}
+ * @note: 分裂时沿右孩子读取子树的最大键，经过自己已经锁住的叶子时不能再加锁
+ */
+bool page_latched_exclusive(Pager *pager, uint32_t page_num)
+{
+    // 别的线程只会写入它自己的线程号，所以不加锁读取也不会误判
+    return __atomic_load_n(&(pager->latch_exclusive[page_num]), __ATOMIC_RELAXED) &&
+           pthread_equal(__atomic_load_n(&(pager->latch_owners[page_num]), __ATOMIC_RELAXED),
+                         pthread_self());
+}
+
+
+/**
+ * @description: 访问文件头字段，既可以用作getter也可以用作setter
+ */
+uint32_t *db_header_root_page(void *header)
+{
+    return header + DB_HEADER_ROOT_PAGE_OFFSET;
+}
+
+uint32_t *db_header_free_head(void *header)
+{
+    return header + DB_HEADER_FREE_HEAD_OFFSET;
+}
+
+uint32_t *db_header_key_type(void *header)
+{
+    return header + DB_HEADER_KEY_TYPE_OFFSET;
+}
+
+uint32_t *db_header_copy_on_write(void *header)
+{
+    return header + DB_HEADER_COPY_ON_WRITE_OFFSET;
+}
+
+uint32_t *db_header_index_root(void *header, uint32_t slot)
+{
+    return header + DB_HEADER_INDEX_ROOT_OFFSET + slot * DB_HEADER_INDEX_ROOT_SIZE;
+}
+
+uint32_t *db_header_index_include(void *header, uint32_t slot)
+{
+    return header + DB_HEADER_INDEX_INCLUDE_OFFSET + slot * DB_HEADER_INDEX_INCLUDE_SIZE;
+}
+
+uint32_t *db_header_access_method(void *header)
+{
+    return header + DB_HEADER_ACCESS_METHOD_OFFSET;
+}
+
+uint32_t *db_header_fill_factor(void *header)
+{
+    return header + DB_HEADER_FILL_FACTOR_OFFSET;
 }
@@ -14,6 +14,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include"Sqlite.h"
 
@@ -38,13 +39,85 @@ MetaCommandResult do_meta_command(InputBuffer *input_buffer, Table *table)
     else if (strcmp(input_buffer->buffer, ".constants") == 0)
     {
         printf("Constants:\n");
-        print_constants();
+        print_constants(table);
         return META_COMMAND_SUCCESS;
     }
     else if (strcmp(input_buffer->buffer, ".btree") == 0)
     {
         printf("Tree:\n");
-        print_tree(table->pager, 0, 0);
+        switch (table->access_method)
+        {
+        case (ACCESS_BTREE):
+            print_tree(table->pager, table->root_page_num, 0);
+            break;
+        case (ACCESS_HASH):
+            print_hash(table);
+            break;
+        case (ACCESS_BETREE):
+            print_tree(table->pager, table->root_page_num, 0);
+            print_buffers(table, table->root_page_num, 0);
+            break;
+        case (ACCESS_LSM):
+            print_lsm(table);
+            break;
+        }
+        return META_COMMAND_SUCCESS;
+    }
+    else if (strncmp(input_buffer->buffer, ".vacuum", 7) == 0 &&
+             (input_buffer->buffer[7] == '\0' || input_buffer->buffer[7] == ' '))
+    {
+        // .vacuum [填充百分比]，不带参数时使用表的填充因子
+        uint32_t fill_factor = vacuum_fill_factor(table);
+        if (input_buffer->buffer[7] == ' ')
+        {
+            char *end;
+            long value = strtol(input_buffer->buffer + 8, &end, 10);
+            if (*end != '\0' || value < FILL_FACTOR_MIN || value > 100)
+            {
+                return META_COMMAND_UNRECOGNIZED_COMMAND;
+            }
+            fill_factor = value;
+        }
+        switch (table_vacuum(table, fill_factor))
+        {
+        case (EXECUTE_TABLE_FULL):
+            printf("Error: Table full.\n");
+            break;
+        case (EXECUTE_UNSUPPORTED):
+            printf("Error: Not supported for this table.\n");
+            break;
+        default:
+            break;
+        }
+        return META_COMMAND_SUCCESS;
+    }
+    else if (strncmp(input_buffer->buffer, ".fillfactor", 11) == 0 &&
+             (input_buffer->buffer[11] == '\0' || input_buffer->buffer[11] == ' '))
+    {
+        // .fillfactor [填充百分比]，不带参数时显示当前的设置
+        if (input_buffer->buffer[11] == '\0')
+        {
+            uint32_t fill_factor = *db_header_fill_factor(get_page(table->pager, DB_HEADER_PAGE_NUM));
+            if (fill_factor == 0)
+            {
+                printf("Fill factor: default\n");
+            }
+            else
+            {
+                printf("Fill factor: %d%%\n", fill_factor);
+            }
+            return META_COMMAND_SUCCESS;
+        }
+        char *end;
+        long value = strtol(input_buffer->buffer + 12, &end, 10);
+        if (*end != '\0' || value < FILL_FACTOR_MIN || value > 100)
+        {
+            return META_COMMAND_UNRECOGNIZED_COMMAND;
+        }
+        if (table_set_fill_factor(table, value) == EXECUTE_UNSUPPORTED)
+        {
+            printf("Error: Not supported for this table.\n");
+        }
         return META_COMMAND_SUCCESS;
     }
     else
@@ -54,15 +127,63 @@ MetaCommandResult do_meta_command(InputBuffer *input_buffer, Table *table)
 }
 
 
+/**
+ * @description: 检查并填写要插入的一行
+ * @param {char} *id_string
+ * @param {char} *username
+ * @param {char} *email
+ * @param {Row} *row
+ * @return {*}
+ * @note: 单行和多行的insert共用
+ */
+PrepareResult prepare_row(char *id_string, char *username, char *email, Row *row)
+{
+    if (id_string == NULL || username == NULL || email == NULL)
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (id_string[0] == '-')
+    {
+        return PREPARE_NEGATIVE_ID;
+    }
+    Key key;
+    if (!parse_key(id_string, &key))
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (strlen(username) > COLUMN_USERNAME_SIZE)
+    {
+        return PREPARE_STRING_TOO_LONG;
+    }
+    if (strlen(email) > COLUMN_EMAIL_SIZE)
+    {
+        return PREPARE_STRING_TOO_LONG;
+    }
+    row->id = key.id;
+    row->tenant_id = key.tenant_id;
+    strcpy(row->username, username);
+    strcpy(row->email, email);
+    return PREPARE_SUCCESS;
+}
+
 /**
  * @description: 插入操作前的判断
  * @param {InputBuffer} *input_buffer
  * @param {Statement} *statement
  * @return {*}
- * @note: 
+ * @note: insert后面是括号时是多行插入
  */
 PrepareResult prepare_insert(InputBuffer *input_buffer, Statement *statement)
 {
+    char *rest = input_buffer->buffer + strlen("insert");
+    while (*rest == ' ')
+    {
+        rest++;
+    }
+    if (*rest == '(')
+    {
+        return prepare_insert_batch(input_buffer, statement);
+    }
     statement->type = STATEMENT_INSERT;
 
     char *keyword = strtok(input_buffer->buffer, " ");
@@ -70,54 +191,489 @@ PrepareResult prepare_insert(InputBuffer *input_buffer, Statement *statement)
     char *username = strtok(NULL, " ");
     char *email = strtok(NULL, " ");
 
-    if (id_string == NULL || username == NULL || email == NULL)
+    return prepare_row(id_string, username, email, &(statement->row_to_insert));
+}
+
+/**
+ * @description: 解析 insert (<id> <username> <email>), (...), ...
+ * @param {InputBuffer} *input_buffer
+ * @param {Statement} *statement
+ * @return {*}
+ * @note: 行数组在这里分配，失败时释放，成功时由execute_insert_batch释放
+ */
+PrepareResult prepare_insert_batch(InputBuffer *input_buffer, Statement *statement)
+{
+    statement->type = STATEMENT_INSERT_BATCH;
+
+    // 每一行至少有一对括号，按左括号的个数分配
+    uint32_t capacity = 0;
+    for (char *c = input_buffer->buffer; *c != '\0'; c++)
+    {
+        capacity += (*c == '(');
+    }
+    statement->insert_rows = malloc(capacity * sizeof(Row));
+    statement->num_insert_rows = 0;
+
+    PrepareResult result = PREPARE_SUCCESS;
+    char *position = input_buffer->buffer + strlen("insert");
+    while (result == PREPARE_SUCCESS)
+    {
+        while (*position == ' ')
+        {
+            position++;
+        }
+        char *close = strchr(position, ')');
+        if (*position != '(' || close == NULL)
+        {
+            result = PREPARE_SYNTAX_ERROR;
+            break;
+        }
+        *close = '\0';
+        char *id_string = strtok(position + 1, " ");
+        char *username = strtok(NULL, " ");
+        char *email = strtok(NULL, " ");
+        if (strtok(NULL, " ") != NULL)
+        {
+            result = PREPARE_SYNTAX_ERROR;
+            break;
+        }
+        result = prepare_row(id_string, username, email,
+                             &(statement->insert_rows[statement->num_insert_rows]));
+        statement->num_insert_rows++;
+
+        position = close + 1;
+        while (*position == ' ')
+        {
+            position++;
+        }
+        if (*position == '\0')
+        {
+            break;
+        }
+        if (*position != ',')
+        {
+            result = PREPARE_SYNTAX_ERROR;
+        }
+        position++;
+    }
+
+    if (result != PREPARE_SUCCESS)
+    {
+        free(statement->insert_rows);
+    }
+    return result;
+}
+
+/**
+ * @description: 把列名转换为ColumnMask，未知列返回0
+ * @param {char} *name
+ * @return {*}
+ * @note: 
+ */
+uint32_t parse_column(const char *name)
+{
+    if (strcmp(name, "*") == 0)
+    {
+        return COLUMN_ALL;
+    }
+    if (strcmp(name, "id") == 0)
+    {
+        return COLUMN_ID;
+    }
+    if (strcmp(name, "username") == 0)
+    {
+        return COLUMN_USERNAME;
+    }
+    if (strcmp(name, "email") == 0)
+    {
+        return COLUMN_EMAIL;
+    }
+    return 0;
+}
+
+/**
+ * @description: 用一个比较条件收紧select的主键范围
+ * @param {KeyRange} *range
+ * @param {char} *op =, >, >=, <, <=
+ * @param {Key} *key
+ * @return {*} 不认识的运算符返回false
+ * @note: 多个条件之间是and的关系，保留更紧的那个界
+ */
+bool key_range_restrict(KeyRange *range, const char *op, Key *key)
+{
+    bool lower = strcmp(op, ">") == 0 || strcmp(op, ">=") == 0 || strcmp(op, "=") == 0;
+    bool upper = strcmp(op, "<") == 0 || strcmp(op, "<=") == 0 || strcmp(op, "=") == 0;
+    bool inclusive = strcmp(op, ">") != 0 && strcmp(op, "<") != 0;
+
+    if (!lower && !upper)
+    {
+        return false;
+    }
+    if (lower)
+    {
+        int cmp = range->has_lower ? compare_key_values(key, &(range->lower)) : 1;
+        if (cmp > 0 || (cmp == 0 && !inclusive))
+        {
+            range->has_lower = true;
+            range->lower = *key;
+            range->lower_inclusive = inclusive;
+        }
+    }
+    if (upper)
+    {
+        int cmp = range->has_upper ? compare_key_values(key, &(range->upper)) : -1;
+        if (cmp < 0 || (cmp == 0 && !inclusive))
+        {
+            range->has_upper = true;
+            range->upper = *key;
+            range->upper_inclusive = inclusive;
+        }
+    }
+    return true;
+}
+
+/**
+ * @description: 主键是否在select的范围内
+ * @param {KeyRange} *range
+ * @param {Key} *key
+ * @return {*}
+ * @note: 通过索引查询时用来过滤回表之前的主键
+ */
+bool key_range_contains(KeyRange *range, Key *key)
+{
+    if (range->has_lower)
+    {
+        int cmp = compare_key_values(key, &(range->lower));
+        if (cmp < 0 || (cmp == 0 && !range->lower_inclusive))
+        {
+            return false;
+        }
+    }
+    if (range->has_upper)
+    {
+        int cmp = compare_key_values(key, &(range->upper));
+        if (cmp > 0 || (cmp == 0 && !range->upper_inclusive))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @description: select的范围是否只包含一个主键(where id = <值>)
+ * @param {KeyRange} *range
+ * @return {*}
+ * @note:
+ */
+bool key_range_is_point(KeyRange *range)
+{
+    return range->has_lower && range->has_upper && range->lower_inclusive && range->upper_inclusive &&
+           compare_key_values(&(range->lower), &(range->upper)) == 0;
+}
+
+/**
+ * @description: 解析where子句中username或email上的条件
+ * @param {Statement} *statement
+ * @param {uint32_t} column COLUMN_USERNAME或COLUMN_EMAIL
+ * @param {char} *op = 或 like
+ * @return {*}
+ * @note: like的模式只能是 <前缀>%，一条select中只能有一个这样的条件
+ */
+PrepareResult prepare_filter(Statement *statement, uint32_t column, const char *op)
+{
+    char *value = strtok(NULL, " ");
+    if (statement->select_filter_column != 0 || op == NULL || value == NULL)
     {
         return PREPARE_SYNTAX_ERROR;
     }
-    int id = atoi(id_string);
-    if (id < 0)
+    uint32_t length = strlen(value);
+    if (strcmp(op, "like") == 0)
     {
-        return PREPARE_NEGATIVE_ID;
+        if (length == 0 || value[length - 1] != '%' || strchr(value, '%') != value + length - 1)
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        length -= 1;
+        statement->select_filter_prefix = true;
     }
-    if (strlen(username) > COLUMN_USERNAME_SIZE)
+    else if (strcmp(op, "=") != 0)
     {
-        return PREPARE_STRING_TOO_LONG;
+        return PREPARE_SYNTAX_ERROR;
     }
-    if (strlen(email) > COLUMN_EMAIL_SIZE)
+    if (length > COLUMN_EMAIL_SIZE)
     {
         return PREPARE_STRING_TOO_LONG;
     }
-    statement->row_to_insert.id = id;
-    strcpy(statement->row_to_insert.username, username);
-    strcpy(statement->row_to_insert.email, email);
-
+    statement->select_filter_column = column;
+    memcpy(statement->select_filter_value, value, length);
+    statement->select_filter_value[length] = '\0';
     return PREPARE_SUCCESS;
 }
 
-PrepareResult prepare_select(InputBuffer *input_buffer, Statement *statement)
+/**
+ * @description: 解析 id in 后面括号中的主键列表
+ * @param {Statement} *statement
+ * @return {*}
+ * @note: 主键之间用逗号和/或空格分隔，括号可以和主键连在一起：(1, 2,3) 或 ( 1 2 )。
+ *        最多SELECT_MAX_KEYS个，重复的主键只输出一次
+ */
+PrepareResult prepare_key_list(Statement *statement)
 {
-    statement->type = STATEMENT_SELECT;
-    
-    if(strcmp(input_buffer->buffer, "select") == 0){
-        int select_id = -1;
-        statement->row_to_select.select_id = select_id;
+    char *token = strtok(NULL, " ,");
+    if (token == NULL || token[0] != '(')
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    token++;
+    statement->select_num_keys = 0;
+    while (true)
+    {
+        size_t length = strlen(token);
+        bool closing = length > 0 && token[length - 1] == ')';
+        if (closing)
+        {
+            token[length - 1] = '\0';
+        }
+        if (token[0] == '-')
+        {
+            return PREPARE_NEGATIVE_ID;
+        }
+        if (token[0] != '\0')
+        {
+            if (statement->select_num_keys == SELECT_MAX_KEYS ||
+                !parse_key(token, &(statement->select_keys[statement->select_num_keys])))
+            {
+                return PREPARE_SYNTAX_ERROR;
+            }
+            statement->select_num_keys++;
+        }
+        if (closing)
+        {
+            return statement->select_num_keys > 0 ? PREPARE_SUCCESS : PREPARE_SYNTAX_ERROR;
+        }
+        token = strtok(NULL, " ,");
+        if (token == NULL)
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+    }
+}
+
+/**
+ * @description: 解析where子句中主键的条件
+ * @param {Statement} *statement
+ * @param {char} **token 输入时指向"where"，返回时指向子句之后的第一个单词
+ * @return {*}
+ * @note: 支持 where <id> | where id = <id> | where id between <a> and <b> | where id in (<id>, ...)
+ *        以及用and连接的 id >|>=|<|<= <id> 和 username|email =|like <值>
+ */
+PrepareResult prepare_where(Statement *statement, char **token)
+{
+    KeyRange *range = &(statement->select_range);
+    char *column = strtok(NULL, " ");
+    Key key;
+
+    if (column == NULL)
+    {
+        *token = NULL;
         return PREPARE_SUCCESS;
     }
+    if (parse_key(column, &key))
+    {
+        key_range_restrict(range, "=", &key);
+        *token = strtok(NULL, " ");
+        return PREPARE_SUCCESS;
+    }
+
+    while (true)
+    {
+        char *op = strtok(NULL, " ");
+        uint32_t filter_column = column == NULL ? 0 : parse_column(column);
+        if (filter_column == COLUMN_USERNAME || filter_column == COLUMN_EMAIL)
+        {
+            PrepareResult result = prepare_filter(statement, filter_column, op);
+            if (result != PREPARE_SUCCESS)
+            {
+                return result;
+            }
+        }
+        else if (column == NULL || strcmp(column, "id") != 0 || op == NULL)
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        else if (strcmp(op, "between") == 0)
+        {
+            Key upper;
+            char *lower_string = strtok(NULL, " ");
+            char *and_key = strtok(NULL, " ");
+            char *upper_string = strtok(NULL, " ");
+            if (and_key == NULL || strcmp(and_key, "and") != 0 ||
+                !parse_key(lower_string, &key) || !parse_key(upper_string, &upper))
+            {
+                return PREPARE_SYNTAX_ERROR;
+            }
+            key_range_restrict(range, ">=", &key);
+            key_range_restrict(range, "<=", &upper);
+        }
+        else if (strcmp(op, "in") == 0)
+        {
+            if (statement->select_num_keys > 0)
+            {
+                return PREPARE_SYNTAX_ERROR;
+            }
+            PrepareResult result = prepare_key_list(statement);
+            if (result != PREPARE_SUCCESS)
+            {
+                return result;
+            }
+        }
+        else
+        {
+            char *key_string = strtok(NULL, " ");
+            if (key_string != NULL && key_string[0] == '-')
+            {
+                return PREPARE_NEGATIVE_ID;
+            }
+            if (!parse_key(key_string, &key) || !key_range_restrict(range, op, &key))
+            {
+                return PREPARE_SYNTAX_ERROR;
+            }
+        }
+
+        *token = strtok(NULL, " ");
+        if (*token == NULL || strcmp(*token, "and") != 0)
+        {
+            return PREPARE_SUCCESS;
+        }
+        column = strtok(NULL, " ");
+    }
+}
+
+/**
+ * @description: 解析limit和offset后面的非负整数
+ * @param {char} *string 可以为NULL
+ * @param {uint32_t} *value
+ * @return {*} 是否合法
+ */
+bool parse_count(const char *string, uint32_t *value)
+{
+    char *end;
+    if (string == NULL || string[0] < '0' || string[0] > '9')
+    {
+        return false;
+    }
+    unsigned long count = strtoul(string, &end, 10);
+    if (*end != '\0' || count > UINT32_MAX)
+    {
+        return false;
+    }
+    *value = count;
+    return true;
+}
+
+/**
+ * @description: 查询操作前的判断:
+ *               select [列, ...] [where <条件>] [order by id [asc|desc]] [limit <n>] [offset <n>]
+ *               select count(*) [where <条件>]
+ *               where id in (...) 可以和其他条件用and连接，结果按主键顺序输出
+ * @param {InputBuffer} *input_buffer
+ * @param {Statement} *statement
+ * @return {*}
+ * @note: 省略列名时输出所有列。username/email条件可能走索引，按索引顺序输出，不能和order by一起使用
+ */
+PrepareResult prepare_select(InputBuffer *input_buffer, Statement *statement)
+{
+    statement->type = STATEMENT_SELECT;
+    statement->select_columns = COLUMN_ALL;
+    memset(&(statement->select_range), 0, sizeof(KeyRange));
+    statement->select_limit = UINT32_MAX;
+    statement->select_offset = 0;
+    statement->select_descending = false;
+    statement->select_count = false;
+    statement->select_filter_column = 0;
+    statement->select_filter_prefix = false;
+    statement->select_num_keys = 0;
 
     char *keyword = strtok(input_buffer->buffer, " ");
-    char *where_key = strtok(NULL, " ");
-    char *select_id_string = strtok(NULL, " ");
-    
-    if ( strcmp(where_key,"where")!=0 && where_key != NULL)
+    char *token = strtok(NULL, " ,");
+
+    if (token != NULL && strcmp(token, "count(*)") == 0)
+    {
+        statement->select_count = true;
+        statement->select_columns = 0;
+        token = strtok(NULL, " ,");
+    }
+    else if (token != NULL && strcmp(token, "where") != 0 && strcmp(token, "order") != 0 &&
+             strcmp(token, "limit") != 0 && strcmp(token, "offset") != 0)
+    {
+        statement->select_columns = 0;
+        while (token != NULL && strcmp(token, "where") != 0 && strcmp(token, "order") != 0 &&
+               strcmp(token, "limit") != 0 && strcmp(token, "offset") != 0)
+        {
+            uint32_t column = parse_column(token);
+            if (column == 0)
+            {
+                return PREPARE_SYNTAX_ERROR;
+            }
+            statement->select_columns |= column;
+            token = strtok(NULL, " ,");
+        }
+    }
+
+    if (token != NULL && strcmp(token, "where") == 0)
+    {
+        PrepareResult result = prepare_where(statement, &token);
+        if (result != PREPARE_SUCCESS)
+        {
+            return result;
+        }
+    }
+
+    // count(*)只输出一个数，不能排序或分页
+    if (token != NULL && statement->select_count)
     {
         return PREPARE_SYNTAX_ERROR;
     }
-    int select_id = -1;
-    if(select_id_string != NULL){
-        select_id = atoi(select_id_string);
+
+    if (token != NULL && strcmp(token, "order") == 0)
+    {
+        char *by = strtok(NULL, " ");
+        char *column = strtok(NULL, " ");
+        if (statement->select_filter_column != 0 || by == NULL || strcmp(by, "by") != 0 || column == NULL || strcmp(column, "id") != 0)
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        token = strtok(NULL, " ");
+        if (token != NULL && (strcmp(token, "asc") == 0 || strcmp(token, "desc") == 0))
+        {
+            statement->select_descending = (strcmp(token, "desc") == 0);
+            token = strtok(NULL, " ");
+        }
+    }
+
+    if (token != NULL && strcmp(token, "limit") == 0)
+    {
+        if (!parse_count(strtok(NULL, " "), &(statement->select_limit)))
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        token = strtok(NULL, " ");
+    }
+
+    if (token != NULL && strcmp(token, "offset") == 0)
+    {
+        if (!parse_count(strtok(NULL, " "), &(statement->select_offset)))
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        token = strtok(NULL, " ");
+    }
+
+    if (token != NULL)
+    {
+        return PREPARE_SYNTAX_ERROR;
     }
-    statement->row_to_select.select_id = select_id;
-    
     return PREPARE_SUCCESS;
 }
 
@@ -133,16 +689,20 @@ PrepareResult prepare_update(InputBuffer *input_buffer, Statement *statement)
     // char *id_key = strtok(NULL, " ");
     char *update_id_string = strtok(NULL, " ");
     
-    if (id_string == NULL || username == NULL || email == NULL || strcmp(where_key,"where")!=0)
+    if (id_string == NULL || username == NULL || email == NULL || where_key == NULL ||
+        strcmp(where_key,"where")!=0 || update_id_string == NULL)
     {
         return PREPARE_SYNTAX_ERROR;
     }
-    int id = atoi(id_string);
-    int update_id = atoi(update_id_string);
-    if (id < 0 || update_id < 0)
+    if (id_string[0] == '-' || update_id_string[0] == '-')
     {
         return PREPARE_NEGATIVE_ID;
     }
+    Key key;
+    if (!parse_key(id_string, &key) || !parse_key(update_id_string, &(statement->update_key)))
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
     if (strlen(username) > COLUMN_USERNAME_SIZE)
     {
         return PREPARE_STRING_TOO_LONG;
@@ -151,15 +711,70 @@ PrepareResult prepare_update(InputBuffer *input_buffer, Statement *statement)
     {
         return PREPARE_STRING_TOO_LONG;
     }
-    statement->row_to_update.id = id;
+    statement->row_to_update.id = key.id;
+    statement->row_to_update.tenant_id = key.tenant_id;
     strcpy(statement->row_to_update.username, username);
     strcpy(statement->row_to_update.email, email);
-    statement->row_to_update.update_id = update_id;
     
     
     return PREPARE_SUCCESS;
 }
 
+/**
+ * @description: create index on <username|email> [include <列>, ...]
+ * @param {InputBuffer} *input_buffer
+ * @param {Statement} *statement
+ * @return {*}
+ * @note: 索引没有名字，每一列最多一个。主键和被索引的列总是被覆盖，include只能列出其他的列
+ */
+PrepareResult prepare_create_index(InputBuffer *input_buffer, Statement *statement)
+{
+    statement->type = STATEMENT_CREATE_INDEX;
+
+    char *keyword = strtok(input_buffer->buffer, " ");
+    char *index_keyword = strtok(NULL, " ");
+    char *on_keyword = strtok(NULL, " ");
+    char *column = strtok(NULL, " ");
+    char *include_keyword = strtok(NULL, " ");
+    if (index_keyword == NULL || strcmp(index_keyword, "index") != 0 || on_keyword == NULL ||
+        strcmp(on_keyword, "on") != 0 || column == NULL ||
+        (include_keyword != NULL && strcmp(include_keyword, "include") != 0))
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    statement->index_column = parse_column(column);
+    statement->index_include = 0;
+    if (index_slot(statement->index_column) < 0)
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (include_keyword == NULL)
+    {
+        return PREPARE_SUCCESS;
+    }
+
+    char *token = strtok(NULL, " ,");
+    if (token == NULL)
+    {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    while (token != NULL)
+    {
+        uint32_t include = parse_column(token);
+        if (include != COLUMN_USERNAME && include != COLUMN_EMAIL)
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        if (include == statement->index_column)
+        {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        statement->index_include |= include;
+        token = strtok(NULL, " ,");
+    }
+    return PREPARE_SUCCESS;
+}
+
 
 
 /**
@@ -184,6 +799,10 @@ PrepareResult prepare_statement(InputBuffer *input_buffer, Statement *statement)
     {
         return prepare_update(input_buffer, statement);
     }
+    if (strncmp(input_buffer->buffer, "create", 6) == 0)
+    {
+        return prepare_create_index(input_buffer, statement);
+    }
 
     return PREPARE_UNRECOGNIZED_STATEMENT;
 }
@@ -202,10 +821,14 @@ ExecuteResult execute_statement(Statement *statement, Table *table)
     {
     case (STATEMENT_INSERT):
         return execute_insert(statement, table);
+    case (STATEMENT_INSERT_BATCH):
+        return execute_insert_batch(statement, table);
     case (STATEMENT_SELECT):
         return execute_select(statement, table);
     case (STATEMENT_UPDATE):
         return execute_update(statement, table);
+    case (STATEMENT_CREATE_INDEX):
+        return execute_create_index(statement, table);
 
     }
     return EXECUTE_SUCCESS;
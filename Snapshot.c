@@ -0,0 +1,247 @@
+/*
+ * @Author: WangZhe
+ * @Date: 2026-10-19 15:02:16
+ * @LastEditors: WangZhe
+ * @LastEditTime: 2026-10-19 16:48:30
+ * @FilePath: /Sqlite/Snapshot.c
+ * @Description: 写时复制模式下的快照(MVCC)
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include"Sqlite.h"
+
+
+/**
+ * @description: 占用一个读者槽位，取得最后一次提交的根
+ * @param {Table} *table
+ * @param {uint32_t} *root_page_num 输出快照的根
+ * @return {*} 槽位下标，用完后交给snapshot_release
+ * @note: 先登记版本号再读根，读完根后版本号没有变化，说明登记早于这个版本之后的任何回收。
+ *        提交时先发布根再增加版本号，所以登记的版本号可能比读到的根旧，这只会让回收更保守
+ */
+int32_t snapshot_acquire(Table *table, uint32_t *root_page_num)
+{
+    Pager *pager = table->pager;
+    while (true)
+    {
+        for (int32_t slot = 0; slot < SNAPSHOT_MAX_READERS; slot++)
+        {
+            uint64_t txn_id = __atomic_load_n(&(pager->txn_id), __ATOMIC_SEQ_CST);
+            uint64_t expected = 0;
+            if (!__atomic_compare_exchange_n(&(pager->readers[slot]), &expected, txn_id + 1, false,
+                                             __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+            {
+                continue;
+            }
+            while (true)
+            {
+                *root_page_num = __atomic_load_n(&(table->snapshot_root_page_num), __ATOMIC_SEQ_CST);
+                uint64_t current = __atomic_load_n(&(pager->txn_id), __ATOMIC_SEQ_CST);
+                if (current == txn_id)
+                {
+                    return slot;
+                }
+                txn_id = current;
+                __atomic_store_n(&(pager->readers[slot]), txn_id + 1, __ATOMIC_SEQ_CST);
+            }
+        }
+        // 槽位都被占用时等待别的读者结束
+        sched_yield();
+    }
+}
+
+
+/**
+ * @description: 释放读者槽位，之后这个快照引用的旧页面可以被回收
+ * @param {Table} *table
+ * @param {int32_t} slot
+ * @return {*}
+ * @note:
+ */
+void snapshot_release(Table *table, int32_t slot)
+{
+    __atomic_store_n(&(table->pager->readers[slot]), 0, __ATOMIC_SEQ_CST);
+}
+
+
+/**
+ * @description: 记录一个被新版本替换下来的页面
+ * @param {Pager} *pager
+ * @param {uint32_t} page_num
+ * @return {*}
+ * @note: 页面属于当前版本，下一次提交之后的快照不再引用它，所以记下txn_id + 1。
+ *        只有持有smo_mutex的写者会调用
+ */
+void snapshot_retire_page(Pager *pager, uint32_t page_num)
+{
+    if (pager->num_retired >= pager->retired_capacity)
+    {
+        pager->retired_capacity = pager->retired_capacity == 0 ? 16 : pager->retired_capacity * 2;
+        pager->retired_pages = realloc(pager->retired_pages, pager->retired_capacity * sizeof(uint32_t));
+        pager->retired_txns = realloc(pager->retired_txns, pager->retired_capacity * sizeof(uint64_t));
+        if (pager->retired_pages == NULL || pager->retired_txns == NULL)
+        {
+            printf("Unable to allocate retired page list.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    pager->retired_pages[pager->num_retired] = page_num;
+    pager->retired_txns[pager->num_retired] = pager->txn_id + 1;
+    pager->num_retired += 1;
+}
+
+
+/**
+ * @description: 把所有活跃快照都不再引用的旧页面放回空闲链表
+ * @param {Pager} *pager
+ * @return {*}
+ * @note: 活跃快照中最旧的版本号为oldest，替换版本号<=oldest的页面已经没有读者
+ */
+void snapshot_reclaim(Pager *pager)
+{
+    uint64_t oldest = __atomic_load_n(&(pager->txn_id), __ATOMIC_SEQ_CST);
+    for (uint32_t slot = 0; slot < SNAPSHOT_MAX_READERS; slot++)
+    {
+        uint64_t reader = __atomic_load_n(&(pager->readers[slot]), __ATOMIC_SEQ_CST);
+        if (reader != 0 && reader - 1 < oldest)
+        {
+            oldest = reader - 1;
+        }
+    }
+
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < pager->num_retired; i++)
+    {
+        if (pager->retired_txns[i] <= oldest)
+        {
+            pager_free_list_push(pager, pager->retired_pages[i]);
+        }
+        else
+        {
+            pager->retired_pages[kept] = pager->retired_pages[i];
+            pager->retired_txns[kept] = pager->retired_txns[i];
+            kept++;
+        }
+    }
+    pager->num_retired = kept;
+}
+
+
+/**
+ * @description: 把游标从根到叶子的路径复制到新页面上，之后的修改只作用于副本
+ * @param {Cursor} *cursor 写者用FIND_WRITE得到的游标
+ * @return {*}
+ * @note: 父节点的副本指向孩子的副本，根的副本成为table->root_page_num，
+ *        要到snapshot_commit时才对读者可见。原来的页面被替换下来等待回收
+ */
+void snapshot_shadow_path(Cursor *cursor)
+{
+    Table *table = cursor->table;
+    Pager *pager = table->pager;
+    uint32_t parent_copy = 0;
+
+    for (uint32_t level = 0; level <= cursor->depth; level++)
+    {
+        uint32_t page_num = level < cursor->depth ? cursor->path_pages[level] : cursor->page_num;
+        uint32_t copy_page_num = get_unused_page_num(pager);
+        memcpy(get_page(pager, copy_page_num), get_page(pager, page_num), PAGE_SIZE);
+        pager_free_page(pager, page_num);
+
+        if (level == 0)
+        {
+            table->root_page_num = copy_page_num;
+        }
+        else
+        {
+            *internal_node_child(get_page(pager, parent_copy), cursor->path_cells[level - 1]) = copy_page_num;
+        }
+
+        if (level < cursor->depth)
+        {
+            cursor->path_pages[level] = copy_page_num;
+        }
+        else
+        {
+            cursor->page_num = copy_page_num;
+        }
+        parent_copy = copy_page_num;
+    }
+}
+
+
+/**
+ * @description: 发布写者修改后的根，并回收旧页面
+ * @param {Table} *table
+ * @return {*}
+ * @note: 调用者持有smo_mutex
+ */
+void snapshot_commit(Table *table)
+{
+    Pager *pager = table->pager;
+    void *header = get_page(pager, DB_HEADER_PAGE_NUM);
+    // 主表和索引的根页码都在文件头中，位置由table->root_offset给出
+    *(uint32_t *)(header + table->root_offset) = table->root_page_num;
+    __atomic_store_n(&(table->snapshot_root_page_num), table->root_page_num, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&(pager->txn_id), 1, __ATOMIC_SEQ_CST);
+    snapshot_reclaim(pager);
+}
+
+
+/**
+ * @description: 沿游标中的路径移动到相邻的叶子
+ * @param {Cursor} *cursor
+ * @param {bool} forward true移到下一个叶子的第一行，false移到上一个叶子的最后一行
+ * @return {*} 没有相邻的叶子时返回false
+ * @note: 写时复制模式下叶子之间不维护兄弟链接(链接会让每次修改波及整条叶子链)，
+ *        向上回到还有相邻孩子的祖先，再沿最左(最右)的孩子下降
+ */
+bool cursor_step_leaf(Cursor *cursor, bool forward)
+{
+    Pager *pager = cursor->table->pager;
+    int32_t level = (int32_t)cursor->depth - 1;
+
+    while (level >= 0)
+    {
+        void *node = get_page(pager, cursor->path_pages[level]);
+        if (forward && cursor->path_cells[level] < *internal_node_num_keys(node))
+        {
+            cursor->path_cells[level] += 1;
+            break;
+        }
+        if (!forward && cursor->path_cells[level] > 0)
+        {
+            cursor->path_cells[level] -= 1;
+            break;
+        }
+        level--;
+    }
+    if (level < 0)
+    {
+        return false;
+    }
+
+    uint32_t page_num = *internal_node_child(get_page(pager, cursor->path_pages[level]),
+                                             cursor->path_cells[level]);
+    void *node = get_page(pager, page_num);
+    for (level = level + 1; get_node_type(node) == NODE_INTERNAL; level++)
+    {
+        cursor->path_pages[level] = page_num;
+        cursor->path_cells[level] = forward ? 0 : *internal_node_num_keys(node);
+        page_num = *internal_node_child(node, cursor->path_cells[level]);
+        node = get_page(pager, page_num);
+    }
+    cursor->depth = level;
+    cursor->page_num = page_num;
+    cursor->cell_num = forward ? 0 : *leaf_node_num_cells(node) - 1;
+    return true;
+}
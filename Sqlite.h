@@ -21,7 +21,79 @@ const extern uint32_t PAGE_SIZE;
 #define TABLE_MAX_PAGES 100
 
 #define COLUMN_USERNAME_SIZE 32
-#define COLUMN_EMAIL_SIZE 255
+#define COLUMN_EMAIL_SIZE 8192
+
+/**
+ * 投影列掩码，select只读取(反序列化)被投影的列
+*/
+typedef enum
+{
+    COLUMN_ID = 1 << 0,
+    COLUMN_USERNAME = 1 << 1,
+    COLUMN_EMAIL = 1 << 2,
+    COLUMN_ALL = COLUMN_ID | COLUMN_USERNAME | COLUMN_EMAIL
+} ColumnMask;
+
+/**
+ * KEY_H
+ * 主键类型在建表时确定，记录在文件头和每个节点的头部。
+ * 节点中保存的是编码后的主键字节，比较时按类型走各自的快速路径。
+*/
+
+typedef enum
+{
+    KEY_U32,
+    KEY_U64,
+    KEY_COMPOSITE,  /* (tenant_id, id)，大端序编码，可以直接memcmp */
+    KEY_INDEX       /* 二级索引: 列值的前INDEX_VALUE_SIZE个字节(不足补0) + 大端序的(tenant_id, id) */
+} KeyType;
+
+#define INDEX_VALUE_SIZE 32
+#define KEY_MAX_SIZE (INDEX_VALUE_SIZE + 12)
+
+typedef struct
+{
+    uint32_t tenant_id;
+    uint64_t id;
+} Key;
+
+uint32_t key_type_size(KeyType key_type);
+
+bool key_fits(KeyType key_type, Key *key);
+
+void encode_key(KeyType key_type, Key *key, void *destination);
+
+void decode_key(KeyType key_type, const void *source, Key *key);
+
+int compare_keys(KeyType key_type, uint32_t key_size, const void *a, const void *b);
+
+const extern uint32_t KEY_INTERPOLATION_MIN_KEYS;
+const extern uint32_t KEY_INTERPOLATION_WINDOW;
+
+uint32_t key_bisect(KeyType key_type, uint32_t key_size, const void *base, uint32_t stride,
+                    uint32_t min_index, uint32_t max_index, const void *key);
+
+uint64_t key_integer_at(KeyType key_type, const void *base, uint32_t stride, uint32_t index);
+
+uint32_t key_lower_bound(KeyType key_type, uint32_t key_size, const void *base,
+                         uint32_t stride, uint32_t count, const void *key);
+
+int compare_key_values(Key *a, Key *b);
+
+/**
+ * 排序时使用的(主键, 原来的位置)，按解码后的主键比较，不需要知道主键类型
+*/
+typedef struct
+{
+    Key key;
+    uint32_t position;
+} KeyEntry;
+
+int compare_key_entries(const void *a, const void *b);
+
+bool parse_key(const char *string, Key *key);
+
+void print_key(KeyType key_type, Key *key);
 
 /**
  * PAGER_H
@@ -29,6 +101,48 @@ const extern uint32_t PAGE_SIZE;
 
 #define INVALID_PAGE_NUM UINT32_MAX
 
+/**
+ * 第0页为数据库文件头：魔数、根节点页码、空闲页链表头。
+ * 页码0因此不会是任何节点或溢出页，可以用作“无下一页”的标记。
+*/
+#define DB_HEADER_PAGE_NUM 0
+#define DB_HEADER_MAGIC "WZSQLITE"
+
+const extern uint32_t DB_HEADER_MAGIC_SIZE;
+const extern uint32_t DB_HEADER_MAGIC_OFFSET;
+const extern uint32_t DB_HEADER_ROOT_PAGE_SIZE;
+const extern uint32_t DB_HEADER_ROOT_PAGE_OFFSET;
+const extern uint32_t DB_HEADER_FREE_HEAD_SIZE;
+const extern uint32_t DB_HEADER_FREE_HEAD_OFFSET;
+const extern uint32_t DB_HEADER_KEY_TYPE_SIZE;
+const extern uint32_t DB_HEADER_KEY_TYPE_OFFSET;
+const extern uint32_t DB_HEADER_COPY_ON_WRITE_SIZE;
+const extern uint32_t DB_HEADER_COPY_ON_WRITE_OFFSET;
+const extern uint32_t DB_HEADER_INDEX_ROOT_SIZE;
+const extern uint32_t DB_HEADER_INDEX_ROOT_OFFSET;
+const extern uint32_t DB_HEADER_INDEX_INCLUDE_SIZE;
+const extern uint32_t DB_HEADER_INDEX_INCLUDE_OFFSET;
+const extern uint32_t DB_HEADER_ACCESS_METHOD_SIZE;
+const extern uint32_t DB_HEADER_ACCESS_METHOD_OFFSET;
+const extern uint32_t DB_HEADER_FILL_FACTOR_SIZE;
+const extern uint32_t DB_HEADER_FILL_FACTOR_OFFSET;
+const extern uint32_t FREE_PAGE_NEXT_OFFSET;
+const extern uint32_t FRAME_PAGE_NUM_OFFSET;
+const extern uint32_t FRAME_CHILDREN_OFFSET;
+const extern uint32_t FRAME_SIZE;
+
+
+/**
+ * 页面闩锁的模式：读者共享，修改页面的线程独占
+*/
+typedef enum
+{
+    LATCH_NONE,
+    LATCH_SHARED,
+    LATCH_EXCLUSIVE
+} LatchMode;
+
+#define SNAPSHOT_MAX_READERS 64
 
 typedef struct
 {
@@ -36,24 +150,241 @@ typedef struct
     uint32_t file_length;
     uint32_t num_pages;
     void *pages[TABLE_MAX_PAGES];
+    /*
+    写时复制模式：已发布的页面从不被原地修改，不需要闩锁。
+    txn_id是最后一次提交的版本号；readers中非0的槽位是正在读取的快照版本号+1；
+    被替换下来的页面连同替换它的版本号记在retired中，没有快照再引用时才放回空闲链表
+    */
+    bool copy_on_write;
+    uint64_t txn_id;
+    uint64_t readers[SNAPSHOT_MAX_READERS];
+    uint32_t *retired_pages;
+    uint64_t *retired_txns;
+    uint32_t num_retired;
+    uint32_t retired_capacity;
+    // 保护缓存缺失时的加载、页面分配和空闲链表(文件头)，可重入
+    pthread_mutex_t mutex;
+    // 每个页面一个读写闩锁，以及持有独占闩锁的线程
+    pthread_rwlock_t latches[TABLE_MAX_PAGES];
+    pthread_t latch_owners[TABLE_MAX_PAGES];
+    bool latch_exclusive[TABLE_MAX_PAGES];
+    // .vacuum重写整个文件时独占地持有，其余读写页面的操作共享地持有；vacuum_owner是正在整理的线程
+    pthread_rwlock_t vacuum_lock;
+    pthread_t vacuum_owner;
+    bool vacuuming;
 } Pager;
 
 
 typedef struct
 {
-    uint32_t id;
+    uint64_t id;
+    uint32_t tenant_id;
     char username[COLUMN_USERNAME_SIZE + 1];
     char email[COLUMN_EMAIL_SIZE + 1];
-    uint32_t update_id;
-    uint32_t select_id;
 } Row;
 
 
 
+#define TABLE_MAX_INDEXES 2
+
+/**
+ * 主表的存取方式
+ * ACCESS_BTREE 按主键有序的B-link树
+ * ACCESS_HASH  可扩展哈希，只适合点查询：等值查找只读目录页和一个桶页，范围查询要扫描所有桶
+ * ACCESS_BETREE 写优化的B树(Bε树)：写入先放进内部节点的消息缓冲，缓冲满时成批下推，
+ *               随机插入不必每次修改一个随机的叶子；点查询要合并路径上的缓冲
+ * ACCESS_LSM   日志结构合并树：写入内存中的跳表，满了整体顺序写成一个有序段，后台线程按层合并；
+ *              点查询依次查跳表和各个有序段，范围查询要归并所有来源
+*/
+typedef enum
+{
+    ACCESS_BTREE,
+    ACCESS_HASH,
+    ACCESS_BETREE,
+    ACCESS_LSM
+} AccessMethod;
+
+/**
+ * 主表主键上的Bloom过滤器，位数组只增不减
+*/
+typedef struct
+{
+    uint64_t *words;
+    uint32_t num_words;
+} KeyFilter;
+
+/**
+ * 自适应基数树(ART)的内部节点按孩子数分四种，孩子多了换成更大的一种。
+ * 主键定长，所以叶子都在同一深度，不会有一个主键是另一个的前缀；
+ * 路径压缩的前缀完整地保存在节点中
+*/
+typedef enum
+{
+    ART_NODE4,
+    ART_NODE16,
+    ART_NODE48,
+    ART_NODE256
+} ArtNodeType;
+
+typedef struct
+{
+    ArtNodeType type;
+    uint32_t num_children;
+    uint32_t prefix_len;
+    uint8_t prefix[KEY_MAX_SIZE];
+} ArtNode;
+
+// 孩子是ArtNode或者带标记位的ArtLeaf，见art_is_leaf
+typedef struct
+{
+    ArtNode header;
+    uint8_t keys[4];
+    void *children[4];
+} ArtNode4;
+
+typedef struct
+{
+    ArtNode header;
+    uint8_t keys[16];
+    void *children[16];
+} ArtNode16;
+
+// child_index[字节]是孩子下标加1，0表示没有
+typedef struct
+{
+    ArtNode header;
+    uint8_t child_index[256];
+    void *children[48];
+} ArtNode48;
+
+typedef struct
+{
+    ArtNode header;
+    void *children[256];
+} ArtNode256;
+
+// 主键所在的叶子页和单元格号
+typedef struct
+{
+    uint32_t page_num;
+    uint32_t cell_num;
+    uint8_t key[];
+} ArtLeaf;
+
+/**
+ * 主表主键到(叶子页, 单元格号)的内存索引，只是提示：使用前在闩住的叶子上核对主键，
+ * 对不上就回到B树下降，所以漏掉或过时的项不影响正确性。
+ * lock保护整棵树：查找共享，插入独占；built为false时还没有建立，build_mutex保证只有一个线程在建立
+*/
+typedef struct
+{
+    void *root;
+    uint32_t key_size;
+    uint32_t num_keys;
+    bool built;
+    pthread_rwlock_t lock;
+    pthread_mutex_t build_mutex;
+} ArtTree;
+
+#define LSM_MAX_HEIGHT 12
+#define LSM_MAX_RUNS 16
+
+/**
+ * 跳表节点：每一层的后继 + 一个单元格(主键 + 值)
+*/
+typedef struct LsmNode
+{
+    struct LsmNode *next[LSM_MAX_HEIGHT];
+    uint8_t cell[];
+} LsmNode;
+
+/**
+ * 内存表：按主键排序的跳表，同一主键只保留最新的值
+*/
+typedef struct
+{
+    LsmNode *head;
+    uint32_t height;
+    uint32_t num_rows;
+} LsmMemtable;
+
+/**
+ * 一个不可变的有序段：一串页面，每页是按主键排序的单元格。
+ * 稀疏索引(每页的第一个主键)和过滤器只在内存中，打开时扫描页面重建
+*/
 typedef struct
+{
+    uint32_t level;
+    uint32_t num_pages;
+    uint32_t num_cells;
+    uint32_t *pages;
+    uint8_t *first_keys;
+    KeyFilter *filter;
+} LsmRun;
+
+/**
+ * 主表的日志结构合并树。
+ * lock保护内存表和有序段的列表：读者共享，写入内存表和安装新的有序段独占；
+ * 有序段一旦写好就不再修改，合并时不持有lock读取输入，只在替换时独占。
+ * compact_mutex使合并(后台线程和.vacuum)串行；work_mutex和两个条件变量用来唤醒后台线程和等待合并完成
+*/
+typedef struct LsmTree
+{
+    LsmMemtable *memtable;
+    // 第0层(最新的在前)，然后按层号递增，第1层及以上每层最多一个有序段
+    LsmRun runs[LSM_MAX_RUNS];
+    uint32_t num_runs;
+    uint64_t random;
+    pthread_rwlock_t lock;
+    pthread_mutex_t compact_mutex;
+    pthread_mutex_t work_mutex;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+    bool work_pending;
+    bool stopping;
+    pthread_t thread;
+} LsmTree;
+
+/**
+ * 一棵B树：主表或者它的二级索引，索引和主表共用同一个Pager
+*/
+typedef struct Table
 {
     uint32_t root_page_num;
     Pager *pager;
+    KeyType key_type;
+    uint32_t key_size;
+    // 叶子单元格中值的字节数：主表是一行，索引是索引项
+    uint32_t value_size;
+    // 文件头中保存根页码的位置
+    uint32_t root_offset;
+    // 同一时刻只允许一个线程做节点分裂(结构修改)，不分裂的插入和更新只锁叶子；
+    // 写时复制模式下所有写操作都持有它
+    pthread_mutex_t smo_mutex;
+    // 保护内部节点中的子树行数：只锁叶子的插入共享地持有它，沿路径增加行数；
+    // 持有smo_mutex的写者独占地持有它，分裂时路径和行数不会被别的写者改变
+    pthread_rwlock_t count_lock;
+    // 写时复制模式下读者看到的根(最后一次提交)，root_page_num是写者正在修改的根
+    uint32_t snapshot_root_page_num;
+    // 主表的二级索引，下标见index_slot，没有索引的位置为NULL；索引树自己的这些字段不使用
+    struct Table *indexes[TABLE_MAX_INDEXES];
+    uint32_t num_indexes;
+    // 有索引时写操作独占地持有它，使主表和索引的修改对其他写者是原子的；没有索引时共享地持有，挡住正在建立的索引
+    pthread_rwlock_t index_lock;
+    // 索引树被索引的列和INCLUDE的列(ColumnMask)
+    uint32_t index_column;
+    uint32_t index_include;
+    // 哈希表的root_page_num是目录页
+    AccessMethod access_method;
+    // 主表打开时建立，判定主键一定不存在时不必下降到叶子；索引树为NULL
+    KeyFilter *key_filter;
+    // 最右边的叶子，按主键递增插入时直接追加到这里；未知时为INVALID_PAGE_NUM。
+    // 它的主键范围就是(叶子中最后一个主键, +∞)，在闩住叶子之后读取
+    uint32_t rightmost_leaf_page_num;
+    // 存取方式是ACCESS_LSM时的内存结构，其余为NULL；root_page_num是记录有序段的目录页
+    LsmTree *lsm;
+    // 主表可选的ART前端索引，按主键的读先查它；没有打开或者是索引树时为NULL
+    ArtTree *front_index;
 } Table;
 
 
@@ -80,9 +411,11 @@ typedef enum
 typedef enum
 {
     STATEMENT_INSERT,
+    STATEMENT_INSERT_BATCH,
     STATEMENT_SELECT,
     STATEMENT_UPDATE,
-    STATEMENT_DELETE
+    STATEMENT_DELETE,
+    STATEMENT_CREATE_INDEX
 } StatementType;
 
 typedef enum
@@ -90,31 +423,81 @@ typedef enum
     EXECUTE_SUCCESS,
     EXECUTE_TABLE_FULL,
     EXECUTE_DUPLICATE_KEY,
-    EXECUTE_KEY_NONE
+    EXECUTE_KEY_NONE,
+    EXECUTE_KEY_OUT_OF_RANGE,
+    EXECUTE_INDEX_EXISTS,
+    EXECUTE_UNSUPPORTED
 } ExecuteResult;
 
 
+#define SELECT_MAX_KEYS 1024
+
+/**
+ * select中主键的取值范围，没有上/下界时对应的has_*为false
+*/
+typedef struct
+{
+    bool has_lower;
+    bool lower_inclusive;
+    Key lower;
+    bool has_upper;
+    bool upper_inclusive;
+    Key upper;
+} KeyRange;
+
 typedef struct
 {
     StatementType type;
     Row row_to_insert;
+    // insert (..), (..), ... 的所有行，prepare时分配，执行后释放
+    Row *insert_rows;
+    uint32_t num_insert_rows;
     Row row_to_update;
     Row row_to_select;
     Row row_to_delete;
+    Key update_key;
+    KeyRange select_range;
+    uint32_t select_limit;
+    // offset <n>：跳过前n个满足条件的行
+    uint32_t select_offset;
+    bool select_descending;
+    uint32_t select_columns;
+    // select count(*)：只输出满足条件的行数
+    bool select_count;
+    // 执行时已经输出(count(*)时已经计数)的行数
+    uint32_t select_num_rows;
+    // where username|email = <值> 或 like <前缀>%，select_filter_column为0表示没有这个条件
+    uint32_t select_filter_column;
+    bool select_filter_prefix;
+    char select_filter_value[COLUMN_EMAIL_SIZE + 1];
+    // where id in (<id>, ...)，select_num_keys为0表示没有这个条件
+    Key select_keys[SELECT_MAX_KEYS];
+    uint32_t select_num_keys;
+    // create index on <列> [include <列>, ...]
+    uint32_t index_column;
+    uint32_t index_include;
 } Statement;
 
 
 
 
 const extern uint32_t ID_SIZE;
+const extern uint32_t TENANT_ID_SIZE;
 const extern uint32_t USERNAME_SIZE;
-const extern uint32_t EMAIL_SIZE;
+const extern uint32_t EMAIL_LENGTH_SIZE;
+const extern uint32_t EMAIL_INLINE_SIZE;
+const extern uint32_t EMAIL_OVERFLOW_SIZE;
 const extern uint32_t ID_OFFSET;
+const extern uint32_t TENANT_ID_OFFSET;
 const extern uint32_t USERNAME_OFFSET;
+const extern uint32_t EMAIL_LENGTH_OFFSET;
 const extern uint32_t EMAIL_OFFSET;
+const extern uint32_t EMAIL_OVERFLOW_OFFSET;
 const extern uint32_t ROW_SIZE;
 
 
+#define BTREE_MAX_DEPTH 32
+
 typedef struct
 {
     Table *table;
@@ -122,8 +505,40 @@ typedef struct
     uint32_t page_num;
     uint32_t cell_num;
     bool end_of_table;
+    // 从根节点到叶子的路径：第i层经过的内部节点页码，以及在其中选择的孩子下标
+    uint32_t path_pages[BTREE_MAX_DEPTH];
+    uint32_t path_cells[BTREE_MAX_DEPTH];
+    uint32_t depth;
+    // 游标在当前叶子上持有的闩锁
+    LatchMode latch_mode;
+    // 写时复制模式下读游标占用的快照槽位，-1表示没有
+    int32_t snapshot_slot;
 } Cursor;
 
+/**
+ * 下降到叶子时的加锁方式，两种方式在内部节点上都只短暂地加共享闩锁
+ * FIND_READ  叶子加共享闩锁
+ * FIND_WRITE 叶子加独占闩锁；持有smo_mutex时记录的路径就是叶子真正的祖先，可以用于分裂
+*/
+typedef enum
+{
+    FIND_READ,
+    FIND_WRITE
+} FindMode;
+
+/**
+ * table_put在主键已存在或不存在时的行为
+ * PUT_INSERT 主键已存在时返回EXECUTE_DUPLICATE_KEY
+ * PUT_UPDATE 主键不存在时返回EXECUTE_KEY_NONE
+ * PUT_UPSERT 存在则覆盖，否则插入
+*/
+typedef enum
+{
+    PUT_INSERT,
+    PUT_UPDATE,
+    PUT_UPSERT
+} PutMode;
+
 
 
 InputBuffer *new_input_buffer();
@@ -136,44 +551,521 @@ void close_input_buffer(InputBuffer *input_buffer);
 
 ExecuteResult execute_insert(Statement *statement, Table *table);
 
+ExecuteResult table_insert_batch(Table *table, uint8_t *cells, uint32_t num_cells, bool *inserted);
+
+ExecuteResult insert_rows(Table *table, Row *rows, uint32_t num_rows);
+
+ExecuteResult execute_insert_batch(Statement *statement, Table *table);
+
 ExecuteResult execute_select(Statement *statement, Table *table);
 
+ExecuteResult select_rows(Statement *statement, Table *table);
+
+ExecuteResult select_key_list(Statement *statement, Table *table);
+
 ExecuteResult execute_update(Statement *statement, Table *table);
 
-void serialize_row(Row *source, void *destination);
+bool table_append_rightmost(Table *table, const void *key, const void *value);
+
+ExecuteResult table_put(Table *table, const void *key, const void *value, PutMode mode, void *old_value);
+
+bool table_get(Table *table, const void *key, void *value);
+
+bool row_matches_filter(Statement *statement, Row *row);
 
-void deserialize_row(void *source, Row *destination);
+bool cursor_key_equals(Cursor *cursor, const void *key);
 
-void print_row(Row *row);
+void serialize_row(Pager *pager, Row *source, void *destination);
+
+void deserialize_row(Pager *pager, void *source, Row *destination, uint32_t columns);
+
+void release_row_overflow(Pager *pager, void *source);
+
+void table_release_overflow(Table *table, void *value);
+
+void select_output_row(Statement *statement, Row *row, KeyType key_type);
+
+void print_row(Row *row, uint32_t columns, KeyType key_type);
 
 void *get_page(Pager *pager, uint32_t page_num);
 
+uint32_t *frame_page_num(void *frame);
+
+void **frame_child(void *frame, uint32_t child_num);
+
+void *get_child_page(Pager *pager, void *node, uint32_t child_num, uint32_t child_page_num);
+
+void frame_unswizzle_all(Pager *pager);
+
 Pager *pager_open(const char *filename);
 
 void pager_flush(Pager *pager, uint32_t page_num);
 
-Table *db_open(const char *filename);
+Table *db_open(const char *filename, KeyType key_type, bool copy_on_write, AccessMethod access_method);
+
+Table *table_open(Pager *pager, uint32_t root_offset, KeyType key_type, uint32_t value_size);
+
+void table_close(Table *table);
 
 void db_close(Table *table);
 
 uint32_t get_unused_page_num(Pager *Pager);
 
+void pager_free_page(Pager *pager, uint32_t page_num);
+
+void pager_free_list_push(Pager *pager, uint32_t page_num);
+
+void pager_truncate(Pager *pager, uint32_t num_pages);
+
+void page_latch(Pager *pager, uint32_t page_num, LatchMode mode);
+
+void page_unlatch(Pager *pager, uint32_t page_num);
+
+bool page_latched_exclusive(Pager *pager, uint32_t page_num);
+
+uint32_t *db_header_root_page(void *header);
+
+uint32_t *db_header_free_head(void *header);
+
+uint32_t *db_header_key_type(void *header);
+
+uint32_t *db_header_copy_on_write(void *header);
+
+uint32_t *db_header_index_root(void *header, uint32_t slot);
+
+uint32_t *db_header_index_include(void *header, uint32_t slot);
+
+uint32_t *db_header_access_method(void *header);
+
+uint32_t *db_header_fill_factor(void *header);
+
 MetaCommandResult do_meta_command(InputBuffer *input_buffer, Table *table);
 
+PrepareResult prepare_row(char *id_string, char *username, char *email, Row *row);
+
 PrepareResult prepare_insert(InputBuffer *input_buffer, Statement *statement);
 
+PrepareResult prepare_insert_batch(InputBuffer *input_buffer, Statement *statement);
+
 PrepareResult prepare_statement(InputBuffer *input_buffer, Statement *statement);
 
+bool key_range_contains(KeyRange *range, Key *key);
+
+bool key_range_is_point(KeyRange *range);
+
+PrepareResult prepare_create_index(InputBuffer *input_buffer, Statement *statement);
+
 ExecuteResult execute_statement(Statement *statement, Table *table);
 
-Cursor *table_find(Table *table, uint32_t key);
+Cursor *table_find(Table *table, const void *key, FindMode mode);
 
 Cursor *table_start(Table *table);
 
+Cursor *table_seek(Table *table, const void *key);
+Cursor *table_end(Table *table);
+
+uint32_t table_count(Table *table);
+
+uint32_t table_rank(Table *table, const void *key, bool inclusive);
+
+Cursor *table_seek_rank(Table *table, uint32_t rank);
+
+void *cursor_key(Cursor *cursor);
+
+void cursor_next_leaf(Cursor *cursor, void *node);
+
 void cursor_advance(Cursor *cursor);
+void cursor_retreat(Cursor *cursor);
 
 void *cursor_value(Cursor *cursor);
 
+void cursor_close(Cursor *cursor);
+
+
+
+/**
+ * OVERFLOW_H
+ * 超过EMAIL_INLINE_SIZE的部分存放在溢出页链表中，每页开头是下一页的页码(0表示结尾)
+*/
+
+const extern uint32_t OVERFLOW_NEXT_PAGE_SIZE;
+const extern uint32_t OVERFLOW_NEXT_PAGE_OFFSET;
+const extern uint32_t OVERFLOW_PAGE_HEADER_SIZE;
+const extern uint32_t OVERFLOW_PAGE_SPACE;
+
+uint32_t *overflow_page_next(void *page);
+
+uint32_t overflow_write(Pager *pager, const char *source, uint32_t length);
+
+void overflow_read(Pager *pager, uint32_t page_num, char *destination, uint32_t length);
+
+void overflow_free(Pager *pager, uint32_t page_num);
+
+
+
+/**
+ * SNAPSHOT_H
+ * 写时复制模式：写者复制从根到叶子的路径，在副本上修改后原子地发布新的根，读者不加锁地读取某个版本的根
+*/
+
+int32_t snapshot_acquire(Table *table, uint32_t *root_page_num);
+
+void snapshot_release(Table *table, int32_t slot);
+
+void snapshot_shadow_path(Cursor *cursor);
+
+void snapshot_commit(Table *table);
+
+void snapshot_retire_page(Pager *pager, uint32_t page_num);
+
+void snapshot_reclaim(Pager *pager);
+
+bool cursor_step_leaf(Cursor *cursor, bool forward);
+
+
+
+/**
+ * INDEX_H
+ * username和email上的二级索引，每个索引是一棵独立的B树，主键是(列值前缀, 主表主键)，
+ * 值是索引项，可以带上INCLUDE的列。查询的列都能从索引项得到时不回表(index-only scan)。
+ * 索引项被删除时只做标记，由.vacuum清除
+*/
+
+const extern uint32_t INDEX_ENTRY_FLAGS_SIZE;
+const extern uint32_t INDEX_ENTRY_FLAGS_OFFSET;
+const extern uint32_t INDEX_ENTRY_HEADER_SIZE;
+const extern uint32_t INDEX_ENTRY_MAX_SIZE;
+const extern uint8_t INDEX_ENTRY_DELETED;
+const extern uint8_t INDEX_ENTRY_PARTIAL;
+const extern uint32_t INDEX_COLUMNS[TABLE_MAX_INDEXES];
+
+int32_t index_slot(uint32_t column);
+
+Table *index_open(Table *table, uint32_t column);
+
+void index_key(Table *table, uint32_t column, const void *key, const void *value, void *destination);
+
+uint32_t index_entry_size(uint32_t include);
+
+void index_entry(Table *index, const void *value, void *destination);
+
+void index_entry_row(Table *index, const void *key, const void *entry, Row *row);
+
+void index_insert_row(Table *table, const void *key, const void *value);
+
+void index_update_row(Table *table, const void *key, const void *old_value, const void *new_value);
+
+void index_write_lock(Table *table);
+
+void index_write_unlock(Table *table);
+
+int index_compare_cells(const void *a, const void *b);
+
+ExecuteResult execute_create_index(Statement *statement, Table *table);
+
+ExecuteResult index_select(Statement *statement, Table *table, Table *index);
+
+
+
+/**
+ * HASH_H
+ * 可扩展哈希表：目录页记录每个哈希值低位前缀对应的桶页，桶满时只分裂这一个桶，
+ * 桶的局部深度等于全局深度时目录加倍。写者之间用smo_mutex串行，读者先共享地闩住目录再闩住桶
+*/
+
+const extern uint32_t HASH_DIRECTORY_DEPTH_SIZE;
+const extern uint32_t HASH_DIRECTORY_DEPTH_OFFSET;
+const extern uint32_t HASH_DIRECTORY_BUCKET_SIZE;
+const extern uint32_t HASH_DIRECTORY_BUCKETS_OFFSET;
+const extern uint32_t HASH_DIRECTORY_MAX_DEPTH;
+const extern uint32_t HASH_BUCKET_LOCAL_DEPTH_SIZE;
+const extern uint32_t HASH_BUCKET_LOCAL_DEPTH_OFFSET;
+const extern uint32_t HASH_BUCKET_NUM_CELLS_SIZE;
+const extern uint32_t HASH_BUCKET_NUM_CELLS_OFFSET;
+const extern uint32_t HASH_BUCKET_HEADER_SIZE;
+const extern uint32_t HASH_BUCKET_SPACE_FOR_CELLS;
+
+uint64_t hash_key(const void *key, uint32_t key_size);
+
+uint32_t *hash_directory_depth(void *directory);
+
+uint32_t *hash_directory_bucket(void *directory, uint32_t index);
+
+uint32_t *hash_bucket_local_depth(void *bucket);
+
+uint32_t *hash_bucket_num_cells(void *bucket);
+
+void *hash_bucket_cell(Table *table, void *bucket, uint32_t cell_num);
+
+uint32_t hash_bucket_max_cells(Table *table);
+
+void hash_initialize(Pager *pager, uint32_t directory_page_num, uint32_t bucket_page_num);
+
+int32_t hash_bucket_find(Table *table, void *bucket, const void *key);
+
+uint32_t hash_latch_bucket(Table *table, uint64_t hash, LatchMode mode);
+
+bool hash_get(Table *table, const void *key, void *value);
+
+ExecuteResult hash_split_bucket(Table *table, uint32_t bucket_page_num);
+
+ExecuteResult hash_put(Table *table, const void *key, const void *value, PutMode mode, void *old_value);
+
+ExecuteResult hash_select(Statement *statement, Table *table);
+
+void print_hash(Table *table);
+
+
+
+/**
+ * BUFFER_H
+ * 写优化模式下内部节点在单元格之后保留一个消息缓冲，消息和叶子单元格的格式相同(主键 + 值)，按主键排序，
+ * 同一主键只保留最新的一条。离根越近的消息越新，查找时从根向下遇到的第一条就是最新值。
+ * 所有写者(包括下推)持有smo_mutex并独占地持有count_lock，读者和B树一样一次只闩住一个节点
+*/
+
+const extern uint32_t INTERNAL_NODE_NUM_MESSAGES_SIZE;
+const extern uint32_t INTERNAL_NODE_NUM_MESSAGES_OFFSET;
+const extern uint32_t INTERNAL_NODE_MESSAGES_OFFSET;
+
+uint32_t *internal_node_num_messages(void *node);
+
+void *internal_node_message(void *node, uint32_t message_num);
+
+uint32_t internal_node_max_messages(void *node);
+
+uint32_t buffer_find(void *node, const void *key, bool *found);
+
+void buffer_put(void *node, const void *key, const void *value);
+
+void buffer_merge(void *node, const uint8_t *messages, uint32_t count);
+
+void buffer_remove(void *node, uint32_t message_num, uint32_t count);
+
+void buffer_split(void *old_node, void *new_node, const void *old_max);
+
+bool betree_get(Table *table, const void *key, void *value);
+
+void betree_apply(Table *table, const void *key, const void *value);
+
+void betree_apply_batch(Table *table, const uint8_t *messages, uint32_t count);
+
+void betree_remove_applied(Table *table, const uint8_t *messages, uint32_t count);
+
+void betree_flush(Table *table, uint32_t page_num);
+
+void betree_flush_all(Table *table);
+
+bool betree_after_rightmost(Table *table, const void *key);
+
+ExecuteResult betree_put(Table *table, const void *key, const void *value, PutMode mode, void *old_value);
+
+void print_buffers(Table *table, uint32_t page_num, uint32_t indentation_level);
+
+
+
+/**
+ * LSM_H
+ * 目录页 = 有序段数 + 每个有序段的(层号, 第一页, 页数, 单元格数)，顺序和LsmTree.runs相同；
+ * 有序段的页 = 单元格数 + 下一页的页码 + 按主键排序的单元格(主键 + 行)。
+ * 内存表在写满时由写者顺序写成第0层的有序段，第0层的段数达到阈值后由后台线程合并进第1层，
+ * 第i层超过容量后合并进第i+1层。没有delete语句，合并时同一主键只保留最新的值
+*/
+
+const extern uint32_t LSM_DIRECTORY_NUM_RUNS_SIZE;
+const extern uint32_t LSM_DIRECTORY_NUM_RUNS_OFFSET;
+const extern uint32_t LSM_DIRECTORY_RUN_LEVEL_OFFSET;
+const extern uint32_t LSM_DIRECTORY_RUN_FIRST_PAGE_OFFSET;
+const extern uint32_t LSM_DIRECTORY_RUN_NUM_PAGES_OFFSET;
+const extern uint32_t LSM_DIRECTORY_RUN_NUM_CELLS_OFFSET;
+const extern uint32_t LSM_DIRECTORY_RUN_SIZE;
+const extern uint32_t LSM_DIRECTORY_RUNS_OFFSET;
+const extern uint32_t LSM_RUN_NUM_CELLS_SIZE;
+const extern uint32_t LSM_RUN_NUM_CELLS_OFFSET;
+const extern uint32_t LSM_RUN_NEXT_PAGE_SIZE;
+const extern uint32_t LSM_RUN_NEXT_PAGE_OFFSET;
+const extern uint32_t LSM_RUN_HEADER_SIZE;
+const extern uint32_t LSM_RUN_SPACE_FOR_CELLS;
+const extern uint32_t LSM_MEMTABLE_MAX_ROWS;
+const extern uint32_t LSM_L0_COMPACTION_TRIGGER;
+const extern uint32_t LSM_LEVEL_BASE_ROWS;
+const extern uint32_t LSM_LEVEL_SIZE_RATIO;
+
+/**
+ * 归并时的一个来源：内存表(node非NULL)或者有序段中的位置
+*/
+typedef struct
+{
+    Table *table;
+    LsmNode *node;
+    LsmRun *run;
+    uint32_t page_index;
+    uint32_t cell_num;
+} LsmIterator;
+
+LsmMemtable *lsm_memtable_create();
+
+void lsm_memtable_free(LsmMemtable *memtable);
+
+LsmNode *lsm_memtable_seek(Table *table, LsmMemtable *memtable, const void *key, LsmNode **update);
+
+void lsm_memtable_put(Table *table, const void *key, const void *value);
+
+uint32_t *lsm_run_num_cells(void *page);
+
+uint32_t *lsm_run_next_page(void *page);
+
+void *lsm_run_cell(Table *table, void *page, uint32_t cell_num);
+
+uint32_t lsm_run_max_cells(Table *table);
+
+void lsm_run_build(Table *table, uint8_t *cells, uint32_t num_cells, uint32_t level, LsmRun *run);
+
+void lsm_run_load(Table *table, uint32_t level, uint32_t first_page_num, uint32_t num_pages,
+                  uint32_t num_cells, LsmRun *run);
+
+void lsm_run_free(Table *table, LsmRun *run, bool free_pages);
+
+bool lsm_run_get(Table *table, LsmRun *run, const void *key, void *value);
+
+void *lsm_iterator_cell(LsmIterator *iterator);
+
+void lsm_iterator_advance(LsmIterator *iterator);
+
+uint8_t *lsm_merge(Table *table, LsmMemtable *memtable, LsmRun *runs, uint32_t num_runs, uint32_t *num_cells);
+
+void lsm_save_directory(Table *table);
+
+void lsm_install_run(LsmTree *lsm, LsmRun *run);
+
+void lsm_flush_memtable(Table *table);
+
+uint32_t lsm_level_max_rows(uint32_t level);
+
+bool lsm_compact(Table *table);
+
+void lsm_compact_all(Table *table);
+
+void *lsm_compaction_thread(void *arg);
+
+void lsm_notify(LsmTree *lsm, bool wait);
+
+void lsm_open(Table *table);
+
+void lsm_close(Table *table);
+
+bool lsm_get(Table *table, const void *key, void *value);
+
+ExecuteResult lsm_put(Table *table, const void *key, const void *value, PutMode mode, void *old_value);
+
+ExecuteResult lsm_select(Statement *statement, Table *table);
+
+void print_lsm(Table *table);
+
+
+
+/**
+ * FILTER_H
+ * 主表主键的Bloom过滤器：update和按主键的select遇到一定不存在的主键时直接返回，不读任何页面
+*/
+
+const extern uint32_t KEY_FILTER_BITS_PER_KEY;
+const extern uint32_t KEY_FILTER_NUM_HASHES;
+
+KeyFilter *key_filter_create(uint32_t num_keys);
+
+void key_filter_free(KeyFilter *filter);
+
+uint64_t key_filter_bit(KeyFilter *filter, uint64_t hash, uint32_t i);
+
+void key_filter_add(KeyFilter *filter, const void *key, uint32_t key_size);
+
+bool key_filter_may_contain(KeyFilter *filter, const void *key, uint32_t key_size);
+
+void table_filter_open(Table *table);
+
+
+
+/**
+ * ART_H
+ * 主表主键上可选的自适应基数树：把主键直接映射到叶子中的位置，命中时点查询不必从根下降
+*/
+
+bool art_is_leaf(void *child);
+
+ArtLeaf *art_leaf(void *child);
+
+void *art_leaf_create(ArtTree *art, const void *key, uint32_t page_num, uint32_t cell_num);
+
+ArtNode *art_node_create(ArtNodeType type);
+
+void art_node_free(void *node);
+
+void **art_find_child(ArtNode *node, uint8_t byte);
+
+void art_add_child(void **ref, uint8_t byte, void *child);
+
+bool art_get(ArtTree *art, const void *key, uint32_t *page_num, uint32_t *cell_num);
+
+void art_put(ArtTree *art, const void *key, uint32_t page_num, uint32_t cell_num);
+
+void table_art_open(Table *table);
+
+void table_art_close(Table *table);
+
+void table_art_reset(Table *table);
+
+void table_art_build(Table *table);
+
+void table_art_update(Table *table, uint32_t page_num, void *node, uint32_t first_cell, uint32_t last_cell);
+
+Cursor *table_art_find(Table *table, const void *key);
+
+
+
+/**
+ * MULTIGET_H
+ * 一次查找多个主键(where id in (...))，各个主键的下降交错进行
+*/
+
+const extern uint32_t MULTI_GET_PREFETCH_LINES;
+
+void page_prefetch(void *page);
+
+void table_multi_get(Table *table, const uint8_t *keys, uint32_t num_keys, uint8_t *values, bool *found);
+
+
+
+/**
+ * VACUUM_H
+ * 按主键顺序重建树，叶子在文件中连续存放
+*/
+
+const extern uint32_t VACUUM_DEFAULT_FILL_FACTOR;
+const extern uint32_t FILL_FACTOR_MIN;
+
+uint32_t vacuum_fill_factor(Table *table);
+
+ExecuteResult table_set_fill_factor(Table *table, uint32_t fill_factor);
+
+void vacuum_read_lock(Pager *pager);
+
+void vacuum_read_unlock(Pager *pager);
+
+char *vacuum_read_overflow(Pager *pager, void *value, uint32_t *length);
+
+uint32_t vacuum_parent_count(uint32_t count, uint32_t per_node);
+
+uint32_t vacuum_per_node(uint32_t fill_factor);
+
+uint8_t *vacuum_collect(Table *table, uint32_t *num_rows);
+
+uint32_t vacuum_tree_pages(Table *table, uint32_t num_rows, uint32_t fill_factor, uint32_t *num_leaves);
+
+void vacuum_rebuild(Table *table, uint8_t *cells, uint32_t num_rows, uint32_t num_leaves, uint32_t per_node);
+
+ExecuteResult table_vacuum(Table *table, uint32_t fill_factor);
+
 
 
 /**
@@ -185,8 +1077,16 @@ const extern uint32_t NODE_TYPE_SIZE;
 const extern uint32_t NODE_TYPE_OFFSET;
 const extern uint32_t IS_ROOT_SIZE;
 const extern uint32_t IS_ROOT_OFFSET;
-const extern uint32_t PARENT_POINTER_SIZE;
-const extern uint32_t PARENT_POINTER_OFFSET;
+const extern uint32_t NODE_KEY_TYPE_SIZE;
+const extern uint32_t NODE_KEY_TYPE_OFFSET;
+const extern uint32_t NODE_KEY_SIZE_SIZE;
+const extern uint32_t NODE_KEY_SIZE_OFFSET;
+const extern uint32_t NODE_VALUE_SIZE_SIZE;
+const extern uint32_t NODE_VALUE_SIZE_OFFSET;
+const extern uint32_t NODE_PADDING_SIZE;
+const extern uint32_t NODE_PADDING_OFFSET;
+const extern uint32_t NODE_HIGH_KEY_SIZE;
+const extern uint32_t NODE_HIGH_KEY_OFFSET;
 const extern uint8_t COMMON_NODE_HEADER_SIZE;
 
 
@@ -194,33 +1094,30 @@ const extern uint32_t LEAF_NODE_NUM_CELLS_SIZE;
 const extern uint32_t LEAF_NODE_NUM_CELLS_OFFSET;
 const extern uint32_t LEAF_NODE_NEXT_LEAF_SIZE;
 const extern uint32_t LEAF_NODE_NEXT_LEAF_OFFSET;
+const extern uint32_t LEAF_NODE_PREV_LEAF_SIZE;
+const extern uint32_t LEAF_NODE_PREV_LEAF_OFFSET;
 const extern uint32_t LEAF_NODE_HEADER_SIZE;
 
 
-const extern uint32_t LEAF_NODE_KEY_SIZE;
 const extern uint32_t LEAF_NODE_KEY_OFFSET;
 const extern uint32_t LEAF_NODE_VALUE_SIZE;
-const extern uint32_t LEAF_NODE_VALUE_OFFSET;
-const extern uint32_t LEAF_NODE_CELL_SIZE;
 const extern uint32_t LEAF_NODE_SPACE_FOR_CELLS;
-const extern uint32_t LEAF_NODE_MAX_CELLS;
-
-
-const extern uint32_t LEAF_NODE_RIGHT_SPLIT_COUNT;
-const extern uint32_t LEAF_NODE_LEFT_SPLIT_COUNT;
 
 
 const extern uint32_t INTERNAL_NODE_NUM_KEYS_SIZE;
 const extern uint32_t INTERNAL_NODE_NUM_KEYS_OFFSET;
 const extern uint32_t INTERNAL_NODE_RIGHT_CHILD_SIZE;
 const extern uint32_t INTERNAL_NODE_RIGHT_CHILD_OFFSET;
+const extern uint32_t INTERNAL_NODE_RIGHT_SIBLING_SIZE;
+const extern uint32_t INTERNAL_NODE_RIGHT_SIBLING_OFFSET;
+const extern uint32_t INTERNAL_NODE_RIGHT_COUNT_SIZE;
+const extern uint32_t INTERNAL_NODE_RIGHT_COUNT_OFFSET;
 const extern uint32_t INTERNAL_NODE_HEADER_SIZE;
 
 
 
-const extern uint32_t INTERNAL_NODE_KEY_SIZE;
 const extern uint32_t INTERNAL_NODE_CHILD_SIZE;
-const extern uint32_t INTERNAL_NODE_CELL_SIZE;
+const extern uint32_t INTERNAL_NODE_COUNT_SIZE;
 
 
 const extern uint32_t INTERNAL_NODE_MAX_CELLS;
@@ -236,17 +1133,36 @@ void indent(uint32_t level);
 
 void print_tree(Pager *pager, uint32_t page_num, uint32_t indentation_level);
 
-void print_constants();
+void print_constants(Table *table);
+
+void check_node_layout(void);
+
+KeyType get_node_key_type(void *node);
+
+uint32_t get_node_key_size(void *node);
+
+void set_node_key_format(void *node, KeyType key_type, uint32_t key_size);
+
+uint32_t get_node_value_size(void *node);
+
+void set_node_value_size(void *node, uint32_t value_size);
+
+uint32_t leaf_node_cell_size(void *node);
+
+uint32_t leaf_node_max_cells(void *node);
+
+uint32_t internal_node_cell_size(void *node);
 
 uint32_t *leaf_node_num_cells(void *node);
 
 void *leaf_node_cell(void *node, uint32_t cell_num);
 
-uint32_t *leaf_node_key(void *node, uint32_t cell_num);
+void *leaf_node_key(void *node, uint32_t cell_num);
 
 void *leaf_node_value(void *node, uint32_t cell_num);
 
 uint32_t *leaf_node_next_leaf(void *node);
+uint32_t *leaf_node_prev_leaf(void *node);
 
 NodeType get_node_type(void *node);
 
@@ -260,6 +1176,14 @@ void initialize_leaf_node(void* node);
 
 uint32_t* internal_node_right_child(void* node);
 
+uint32_t *internal_node_right_sibling(void *node);
+
+void *node_high_key(void *node);
+
+uint32_t node_right_sibling(void *node);
+
+bool node_covers_key(void *node, const void *key);
+
 void initialize_internal_node(void* node);
 
 uint32_t *internal_node_num_keys(void *node);
@@ -268,32 +1192,45 @@ uint32_t *internal_node_cell(void *node, uint32_t cell_num);
 
 uint32_t *internal_node_child(void *node, uint32_t child_num);
 
-uint32_t *internal_node_key(void *node, uint32_t key_num);
+void *internal_node_key(void *node, uint32_t key_num);
+
+uint32_t *internal_node_child_count(void *node, uint32_t child_num);
+
+uint32_t node_row_count(Pager *pager, uint32_t page_num);
 
-uint32_t get_node_max_key(Pager *pager, void *node);
+void internal_node_update_child_count(Pager *pager, void *parent, uint32_t child_page_num);
 
-uint32_t *node_parent(void *node);
+void cursor_count_insert(Cursor *cursor);
+
+void get_node_max_key(Pager *pager, uint32_t page_num, void *destination);
 
 void create_new_root(Table *table, uint32_t right_child_page_num);
 
-void update_internal_node_key(void *node, uint32_t old_key, uint32_t new_key);
+void update_internal_node_key(void *node, const void *old_key, const void *new_key);
+
+void internal_node_split_and_insert(Cursor *cursor, uint32_t level, uint32_t child_page_num);
+
+void internal_node_insert(Cursor *cursor, uint32_t level, uint32_t child_page_num);
+
+void internal_node_add_child(Table *table, uint32_t parent_page_num, uint32_t child_page_num);
+
+uint32_t leaf_node_append_split_count(Table *table, uint32_t max_cells);
 
-void internal_node_split_and_insert(Table *table, uint32_t parent_page_num,
-                                    uint32_t child_page_num);
+void leaf_node_split_and_insert(Cursor *cursor, const void *key, const void *value);
 
-void internal_node_insert(Table *table, uint32_t parent_page_num, uint32_t child_page_num);
+void leaf_node_split_at(Cursor *cursor, const void *key, const void *value, uint32_t left_split_count);
 
-void leaf_node_split_and_insert(Cursor *cursor, uint32_t key, Row *value);
+void leaf_node_insert(Cursor *cursor, const void *key, const void *value);
 
-void leaf_node_insert(Cursor *cursor, uint32_t key, Row *value);
+void leaf_node_update(Cursor *cursor, const void *value);
 
-void leaf_node_update(Cursor *cursor, uint32_t key, Row *value);
+Cursor *leaf_node_find(Table *table, uint32_t page_num, const void *key);
 
-Cursor *leaf_node_find(Table *table, uint32_t page_num, uint32_t key);
+uint32_t internal_node_find_child(void *node, const void *key);
 
-uint32_t internal_node_find_child(void *node, uint32_t key);
+Cursor *internal_node_find(Table *table, uint32_t page_num, const void *key, FindMode mode);
 
-Cursor *internal_node_find(Table *table, uint32_t page_num, uint32_t key);
+bool node_is_safe(void *node);
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,343 @@
+/*
+ * @Author: WangZhe
+ * @Date: 2026-10-19 20:12:46
+ * @LastEditors: WangZhe
+ * @LastEditTime: 2026-10-19 21:05:33
+ * @FilePath: /Sqlite/Stress.c
+ * @Description: 并发压力测试：多个写线程交错插入让叶子和内部节点同时分裂，读线程点查询、扫描线程用游标顺序扫描，
+ *               检查锁耦合和沿右指针右移之后没有丢行、乱序或读到别的行
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include"Sqlite.h"
+
+
+#define STRESS_WRITERS 4
+#define STRESS_READERS 2
+#define STRESS_SCANNERS 2
+#define STRESS_ROWS_PER_WRITER 300
+#define STRESS_BATCH_SIZE 20
+#define STRESS_NUM_ROWS (STRESS_WRITERS * STRESS_ROWS_PER_WRITER)
+#define STRESS_ROUNDS 5
+#define STRESS_YIELD_INTERVAL 64
+
+Table *stress_table;
+// 写线程全部结束后置位，读线程和扫描线程随之退出
+bool stress_done;
+// 每个写线程已经插入完成的行数，这些行对读线程和扫描线程必须可见
+uint32_t stress_progress[STRESS_WRITERS];
+
+/**
+ * @description: 压力测试失败时输出原因并退出
+ * @param {char} *message
+ * @param {uint32_t} id 出错的主键，0表示和具体主键无关
+ * @return {*}
+ */
+void stress_fail(const char *message, uint32_t id)
+{
+    printf("Stress test failed: %s (id %d).\n", message, id);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @description: 第writer个写线程第i次插入的主键
+ * @param {uint32_t} writer
+ * @param {uint32_t} i
+ * @return {uint32_t}
+ * @note: 各写线程的主键按模STRESS_WRITERS交错，并且每个线程内部打乱顺序，所以几个线程总是同时往相邻的叶子里插入
+ */
+uint32_t stress_id(uint32_t writer, uint32_t i)
+{
+    return (i * 7919 % STRESS_ROWS_PER_WRITER) * STRESS_WRITERS + writer + 1;
+}
+
+/**
+ * @description: 用主键填充一行
+ * @param {Row} *row
+ * @param {uint32_t} id
+ * @return {*}
+ */
+void stress_fill_row(Row *row, uint32_t id)
+{
+    memset(row, 0, sizeof(Row));
+    row->id = id;
+    snprintf(row->username, sizeof(row->username), "user%d", id);
+    snprintf(row->email, sizeof(row->email), "person%d@example.com", id);
+}
+
+/**
+ * @description: 点查询主键id，找到时检查读出来的正是这一行
+ * @param {uint32_t} id
+ * @return {bool} 是否找到
+ */
+bool stress_get(uint32_t id)
+{
+    uint8_t key[KEY_MAX_SIZE];
+    uint8_t value[ROW_SIZE];
+    Key row_key = {0, id};
+    encode_key(KEY_U32, &row_key, key);
+    if (!table_get(stress_table, key, value))
+    {
+        return false;
+    }
+    Row row;
+    deserialize_row(stress_table->pager, value, &row, COLUMN_ID);
+    if (row.id != id)
+    {
+        stress_fail("point lookup returned another row", id);
+    }
+    return true;
+}
+
+/**
+ * @description: 写线程：偶数号线程用insert_rows按批插入，奇数号线程用table_put逐行插入并立即读回
+ * @param {void} *arg 写线程编号
+ * @return {*}
+ */
+void *stress_writer(void *arg)
+{
+    uint32_t writer = (uint32_t)(uintptr_t)arg;
+    Row rows[STRESS_BATCH_SIZE];
+    uint8_t key[KEY_MAX_SIZE];
+    uint8_t value[ROW_SIZE];
+    for (uint32_t i = 0; i < STRESS_ROWS_PER_WRITER; i += STRESS_BATCH_SIZE)
+    {
+        for (uint32_t j = 0; j < STRESS_BATCH_SIZE; j++)
+        {
+            stress_fill_row(&rows[j], stress_id(writer, i + j));
+        }
+        if (writer % 2 == 0)
+        {
+            if (insert_rows(stress_table, rows, STRESS_BATCH_SIZE) != EXECUTE_SUCCESS)
+            {
+                stress_fail("batch insert failed", rows[0].id);
+            }
+            __atomic_store_n(&stress_progress[writer], i + STRESS_BATCH_SIZE, __ATOMIC_RELEASE);
+            continue;
+        }
+        for (uint32_t j = 0; j < STRESS_BATCH_SIZE; j++)
+        {
+            Key row_key = {0, rows[j].id};
+            encode_key(KEY_U32, &row_key, key);
+            serialize_row(stress_table->pager, &rows[j], value);
+            if (table_put(stress_table, key, value, PUT_INSERT, NULL) != EXECUTE_SUCCESS)
+            {
+                stress_fail("insert failed", rows[j].id);
+            }
+            // 刚插入的行被别的线程分裂到右边的兄弟里也必须能查到
+            if (!stress_get(rows[j].id))
+            {
+                stress_fail("row missing right after insert", rows[j].id);
+            }
+            __atomic_store_n(&stress_progress[writer], i + j + 1, __ATOMIC_RELEASE);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @description: 读线程：在写线程结束前不停地点查询某个写线程已经插入完成的随机主键
+ * @param {void} *arg 随机数种子
+ * @return {*}
+ */
+void *stress_reader(void *arg)
+{
+    unsigned int seed = (unsigned int)(uintptr_t)arg;
+    uint32_t num_lookups = 0;
+    while (!__atomic_load_n(&stress_done, __ATOMIC_ACQUIRE))
+    {
+        uint32_t writer = rand_r(&seed) % STRESS_WRITERS;
+        uint32_t progress = __atomic_load_n(&stress_progress[writer], __ATOMIC_ACQUIRE);
+        if (progress == 0)
+        {
+            sched_yield();
+            continue;
+        }
+        uint32_t id = stress_id(writer, rand_r(&seed) % progress);
+        if (!stress_get(id))
+        {
+            stress_fail("committed row missing", id);
+        }
+        // 单核机器上读线程一直不让出处理器的话，写线程很难拿到独占闩锁；
+        // 也不能每次都让出，否则读线程总是在下降完成之后才被切换，碰不到分裂
+        if (++num_lookups % STRESS_YIELD_INTERVAL == 0)
+        {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @description: 扫描线程：在写线程结束前不停地从头到尾扫描整张表
+ * @param {void} *arg
+ * @return {*}
+ * @note: 主键必须严格递增；扫描开始前已经插入完成的行一行都不能少
+ */
+void *stress_scanner(void *arg)
+{
+    (void)arg;
+    uint8_t prev[KEY_MAX_SIZE];
+    while (!__atomic_load_n(&stress_done, __ATOMIC_ACQUIRE))
+    {
+        uint32_t inserted = 0;
+        for (uint32_t i = 0; i < STRESS_WRITERS; i++)
+        {
+            inserted += __atomic_load_n(&stress_progress[i], __ATOMIC_ACQUIRE);
+        }
+        uint32_t num_rows = 0;
+        Cursor *cursor = table_start(stress_table);
+        while (!cursor->end_of_table)
+        {
+            if (num_rows > 0 &&
+                compare_keys(stress_table->key_type, stress_table->key_size, prev, cursor_key(cursor)) >= 0)
+            {
+                stress_fail("scan out of order", num_rows);
+            }
+            memcpy(prev, cursor_key(cursor), stress_table->key_size);
+            num_rows++;
+            cursor_advance(cursor);
+        }
+        cursor_close(cursor);
+        if (num_rows < inserted)
+        {
+            stress_fail("scan lost rows", inserted - num_rows);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @description: 递归检查内部节点里记录的子树行数
+ * @param {Pager} *pager
+ * @param {uint32_t} page_num 子树的根
+ * @return {uint32_t} 子树实际的行数
+ */
+uint32_t stress_verify_counts(Pager *pager, uint32_t page_num)
+{
+    void *node = get_page(pager, page_num);
+    if (get_node_type(node) == NODE_LEAF)
+    {
+        return *leaf_node_num_cells(node);
+    }
+    uint32_t num_keys = *internal_node_num_keys(node);
+    uint32_t total = 0;
+    for (uint32_t i = 0; i <= num_keys; i++)
+    {
+        uint32_t count = stress_verify_counts(pager, *internal_node_child(node, i));
+        if (count != *internal_node_child_count(node, i))
+        {
+            stress_fail("subtree count mismatch", page_num);
+        }
+        total += count;
+    }
+    return total;
+}
+
+/**
+ * @description: 所有线程结束后检查整棵树：顺序扫描、逐个点查询、子树行数和总行数
+ * @return {*}
+ */
+void stress_verify()
+{
+    uint8_t prev[KEY_MAX_SIZE];
+    uint32_t num_rows = 0;
+    Cursor *cursor = table_start(stress_table);
+    while (!cursor->end_of_table)
+    {
+        if (num_rows > 0 &&
+            compare_keys(stress_table->key_type, stress_table->key_size, prev, cursor_key(cursor)) >= 0)
+        {
+            stress_fail("final scan out of order", num_rows);
+        }
+        memcpy(prev, cursor_key(cursor), stress_table->key_size);
+        num_rows++;
+        cursor_advance(cursor);
+    }
+    cursor_close(cursor);
+    if (num_rows != STRESS_NUM_ROWS)
+    {
+        stress_fail("final scan row count", num_rows);
+    }
+    for (uint32_t id = 1; id <= STRESS_NUM_ROWS; id++)
+    {
+        if (!stress_get(id))
+        {
+            stress_fail("row missing after all writers finished", id);
+        }
+    }
+    if (stress_verify_counts(stress_table->pager, stress_table->root_page_num) != STRESS_NUM_ROWS)
+    {
+        stress_fail("subtree counts do not add up", 0);
+    }
+    if (table_count(stress_table) != STRESS_NUM_ROWS)
+    {
+        stress_fail("table_count", table_count(stress_table));
+    }
+}
+
+/**
+ * @description: 在新建的空表上跑一轮：所有线程并发执行，结束后检查整棵树
+ * @param {char} *filename 每轮开始前和结束后都会删除
+ * @return {*}
+ */
+void stress_round(const char *filename)
+{
+    unlink(filename);
+    stress_table = db_open(filename, KEY_U32, false, ACCESS_BTREE);
+    stress_done = false;
+    memset(stress_progress, 0, sizeof(stress_progress));
+
+    pthread_t writers[STRESS_WRITERS];
+    pthread_t readers[STRESS_READERS];
+    pthread_t scanners[STRESS_SCANNERS];
+    for (uintptr_t i = 0; i < STRESS_READERS; i++)
+    {
+        pthread_create(&readers[i], NULL, stress_reader, (void *)(i + 1));
+    }
+    for (uintptr_t i = 0; i < STRESS_SCANNERS; i++)
+    {
+        pthread_create(&scanners[i], NULL, stress_scanner, NULL);
+    }
+    for (uintptr_t i = 0; i < STRESS_WRITERS; i++)
+    {
+        pthread_create(&writers[i], NULL, stress_writer, (void *)i);
+    }
+    for (uint32_t i = 0; i < STRESS_WRITERS; i++)
+    {
+        pthread_join(writers[i], NULL);
+    }
+    __atomic_store_n(&stress_done, true, __ATOMIC_RELEASE);
+    for (uint32_t i = 0; i < STRESS_READERS; i++)
+    {
+        pthread_join(readers[i], NULL);
+    }
+    for (uint32_t i = 0; i < STRESS_SCANNERS; i++)
+    {
+        pthread_join(scanners[i], NULL);
+    }
+
+    stress_verify();
+    db_close(stress_table);
+    unlink(filename);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *filename = argc > 1 ? argv[1] : "stress.db";
+    for (uint32_t round = 0; round < STRESS_ROUNDS; round++)
+    {
+        stress_round(filename);
+    }
+    printf("Stress test passed: %d rounds of %d rows, %d writers, %d readers, %d scanners.\n", STRESS_ROUNDS,
+           STRESS_NUM_ROWS, STRESS_WRITERS, STRESS_READERS, STRESS_SCANNERS);
+    return EXIT_SUCCESS;
+}
@@ -15,130 +15,933 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include"Sqlite.h"
 
 
 /**
  * @description: 紧凑结构转换,将数据紧凑存储在连续的字节上
+ * @param {Pager} *pager
  * @param {Row} *source
  * @param {void} *destination
  * @return {*}
- * @note: 
+ * @note: email超出EMAIL_INLINE_SIZE的部分写入溢出页，单元格中记录长度和溢出页页码
  */
-void serialize_row(Row *source, void *destination)
+void serialize_row(Pager *pager, Row *source, void *destination)
 {
+    uint32_t email_length = strlen(source->email);
+    uint32_t inline_length = email_length < EMAIL_INLINE_SIZE ? email_length : EMAIL_INLINE_SIZE;
+    uint32_t overflow_page_num = 0;
+
+    if (email_length > EMAIL_INLINE_SIZE)
+    {
+        overflow_page_num = overflow_write(pager, source->email + EMAIL_INLINE_SIZE,
+                                           email_length - EMAIL_INLINE_SIZE);
+    }
+
     memcpy(destination + ID_OFFSET, &(source->id), ID_SIZE);
+    memcpy(destination + TENANT_ID_OFFSET, &(source->tenant_id), TENANT_ID_SIZE);
     strncpy(destination + USERNAME_OFFSET, source->username, USERNAME_SIZE);
-    strncpy(destination + EMAIL_OFFSET, source->email, EMAIL_SIZE);
+    memcpy(destination + EMAIL_LENGTH_OFFSET, &email_length, EMAIL_LENGTH_SIZE);
+    memset(destination + EMAIL_OFFSET, 0, EMAIL_INLINE_SIZE);
+    memcpy(destination + EMAIL_OFFSET, source->email, inline_length);
+    memcpy(destination + EMAIL_OVERFLOW_OFFSET, &overflow_page_num, EMAIL_OVERFLOW_SIZE);
 }
 
 /**
  * @description: 从内存中读取并存入表结构Row中
+ * @param {Pager} *pager
  * @param {void} *source
  * @param {Row} *destination
+ * @param {uint32_t} columns 需要读取的列(ColumnMask)，id总是会被读取
  * @return {*}
- * @note: 
+ * @note: 只有投影了email列时才会去读溢出页
  */
-void deserialize_row(void *source, Row *destination)
+void deserialize_row(Pager *pager, void *source, Row *destination, uint32_t columns)
 {
     memcpy(&(destination->id), source + ID_OFFSET, ID_SIZE);
-    memcpy(&(destination->username), source + USERNAME_OFFSET, USERNAME_SIZE);
-    memcpy(&(destination->email), source + EMAIL_OFFSET, EMAIL_SIZE);
+    memcpy(&(destination->tenant_id), source + TENANT_ID_OFFSET, TENANT_ID_SIZE);
+    if (columns & COLUMN_USERNAME)
+    {
+        memcpy(&(destination->username), source + USERNAME_OFFSET, USERNAME_SIZE);
+    }
+    if (columns & COLUMN_EMAIL)
+    {
+        uint32_t email_length;
+        memcpy(&email_length, source + EMAIL_LENGTH_OFFSET, EMAIL_LENGTH_SIZE);
+        if (email_length <= EMAIL_INLINE_SIZE)
+        {
+            memcpy(&(destination->email), source + EMAIL_OFFSET, email_length);
+        }
+        else
+        {
+            uint32_t overflow_page_num;
+            memcpy(&overflow_page_num, source + EMAIL_OVERFLOW_OFFSET, EMAIL_OVERFLOW_SIZE);
+            memcpy(&(destination->email), source + EMAIL_OFFSET, EMAIL_INLINE_SIZE);
+            overflow_read(pager, overflow_page_num, destination->email + EMAIL_INLINE_SIZE,
+                          email_length - EMAIL_INLINE_SIZE);
+        }
+        destination->email[email_length] = '\0';
+    }
+}
+
+/**
+ * @description: 释放行所引用的溢出页，在覆盖或删除单元格之前调用
+ * @param {Pager} *pager
+ * @param {void} *source
+ * @return {*}
+ * @note: 
+ */
+void release_row_overflow(Pager *pager, void *source)
+{
+    uint32_t overflow_page_num;
+    memcpy(&overflow_page_num, source + EMAIL_OVERFLOW_OFFSET, EMAIL_OVERFLOW_SIZE);
+    overflow_free(pager, overflow_page_num);
+    overflow_page_num = 0;
+    memcpy(source + EMAIL_OVERFLOW_OFFSET, &overflow_page_num, EMAIL_OVERFLOW_SIZE);
 }
 
 
+/**
+ * @description: 释放主表中一行引用的溢出页
+ * @param {Table} *table
+ * @param {void} *value 已经不在树中的行
+ * @return {*}
+ * @note: 写时复制模式下释放的页面要记入替换列表，和其他写者一样持有smo_mutex
+ */
+void table_release_overflow(Table *table, void *value)
+{
+    if (table->pager->copy_on_write)
+    {
+        pthread_mutex_lock(&(table->smo_mutex));
+    }
+    release_row_overflow(table->pager, value);
+    if (table->pager->copy_on_write)
+    {
+        pthread_mutex_unlock(&(table->smo_mutex));
+    }
+}
+
+
+/**
+ * @description: 判断游标是否正好指向给定的主键
+ * @param {Cursor} *cursor
+ * @param {void} *key 编码后的主键
+ * @return {*}
+ * @note: table_find返回的游标在主键不存在时指向插入位置
+ */
+bool cursor_key_equals(Cursor *cursor, const void *key)
+{
+    Table *table = cursor->table;
+    void *node = get_page(table->pager, cursor->page_num);
+    if (cursor->cell_num >= *leaf_node_num_cells(node))
+    {
+        return false;
+    }
+    return compare_keys(table->key_type, table->key_size,
+                        leaf_node_key(node, cursor->cell_num), key) == 0;
+}
+
+/**
+ * @description: 主键比表中所有主键都大时，直接追加到缓存的最右叶子
+ * @param {Table} *table
+ * @param {void} *key 编码后的主键
+ * @param {void} *value
+ * @return {*} 是否已经追加；false时调用者走正常的下降路径
+ * @note: 只锁这一个叶子，不经过table_find。闩住之后再确认它仍是最右边的叶子(没有右兄弟)、
+ *        主键大于它的最后一个主键、并且还有空间，需要分裂时交给正常路径。
+ *        缓存的页码由分裂(leaf_node_split_at)和重建(vacuum_rebuild)更新，
+ *        调用者共享地持有整理锁，.vacuum重建期间不会读到过期的页码。过滤器由调用者维护。
+ *        调用者共享或独占地持有count_lock，不持有任何页面闩锁，追加后最右路径上(每层的右孩子)的行数加一
+ */
+bool table_append_rightmost(Table *table, const void *key, const void *value)
+{
+    Pager *pager = table->pager;
+    uint32_t page_num = __atomic_load_n(&(table->rightmost_leaf_page_num), __ATOMIC_ACQUIRE);
+    if (page_num == INVALID_PAGE_NUM || pager->copy_on_write)
+    {
+        return false;
+    }
+    page_latch(pager, page_num, LATCH_EXCLUSIVE);
+    void *node = get_page(pager, page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    bool appendable = get_node_type(node) == NODE_LEAF && *leaf_node_next_leaf(node) == 0 &&
+                      num_cells < leaf_node_max_cells(node) &&
+                      (num_cells == 0 ||
+                       compare_keys(table->key_type, table->key_size, key,
+                                    leaf_node_key(node, num_cells - 1)) > 0);
+    if (appendable)
+    {
+        memcpy(leaf_node_key(node, num_cells), key, table->key_size);
+        memcpy(leaf_node_value(node, num_cells), value, table->value_size);
+        *leaf_node_num_cells(node) = num_cells + 1;
+    }
+    page_unlatch(pager, page_num);
+    if (appendable)
+    {
+        void *ancestor = get_page(pager, table->root_page_num);
+        while (get_node_type(ancestor) == NODE_INTERNAL)
+        {
+            __atomic_fetch_add(internal_node_child_count(ancestor, *internal_node_num_keys(ancestor)), 1,
+                               __ATOMIC_RELAXED);
+            ancestor = get_page(pager, *internal_node_right_child(ancestor));
+        }
+    }
+    return appendable;
+}
+
+/**
+ * @description: 按主键写入一个已经序列化好的值，主表和索引共用
+ * @param {Table} *table
+ * @param {void} *key 编码后的主键
+ * @param {void} *value table->value_size个字节
+ * @param {PutMode} mode 主键已存在或不存在时的行为
+ * @param {void} *old_value 非NULL且主键已存在时，输出被覆盖的旧值
+ * @return {*}
+ * @note: 比所有主键都大的插入先尝试追加到缓存的最右叶子；否则乐观地只锁叶子插入；叶子已满需要分裂时，持有smo_mutex重新下降，
+ *        这样游标中的路径在分裂过程中不会被别的线程改变。只锁叶子时共享地、持有smo_mutex时独占地持有count_lock，
+ *        插入新行之前沿路径增加祖先中的子树行数。
+ *        写时复制模式下整个写操作持有smo_mutex，在路径的副本上修改后提交新的根。B树的写操作先共享地持有整理锁再取smo_mutex，
+ *        和.vacuum的加锁顺序一致。哈希表交给hash_put，写优化模式交给betree_put，日志结构合并树交给lsm_put。
+ *        过滤器判定主键不存在的update直接返回；可能插入时先把主键加入过滤器，再让它对读者可见
+ */
+ExecuteResult table_put(Table *table, const void *key, const void *value, PutMode mode, void *old_value)
+{
+    if (table->access_method == ACCESS_BETREE)
+    {
+        return betree_put(table, key, value, mode, old_value);
+    }
+    if (table->access_method == ACCESS_LSM)
+    {
+        return lsm_put(table, key, value, mode, old_value);
+    }
+    if (table->key_filter != NULL)
+    {
+        if (mode == PUT_UPDATE && !key_filter_may_contain(table->key_filter, key, table->key_size))
+        {
+            return EXECUTE_KEY_NONE;
+        }
+        if (mode != PUT_UPDATE)
+        {
+            key_filter_add(table->key_filter, key, table->key_size);
+        }
+    }
+    if (table->access_method == ACCESS_HASH)
+    {
+        return hash_put(table, key, value, mode, old_value);
+    }
+    bool copy_on_write = table->pager->copy_on_write;
+    bool splitting = copy_on_write;
+    vacuum_read_lock(table->pager);
+    if (copy_on_write)
+    {
+        pthread_mutex_lock(&(table->smo_mutex));
+        pthread_rwlock_wrlock(&(table->count_lock));
+    }
+    else
+    {
+        pthread_rwlock_rdlock(&(table->count_lock));
+        if (mode != PUT_UPDATE && table_append_rightmost(table, key, value))
+        {
+            pthread_rwlock_unlock(&(table->count_lock));
+            vacuum_read_unlock(table->pager);
+            return EXECUTE_SUCCESS;
+        }
+    }
+    Cursor *cursor = table_find(table, key, FIND_WRITE);
+    bool exists = cursor_key_equals(cursor, key);
+
+    if (!exists && mode != PUT_UPDATE && !copy_on_write &&
+        !node_is_safe(get_page(table->pager, cursor->page_num)))
+    {
+        cursor_close(cursor);
+        pthread_rwlock_unlock(&(table->count_lock));
+        pthread_mutex_lock(&(table->smo_mutex));
+        pthread_rwlock_wrlock(&(table->count_lock));
+        cursor = table_find(table, key, FIND_WRITE);
+        splitting = true;
+        exists = cursor_key_equals(cursor, key);
+    }
+
+    ExecuteResult result = EXECUTE_SUCCESS;
+    if (exists && mode == PUT_INSERT)
+    {
+        result = EXECUTE_DUPLICATE_KEY;
+    }
+    else if (!exists && mode == PUT_UPDATE)
+    {
+        result = EXECUTE_KEY_NONE;
+    }
+    else
+    {
+        if (copy_on_write)
+        {
+            snapshot_shadow_path(cursor);
+        }
+        if (exists)
+        {
+            if (old_value != NULL)
+            {
+                memcpy(old_value, cursor_value(cursor), table->value_size);
+            }
+            leaf_node_update(cursor, value);
+        }
+        else
+        {
+            cursor_count_insert(cursor);
+            leaf_node_insert(cursor, key, value);
+        }
+    }
+
+    // 第一次插入到最右边的叶子时记下它，之后的递增插入走table_append_rightmost
+    void *node = get_page(table->pager, cursor->page_num);
+    if (!copy_on_write && get_node_type(node) == NODE_LEAF && *leaf_node_next_leaf(node) == 0)
+    {
+        __atomic_store_n(&(table->rightmost_leaf_page_num), cursor->page_num, __ATOMIC_RELEASE);
+    }
+    cursor_close(cursor);
+    if (copy_on_write && result == EXECUTE_SUCCESS)
+    {
+        snapshot_commit(table);
+    }
+    pthread_rwlock_unlock(&(table->count_lock));
+    if (splitting)
+    {
+        pthread_mutex_unlock(&(table->smo_mutex));
+    }
+    vacuum_read_unlock(table->pager);
+    return result;
+}
+
+/**
+ * @description: 按主键读取一行，主表和索引共用
+ * @param {Table} *table
+ * @param {void} *key 编码后的主键
+ * @param {void} *value 输出table->value_size个字节，可以为NULL
+ * @return {*} 主键是否存在
+ * @note: B树从根下降到叶子，写优化模式沿途合并缓冲，哈希表只读目录和一个桶，日志结构合并树依次查内存表和各有序段；过滤器判定不存在时不读任何页面
+ */
+bool table_get(Table *table, const void *key, void *value)
+{
+    if (table->key_filter != NULL && !key_filter_may_contain(table->key_filter, key, table->key_size))
+    {
+        return false;
+    }
+    if (table->access_method == ACCESS_HASH)
+    {
+        return hash_get(table, key, value);
+    }
+    if (table->access_method == ACCESS_BETREE)
+    {
+        return betree_get(table, key, value);
+    }
+    if (table->access_method == ACCESS_LSM)
+    {
+        return lsm_get(table, key, value);
+    }
+    Cursor *cursor = table_find(table, key, FIND_READ);
+    bool exists = cursor_key_equals(cursor, key);
+    if (exists && value != NULL)
+    {
+        memcpy(value, cursor_value(cursor), table->value_size);
+    }
+    cursor_close(cursor);
+    return exists;
+}
 
 /**
  * @description: 执行插入操作
  * @param {Table} *table
  * @param {uint32_t} key
  * @return {*}
- * @note: 
+ * @note: 行先序列化(写出溢出页)再插入，主键重复时归还溢出页。主表插入成功后再维护索引
  */
 ExecuteResult execute_insert(Statement *statement, Table *table)
 {
-    void *node = get_page(table->pager, table->root_page_num);
-    uint32_t num_cells = (*leaf_node_num_cells(node));
-
     Row *row_to_insert = &(statement->row_to_insert);
-    uint32_t key_to_insert = row_to_insert->id;
-    Cursor *cursor = table_find(table, key_to_insert);
+    Key key = {row_to_insert->tenant_id, row_to_insert->id};
+    if (!key_fits(table->key_type, &key))
+    {
+        return EXECUTE_KEY_OUT_OF_RANGE;
+    }
+    uint8_t key_to_insert[KEY_MAX_SIZE];
+    encode_key(table->key_type, &key, key_to_insert);
+    uint8_t value[ROW_SIZE];
+    index_write_lock(table);
+    serialize_row(table->pager, row_to_insert, value);
+
+    ExecuteResult result = table_put(table, key_to_insert, value, PUT_INSERT, NULL);
+    if (result == EXECUTE_SUCCESS)
+    {
+        index_insert_row(table, key_to_insert, value);
+    }
+    else
+    {
+        table_release_overflow(table, value);
+    }
+    index_write_unlock(table);
+    return result;
+}
+
+/**
+ * @description: 按主键顺序批量插入，C接口
+ * @param {Table} *table
+ * @param {uint8_t} *cells num_cells个按主键升序排列、主键互不相同的(主键, 值)
+ * @param {uint32_t} num_cells
+ * @param {bool} *inserted 输出每个单元格是否被插入，主键已存在的被跳过
+ * @return {*} 有单元格被跳过时返回EXECUTE_DUPLICATE_KEY，其余的照常插入
+ * @note: 整个批次持有smo_mutex并独占count_lock。落在同一个叶子里的行只下降一次；下一行超出当前叶子的高键时重新下降，
+ *        游标中的路径始终是叶子真正的祖先，用来增加子树行数和分裂；
+ *        分裂(可能产生新的根)之后也从根重新下降一次，之后的行继续填充分裂出的叶子；
+ *        追加在叶子末尾引起的分裂不对半分，左边按填充因子保留(见leaf_node_append_split_count)，
+ *        按顺序写入的叶子因此接近填充因子。比表中所有主键都大的行和table_put一样先尝试table_append_rightmost，不下降。
+ *        写时复制模式和哈希表逐行交给table_put
+ */
+ExecuteResult table_insert_batch(Table *table, uint8_t *cells, uint32_t num_cells, bool *inserted)
+{
+    Pager *pager = table->pager;
+    uint32_t cell_size = table->key_size + table->value_size;
+    ExecuteResult result = EXECUTE_SUCCESS;
 
-    if (cursor->cell_num < num_cells)
+    if (table->access_method != ACCESS_BTREE || pager->copy_on_write)
     {
-        uint32_t key_at_index = *leaf_node_key(node, cursor->cell_num);
-        if (key_at_index == key_to_insert)
+        for (uint32_t i = 0; i < num_cells; i++)
         {
-            return EXECUTE_DUPLICATE_KEY;
+            uint8_t *cell = cells + i * cell_size;
+            ExecuteResult put_result = table_put(table, cell, cell + table->key_size, PUT_INSERT, NULL);
+            inserted[i] = (put_result == EXECUTE_SUCCESS);
+            if (put_result != EXECUTE_SUCCESS)
+            {
+                result = put_result;
+            }
         }
+        return result;
     }
 
-    leaf_node_insert(cursor, row_to_insert->id, row_to_insert);
+    vacuum_read_lock(pager);
+    pthread_mutex_lock(&(table->smo_mutex));
+    pthread_rwlock_wrlock(&(table->count_lock));
+    Cursor *cursor = NULL;
+    for (uint32_t i = 0; i < num_cells; i++)
+    {
+        uint8_t *key = cells + i * cell_size;
+        uint8_t *value = key + table->key_size;
+        if (cursor != NULL && !node_covers_key(get_page(pager, cursor->page_num), key))
+        {
+            cursor_close(cursor);
+            cursor = NULL;
+        }
+        // 先把主键加入过滤器再让它对读者可见；重复的主键本来就在过滤器中
+        if (table->key_filter != NULL)
+        {
+            key_filter_add(table->key_filter, key, table->key_size);
+        }
+        if (cursor == NULL)
+        {
+            if (table_append_rightmost(table, key, value))
+            {
+                inserted[i] = true;
+                continue;
+            }
+            cursor = table_find(table, key, FIND_WRITE);
+        }
+        void *node = get_page(pager, cursor->page_num);
+        cursor->cell_num = key_lower_bound(table->key_type, table->key_size, leaf_node_key(node, 0),
+                                           cell_size, *leaf_node_num_cells(node), key);
 
-    free(cursor);
-    return EXECUTE_SUCCESS;
+        if (cursor_key_equals(cursor, key))
+        {
+            inserted[i] = false;
+            result = EXECUTE_DUPLICATE_KEY;
+            continue;
+        }
+        bool splitting = !node_is_safe(node);
+        cursor_count_insert(cursor);
+        // 追加到叶子末尾、并且批次的下一行也落在这个叶子里时，左边按填充因子保留，批次接着填充新叶子
+        if (splitting && cursor->cell_num == *leaf_node_num_cells(node) && i + 1 < num_cells &&
+            node_covers_key(node, key + cell_size))
+        {
+            leaf_node_split_at(cursor, key, value,
+                               leaf_node_append_split_count(table, *leaf_node_num_cells(node)));
+        }
+        else
+        {
+            leaf_node_insert(cursor, key, value);
+            // 插入到最右边的叶子时记下它，之后递增的行走table_append_rightmost
+            if (!splitting && *leaf_node_next_leaf(node) == 0)
+            {
+                __atomic_store_n(&(table->rightmost_leaf_page_num), cursor->page_num, __ATOMIC_RELEASE);
+            }
+        }
+        inserted[i] = true;
+        if (splitting)
+        {
+            cursor_close(cursor);
+            cursor = NULL;
+        }
+    }
+    if (cursor != NULL)
+    {
+        cursor_close(cursor);
+    }
+    pthread_rwlock_unlock(&(table->count_lock));
+    pthread_mutex_unlock(&(table->smo_mutex));
+    vacuum_read_unlock(pager);
+    return result;
+}
+
+/**
+ * @description: 插入多行，C接口
+ * @param {Table} *table
+ * @param {Row} *rows
+ * @param {uint32_t} num_rows
+ * @return {*} 有主键超出范围时一行也不插入；有重复主键(和表中或批次中更早的行)时跳过这些行，返回EXECUTE_DUPLICATE_KEY
+ * @note: 行先按主键排序，序列化后交给table_insert_batch，成功插入的行再逐个维护索引
+ */
+ExecuteResult insert_rows(Table *table, Row *rows, uint32_t num_rows)
+{
+    KeyEntry *entries = malloc((num_rows + 1) * sizeof(KeyEntry));
+    for (uint32_t i = 0; i < num_rows; i++)
+    {
+        entries[i].key.tenant_id = rows[i].tenant_id;
+        entries[i].key.id = rows[i].id;
+        entries[i].position = i;
+        if (!key_fits(table->key_type, &(entries[i].key)))
+        {
+            free(entries);
+            return EXECUTE_KEY_OUT_OF_RANGE;
+        }
+    }
+    // 主键相同的行按原来的先后排列，后面的作为重复行
+    qsort(entries, num_rows, sizeof(KeyEntry), compare_key_entries);
+
+    uint32_t cell_size = table->key_size + table->value_size;
+    uint8_t *cells = malloc((num_rows + 1) * cell_size);
+    bool *inserted = malloc((num_rows + 1) * sizeof(bool));
+    uint32_t num_cells = 0;
+    ExecuteResult result = EXECUTE_SUCCESS;
+
+    index_write_lock(table);
+    for (uint32_t i = 0; i < num_rows; i++)
+    {
+        if (i > 0 && compare_key_values(&(entries[i - 1].key), &(entries[i].key)) == 0)
+        {
+            result = EXECUTE_DUPLICATE_KEY;
+            continue;
+        }
+        uint8_t *cell = cells + num_cells * cell_size;
+        encode_key(table->key_type, &(entries[i].key), cell);
+        serialize_row(table->pager, &(rows[entries[i].position]), cell + table->key_size);
+        num_cells++;
+    }
+
+    ExecuteResult batch_result = table_insert_batch(table, cells, num_cells, inserted);
+    if (batch_result != EXECUTE_SUCCESS)
+    {
+        result = batch_result;
+    }
+    for (uint32_t i = 0; i < num_cells; i++)
+    {
+        uint8_t *cell = cells + i * cell_size;
+        if (inserted[i])
+        {
+            index_insert_row(table, cell, cell + table->key_size);
+        }
+        else
+        {
+            table_release_overflow(table, cell + table->key_size);
+        }
+    }
+    index_write_unlock(table);
+
+    free(entries);
+    free(cells);
+    free(inserted);
+    return result;
+}
+
+/**
+ * @description: 执行多行插入
+ * @param {Statement} *statement
+ * @param {Table} *table
+ * @return {*}
+ * @note: 释放prepare_insert_batch分配的行
+ */
+ExecuteResult execute_insert_batch(Statement *statement, Table *table)
+{
+    ExecuteResult result = insert_rows(table, statement->insert_rows, statement->num_insert_rows);
+    free(statement->insert_rows);
+    return result;
 }
 
 /**
  * @description: 执行查询操作
  * @param {Table} *table
  * @return {*}
- * @note: 
+ * @note: select count(*)在查询结束后输出计数
  */
 ExecuteResult execute_select(Statement *statement, Table *table)
 {
-    Cursor *cursor = table_start(table);
+    statement->select_num_rows = 0;
+    // 整个查询共享地持有整理锁，读出的行和其中的溢出页码在输出之前不会被.vacuum改写
+    vacuum_read_lock(table->pager);
+    ExecuteResult result = select_rows(statement, table);
+    vacuum_read_unlock(table->pager);
+    if (statement->select_count)
+    {
+        printf("(%d)\n", statement->select_num_rows);
+    }
+    return result;
+}
+
+/**
+ * @description: where id in (...)：按主键列表成批查找
+ * @param {Statement} *statement
+ * @param {Table} *table
+ * @return {*}
+ * @note: 主键排序去重，去掉不在主键条件范围内的，交给table_multi_get一次查完，
+ *        再按主键顺序(desc时倒序)经过username/email条件、offset和limit输出
+ */
+ExecuteResult select_key_list(Statement *statement, Table *table)
+{
+    uint32_t columns = statement->select_columns | statement->select_filter_column;
+    KeyEntry *entries = malloc(statement->select_num_keys * sizeof(KeyEntry));
+    uint32_t num_keys = 0;
+    for (uint32_t i = 0; i < statement->select_num_keys; i++)
+    {
+        Key *key = &(statement->select_keys[i]);
+        if (key_fits(table->key_type, key) && key_range_contains(&(statement->select_range), key))
+        {
+            entries[num_keys].key = *key;
+            entries[num_keys].position = i;
+            num_keys++;
+        }
+    }
+    qsort(entries, num_keys, sizeof(KeyEntry), compare_key_entries);
+
+    uint8_t *keys = malloc(num_keys * table->key_size + 1);
+    uint32_t num_unique = 0;
+    for (uint32_t i = 0; i < num_keys; i++)
+    {
+        if (i > 0 && compare_key_values(&(entries[i].key), &(entries[i - 1].key)) == 0)
+        {
+            continue;
+        }
+        encode_key(table->key_type, &(entries[i].key), keys + num_unique * table->key_size);
+        num_unique++;
+    }
+    uint8_t *values = malloc(num_unique * table->value_size + 1);
+    bool *found = malloc(num_unique * sizeof(bool) + 1);
+    table_multi_get(table, keys, num_unique, values, found);
+
     Row row;
-    while (!(cursor->end_of_table))
+    memset(&row, 0, sizeof(row));
+    for (uint32_t i = 0; i < num_unique && statement->select_num_rows < statement->select_limit; i++)
     {
-        deserialize_row(cursor_value(cursor), &row);
-        if(row.id == statement->row_to_select.select_id || statement->row_to_select.select_id == -1){
-            print_row(&row);
+        uint32_t position = statement->select_descending ? num_unique - 1 - i : i;
+        if (!found[position])
+        {
+            continue;
+        }
+        deserialize_row(table->pager, values + position * table->value_size, &row, columns);
+        if (row_matches_filter(statement, &row))
+        {
+            select_output_row(statement, &row, table->key_type);
         }
-        cursor_advance(cursor);
     }
-    free(cursor);
+    free(entries);
+    free(keys);
+    free(values);
+    free(found);
     return EXECUTE_SUCCESS;
 }
 
 /**
- * @description: 执行更新操作
+ * @description: 按查询条件逐行输出
  * @param {Table} *table
  * @return {*}
- * @note: 
+ * @note: 用table_seek直接定位到范围的起点(降序时是上界)，越过另一端的界或达到limit后立即停止，
+ *        代价是O(log n + k)而不是全表扫描。没有username/email条件时，count(*)是两端的排名之差，
+ *        offset用table_seek_rank直接定位，都是O(log n)。
+ *        where中有username/email条件且这一列有索引时改走index_select，否则扫描时逐行过滤。
+ *        哈希表没有主键顺序，交给hash_select；日志结构合并树交给lsm_select。写优化模式下点查询合并缓冲，其余查询先把缓冲全部下推到叶子。
+ *        where id in (...)对所有存取方式都交给select_key_list
  */
-ExecuteResult execute_update(Statement *statement, Table *table)
+ExecuteResult select_rows(Statement *statement, Table *table)
 {
-    void *node = get_page(table->pager, table->root_page_num);
-    uint32_t num_cells = (*leaf_node_num_cells(node));
+    if (statement->select_num_keys > 0)
+    {
+        return select_key_list(statement, table);
+    }
+    if (table->access_method == ACCESS_HASH)
+    {
+        return hash_select(statement, table);
+    }
+    if (table->access_method == ACCESS_LSM)
+    {
+        return lsm_select(statement, table);
+    }
+    uint32_t filter_column = statement->select_filter_column;
+    if (filter_column != 0)
+    {
+        Table *index = __atomic_load_n(&(table->indexes[index_slot(filter_column)]), __ATOMIC_ACQUIRE);
+        if (index != NULL)
+        {
+            return index_select(statement, table, index);
+        }
+    }
 
-    Row *row_to_update = &(statement->row_to_update);
-    uint32_t key_to_update = row_to_update->update_id;
-    Cursor *cursor = table_find(table, key_to_update);
+    KeyRange *range = &(statement->select_range);
+    bool descending = statement->select_descending;
+    uint8_t lower[KEY_MAX_SIZE];
+    uint8_t upper[KEY_MAX_SIZE];
+    Cursor *cursor;
+    Row row;
+    int cmp;
 
-    if (cursor->cell_num < num_cells)
+    // 下界超出了主键类型的取值范围，没有行能满足；上界超出则等价于没有上界
+    if (range->has_lower && !key_fits(table->key_type, &(range->lower)))
+    {
+        return EXECUTE_SUCCESS;
+    }
+    bool has_lower = range->has_lower;
+    bool has_upper = range->has_upper && key_fits(table->key_type, &(range->upper));
+    if (has_lower)
     {
-        uint32_t key_at_index = *leaf_node_key(node, cursor->cell_num);
-        // printf("key_to_update: %d,key_at_index : %d\n",key_to_update, key_at_index);
-        if (key_at_index == key_to_update)
+        encode_key(table->key_type, &(range->lower), lower);
+    }
+    // where id = <值>，过滤器判定主键不存在时不必下降
+    if (key_range_is_point(range) && table->key_filter != NULL &&
+        !key_filter_may_contain(table->key_filter, lower, table->key_size))
+    {
+        return EXECUTE_SUCCESS;
+    }
+    if (has_upper)
+    {
+        encode_key(table->key_type, &(range->upper), upper);
+    }
+    if (table->access_method == ACCESS_BETREE && key_range_is_point(range))
+    {
+        uint8_t value[ROW_SIZE];
+        if (statement->select_limit > 0 && table_get(table, lower, value))
+        {
+            deserialize_row(table->pager, value, &row, statement->select_columns | filter_column);
+            if (row_matches_filter(statement, &row))
+            {
+                select_output_row(statement, &row, table->key_type);
+            }
+        }
+        return EXECUTE_SUCCESS;
+    }
+    if (table->access_method == ACCESS_BETREE)
+    {
+        betree_flush_all(table);
+    }
+
+    if (filter_column == 0 && (statement->select_count || statement->select_offset > 0))
+    {
+        // 范围内的行按主键顺序排在[first, last)
+        uint32_t first = has_lower ? table_rank(table, lower, !range->lower_inclusive) : 0;
+        uint32_t last = has_upper ? table_rank(table, upper, range->upper_inclusive) : table_count(table);
+        uint32_t offset = statement->select_offset;
+        statement->select_offset = 0;
+        if (last <= first || statement->select_count)
+        {
+            statement->select_num_rows = last > first ? last - first : 0;
+            return EXECUTE_SUCCESS;
+        }
+        if (last - first <= offset)
         {
-            leaf_node_update(cursor, row_to_update->update_id, row_to_update);
-            free(cursor);
             return EXECUTE_SUCCESS;
         }
+        cursor = table_seek_rank(table, descending ? last - 1 - offset : first + offset);
+    }
+    else if (!descending && has_lower)
+    {
+        cursor = table_seek(table, lower);
+        if (!range->lower_inclusive && !(cursor->end_of_table) &&
+            compare_keys(table->key_type, table->key_size, cursor_key(cursor), lower) == 0)
+        {
+            cursor_advance(cursor);
+        }
+    }
+    else if (!descending)
+    {
+        cursor = table_start(table);
+    }
+    else if (has_upper)
+    {
+        // 第一个>=上界的行，不在范围内时退回一行；所有行都小于上界时从最后一行开始
+        cursor = table_seek(table, upper);
+        if (cursor->end_of_table)
+        {
+            cursor_close(cursor);
+            cursor = table_end(table);
+        }
+        else
+        {
+            cmp = compare_keys(table->key_type, table->key_size, cursor_key(cursor), upper);
+            if (cmp > 0 || (cmp == 0 && !range->upper_inclusive))
+            {
+                cursor_retreat(cursor);
+            }
+        }
+    }
+    else
+    {
+        cursor = table_end(table);
+    }
+
+    memset(&row, 0, sizeof(row));
+    while (!(cursor->end_of_table) && statement->select_num_rows < statement->select_limit)
+    {
+        if (!descending && has_upper)
+        {
+            cmp = compare_keys(table->key_type, table->key_size, cursor_key(cursor), upper);
+            if (cmp > 0 || (cmp == 0 && !range->upper_inclusive))
+            {
+                break;
+            }
+        }
+        if (descending && has_lower)
+        {
+            cmp = compare_keys(table->key_type, table->key_size, cursor_key(cursor), lower);
+            if (cmp < 0 || (cmp == 0 && !range->lower_inclusive))
+            {
+                break;
+            }
+        }
+        deserialize_row(table->pager, cursor_value(cursor), &row, statement->select_columns | filter_column);
+        if (row_matches_filter(statement, &row))
+        {
+            select_output_row(statement, &row, table->key_type);
+        }
+        if (descending)
+        {
+            cursor_retreat(cursor);
+        }
+        else
+        {
+            cursor_advance(cursor);
+        }
+    }
+    cursor_close(cursor);
+    return EXECUTE_SUCCESS;
+}
+
+/**
+ * @description: 执行更新操作
+ * @param {Table} *table
+ * @return {*}
+ * @note: 新行先序列化再覆盖旧行，成功后用旧行维护索引并归还旧行的溢出页
+ */
+ExecuteResult execute_update(Statement *statement, Table *table)
+{
+    Row *row_to_update = &(statement->row_to_update);
+    if (!key_fits(table->key_type, &(statement->update_key)))
+    {
+        return EXECUTE_KEY_NONE;
+    }
+    uint8_t key_to_update[KEY_MAX_SIZE];
+    encode_key(table->key_type, &(statement->update_key), key_to_update);
+    uint8_t value[ROW_SIZE];
+    uint8_t old_value[ROW_SIZE];
+    index_write_lock(table);
+    serialize_row(table->pager, row_to_update, value);
+
+    ExecuteResult result = table_put(table, key_to_update, value, PUT_UPDATE, old_value);
+    if (result == EXECUTE_SUCCESS)
+    {
+        index_update_row(table, key_to_update, old_value, value);
+        table_release_overflow(table, old_value);
+    }
+    else
+    {
+        table_release_overflow(table, value);
     }
-    free(cursor);
-    return EXECUTE_KEY_NONE;
+    index_write_unlock(table);
+    return result;
+}
+
+/**
+ * @description: 行是否满足where中username/email上的条件
+ * @param {Statement} *statement
+ * @param {Row} *row 至少读取了被过滤的列
+ * @return {*} 没有这个条件时总是true
+ * @note: like只支持前缀匹配
+ */
+bool row_matches_filter(Statement *statement, Row *row)
+{
+    const char *column_value;
+    switch (statement->select_filter_column)
+    {
+    case COLUMN_USERNAME:
+        column_value = row->username;
+        break;
+    case COLUMN_EMAIL:
+        column_value = row->email;
+        break;
+    default:
+        return true;
+    }
+    if (statement->select_filter_prefix)
+    {
+        return strncmp(column_value, statement->select_filter_value,
+                       strlen(statement->select_filter_value)) == 0;
+    }
+    return strcmp(column_value, statement->select_filter_value) == 0;
 }
 
 /**
  * @description: 输出行
  * @param {Row} *row
+ * @param {uint32_t} columns 需要输出的列(ColumnMask)
+ * @param {KeyType} key_type 复合主键的id列输出为 tenant_id:id
  * @return {*}
  * @note: 
  */
-void print_row(Row *row)
+void print_row(Row *row, uint32_t columns, KeyType key_type)
 {
-    printf("(%d, %s, %s)\n", row->id, row->username, row->email);
+    const char *separator = "";
+    printf("(");
+    if (columns & COLUMN_ID)
+    {
+        Key key = {row->tenant_id, row->id};
+        printf("%s", separator);
+        print_key(key_type, &key);
+        separator = ", ";
+    }
+    if (columns & COLUMN_USERNAME)
+    {
+        printf("%s%s", separator, row->username);
+        separator = ", ";
+    }
+    if (columns & COLUMN_EMAIL)
+    {
+        printf("%s%s", separator, row->email);
+    }
+    printf(")\n");
+}
+
+/**
+ * @description: 输出一个满足条件的行
+ * @param {Statement} *statement
+ * @param {Row} *row
+ * @param {KeyType} key_type
+ * @return {*}
+ * @note: 先跳过offset行；count(*)只计数不输出。计入select_num_rows的行受limit限制
+ */
+void select_output_row(Statement *statement, Row *row, KeyType key_type)
+{
+    if (statement->select_offset > 0)
+    {
+        statement->select_offset--;
+        return;
+    }
+    if (!statement->select_count)
+    {
+        print_row(row, statement->select_columns, key_type);
+    }
+    statement->select_num_rows++;
 }
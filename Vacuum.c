@@ -0,0 +1,445 @@
+/*
+ * @Author: WangZhe
+ * @Date: 2026-10-19 17:20:44
+ * @LastEditors: WangZhe
+ * @LastEditTime: 2026-10-19 18:35:09
+ * @FilePath: /Sqlite/Vacuum.c
+ * @Description: 整理数据库文件，按主键顺序重写叶子
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include"Sqlite.h"
+
+
+/**
+ * @description: 读写页面之前共享地持有整理锁，.vacuum独占地持有它，期间没有别的线程读写任何页面
+ * @param {Pager} *pager
+ * @return {*}
+ * @note: 可以重入(见pager_open)。游标从创建起持有到cursor_close，写时复制模式下先持有它再占用快照槽位，
+ *        所以.vacuum开始时没有活跃的快照。正在整理的线程自己收集行时不再加锁
+ */
+void vacuum_read_lock(Pager *pager)
+{
+    // 别的线程只会写入它自己的线程号，所以不加锁读取也不会误判
+    if (__atomic_load_n(&(pager->vacuuming), __ATOMIC_RELAXED) &&
+        pthread_equal(__atomic_load_n(&(pager->vacuum_owner), __ATOMIC_RELAXED), pthread_self()))
+    {
+        return;
+    }
+    pthread_rwlock_rdlock(&(pager->vacuum_lock));
+}
+
+void vacuum_read_unlock(Pager *pager)
+{
+    if (__atomic_load_n(&(pager->vacuuming), __ATOMIC_RELAXED) &&
+        pthread_equal(__atomic_load_n(&(pager->vacuum_owner), __ATOMIC_RELAXED), pthread_self()))
+    {
+        return;
+    }
+    pthread_rwlock_unlock(&(pager->vacuum_lock));
+}
+
+
+/**
+ * @description: 把单元格引用的溢出页内容读到新分配的缓冲区中
+ * @param {Pager} *pager
+ * @param {void} *value 叶子单元格中的行
+ * @param {uint32_t} *length 输出溢出部分的长度
+ * @return {*} 没有溢出页时返回NULL
+ * @note:
+ */
+char *vacuum_read_overflow(Pager *pager, void *value, uint32_t *length)
+{
+    uint32_t email_length;
+    memcpy(&email_length, value + EMAIL_LENGTH_OFFSET, EMAIL_LENGTH_SIZE);
+    *length = 0;
+    if (email_length <= EMAIL_INLINE_SIZE)
+    {
+        return NULL;
+    }
+    uint32_t overflow_page_num;
+    memcpy(&overflow_page_num, value + EMAIL_OVERFLOW_OFFSET, EMAIL_OVERFLOW_SIZE);
+    *length = email_length - EMAIL_INLINE_SIZE;
+    char *tail = malloc(*length);
+    overflow_read(pager, overflow_page_num, tail, *length);
+    return tail;
+}
+
+
+/**
+ * @description: 每一层按填充因子均匀分配，返回上一层的节点数
+ * @param {uint32_t} count 这一层的节点数
+ * @param {uint32_t} per_node 每个父节点最多的孩子数
+ * @return {*}
+ * @note: 父节点数不超过count / 2，均匀分配后每个内部节点至少有2个孩子。
+ *        填充因子低于75时per_node为2，孩子数为奇数时会有一个父节点多分到一个孩子
+ */
+uint32_t vacuum_parent_count(uint32_t count, uint32_t per_node)
+{
+    uint32_t parents = (count + per_node - 1) / per_node;
+    if (count > 1 && parents > count / 2)
+    {
+        parents = count / 2;
+    }
+    return parents;
+}
+
+
+/**
+ * @description: 按主键顺序复制一棵树的所有单元格
+ * @param {Table} *table 主表或索引
+ * @param {uint32_t} *num_rows 输出单元格数
+ * @return {*} 新分配的缓冲区，单元格大小为key_size + value_size
+ * @note: 索引中被标记删除的索引项在这里丢弃
+ */
+uint8_t *vacuum_collect(Table *table, uint32_t *num_rows)
+{
+    uint32_t cell_size = table->key_size + table->value_size;
+    uint32_t capacity = 0;
+    uint8_t *cells = NULL;
+    *num_rows = 0;
+    Cursor *cursor = table_start(table);
+    while (!(cursor->end_of_table))
+    {
+        uint8_t *value = cursor_value(cursor);
+        if (table->index_column != 0 && (value[INDEX_ENTRY_FLAGS_OFFSET] & INDEX_ENTRY_DELETED))
+        {
+            cursor_advance(cursor);
+            continue;
+        }
+        if (*num_rows >= capacity)
+        {
+            capacity = capacity == 0 ? 64 : capacity * 2;
+            cells = realloc(cells, capacity * cell_size);
+        }
+        memcpy(cells + *num_rows * cell_size, cursor_key(cursor), table->key_size);
+        memcpy(cells + *num_rows * cell_size + table->key_size, value, table->value_size);
+        *num_rows += 1;
+        cursor_advance(cursor);
+    }
+    cursor_close(cursor);
+    return cells;
+}
+
+
+/**
+ * @description: 内部节点按填充因子最多的孩子数
+ */
+uint32_t vacuum_per_node(uint32_t fill_factor)
+{
+    uint32_t per_node = (INTERNAL_NODE_MAX_CELLS + 1) * fill_factor / 100;
+    return per_node < 2 ? 2 : per_node;
+}
+
+
+/**
+ * @description: 按填充因子重建一棵树需要的页面数
+ * @param {Table} *table
+ * @param {uint32_t} num_rows
+ * @param {uint32_t} fill_factor
+ * @param {uint32_t} *num_leaves 输出叶子数
+ * @return {*} 叶子和内部节点的总页数
+ * @note:
+ */
+uint32_t vacuum_tree_pages(Table *table, uint32_t num_rows, uint32_t fill_factor, uint32_t *num_leaves)
+{
+    uint32_t max_cells = LEAF_NODE_SPACE_FOR_CELLS / (table->key_size + table->value_size);
+    uint32_t per_leaf = max_cells * fill_factor / 100;
+    per_leaf = per_leaf < 1 ? 1 : per_leaf;
+    uint32_t per_node = vacuum_per_node(fill_factor);
+
+    *num_leaves = (num_rows + per_leaf - 1) / per_leaf;
+    *num_leaves = *num_leaves == 0 ? 1 : *num_leaves;
+    uint32_t num_tree_pages = *num_leaves;
+    for (uint32_t count = *num_leaves; count > 1; count = vacuum_parent_count(count, per_node))
+    {
+        num_tree_pages += vacuum_parent_count(count, per_node);
+    }
+    return num_tree_pages;
+}
+
+
+/**
+ * @description: 把按主键顺序排列的单元格写成一棵新的树
+ * @param {Table} *table 主表或索引
+ * @param {uint8_t} *cells
+ * @param {uint32_t} num_rows
+ * @param {uint32_t} num_leaves 行均匀地分到这么多个叶子上
+ * @param {uint32_t} per_node 内部节点最多的孩子数
+ * @return {*}
+ * @note: 页面从get_unused_page_num依次分配，.vacuum先清空了空闲链表，所以新树在文件中是连续的。
+ *        新的根写入文件头，写时复制模式下同时发布给读者
+ */
+void vacuum_rebuild(Table *table, uint8_t *cells, uint32_t num_rows, uint32_t num_leaves, uint32_t per_node)
+{
+    Pager *pager = table->pager;
+    uint32_t key_size = table->key_size;
+    uint32_t cell_size = key_size + table->value_size;
+
+    bool linked = !pager->copy_on_write;
+    uint32_t *level_pages = malloc(num_leaves * sizeof(uint32_t));
+    uint8_t *level_keys = malloc(num_leaves * KEY_MAX_SIZE);
+    uint32_t count = num_leaves;
+
+    uint32_t rightmost_leaf_page_num = INVALID_PAGE_NUM;
+    for (uint32_t i = 0; i < num_leaves; i++)
+    {
+        uint32_t first = (uint64_t)i * num_rows / num_leaves;
+        uint32_t last = (uint64_t)(i + 1) * num_rows / num_leaves;
+        uint32_t page_num = get_unused_page_num(pager);
+        rightmost_leaf_page_num = page_num;
+        void *node = get_page(pager, page_num);
+        memset(node, 0, PAGE_SIZE);
+        initialize_leaf_node(node);
+        set_node_key_format(node, table->key_type, key_size);
+        set_node_value_size(node, table->value_size);
+        memcpy(leaf_node_cell(node, 0), cells + first * cell_size, (last - first) * cell_size);
+        *leaf_node_num_cells(node) = last - first;
+
+        level_pages[i] = page_num;
+        if (last > first)
+        {
+            memcpy(level_keys + i * KEY_MAX_SIZE, leaf_node_key(node, last - first - 1), key_size);
+        }
+        if (linked && i > 0)
+        {
+            void *prev = get_page(pager, level_pages[i - 1]);
+            *leaf_node_next_leaf(prev) = page_num;
+            memcpy(node_high_key(prev), level_keys + (i - 1) * KEY_MAX_SIZE, key_size);
+            *leaf_node_prev_leaf(node) = level_pages[i - 1];
+        }
+    }
+
+    // 逐层向上建立内部节点，分隔键是孩子子树中最大的主键
+    while (count > 1)
+    {
+        uint32_t parents = vacuum_parent_count(count, per_node);
+        for (uint32_t j = 0; j < parents; j++)
+        {
+            uint32_t first = (uint64_t)j * count / parents;
+            uint32_t last = (uint64_t)(j + 1) * count / parents;
+            uint32_t page_num = get_unused_page_num(pager);
+            void *node = get_page(pager, page_num);
+            memset(node, 0, PAGE_SIZE);
+            initialize_internal_node(node);
+            set_node_key_format(node, table->key_type, key_size);
+            set_node_value_size(node, table->value_size);
+            *internal_node_num_keys(node) = last - first - 1;
+            for (uint32_t k = first; k + 1 < last; k++)
+            {
+                *internal_node_child(node, k - first) = level_pages[k];
+                memcpy(internal_node_key(node, k - first), level_keys + k * KEY_MAX_SIZE, key_size);
+            }
+            *internal_node_right_child(node) = level_pages[last - 1];
+            for (uint32_t k = first; k < last; k++)
+            {
+                *internal_node_child_count(node, k - first) = node_row_count(pager, level_pages[k]);
+            }
+
+            // 原地覆盖下一层的数组：第j个父节点写入位置j，它的孩子都在位置j及之后
+            level_pages[j] = page_num;
+            memmove(level_keys + j * KEY_MAX_SIZE, level_keys + (last - 1) * KEY_MAX_SIZE, KEY_MAX_SIZE);
+            if (linked && j > 0)
+            {
+                void *prev = get_page(pager, level_pages[j - 1]);
+                *internal_node_right_sibling(prev) = page_num;
+                memcpy(node_high_key(prev), level_keys + (j - 1) * KEY_MAX_SIZE, key_size);
+            }
+        }
+        count = parents;
+    }
+
+    uint32_t root_page_num = level_pages[0];
+    set_node_root(get_page(pager, root_page_num), true);
+    table->rightmost_leaf_page_num = rightmost_leaf_page_num;
+    free(level_pages);
+    free(level_keys);
+
+    table->root_page_num = root_page_num;
+    *(uint32_t *)(get_page(pager, DB_HEADER_PAGE_NUM) + table->root_offset) = root_page_num;
+    if (pager->copy_on_write)
+    {
+        __atomic_store_n(&(table->snapshot_root_page_num), root_page_num, __ATOMIC_SEQ_CST);
+    }
+}
+
+
+/**
+ * @description: 按主键顺序重建主表和所有索引并截断文件
+ * @param {Table} *table 主表
+ * @param {uint32_t} fill_factor 叶子和内部节点的目标填充百分比
+ * @return {*} 按这个填充因子放不下时返回EXECUTE_TABLE_FULL，树保持不变
+ * @note: 新的布局是: 主表的叶子按主键顺序占据从1开始的连续页面，之后是逐层向上的内部节点，根在最后，
+ *        然后依次是各个索引的树，最后是溢出页。顺序扫描因此变成对文件的顺序读。
+ *        被标记删除的索引项在重建时清除。
+ *        重建期间独占index_lock和整理锁并持有smo_mutex：写者和读者(包括游标和快照)都等到重建结束，
+ *        所以重写和释放页面时没有线程在读它们。调用的线程自己不能持有游标
+ */
+ExecuteResult table_vacuum(Table *table, uint32_t fill_factor)
+{
+    if (table->access_method == ACCESS_HASH)
+    {
+        return EXECUTE_UNSUPPORTED;
+    }
+    // 日志结构合并树的有序段本来就是顺序写出的，重建就是把所有段合并成一个，填充因子不起作用
+    if (table->access_method == ACCESS_LSM)
+    {
+        lsm_compact_all(table);
+        return EXECUTE_SUCCESS;
+    }
+    // 写优化模式下先把缓冲中的消息都写入叶子，重建出的内部节点缓冲为空
+    if (table->access_method == ACCESS_BETREE)
+    {
+        betree_flush_all(table);
+    }
+    Pager *pager = table->pager;
+    pthread_rwlock_wrlock(&(table->index_lock));
+    pthread_rwlock_wrlock(&(pager->vacuum_lock));
+    __atomic_store_n(&(pager->vacuum_owner), pthread_self(), __ATOMIC_RELAXED);
+    __atomic_store_n(&(pager->vacuuming), true, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&(table->smo_mutex));
+
+    // 第0棵是主表，之后是已经建立的索引
+    Table *trees[1 + TABLE_MAX_INDEXES];
+    uint8_t *cells[1 + TABLE_MAX_INDEXES];
+    uint32_t num_rows[1 + TABLE_MAX_INDEXES];
+    uint32_t num_leaves[1 + TABLE_MAX_INDEXES];
+    uint32_t num_trees = 0;
+    uint32_t num_pages = 1;
+    trees[num_trees++] = table;
+    for (uint32_t slot = 0; slot < TABLE_MAX_INDEXES; slot++)
+    {
+        if (table->indexes[slot] != NULL)
+        {
+            trees[num_trees++] = table->indexes[slot];
+        }
+    }
+    for (uint32_t t = 0; t < num_trees; t++)
+    {
+        cells[t] = vacuum_collect(trees[t], &(num_rows[t]));
+        num_pages += vacuum_tree_pages(trees[t], num_rows[t], fill_factor, &(num_leaves[t]));
+    }
+
+    // 主表中每行的溢出部分单独保存，重建后重新写出
+    uint32_t cell_size = table->key_size + table->value_size;
+    char **tails = malloc((num_rows[0] + 1) * sizeof(char *));
+    uint32_t *tail_lengths = malloc((num_rows[0] + 1) * sizeof(uint32_t));
+    for (uint32_t i = 0; i < num_rows[0]; i++)
+    {
+        tails[i] = vacuum_read_overflow(pager, cells[0] + i * cell_size + table->key_size, &(tail_lengths[i]));
+        num_pages += (tail_lengths[i] + OVERFLOW_PAGE_SPACE - 1) / OVERFLOW_PAGE_SPACE;
+    }
+
+    ExecuteResult result = EXECUTE_TABLE_FULL;
+    if (num_pages <= TABLE_MAX_PAGES)
+    {
+        // 持有整理锁时所有快照都已经释放，替换下来的页面先照常回收，再和其他旧页面一起作废
+        if (pager->copy_on_write)
+        {
+            snapshot_reclaim(pager);
+            if (pager->num_retired != 0)
+            {
+                printf("Retired pages are still referenced by a snapshot.\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        // 旧的页面全部作废，之后按页码顺序重新分配
+        void *header = get_page(pager, DB_HEADER_PAGE_NUM);
+        pthread_mutex_lock(&(pager->mutex));
+        *db_header_free_head(header) = 0;
+        pager->num_pages = 1;
+        pthread_mutex_unlock(&(pager->mutex));
+
+        for (uint32_t t = 0; t < num_trees; t++)
+        {
+            vacuum_rebuild(trees[t], cells[t], num_rows[t], num_leaves[t], vacuum_per_node(fill_factor));
+        }
+
+        // 溢出页放在所有树节点之后，主表的叶子依次占据页面1到num_leaves[0]
+        for (uint32_t i = 0; i < num_leaves[0]; i++)
+        {
+            uint32_t first = (uint64_t)i * num_rows[0] / num_leaves[0];
+            uint32_t last = (uint64_t)(i + 1) * num_rows[0] / num_leaves[0];
+            void *node = get_page(pager, 1 + i);
+            for (uint32_t row = first; row < last; row++)
+            {
+                if (tails[row] == NULL)
+                {
+                    continue;
+                }
+                uint32_t overflow_page_num = overflow_write(pager, tails[row], tail_lengths[row]);
+                memcpy(leaf_node_value(node, row - first) + EMAIL_OVERFLOW_OFFSET, &overflow_page_num,
+                       EMAIL_OVERFLOW_SIZE);
+            }
+        }
+
+        if (pager->copy_on_write)
+        {
+            __atomic_add_fetch(&(pager->txn_id), 1, __ATOMIC_SEQ_CST);
+        }
+        pager_truncate(pager, pager->num_pages);
+        // 行都换了位置，ART前端索引在下次查找时重新建立
+        if (table->front_index != NULL)
+        {
+            table_art_reset(table);
+        }
+        result = EXECUTE_SUCCESS;
+    }
+
+    for (uint32_t i = 0; i < num_rows[0]; i++)
+    {
+        free(tails[i]);
+    }
+    free(tails);
+    free(tail_lengths);
+    for (uint32_t t = 0; t < num_trees; t++)
+    {
+        free(cells[t]);
+    }
+    pthread_mutex_unlock(&(table->smo_mutex));
+    __atomic_store_n(&(pager->vacuuming), false, __ATOMIC_RELAXED);
+    pthread_rwlock_unlock(&(pager->vacuum_lock));
+    pthread_rwlock_unlock(&(table->index_lock));
+    return result;
+}
+
+
+/**
+ * @description: .vacuum不带参数和建立索引时使用的填充因子
+ * @param {Table} *table 主表或索引
+ * @return {*} 文件头中设置的填充因子，没有设置时是VACUUM_DEFAULT_FILL_FACTOR
+ */
+uint32_t vacuum_fill_factor(Table *table)
+{
+    uint32_t fill_factor = __atomic_load_n(db_header_fill_factor(get_page(table->pager, DB_HEADER_PAGE_NUM)),
+                                           __ATOMIC_RELAXED);
+    return fill_factor != 0 ? fill_factor : VACUUM_DEFAULT_FILL_FACTOR;
+}
+
+/**
+ * @description: 设置主表和索引的填充因子，保存在文件头中
+ * @param {Table} *table 主表
+ * @param {uint32_t} fill_factor FILL_FACTOR_MIN到100
+ * @return {*} 哈希表和日志结构合并树没有叶子分裂，返回EXECUTE_UNSUPPORTED
+ * @note: 之后的追加分裂、批量插入、.vacuum和建立索引都按它填充，已有的叶子要等.vacuum才按新的填充因子重写。
+ *        索引的分裂持有的是索引自己的smo_mutex，所以读写填充因子都用原子操作
+ */
+ExecuteResult table_set_fill_factor(Table *table, uint32_t fill_factor)
+{
+    if (table->access_method == ACCESS_HASH || table->access_method == ACCESS_LSM)
+    {
+        return EXECUTE_UNSUPPORTED;
+    }
+    __atomic_store_n(db_header_fill_factor(get_page(table->pager, DB_HEADER_PAGE_NUM)), fill_factor,
+                     __ATOMIC_RELAXED);
+    return EXECUTE_SUCCESS;
+}
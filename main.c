@@ -14,6 +14,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 
 
 #include"Sqlite.h"
@@ -28,7 +29,69 @@ int main(int argc, char *argv[])
         exit(EXIT_FAILURE);
     }
     char *filename = argv[1];
-    Table *table = db_open(filename);
+    // 可选参数，只在新建数据库时生效: 主键类型 u32(默认) | u64 | composite，写时复制模式 cow，
+    // 以及用可扩展哈希代替B树存放主表 hash，或者使用内部节点带消息缓冲的写优化B树 buffered，
+    // 或者使用日志结构合并树 lsm。art每次打开时生效：为B树主表在内存中建立主键的ART前端索引
+    KeyType key_type = KEY_U32;
+    bool copy_on_write = false;
+    AccessMethod access_method = ACCESS_BTREE;
+    bool front_index = false;
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "u64") == 0)
+        {
+            key_type = KEY_U64;
+        }
+        else if (strcmp(argv[i], "composite") == 0)
+        {
+            key_type = KEY_COMPOSITE;
+        }
+        else if (strcmp(argv[i], "cow") == 0)
+        {
+            copy_on_write = true;
+        }
+        else if (strcmp(argv[i], "hash") == 0)
+        {
+            access_method = ACCESS_HASH;
+        }
+        else if (strcmp(argv[i], "buffered") == 0)
+        {
+            access_method = ACCESS_BETREE;
+        }
+        else if (strcmp(argv[i], "lsm") == 0)
+        {
+            access_method = ACCESS_LSM;
+        }
+        else if (strcmp(argv[i], "art") == 0)
+        {
+            front_index = true;
+        }
+        else if (strcmp(argv[i], "u32") != 0)
+        {
+            printf("Unknown option '%s'.\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (copy_on_write && access_method == ACCESS_HASH)
+    {
+        printf("Option 'cow' cannot be combined with 'hash'.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (copy_on_write && access_method == ACCESS_BETREE)
+    {
+        printf("Option 'cow' cannot be combined with 'buffered'.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (copy_on_write && access_method == ACCESS_LSM)
+    {
+        printf("Option 'cow' cannot be combined with 'lsm'.\n");
+        exit(EXIT_FAILURE);
+    }
+    Table *table = db_open(filename, key_type, copy_on_write, access_method);
+    if (front_index)
+    {
+        table_art_open(table);
+    }
 
     InputBuffer *input_buffer = new_input_buffer();
     while (true)
@@ -83,6 +146,15 @@ int main(int argc, char *argv[])
         case (EXECUTE_KEY_NONE):
             printf("key is not in db\n");
             break;
+        case (EXECUTE_KEY_OUT_OF_RANGE):
+            printf("Error: Key out of range for this table.\n");
+            break;
+        case (EXECUTE_INDEX_EXISTS):
+            printf("Error: Index already exists.\n");
+            break;
+        case (EXECUTE_UNSUPPORTED):
+            printf("Error: Not supported for this table.\n");
+            break;
         }
     }
     return 0;
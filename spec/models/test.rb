@@ -1,7 +1,11 @@
 describe 'database' do
-  def run_script(commands)
+  before do
+    `rm -rf test.db`
+  end
+
+  def run_script(commands, options = "")
     raw_output = nil
-    IO.popen("./db", "r+") do |pipe|
+    IO.popen("./db test.db #{options}", "r+") do |pipe|
       commands.each do |command|
         pipe.puts command
       end
@@ -27,4 +31,694 @@ describe 'database' do
       "db > ",
     ])
   end
+
+  it 'selects a single row by primary key' do
+    script = (1..50).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << "select where 37"
+    script << "select where 51"
+    script << ".exit"
+    result = run_script(script)
+    expect(result.last(4)).to match_array([
+      "db > (37, user37, person37@example.com)",
+      "Executed.",
+      "db > Executed.",
+      "db > ",
+    ])
+  end
+
+  it 'selects a range of rows with a limit' do
+    script = (1..50).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << "select id where id between 10 and 12"
+    script << "select id where id > 47"
+    script << "select id where id >= 20 limit 2"
+    script << ".exit"
+    result = run_script(script)
+    expect(result.last(12)).to match_array([
+      "db > (10)",
+      "(11)",
+      "(12)",
+      "Executed.",
+      "db > (48)",
+      "(49)",
+      "(50)",
+      "Executed.",
+      "db > (20)",
+      "(21)",
+      "Executed.",
+      "db > ",
+    ])
+  end
+
+  it 'selects the latest rows in descending order' do
+    script = (1..50).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << "select id order by id desc limit 3"
+    script << ".exit"
+    result = run_script(script)
+    expect(result.last(5)).to match_array([
+      "db > (50)",
+      "(49)",
+      "(48)",
+      "Executed.",
+      "db > ",
+    ])
+  end
+
+  it 'reads and updates rows in copy-on-write mode' do
+    script = (1..40).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << "update 12 renamed renamed@example.com where 12"
+    script << "select where id between 11 and 13 order by id desc"
+    script << ".exit"
+    result = run_script(script, "cow")
+
+    expect(result.last(5)).to eq([
+      "db > (13, user13, person13@example.com)",
+      "(12, renamed, renamed@example.com)",
+      "(11, user11, person11@example.com)",
+      "Executed.",
+      "db > ",
+    ])
+  end
+
+  it 'keeps every row after a vacuum' do
+    script = [5, 3, 9, 1, 7].map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ".vacuum"
+    script << "select id"
+    script << ".exit"
+    result = run_script(script)
+
+    expect(result.last(7)).to eq([
+      "db > db > (1)",
+      "(3)",
+      "(5)",
+      "(7)",
+      "(9)",
+      "Executed.",
+      "db > ",
+    ])
+  end
+
+  it 'gives every internal node two children after a low fill factor vacuum' do
+    script = (1..45).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ".vacuum 50"
+    script << ".btree"
+    script << ".exit"
+    result = run_script(script)
+
+    # Three leaves and at most two children per node: the root takes all three
+    # instead of one parent getting a single child
+    expect(result.none? { |line| line.include?("internal (size 0)") }).to eq(true)
+    expect(result.include?("db > db > Tree:")).to eq(true)
+    expect(result.include?("- internal (size 2)")).to eq(true)
+    expect(result.count("  - leaf (size 15)")).to eq(3)
+    keys = result.select { |line| line =~ /^    - \d+$/ }.map { |line| line[/\d+/].to_i }
+    expect(keys).to eq((1..45).to_a)
+  end
+
+  it 'finds rows through a secondary index' do
+    script = [
+      "insert 1 alice alice@example.com",
+      "insert 2 bob bob@example.com",
+      "create index on email",
+      "insert 3 alan alan@example.com",
+      "update 2 bob al@example.com where 2",
+      "select where email like al%",
+      "select id where email = bob@example.com",
+      ".exit",
+    ]
+    result = run_script(script)
+
+    expect(result.last(7)).to eq([
+      "db > Executed.",
+      "db > (2, bob, al@example.com)",
+      "(3, alan, alan@example.com)",
+      "(1, alice, alice@example.com)",
+      "Executed.",
+      "db > Executed.",
+      "db > ",
+    ])
+  end
+
+  it 'answers covered queries from an index with included columns' do
+    script = [
+      "insert 1 alice alice@example.com",
+      "insert 2 bob bob@example.com",
+      "create index on username include email",
+      "update 2 bob robert@example.com where 2",
+      "select id, email where username = bob",
+      ".exit",
+    ]
+    result = run_script(script)
+
+    expect(result.last(3)).to eq([
+      "db > (2, robert@example.com)",
+      "Executed.",
+      "db > ",
+    ])
+  end
+
+  it 'stores rows in an extendible hash table' do
+    script = (1..100).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << "update 42 renamed renamed@example.com where 42"
+    script << "select where 42"
+    script << "select where id > 97"
+    script << "insert 7 dup dup@example.com"
+    script << ".exit"
+    result = run_script(script, "hash")
+
+    expect(result.last(8)).to eq([
+      "db > (42, renamed, renamed@example.com)",
+      "Executed.",
+      "db > (98, user98, person98@example.com)",
+      "(99, user99, person99@example.com)",
+      "(100, user100, person100@example.com)",
+      "Executed.",
+      "db > Error: Duplocate key.",
+      "db > ",
+    ])
+  end
+
+  it 'rebuilds the key filter when the database is reopened' do
+    run_script((1..30).map { |i| "insert #{i} user#{i} person#{i}@example.com" } << ".exit")
+    result = run_script([
+      "update 31 ghost ghost@example.com where 31",
+      "update 17 renamed renamed@example.com where 17",
+      "select where 17",
+      ".exit",
+    ])
+
+    expect(result).to eq([
+      "db > key is not in db",
+      "db > Executed.",
+      "db > (17, renamed, renamed@example.com)",
+      "Executed.",
+      "db > ",
+    ])
+  end
+
+  it 'inserts several rows in one statement' do
+    result = run_script([
+      "insert (3 carol carol@example.com), (1 alice alice@example.com), (2 bob bob@example.com)",
+      "insert (4 dave dave@example.com), (2 again again@example.com)",
+      "insert (5 erin erin@example.com) (6 frank frank@example.com)",
+      "select",
+      ".exit",
+    ])
+
+    expect(result).to eq([
+      "db > Executed.",
+      "db > Error: Duplocate key.",
+      "db > Syntax error. Could not parse statement.",
+      "db > (1, alice, alice@example.com)",
+      "(2, bob, bob@example.com)",
+      "(3, carol, carol@example.com)",
+      "(4, dave, dave@example.com)",
+      "Executed.",
+      "db > ",
+    ])
+  end
+
+  it 'keeps leaves full when rows are inserted in key order' do
+    script = (1..40).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ".btree"
+    script << "insert 20 again again@example.com"
+    script << ".exit"
+    result = run_script(script)
+
+    expect(result.reject { |line| line =~ /^ +- \d+$/ }.last(7)).to eq([
+      "db > Tree:",
+      "- internal (size 1)",
+      "  - leaf (size 33)",
+      "  - key 33",
+      "  - leaf (size 7)",
+      "db > Error: Duplocate key.",
+      "db > ",
+    ])
+  end
+
+  it 'counts rows and pages with offset' do
+    script = (1..60).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << "select count(*)"
+    script << "select count(*) where id > 45"
+    script << "select id limit 2 offset 30"
+    script << "select id order by id desc limit 2 offset 5"
+    script << "select count(*) limit 1"
+    script << ".exit"
+    result = run_script(script)
+
+    expect(result.last(12)).to eq([
+      "db > (60)",
+      "Executed.",
+      "db > (15)",
+      "Executed.",
+      "db > (31)",
+      "(32)",
+      "Executed.",
+      "db > (55)",
+      "(54)",
+      "Executed.",
+      "db > Syntax error. Could not parse statement.",
+      "db > ",
+    ])
+  end
+
+  it 'buffers writes in internal nodes and merges them on lookup' do
+    script = (0...200).map do |i|
+      id = i * 37 % 200 + 1
+      "insert #{id} user#{id} person#{id}@example.com"
+    end
+    script << ".btree"
+    script << "update 42 renamed renamed@example.com where 42"
+    script << "select where 42"
+    script << "insert 7 dup dup@example.com"
+    script << "select count(*)"
+    script << "select id where id > 197"
+    script << ".exit"
+    result = run_script(script, "buffered")
+
+    expect(result.any? { |line| line.start_with?("- buffer of page") }).to eq(true)
+    expect(result.last(11)).to eq([
+      "db > Executed.",
+      "db > (42, renamed, renamed@example.com)",
+      "Executed.",
+      "db > Error: Duplocate key.",
+      "db > (200)",
+      "Executed.",
+      "db > (198)",
+      "(199)",
+      "(200)",
+      "Executed.",
+      "db > ",
+    ])
+  end
+
+  it 'stores rows in a log-structured merge tree' do
+    script = (0...300).map do |i|
+      id = i * 37 % 300 + 1
+      "insert #{id} user#{id} person#{id}@example.com"
+    end
+    script << "update 42 renamed renamed@example.com where 42"
+    script << "insert 7 dup dup@example.com"
+    script << ".exit"
+    result = run_script(script, "lsm")
+    expect(result.last(3)).to eq([
+      "db > Executed.",
+      "db > Error: Duplocate key.",
+      "db > ",
+    ])
+
+    result = run_script([
+      ".btree",
+      "select where 42",
+      "select count(*)",
+      "select id where id > 297",
+      "select id where id < 3 order by id desc",
+      ".exit",
+    ])
+    expect(result.any? { |line| line.start_with?("- run (level 0") }).to eq(true)
+    expect(result.last(12)).to eq([
+      "db > (42, renamed, renamed@example.com)",
+      "Executed.",
+      "db > (300)",
+      "Executed.",
+      "db > (298)",
+      "(299)",
+      "(300)",
+      "Executed.",
+      "db > (2)",
+      "(1)",
+      "Executed.",
+      "db > ",
+    ])
+  end
+
+  it 'answers primary key lookups through the ART front index' do
+    script = (0...150).map do |i|
+      id = i * 37 % 150 + 1
+      "insert #{id} user#{id} person#{id}@example.com"
+    end
+    script << ".exit"
+    run_script(script)
+
+    result = run_script([
+      "select where 42",
+      "insert 151 user151 person151@example.com",
+      "insert 0 user0 person0@example.com",
+      "select where 151",
+      "update 42 renamed renamed@example.com where 42",
+      "select where 42",
+      "select where 200",
+      ".vacuum",
+      "select where 150",
+      "select count(*)",
+      ".exit",
+    ], "art")
+    expect(result).to eq([
+      "db > (42, user42, person42@example.com)",
+      "Executed.",
+      "db > Executed.",
+      "db > Executed.",
+      "db > (151, user151, person151@example.com)",
+      "Executed.",
+      "db > Executed.",
+      "db > (42, renamed, renamed@example.com)",
+      "Executed.",
+      "db > Executed.",
+      "db > db > (150, user150, person150@example.com)",
+      "Executed.",
+      "db > (152)",
+      "Executed.",
+      "db > ",
+    ])
+  end
+
+  it 'selects a list of primary keys with id in' do
+    script = (1..100).map do |i|
+      "insert #{i * 3} user#{i * 3} person#{i * 3}@example.com"
+    end
+    script += [
+      "select where id in (300, 3,4 ,150, 3) order by id desc",
+      "select count(*) where id in (3 6 7 9) and id > 3",
+      "select where id in ()",
+      "select where id in (1, 2",
+      ".exit",
+    ]
+    result = run_script(script)
+    expect(result.last(10)).to eq([
+      "db > Executed.",
+      "db > (300, user300, person300@example.com)",
+      "(150, user150, person150@example.com)",
+      "(3, user3, person3@example.com)",
+      "Executed.",
+      "db > (2)",
+      "Executed.",
+      "db > Syntax error. Could not parse statement.",
+      "db > Syntax error. Could not parse statement.",
+      "db > ",
+    ])
+  end
+
+  it 'keeps a persistent fill factor for append splits' do
+    script = [".fillfactor", ".fillfactor 50"]
+    script += (1..34).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ".exit"
+    result = run_script(script)
+    expect(result.first).to eq("db > Fill factor: default")
+
+    result = run_script([
+      ".fillfactor",
+      ".fillfactor 5",
+      ".btree",
+      ".exit",
+    ])
+    expect(result[0..1]).to eq([
+      "db > Fill factor: 50%",
+      "db > Unrecognized command '.fillfactor 5'",
+    ])
+    # The full 33-cell leaf splits at 50%, keeping 16 cells on the left
+    expect(result.include?("  - leaf (size 16)")).to eq(true)
+    expect(result.include?("  - leaf (size 18)")).to eq(true)
+  end
+
+  it 'uses the stored fill factor for a plain vacuum' do
+    script = [".fillfactor 50"]
+    script += (1..45).map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ".vacuum"
+    script << ".btree"
+    script << ".exit"
+    result = run_script(script)
+
+    # 50% packs 15 rows per leaf, and the three leaves share one root
+    expect(result.none? { |line| line.include?("internal (size 0)") }).to eq(true)
+    expect(result.include?("- internal (size 2)")).to eq(true)
+    expect(result.count("  - leaf (size 15)")).to eq(3)
+    keys = result.select { |line| line =~ /^    - \d+$/ }.map { |line| line[/\d+/].to_i }
+    expect(keys).to eq((1..45).to_a)
+  end
+
+  it 'stores long emails in overflow pages and reuses the chain after an update' do
+    long_email = "a" * 6000 + "@example.com"
+    longer_email = "b" * 7000 + "@example.com"
+    result = run_script([
+      "insert 1 user1 #{long_email}",
+      "insert 2 user2 person2@example.com",
+      "select where 1",
+      ".exit",
+    ])
+    expect(result).to eq([
+      "db > Executed.",
+      "db > Executed.",
+      "db > (1, user1, #{long_email})",
+      "Executed.",
+      "db > ",
+    ])
+    # Header, one leaf and a two-page overflow chain
+    expect(File.size("test.db")).to eq(4 * 4096)
+
+    result = run_script([
+      "update 1 user1 short@example.com where 1",
+      "select where 1",
+      "update 1 user1 #{longer_email} where 1",
+      "select where 1",
+      ".exit",
+    ])
+    expect(result).to eq([
+      "db > Executed.",
+      "db > (1, user1, short@example.com)",
+      "Executed.",
+      "db > Executed.",
+      "db > (1, user1, #{longer_email})",
+      "Executed.",
+      "db > ",
+    ])
+    # The freed chain is reused, so the file does not grow
+    expect(File.size("test.db")).to eq(4 * 4096)
+  end
+
+  it 'keeps long emails through vacuum and reopen' do
+    long_email = "a" * 6000 + "@example.com"
+    longer_email = "b" * 7000 + "@example.com"
+    run_script([
+      "insert 1 user1 #{long_email}",
+      "insert 2 user2 #{longer_email}",
+      "update 2 user2 short@example.com where 2",
+      ".exit",
+    ])
+    expect(File.size("test.db")).to eq(6 * 4096)
+
+    # Vacuum drops the freed chain and rewrites the live one
+    run_script([".vacuum", ".exit"])
+    expect(File.size("test.db")).to eq(4 * 4096)
+
+    result = run_script([
+      "select",
+      "update 1 user1 short@example.com where 1",
+      "update 2 user2 #{longer_email} where 2",
+      "select",
+      ".exit",
+    ])
+    expect(result).to eq([
+      "db > (1, user1, #{long_email})",
+      "(2, user2, short@example.com)",
+      "Executed.",
+      "db > Executed.",
+      "db > Executed.",
+      "db > (1, user1, short@example.com)",
+      "(2, user2, #{longer_email})",
+      "Executed.",
+      "db > ",
+    ])
+    expect(File.size("test.db")).to eq(4 * 4096)
+  end
+
+  it 'rejects duplicate keys inserted in random order' do
+    ids = (1..120).to_a.shuffle(random: Random.new(27))
+    script = ids.map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script += [17, 1, 120, 64].map do |i|
+      "insert #{i} again#{i} again#{i}@example.com"
+    end
+    script << "select count(*)"
+    script << "select where 64"
+    script << ".exit"
+    result = run_script(script)
+
+    expect(result.count("db > Error: Duplocate key.")).to eq(4)
+    expect(result.last(5)).to eq([
+      "db > (120)",
+      "Executed.",
+      "db > (64, user64, person64@example.com)",
+      "Executed.",
+      "db > ",
+    ])
+  end
+
+  it 'keeps rows sorted when the internal root splits' do
+    ids = (1..200).to_a.shuffle(random: Random.new(33))
+    script = ids.map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ".btree"
+    script << "select id"
+    script << ".exit"
+    result = run_script(script)
+
+    # The root's children are internal nodes themselves
+    expect(result.any? { |line| line.start_with?("  - internal") }).to eq(true)
+    rows = result.select { |line| line =~ /^(db > )?\(\d+\)$/ }.map { |line| line[/\d+/].to_i }
+    expect(rows).to eq((1..200).to_a)
+  end
+
+  it 'uses the subtree maximum as every separator key' do
+    ids = (1..200).to_a.shuffle(random: Random.new(33))
+    script = ids.map do |i|
+      "insert #{i} user#{i} person#{i}@example.com"
+    end
+    script << ".btree"
+    script << "select where 110"
+    script << ".exit"
+    result = run_script(script)
+
+    # .btree prints in key order, so each separator equals the last leaf key printed before it
+    last_key = nil
+    separators = 0
+    result.each do |line|
+      case line
+      when /^ *- (\d+)$/
+        last_key = $1.to_i
+      when /^ *- key (\d+)$/
+        expect($1.to_i).to eq(last_key)
+        separators += 1
+      end
+    end
+    expect(separators > 3).to eq(true)
+    expect(result.last(3)).to eq([
+      "db > (110, user110, person110@example.com)",
+      "Executed.",
+      "db > ",
+    ])
+  end
+
+  it 'parses, range-scans and orders u64 keys' do
+    result = run_script([
+      "insert 18446744073709551615 max max@example.com",
+      "insert 4294967296 big big@example.com",
+      "insert 5 five five@example.com",
+      "insert 4294967295 edge edge@example.com",
+      "insert 18446744073709551616 over over@example.com",
+      "insert 1:2 tenant tenant@example.com",
+      "select id where id > 4294967295",
+      "select id where id between 5 and 4294967296 order by id desc",
+      "select id order by id desc limit 2",
+      "select where 4294967296",
+      ".exit",
+    ], "u64")
+
+    expect(result).to eq([
+      "db > Executed.",
+      "db > Executed.",
+      "db > Executed.",
+      "db > Executed.",
+      "db > Syntax error. Could not parse statement.",
+      "db > Error: Key out of range for this table.",
+      "db > (4294967296)",
+      "(18446744073709551615)",
+      "Executed.",
+      "db > (4294967296)",
+      "(4294967295)",
+      "(5)",
+      "Executed.",
+      "db > (18446744073709551615)",
+      "(4294967296)",
+      "Executed.",
+      "db > (4294967296, big, big@example.com)",
+      "Executed.",
+      "db > ",
+    ])
+  end
+
+  it 'rejects keys wider than a u32 table' do
+    result = run_script([
+      "insert 4294967295 max max@example.com",
+      "insert 4294967296 over over@example.com",
+      "insert 1:2 tenant tenant@example.com",
+      "select id",
+      ".exit",
+    ])
+
+    expect(result).to eq([
+      "db > Executed.",
+      "db > Error: Key out of range for this table.",
+      "db > Error: Key out of range for this table.",
+      "db > (4294967295)",
+      "Executed.",
+      "db > ",
+    ])
+  end
+
+  it 'orders composite keys by tenant and then id' do
+    result = run_script([
+      "insert 2:1 carol carol@example.com",
+      "insert 1:5 alice alice@example.com",
+      "insert 1:4294967296 bob bob@example.com",
+      "insert 2:0 dave dave@example.com",
+      "insert 7 erin erin@example.com",
+      "insert 4294967296:1 over over@example.com",
+      "insert 1: empty empty@example.com",
+      "select id",
+      "select id where id between 1:5 and 2:0",
+      "select id where id > 1:5 order by id desc limit 3",
+      "select where 1:4294967296",
+      ".exit",
+    ], "composite")
+
+    expect(result).to eq([
+      "db > Executed.",
+      "db > Executed.",
+      "db > Executed.",
+      "db > Executed.",
+      "db > Executed.",
+      "db > Syntax error. Could not parse statement.",
+      "db > Syntax error. Could not parse statement.",
+      "db > (0:7)",
+      "(1:5)",
+      "(1:4294967296)",
+      "(2:0)",
+      "(2:1)",
+      "Executed.",
+      "db > (1:5)",
+      "(1:4294967296)",
+      "(2:0)",
+      "Executed.",
+      "db > (2:1)",
+      "(2:0)",
+      "(1:4294967296)",
+      "Executed.",
+      "db > (1:4294967296, bob, bob@example.com)",
+      "Executed.",
+      "db > ",
+    ])
+  end
 end